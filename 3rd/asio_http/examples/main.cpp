@@ -10,7 +10,7 @@ int main(int argc, char *argv[]) {
 
   s.add_handler("/hello", [](const request &req) {
     reply rep("hello world");
-    rep.headers["Content-Type"] = "text/plain";
+    rep.content_type = reply::text_plain;
     return rep;
   });
 
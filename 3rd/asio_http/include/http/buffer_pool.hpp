@@ -0,0 +1,84 @@
+//
+// buffer_pool.hpp
+// ~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_BUFFER_POOL_HPP
+#define HTTP_BUFFER_POOL_HPP
+
+#include <cstddef>
+#include <cstdint>
+
+namespace http {
+namespace server {
+
+/// Buffers in power of two size classes, from min_size to max_pooled_size.
+/// Every thread keeps the buffers released on it for reuse, up to
+/// max_free_bytes per class, so the connections of a thread allocate from
+/// the system only while the pool warms up. Larger buffers are not pooled.
+class buffer_pool
+{
+public:
+  static constexpr std::size_t min_size = 4096;
+
+  static constexpr std::size_t max_pooled_size = 1024 * 1024;
+
+  static constexpr std::size_t max_free_bytes = 4 * 1024 * 1024;
+
+  /// Counters of the calling thread.
+  struct stats
+  {
+    /// Buffers taken from the pool.
+    std::uint64_t reused;
+
+    /// Buffers allocated from the system.
+    std::uint64_t allocated;
+
+    /// Buffers kept in the pool now.
+    std::uint64_t free;
+  };
+
+  /// A buffer of at least size bytes, size is set to its capacity.
+  static char* acquire(std::size_t& size);
+
+  /// Give back a buffer of acquire with its capacity.
+  static void release(char* data, std::size_t size);
+
+  static stats get_stats();
+};
+
+/// A growable buffer from the pool of the thread, given back when it is
+/// destroyed or grows.
+class pooled_buffer
+{
+public:
+  pooled_buffer();
+
+  ~pooled_buffer();
+
+  pooled_buffer(const pooled_buffer&) = delete;
+  pooled_buffer& operator=(const pooled_buffer&) = delete;
+
+  char* data() { return data_; }
+
+  std::size_t capacity() const { return capacity_; }
+
+  /// Make the capacity at least size, the first keep bytes are kept.
+  void reserve(std::size_t size, std::size_t keep);
+
+  /// Give the memory back to the pool.
+  void release();
+
+private:
+  char* data_;
+
+  std::size_t capacity_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_BUFFER_POOL_HPP
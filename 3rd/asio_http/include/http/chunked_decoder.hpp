@@ -0,0 +1,72 @@
+//
+// chunked_decoder.hpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_CHUNKED_DECODER_HPP
+#define HTTP_CHUNKED_DECODER_HPP
+
+#include <cstddef>
+#include "request_parser.hpp"
+
+namespace http {
+namespace server {
+
+/// Decodes a chunked request body in place, the chunk sizes and trailers are
+/// removed as the data arrives so the body ends up contiguous in the read
+/// buffer. Chunk extensions and trailers are ignored.
+class chunked_decoder
+{
+public:
+  /// The most bytes of trailers after the last chunk.
+  static constexpr std::size_t max_trailers_size = 8192;
+
+  chunked_decoder();
+
+  /// Get ready for the body of another request.
+  void reset();
+
+  /// Decode the body at data, of which size bytes are there: the decoded()
+  /// bytes of the calls before, then the bytes received since. The data of
+  /// the chunks is moved down after the decoded bytes and size is set to the
+  /// bytes left, the decoded ones then, when the result is good, the bytes
+  /// after the body, like the next pipelined request. The result is bad if
+  /// the encoding is invalid, indeterminate while the body goes on.
+  request_parser::result_type decode(char* data, std::size_t& size);
+
+  /// The bytes of the body decoded so far.
+  std::size_t decoded() const { return decoded_; }
+
+private:
+  enum state
+  {
+    chunk_size,
+    chunk_extension,
+    chunk_size_lf,
+    chunk_data,
+    chunk_data_cr,
+    chunk_data_lf,
+    trailer_start,
+    trailer,
+    trailer_lf,
+    last_lf
+  } state_;
+
+  std::size_t decoded_;
+
+  /// The bytes of the current chunk not decoded yet, or its size so far
+  /// while reading it.
+  std::size_t chunk_left_;
+
+  std::size_t size_digits_;
+
+  std::size_t trailers_size_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_CHUNKED_DECODER_HPP
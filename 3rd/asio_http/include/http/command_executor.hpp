@@ -0,0 +1,83 @@
+//
+// command_executor.hpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_COMMAND_EXECUTOR_HPP
+#define HTTP_COMMAND_EXECUTOR_HPP
+
+#include <condition_variable>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+
+namespace http {
+namespace server {
+
+class connection;
+
+/// Runs the request handlers of all connections on a single thread, like the
+/// threaded I/O of redis 6. The I/O threads read, parse and write, the
+/// handlers never run concurrently so they can use unsynchronized data.
+class command_executor
+{
+public:
+  command_executor(const command_executor&) = delete;
+  command_executor& operator=(const command_executor&) = delete;
+
+  command_executor();
+
+  ~command_executor();
+
+  /// Start the executor thread, it calls init first if given.
+  void start(std::function<void()> init = nullptr);
+
+  /// Stop the executor thread, the queued requests are dropped.
+  void stop();
+
+  /// Queue a connection holding a parsed request. Called by an I/O thread,
+  /// the queued connections are handed over together by flush.
+  void defer(std::shared_ptr<connection> conn);
+
+  /// Hand the connections queued by the calling I/O thread to the executor,
+  /// called once per iteration of its event loop.
+  void flush();
+
+  /// Called when the reply of conn is set. The write is posted to the I/O
+  /// thread of the connection, once per I/O thread for the replies of a batch.
+  void complete(std::shared_ptr<connection> conn);
+
+private:
+  /// The loop of the executor thread.
+  void run();
+
+  /// Post the replies of the batch to their I/O threads.
+  void flush_replies();
+
+  std::thread thread_;
+
+  std::mutex mutex_;
+
+  std::condition_variable cond_;
+
+  /// The connections handed over by the I/O threads.
+  std::vector<std::shared_ptr<connection>> pending_;
+
+  bool stopped_;
+
+  /// The replies of the running batch by I/O thread, only used by the
+  /// executor thread.
+  std::vector<std::pair<boost::asio::io_service*, std::vector<std::shared_ptr<connection>>>> replies_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_COMMAND_EXECUTOR_HPP
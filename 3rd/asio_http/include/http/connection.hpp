@@ -12,8 +12,15 @@
 #define HTTP_CONNECTION_HPP
 
 #include <array>
+#include <atomic>
+#include <chrono>
+#include <cstddef>
 #include <memory>
+#include <vector>
 #include <boost/asio.hpp>
+#include "buffer_pool.hpp"
+#include "chunked_decoder.hpp"
+#include "command_executor.hpp"
 #include "reply.hpp"
 #include "request.hpp"
 #include "request_handler.hpp"
@@ -22,7 +29,34 @@
 namespace http {
 namespace server {
 
-/// Represents a single connection from a client.
+/// Settings shared by the connections of a server.
+struct connection_settings
+{
+  /// A kept-alive connection is closed when no request arrives for this
+  /// long, zero closes every connection after its first reply.
+  std::chrono::steady_clock::duration idle_timeout = std::chrono::seconds(60);
+
+  /// The most pipelined requests handled as one batch.
+  std::size_t max_pipelined_requests = 16;
+
+  /// A longer request head is answered with 431.
+  std::size_t max_request_head_size = 16384;
+
+  /// A longer request body is answered with 413.
+  std::size_t max_body_size = 1024 * 1024;
+
+  /// Every io_service is run by one thread, the handlers of a connection
+  /// run one at a time without a strand.
+  bool single_threaded_io = false;
+};
+
+/// Represents a single connection from a client. The connection is kept
+/// alive for HTTP/1.1 requests, and HTTP/1.0 ones asking for it, until a
+/// request asks to close it or it is idle for too long. The pipelined
+/// requests of a read are handled as a batch, their replies go out in
+/// order in one write. A request is handled once its body is read, the read
+/// buffer comes from the pool of the thread and grows to hold the request.
+/// A streamed reply is written piece by piece, the replies after it wait.
 class connection
   : public std::enable_shared_from_this<connection>
 {
@@ -30,9 +64,11 @@ public:
   connection(const connection&) = delete;
   connection& operator=(const connection&) = delete;
 
-  /// Construct a connection with the given socket.
+  /// Construct a connection with the given socket. With an executor the
+  /// requests are handled on the executor thread.
   explicit connection(boost::asio::io_service& io_service,
-      request_handler& handler);
+      request_handler& handler, const connection_settings& settings,
+      command_executor* executor = nullptr);
 
   /// Start the first asynchronous operation for the connection.
   void start();
@@ -42,32 +78,138 @@ public:
 
   boost::asio::ip::tcp::socket& socket();
 
+  /// The io_service running the socket.
+  boost::asio::io_service& get_io_service();
+
+  /// Run the handlers on the parsed requests, called on the executor thread.
+  void execute(command_executor& executor);
+
+  /// Write the replies set by execute, called on the io_service.
+  void write_reply();
+
 private:
+  /// A request of the batch and its reply.
+  struct exchange
+  {
+    request req;
+    reply rep;
+
+    /// False for a bad request, its reply is set by the parser.
+    bool handle;
+
+    bool keep_alive;
+  };
+
+  /// Parse the buffered requests and handle them as a batch, or read more.
+  void handle_input();
+
+  /// Find the body of the request at buffer_begin_ after its head of
+  /// head_size bytes. The result is good when it is all there, request_size
+  /// is then the size of the whole request, bad when the reply is set to an
+  /// error, indeterminate when more has to be read.
+  request_parser::result_type read_body(exchange& ex, std::size_t head_size,
+      std::size_t& request_size);
+
+  /// Set the reply of a request of the batch, the last one writes the batch.
+  void complete(std::size_t index, reply rep);
+
   /// Perform an asynchronous read operation.
   void do_read();
 
-  /// Perform an asynchronous write operation.
+  /// Close the connection if nothing is read before the idle timeout.
+  void do_wait_idle();
+
+  /// Write the replies of the batch in one asynchronous operation.
   void do_write();
 
+  /// Tell a client waiting for it to send the body.
+  void do_write_continue();
+
+  /// Ask the producer of the streamed reply for its next piece.
+  void do_produce();
+
+  /// Write a piece of the streamed reply, an empty one ends it.
+  void do_write_chunk(std::string chunk);
+
+  /// Read the next requests after the batch is written, or close.
+  void finish_batch();
+
+  /// Whether the connection stays open after the reply to req.
+  bool keep_alive(const request& req) const;
+
+  /// The io_service running the socket.
+  boost::asio::io_service& io_service_;
+
   /// Socket for the connection.
   boost::asio::ip::tcp::socket socket_;
 
   /// The handler used to process the incoming request.
   request_handler& request_handler_;
 
-  /// Buffer for incoming data.
-  std::array<char, 8192> buffer_;
+  /// The settings of the server.
+  const connection_settings& settings_;
+
+  /// The executor running the handlers, or nullptr to run them here.
+  command_executor* executor_;
+
+  /// Buffer for incoming data, the bytes not parsed yet are
+  /// [buffer_begin_, buffer_end_). The headers and bodies of the batch point
+  /// into it, so it only moves or grows between batches.
+  pooled_buffer buffer_;
+
+  std::size_t buffer_begin_;
+
+  std::size_t buffer_end_;
+
+  /// The capacity the request at buffer_begin_ needs, from the start of the
+  /// buffer.
+  std::size_t buffer_needed_;
+
+  /// Decodes the chunked body of the request at buffer_begin_.
+  chunked_decoder chunked_decoder_;
+
+  bool decoding_chunks_;
 
-  /// The incoming request.
-  request request_;
+  /// 100 Continue was sent for the request at buffer_begin_.
+  bool continue_sent_;
+
+  /// The replies of the batch wait for 100 Continue to be written.
+  bool writing_continue_;
+
+  bool write_waiting_;
 
   /// The parser for the incoming request.
   request_parser request_parser_;
 
-  /// The reply to be sent back to the client.
-  reply reply_;
+  /// The requests being handled, the batch does not change until its
+  /// replies are written.
+  std::vector<exchange> batch_;
+
+  /// The requests of the batch without a reply yet, set by the threads
+  /// replying.
+  std::atomic<std::size_t> unanswered_;
+
+  /// The last request of the batch closes the connection.
+  bool close_after_batch_;
+
+  /// The replies being written.
+  reply_buffers reply_buffers_;
+
+  /// The replies of the batch before it are written, a streamed one is
+  /// before it too.
+  std::size_t write_index_;
+
+  /// The piece of the streamed reply being written and its size line.
+  std::string chunk_;
+
+  std::array<char, 20> chunk_size_;
+
+  /// Closes an idle connection.
+  boost::asio::steady_timer idle_timer_;
 
-  boost::asio::io_service::strand strand_;
+  /// Runs the handlers of the connection one at a time, a strand unless
+  /// the io_service is run by one thread.
+  boost::asio::any_io_executor handler_executor_;
 };
 
 typedef std::shared_ptr<connection> connection_ptr;
@@ -11,8 +11,13 @@
 #ifndef HTTP_REPLY_HPP
 #define HTTP_REPLY_HPP
 
-#include <string>
+#include <cstddef>
+#include <functional>
 #include <map>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
 #include <boost/asio.hpp>
 
 namespace http {
@@ -36,32 +41,96 @@ struct reply
     unauthorized = 401,
     forbidden = 403,
     not_found = 404,
+    payload_too_large = 413,
+    request_header_fields_too_large = 431,
     internal_server_error = 500,
     not_implemented = 501,
     bad_gateway = 502,
     service_unavailable = 503
   } status;
 
+  /// The common content types, their header lines are serialized once.
+  enum content_type_type
+  {
+    text_html,
+    text_plain,
+    application_json,
+    application_octet_stream
+  } content_type;
+
   reply();
 
   explicit reply(const std::string& c);
 
+  /// A reply with content shared with others, e.g. a large value kept
+  /// elsewhere, which is written without a copy.
+  explicit reply(std::shared_ptr<const std::string> c);
+
   explicit reply(status_type status_code);
 
   /// The content to be sent in the reply.
   std::string content;
 
-  /// The headers to be included in the reply.
-  std::map<std::string, std::string> headers;
+  /// The content written instead of content when set.
+  std::shared_ptr<const std::string> shared_content;
+
+  /// The next piece of a streamed content, an empty one ends it.
+  typedef std::function<void(std::string chunk)> chunk_callback;
 
+  /// Produces a streamed content. It is called on the thread of the
+  /// connection once the piece before is written, and calls next with the
+  /// next piece, then or later from any thread. So one piece is in memory at
+  /// a time, and a client reading slowly pauses the producer.
+  typedef std::function<void(chunk_callback next)> chunk_producer;
 
-  /// Convert the reply into a vector of buffers. The buffers do not own the
-  /// underlying memory blocks, therefore the reply object must remain valid and
-  /// not be changed until the write operation has completed.
-  std::vector<boost::asio::const_buffer> to_buffers();
+  /// The content is streamed from it when set, in chunks to an HTTP/1.1
+  /// client, up to the closing of the connection to an HTTP/1.0 one.
+  chunk_producer producer;
+
+  /// More headers to be included in the reply. The Content-Type,
+  /// Content-Length, Date and Connection headers are added when it is
+  /// written, a Content-Type or Content-Length here replaces the added one.
+  std::map<std::string, std::string> headers;
 
   /// Get a json reply
   static reply json_reply(const std::string &json);
+
+  /// Get a reply streaming its content from producer.
+  static reply stream(chunk_producer producer, content_type_type type = text_plain);
+};
+
+/// The buffers of the replies written at once. The heads and the small
+/// contents are copied into one block, a larger content is referenced where
+/// it is, so a batch of replies is one gather write of few buffers.
+class reply_buffers
+{
+public:
+  /// A content up to this size is copied after its head.
+  static constexpr std::size_t copy_threshold = 1024;
+
+  /// Forget the replies added.
+  void clear();
+
+  /// Add a reply with the status line of HTTP/1.1 or HTTP/1.0 and the
+  /// Connection header telling if the connection is kept alive. The reply
+  /// must not change until the write has completed. Only the head of a
+  /// streamed reply is added.
+  void add(const reply& rep, bool http_1_1, bool keep_alive);
+
+  /// The buffers of the replies added, valid until the next add or clear.
+  const std::vector<boost::asio::const_buffer>& buffers();
+
+  /// The bytes copied into the block.
+  std::size_t bytes_copied() const { return block_.size(); }
+
+private:
+  /// The heads and small contents.
+  std::string block_;
+
+  /// The large contents and the offsets in the block they come at.
+  std::vector<std::pair<std::size_t, boost::asio::const_buffer>> references_;
+
+  std::vector<boost::asio::const_buffer> buffers_;
 };
 
 } // namespace server
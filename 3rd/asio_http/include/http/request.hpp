@@ -11,22 +11,97 @@
 #ifndef HTTP_REQUEST_HPP
 #define HTTP_REQUEST_HPP
 
+#include <cctype>
 #include <string>
-#include <map>
+#include <string_view>
+#include <boost/container/small_vector.hpp>
 
 namespace http {
 namespace server {
 
-/// A request received from a client.
+/// A header of a request, the views point into the read buffer of the
+/// connection.
+struct header
+{
+  std::string_view name;
+  std::string_view value;
+};
+
+/// A parameter of the route matching a request, its value is a part of the
+/// uri.
+struct param
+{
+  std::string_view name;
+  std::size_t offset;
+  std::size_t size;
+};
+
+/// A request received from a client. The headers and body stay valid until the reply
+/// to the request is sent.
 struct request
 {
   std::string method;
   std::string uri;
   int http_version_major;
   int http_version_minor;
-  std::map<std::string, std::string> headers;
+  boost::container::small_vector<header, 16> headers;
+
+  /// The body, read by its Content-Length or decoded from chunks. Like the
+  /// headers it points into the read buffer.
+  std::string_view body;
+
+  /// The parameters of the route, set by the request handler.
+  boost::container::small_vector<param, 8> params;
+
+  /// The value of the first header called name, case insensitive, or
+  /// nullptr if there is none.
+  const std::string_view* find_header(std::string_view name) const;
+
+  /// The value of the route parameter called name, empty if there is none.
+  std::string_view find_param(std::string_view name) const;
 };
 
+/// Compare ASCII strings ignoring case, e.g. header names.
+inline bool iequals(std::string_view a, std::string_view b)
+{
+  if (a.size() != b.size())
+  {
+    return false;
+  }
+  for (std::size_t i = 0; i < a.size(); ++i)
+  {
+    if (std::tolower(static_cast<unsigned char>(a[i])) != std::tolower(static_cast<unsigned char>(b[i])))
+    {
+      return false;
+    }
+  }
+  return true;
+}
+
+inline const std::string_view* request::find_header(std::string_view name) const
+{
+  for (auto&& h : headers)
+  {
+    if (iequals(h.name, name))
+    {
+      return &h.value;
+    }
+  }
+  return nullptr;
+}
+
+inline std::string_view request::find_param(std::string_view name) const
+{
+  for (auto&& p : params)
+  {
+    if (p.name == name)
+    {
+      return std::string_view(uri).substr(p.offset, p.size);
+    }
+  }
+  return std::string_view();
+}
+
 } // namespace server
 } // namespace http
 
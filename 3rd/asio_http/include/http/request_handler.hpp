@@ -37,8 +37,11 @@
 
 #include <string>
 #include <functional>
+#include <utility>
+#include <vector>
 #include "request.hpp"
 #include "reply.hpp"
+#include "router.hpp"
 
 namespace http {
 namespace server {
@@ -48,6 +51,9 @@ class request_handler
 {
 public:
   using handle = std::function<reply(const request&)>;
+  /// Called once with the reply, may be called later from another thread.
+  using reply_callback = std::function<void(reply)>;
+  using async_handle = std::function<void(const request&, reply_callback)>;
   request_handler(const request_handler&) = delete;
   request_handler& operator=(const request_handler&) = delete;
 
@@ -56,14 +62,33 @@ public:
   /// Handle a request and produce a reply.
   void handle_request(request& req, reply& rep);
 
-  /// Register a new request handler.
+  /// Handle a request, done is called with the reply.
+  void handle_request(request& req, reply_callback done);
+
+  /// Register a new request handler for the urls starting with url, which
+  /// may have parameters like "/users/:id". Throws std::invalid_argument
+  /// for a url registered twice and std::logic_error once frozen.
   void reg(const std::string& url, request_handler::handle handler);
 
+  /// Register a new handler which replies through a callback.
+  void reg_async(const std::string& url, request_handler::async_handle handler);
+
+  /// Build the routing tree from the registered urls, called by the server
+  /// before it starts its threads. A handler used without a server freezes
+  /// on its first request.
+  void freeze();
+
   /// Perform URL-decoding on a string. Returns false if the encoding was
   /// invalid.
   static bool url_decode(const std::string& in, std::string& out);
 private:
-  std::vector<std::pair<std::string, handle>> handler_list_;
+  /// URL-decode a string in place, the decoded string is never longer.
+  static bool url_decode(std::string& s);
+
+  /// The handlers, numbered by the router.
+  std::vector<async_handle> handlers_;
+
+  router router_;
 };
 
 } // namespace server
@@ -0,0 +1,94 @@
+//
+// router.hpp
+// ~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#ifndef HTTP_ROUTER_HPP
+#define HTTP_ROUTER_HPP
+
+#include <cstddef>
+#include <cstdint>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <vector>
+#include "request.hpp"
+
+namespace http {
+namespace server {
+
+/// Maps request paths to route numbers with a compressed radix tree. A route
+/// matches the paths starting with it, like "/cmd/" matches "/cmd/GET/key",
+/// and a segment ":name" in it matches any non-empty path segment, like
+/// "/users/:id/posts". The route matching the longest part of the path wins,
+/// a static segment before a parameter. Routes are added first, then freeze
+/// packs the tree into flat arrays which are only read, so match is thread
+/// safe and does not allocate.
+class router
+{
+public:
+  /// The most parameters in a route.
+  static constexpr std::size_t max_params = 8;
+
+  router();
+
+  ~router();
+
+  router(const router&) = delete;
+  router& operator=(const router&) = delete;
+
+  /// Add a route, throws std::invalid_argument if it is registered already
+  /// or names a parameter differently from another route at the same place,
+  /// and std::logic_error once frozen.
+  void add(const std::string& route, std::size_t number);
+
+  /// Build the immutable tree, nothing can be added after it.
+  void freeze();
+
+  bool frozen() const;
+
+  /// The number of the route matching path, false if none does. The
+  /// parameters of the route are set in params, cleared otherwise.
+  bool match(std::string_view path, std::size_t& number,
+      boost::container::small_vector<param, 8>& params) const;
+
+private:
+  /// A node of the tree while routes are added.
+  struct build_node;
+
+  /// A node of the frozen tree. The static children of a node are
+  /// consecutive, the label of a parameter node is its name.
+  struct node
+  {
+    std::uint32_t label_offset;
+    std::uint32_t label_size;
+    std::uint32_t children_begin;
+    std::uint32_t children_end;
+    std::int32_t param_child;
+    std::int32_t number;
+  };
+
+  /// The longest match found so far by match_node.
+  struct match_state;
+
+  void match_node(std::uint32_t index, std::string_view path, std::size_t pos,
+      std::size_t param_count, match_state& state) const;
+
+  std::string_view label(const node& n) const;
+
+  std::unique_ptr<build_node> root_;
+
+  /// The frozen tree, the root is the first node.
+  std::vector<node> nodes_;
+
+  /// The labels of the frozen nodes.
+  std::string labels_;
+};
+
+} // namespace server
+} // namespace http
+
+#endif // HTTP_ROUTER_HPP
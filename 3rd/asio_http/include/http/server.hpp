@@ -36,7 +36,12 @@
 #define HTTP_SERVER_HPP
 
 #include <boost/asio.hpp>
+#include <chrono>
+#include <functional>
+#include <memory>
 #include <string>
+#include <vector>
+#include "command_executor.hpp"
 #include "connection.hpp"
 #include "request_handler.hpp"
 
@@ -47,41 +52,152 @@ namespace server {
 class server
 {
 public:
+  /// How the threads of the server share the work.
+  enum class execution_mode
+  {
+    /// All threads run one io_service, every connection has a strand when
+    /// there is more than one thread.
+    shared,
+
+    /// Every thread owns an io_service and an acceptor bound with
+    /// SO_REUSEPORT, a connection stays on the thread which accepted it. The
+    /// handlers of a thread can keep per thread state without locks, and
+    /// the connections need no strand.
+    per_core,
+
+    /// Like per_core, the threads only read, parse and write, the handlers
+    /// of all connections run on one more thread. The requests parsed by a
+    /// thread in an iteration of its loop are handed over as a batch.
+    threaded_io
+  };
+
+  /// The kind of a thread started by run.
+  enum class thread_role
+  {
+    /// Runs an io_service, the one of core index in per_core and
+    /// threaded_io mode.
+    io,
+
+    /// Runs the handlers in threaded_io mode.
+    executor
+  };
+
+  /// Called first in every thread of run.
+  typedef std::function<void(thread_role role, std::size_t index)> thread_init_handler;
+
   server(const server&) = delete;
   server& operator=(const server&) = delete;
 
   /// Construct the server to listen on the specified TCP address and port, and
   /// serve up files from the given directory.
-  explicit server(const std::string& address, const std::string& port, std::size_t thread_num = 1);
+  explicit server(const std::string& address, const std::string& port, std::size_t thread_num = 1,
+      execution_mode mode = execution_mode::shared);
 
   /// Run the server's io_service loop.
   void run();
 
-  /// Add request handler.
+  /// Stop the server, the same as a termination signal. Thread safe.
+  void stop();
+
+  /// Set the handler called by every thread of run before it serves
+  /// anything, e.g. to pin it to a cpu and allocate its data there. No
+  /// thread starts serving before the handlers of all threads have returned.
+  void set_thread_init(thread_init_handler handler);
+
+  /// Close a kept-alive connection when no request arrives for this long,
+  /// zero closes every connection after its first reply. Call before run.
+  void set_idle_timeout(std::chrono::steady_clock::duration timeout);
+
+  /// The most pipelined requests of a connection handled together, their
+  /// replies are written at once. Call before run.
+  void set_max_pipelined_requests(std::size_t max_requests);
+
+  /// A request with a longer body, by Content-Length or once decoded from
+  /// chunks, is answered with 413 and the connection closed. Call before run.
+  void set_max_body_size(std::size_t max_size);
+
+  /// Add request handler for the urls starting with url, which may have
+  /// parameters like "/users/:id", read with request::find_param. Handlers
+  /// are added before run.
   void add_handler(const std::string& url, request_handler::handle handler);
 
+  /// Add a request handler which replies later through the callback.
+  void add_async_handler(const std::string& url, request_handler::async_handle handler);
+
+  /// The number of io_services, thread_num in per_core mode, otherwise 1.
+  std::size_t core_num() const;
+
+  /// The io_service of a core, used to post work to the thread owning it.
+  boost::asio::io_service& get_io_service(std::size_t core);
+
+  /// The core of the calling thread in per_core and threaded_io mode, 0 in
+  /// other threads.
+  static std::size_t current_core();
+
+  /// The mechanism asio waits for I/O with: "io_uring" when built with
+  /// HTTP_WITH_IO_URING, otherwise "epoll", "kqueue", "iocp" or "select".
+  static const char* io_backend();
+
 private:
+  /// An io_service with its acceptor.
+  struct core
+  {
+    explicit core(boost::asio::io_service& io_service);
+
+    boost::asio::io_service& io_service_;
+
+    boost::asio::ip::tcp::acceptor acceptor_;
+
+    connection_ptr new_connection_;
+  };
+
   /// Perform an asynchronous accept operation.
-  void do_accept();
+  void do_accept(core& c);
 
   /// Wait for a request to stop the server.
   void do_await_stop();
 
-  /// The io_service used to perform asynchronous operations.
+  /// Stop the io_services, called on the io_service of core 0.
+  void do_stop();
+
+  /// The loop of an I/O thread in threaded_io mode.
+  void run_io_loop(core& c);
+
+  /// The io_service used to perform asynchronous operations, the one of core
+  /// 0 in per_core mode.
   boost::asio::io_service io_service_;
 
+  /// The io_services of the other cores in per_core and threaded_io mode.
+  std::vector<std::unique_ptr<boost::asio::io_service>> core_io_services_;
+
+  /// Keep the io_services of the cores running when they have nothing to do.
+  std::vector<boost::asio::executor_work_guard<boost::asio::io_service::executor_type>> work_guards_;
+
   /// The signal_set is used to register for process termination notifications.
   boost::asio::signal_set signals_;
 
-  /// Acceptor used to listen for incoming connections.
-  boost::asio::ip::tcp::acceptor acceptor_;
+  /// The cores, a single one in shared mode. Only the acceptor of core 0 is
+  /// open when SO_REUSEPORT is not available, it spreads the connections over
+  /// the cores round robin.
+  std::vector<std::unique_ptr<core>> cores_;
 
-  connection_ptr new_connection_;
+  std::size_t next_core_;
 
   /// The handler for all incoming requests.
   request_handler request_handler_;
 
+  /// The settings of the connections.
+  connection_settings connection_settings_;
+
+  /// The thread running the handlers in threaded_io mode.
+  std::unique_ptr<command_executor> executor_;
+
+  /// Called first in every thread of run.
+  thread_init_handler thread_init_;
+
   std::size_t thread_num_;
+
+  execution_mode mode_;
 };
 
 } // namespace server
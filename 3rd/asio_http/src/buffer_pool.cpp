@@ -0,0 +1,140 @@
+//
+// buffer_pool.cpp
+// ~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "buffer_pool.hpp"
+#include <cstring>
+#include <new>
+#include <vector>
+
+namespace http {
+namespace server {
+
+namespace {
+
+constexpr std::size_t class_count = 9; // 4 KiB to 1 MiB
+
+/// The size class of a buffer of size bytes.
+std::size_t class_of(std::size_t size)
+{
+  std::size_t c = 0;
+  while ((buffer_pool::min_size << c) < size)
+  {
+    ++c;
+  }
+  return c;
+}
+
+/// The buffers released on a thread, freed when it exits.
+struct thread_pool
+{
+  ~thread_pool()
+  {
+    for (auto&& list : free)
+    {
+      for (char* data : list)
+      {
+        ::operator delete(data);
+      }
+    }
+  }
+
+  std::vector<char*> free[class_count];
+
+  buffer_pool::stats counters = {0, 0, 0};
+};
+
+thread_pool& this_thread_pool()
+{
+  static thread_local thread_pool pool;
+  return pool;
+}
+
+} // namespace
+
+char* buffer_pool::acquire(std::size_t& size)
+{
+  thread_pool& pool = this_thread_pool();
+  if (size > max_pooled_size)
+  {
+    ++pool.counters.allocated;
+    return static_cast<char*>(::operator new(size));
+  }
+  std::size_t c = class_of(size);
+  size = min_size << c;
+  if (!pool.free[c].empty())
+  {
+    char* data = pool.free[c].back();
+    pool.free[c].pop_back();
+    ++pool.counters.reused;
+    --pool.counters.free;
+    return data;
+  }
+  ++pool.counters.allocated;
+  return static_cast<char*>(::operator new(size));
+}
+
+void buffer_pool::release(char* data, std::size_t size)
+{
+  thread_pool& pool = this_thread_pool();
+  if (size <= max_pooled_size)
+  {
+    std::vector<char*>& list = pool.free[class_of(size)];
+    if ((list.size() + 1) * size <= max_free_bytes)
+    {
+      list.push_back(data);
+      ++pool.counters.free;
+      return;
+    }
+  }
+  ::operator delete(data);
+}
+
+buffer_pool::stats buffer_pool::get_stats()
+{
+  return this_thread_pool().counters;
+}
+
+pooled_buffer::pooled_buffer()
+  : data_(nullptr),
+    capacity_(0)
+{
+}
+
+pooled_buffer::~pooled_buffer()
+{
+  release();
+}
+
+void pooled_buffer::reserve(std::size_t size, std::size_t keep)
+{
+  if (size <= capacity_)
+  {
+    return;
+  }
+  char* data = buffer_pool::acquire(size);
+  if (keep > 0)
+  {
+    std::memcpy(data, data_, keep);
+  }
+  release();
+  data_ = data;
+  capacity_ = size;
+}
+
+void pooled_buffer::release()
+{
+  if (data_)
+  {
+    buffer_pool::release(data_, capacity_);
+    data_ = nullptr;
+    capacity_ = 0;
+  }
+}
+
+} // namespace server
+} // namespace http
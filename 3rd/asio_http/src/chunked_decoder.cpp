@@ -0,0 +1,173 @@
+//
+// chunked_decoder.cpp
+// ~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "chunked_decoder.hpp"
+#include <algorithm>
+#include <cstring>
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// The value of a hex digit, -1 for other characters.
+int hex_digit(char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
+  }
+  if (c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
+  }
+  if (c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
+}
+
+} // namespace
+
+chunked_decoder::chunked_decoder()
+{
+  reset();
+}
+
+void chunked_decoder::reset()
+{
+  state_ = chunk_size;
+  decoded_ = 0;
+  chunk_left_ = 0;
+  size_digits_ = 0;
+  trailers_size_ = 0;
+}
+
+request_parser::result_type chunked_decoder::decode(char* data, std::size_t& size)
+{
+  std::size_t in = decoded_;
+  std::size_t out = decoded_;
+  while (in < size)
+  {
+    if (state_ == chunk_data)
+    {
+      std::size_t n = std::min(chunk_left_, size - in);
+      std::memmove(data + out, data + in, n);
+      in += n;
+      out += n;
+      chunk_left_ -= n;
+      if (chunk_left_ == 0)
+      {
+        state_ = chunk_data_cr;
+      }
+      continue;
+    }
+    char c = data[in++];
+    switch (state_)
+    {
+    case chunk_size:
+      if (hex_digit(c) >= 0)
+      {
+        // 15 digits keep the size from overflowing.
+        if (++size_digits_ > 15)
+        {
+          return request_parser::bad;
+        }
+        chunk_left_ = chunk_left_ * 16 + hex_digit(c);
+      }
+      else if (size_digits_ == 0)
+      {
+        return request_parser::bad;
+      }
+      else if (c == ';' || c == ' ' || c == '\t')
+      {
+        state_ = chunk_extension;
+      }
+      else if (c == '\r')
+      {
+        state_ = chunk_size_lf;
+      }
+      else
+      {
+        return request_parser::bad;
+      }
+      break;
+    case chunk_extension:
+      if (c == '\r')
+      {
+        state_ = chunk_size_lf;
+      }
+      else if (c == '\n')
+      {
+        return request_parser::bad;
+      }
+      break;
+    case chunk_size_lf:
+      if (c != '\n')
+      {
+        return request_parser::bad;
+      }
+      size_digits_ = 0;
+      state_ = chunk_left_ == 0 ? trailer_start : chunk_data;
+      break;
+    case chunk_data_cr:
+      if (c != '\r')
+      {
+        return request_parser::bad;
+      }
+      state_ = chunk_data_lf;
+      break;
+    case chunk_data_lf:
+      if (c != '\n')
+      {
+        return request_parser::bad;
+      }
+      state_ = chunk_size;
+      break;
+    case trailer_start:
+      state_ = c == '\r' ? last_lf : trailer;
+      break;
+    case trailer:
+      if (++trailers_size_ > max_trailers_size)
+      {
+        return request_parser::bad;
+      }
+      if (c == '\r')
+      {
+        state_ = trailer_lf;
+      }
+      break;
+    case trailer_lf:
+      if (c != '\n')
+      {
+        return request_parser::bad;
+      }
+      state_ = trailer_start;
+      break;
+    case last_lf:
+      if (c != '\n')
+      {
+        return request_parser::bad;
+      }
+      // The bytes after the body follow the decoded ones.
+      std::memmove(data + out, data + in, size - in);
+      size = out + size - in;
+      decoded_ = out;
+      return request_parser::good;
+    case chunk_data:
+      break;
+    }
+  }
+  size = out;
+  decoded_ = out;
+  return request_parser::indeterminate;
+}
+
+} // namespace server
+} // namespace http
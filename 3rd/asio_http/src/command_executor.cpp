@@ -0,0 +1,143 @@
+//
+// command_executor.cpp
+// ~~~~~~~~~~~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "command_executor.hpp"
+#include "connection.hpp"
+
+namespace http {
+namespace server {
+
+namespace {
+
+/// The connections queued by this I/O thread since the last flush.
+thread_local std::vector<connection_ptr> io_batch;
+
+} // namespace
+
+command_executor::command_executor()
+  : stopped_(false)
+{
+}
+
+command_executor::~command_executor()
+{
+  stop();
+}
+
+void command_executor::start(std::function<void()> init)
+{
+  stopped_ = false;
+  thread_ = std::thread([this, init]() {
+    if (init) {
+      init();
+    }
+    run();
+  });
+}
+
+void command_executor::stop()
+{
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    stopped_ = true;
+  }
+  cond_.notify_one();
+  if (thread_.joinable())
+  {
+    thread_.join();
+  }
+  pending_.clear();
+}
+
+void command_executor::defer(connection_ptr conn)
+{
+  io_batch.push_back(std::move(conn));
+}
+
+void command_executor::flush()
+{
+  if (io_batch.empty())
+  {
+    return;
+  }
+  bool was_empty;
+  {
+    std::lock_guard<std::mutex> lock(mutex_);
+    was_empty = pending_.empty();
+    pending_.insert(pending_.end(), std::make_move_iterator(io_batch.begin()),
+        std::make_move_iterator(io_batch.end()));
+  }
+  io_batch.clear();
+  if (was_empty)
+  {
+    cond_.notify_one();
+  }
+}
+
+void command_executor::complete(connection_ptr conn)
+{
+  boost::asio::io_service& io_service = conn->get_io_service();
+  if (std::this_thread::get_id() != thread_.get_id())
+  {
+    // An asynchronous handler replied from another thread.
+    io_service.post([conn]() { conn->write_reply(); });
+    return;
+  }
+  for (auto&& item : replies_)
+  {
+    if (item.first == &io_service)
+    {
+      item.second.push_back(std::move(conn));
+      return;
+    }
+  }
+  replies_.emplace_back(&io_service, std::vector<connection_ptr>{std::move(conn)});
+}
+
+void command_executor::run()
+{
+  std::vector<connection_ptr> batch;
+  while (true)
+  {
+    {
+      std::unique_lock<std::mutex> lock(mutex_);
+      cond_.wait(lock, [this]() { return stopped_ || !pending_.empty(); });
+      if (stopped_)
+      {
+        return;
+      }
+      batch.swap(pending_);
+    }
+    for (auto&& conn : batch)
+    {
+      conn->execute(*this);
+    }
+    batch.clear();
+    flush_replies();
+  }
+}
+
+void command_executor::flush_replies()
+{
+  for (auto&& item : replies_)
+  {
+    std::shared_ptr<std::vector<connection_ptr>> conns =
+        std::make_shared<std::vector<connection_ptr>>(std::move(item.second));
+    item.first->post([conns]()
+    {
+      for (auto&& conn : *conns)
+      {
+        conn->write_reply();
+      }
+    });
+  }
+  replies_.clear();
+}
+
+} // namespace server
+} // namespace http
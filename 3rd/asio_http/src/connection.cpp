@@ -10,24 +10,191 @@
 
 #include "connection.hpp"
 #include <boost/beast/core.hpp>
+#include <algorithm>
+#include <charconv>
+#include <cstring>
 #include <utility>
 #include <vector>
+#include "request.hpp"
 #include "request_handler.hpp"
 
 namespace http {
 namespace server {
 
-connection::connection(boost::asio::io_service& io_service, request_handler& handler)
-  : socket_(io_service),
+namespace {
+
+/// Whether a comma separated header value has token, case insensitive.
+bool has_token(std::string_view value, const char* token)
+{
+  std::size_t begin = 0;
+  while (begin < value.size())
+  {
+    std::size_t end = value.find(',', begin);
+    if (end == std::string_view::npos)
+    {
+      end = value.size();
+    }
+    std::size_t first = value.find_first_not_of(" \t", begin);
+    std::size_t last = end;
+    while (last > first && (value[last - 1] == ' ' || value[last - 1] == '\t'))
+    {
+      --last;
+    }
+    if (first < last && iequals(value.substr(first, last - first), token))
+    {
+      return true;
+    }
+    begin = end + 1;
+  }
+  return false;
+}
+
+/// The value without the spaces around it.
+std::string_view trim(std::string_view value)
+{
+  std::size_t first = value.find_first_not_of(" \t");
+  if (first == std::string_view::npos)
+  {
+    return std::string_view();
+  }
+  return value.substr(first, value.find_last_not_of(" \t") - first + 1);
+}
+
+/// How the end of a request body is found.
+enum class body_framing { none, length, chunked, invalid, unsupported };
+
+body_framing find_framing(const request& req, std::size_t& length)
+{
+  const std::string_view* encoding = nullptr;
+  const std::string_view* content_length = nullptr;
+  for (auto&& h : req.headers)
+  {
+    if (iequals(h.name, "Transfer-Encoding"))
+    {
+      if (encoding)
+      {
+        return body_framing::unsupported;
+      }
+      encoding = &h.value;
+    }
+    else if (iequals(h.name, "Content-Length"))
+    {
+      if (content_length && trim(*content_length) != trim(h.value))
+      {
+        return body_framing::invalid;
+      }
+      content_length = &h.value;
+    }
+  }
+  // A proxy in front could read a request with both differently.
+  if (encoding && content_length)
+  {
+    return body_framing::invalid;
+  }
+  if (encoding)
+  {
+    return iequals(trim(*encoding), "chunked") ? body_framing::chunked : body_framing::unsupported;
+  }
+  if (!content_length)
+  {
+    return body_framing::none;
+  }
+  std::string_view digits = trim(*content_length);
+  if (digits.empty() || digits.size() > 18)
+  {
+    return body_framing::invalid;
+  }
+  length = 0;
+  for (char c : digits)
+  {
+    if (c < '0' || c > '9')
+    {
+      return body_framing::invalid;
+    }
+    length = length * 10 + (c - '0');
+  }
+  return length > 0 ? body_framing::length : body_framing::none;
+}
+
+/// Whether the request is HTTP/1.1 or later.
+bool is_http_1_1(const request& req)
+{
+  return req.http_version_major > 1 || (req.http_version_major == 1 && req.http_version_minor >= 1);
+}
+
+/// Whether the client waits for 100 Continue before sending the body.
+bool expects_continue(const request& req)
+{
+  const std::string_view* expect = req.find_header("Expect");
+  return expect && iequals(trim(*expect), "100-continue") && is_http_1_1(req);
+}
+
+const char continue_line[] = "HTTP/1.1 100 Continue\r\n\r\n";
+
+const char last_chunk[] = "0\r\n\r\n";
+
+const char crlf[] = "\r\n";
+
+} // namespace
+
+connection::connection(boost::asio::io_service& io_service, request_handler& handler,
+    const connection_settings& settings, command_executor* executor)
+  : io_service_(io_service),
+    socket_(io_service),
     request_handler_(handler),
-    strand_(io_service)
+    settings_(settings),
+    executor_(executor),
+    buffer_begin_(0),
+    buffer_end_(0),
+    buffer_needed_(0),
+    decoding_chunks_(false),
+    continue_sent_(false),
+    writing_continue_(false),
+    write_waiting_(false),
+    unanswered_(0),
+    close_after_batch_(false),
+    write_index_(0),
+    idle_timer_(io_service),
+    handler_executor_(io_service.get_executor())
 {
+  if (!settings_.single_threaded_io)
+  {
+    handler_executor_ = boost::asio::make_strand(io_service);
+  }
 }
 
 boost::asio::ip::tcp::socket& connection::socket() {
   return socket_;
 }
 
+boost::asio::io_service& connection::get_io_service() {
+  return io_service_;
+}
+
+void connection::execute(command_executor& executor)
+{
+  auto self(shared_from_this());
+  for (std::size_t i = 0; i < batch_.size(); ++i)
+  {
+    if (batch_[i].handle)
+    {
+      request_handler_.handle_request(batch_[i].req, [this, self, i, &executor](reply rep)
+      {
+        batch_[i].rep = std::move(rep);
+        if (--unanswered_ == 0)
+        {
+          executor.complete(self);
+        }
+      });
+    }
+  }
+}
+
+void connection::write_reply()
+{
+  do_write();
+}
+
 void connection::start()
 {
   do_read();
@@ -35,51 +202,406 @@ void connection::start()
 
 void connection::stop()
 {
-  socket_.close();
+  boost::system::error_code ignored_ec;
+  idle_timer_.cancel(ignored_ec);
+  socket_.close(ignored_ec);
+}
+
+bool connection::keep_alive(const request& req) const
+{
+  if (settings_.idle_timeout <= std::chrono::steady_clock::duration::zero())
+  {
+    return false;
+  }
+  // HTTP/1.1 keeps the connection unless told otherwise, HTTP/1.0 only
+  // when asked to.
+  bool keep = req.http_version_major > 1 ||
+      (req.http_version_major == 1 && req.http_version_minor >= 1);
+  for (auto&& h : req.headers)
+  {
+    if (iequals(h.name, "Connection"))
+    {
+      if (has_token(h.value, "close"))
+      {
+        return false;
+      }
+      if (has_token(h.value, "keep-alive"))
+      {
+        keep = true;
+      }
+    }
+  }
+  return keep;
+}
+
+void connection::handle_input()
+{
+  // A request left in the buffer by a full batch is parsed before reading.
+  buffer_needed_ = 0;
+  bool send_continue = false;
+  while (buffer_begin_ != buffer_end_ && batch_.size() < settings_.max_pipelined_requests)
+  {
+    batch_.emplace_back();
+    exchange& ex = batch_.back();
+    char* begin = buffer_.data() + buffer_begin_;
+    request_parser::result_type result;
+    const char* head_end;
+    std::tie(result, head_end) = request_parser_.parse(
+        ex.req, begin, buffer_.data() + buffer_end_);
+    std::size_t request_size = 0;
+    if (result == request_parser::good)
+    {
+      result = read_body(ex, head_end - begin, request_size);
+      if (result == request_parser::indeterminate)
+      {
+        send_continue = batch_.size() == 1 && !continue_sent_ && expects_continue(ex.req);
+        batch_.pop_back();
+        break;
+      }
+    }
+    else if (result == request_parser::indeterminate)
+    {
+      if (buffer_end_ - buffer_begin_ < settings_.max_request_head_size)
+      {
+        batch_.pop_back();
+        break;
+      }
+      ex.rep = reply(reply::request_header_fields_too_large);
+    }
+    else
+    {
+      ex.rep = reply(reply::bad_request);
+    }
+    if (result == request_parser::good)
+    {
+      buffer_begin_ += request_size;
+      continue_sent_ = false;
+    }
+    ex.handle = result == request_parser::good;
+    ex.keep_alive = ex.handle && keep_alive(ex.req);
+    if (!ex.keep_alive)
+    {
+      // The requests after it are not answered.
+      close_after_batch_ = true;
+      break;
+    }
+  }
+  if (buffer_begin_ == buffer_end_)
+  {
+    buffer_begin_ = buffer_end_ = 0;
+  }
+  if (batch_.empty())
+  {
+    if (send_continue)
+    {
+      do_write_continue();
+    }
+    do_read();
+    return;
+  }
+
+  std::size_t handled = 0;
+  for (auto&& ex : batch_)
+  {
+    handled += ex.handle ? 1 : 0;
+  }
+  unanswered_ = handled;
+  if (handled == 0)
+  {
+    do_write();
+  }
+  else if (executor_)
+  {
+    // The I/O thread hands the batch over with the others parsed in this
+    // iteration of its loop.
+    executor_->defer(shared_from_this());
+  }
+  else
+  {
+    auto self(shared_from_this());
+    for (std::size_t i = 0; i < batch_.size(); ++i)
+    {
+      if (batch_[i].handle)
+      {
+        request_handler_.handle_request(batch_[i].req, [this, self, i](reply rep)
+        {
+          complete(i, std::move(rep));
+        });
+      }
+    }
+  }
+}
+
+request_parser::result_type connection::read_body(exchange& ex, std::size_t head_size,
+    std::size_t& request_size)
+{
+  char* begin = buffer_.data() + buffer_begin_;
+  std::size_t length = 0;
+  switch (find_framing(ex.req, length))
+  {
+  case body_framing::none:
+    request_size = head_size;
+    return request_parser::good;
+  case body_framing::length:
+    if (length > settings_.max_body_size)
+    {
+      ex.rep = reply(reply::payload_too_large);
+      return request_parser::bad;
+    }
+    if (buffer_end_ - buffer_begin_ < head_size + length)
+    {
+      buffer_needed_ = head_size + length;
+      return request_parser::indeterminate;
+    }
+    ex.req.body = std::string_view(begin + head_size, length);
+    request_size = head_size + length;
+    return request_parser::good;
+  case body_framing::chunked:
+  {
+    // The decoder goes on where it stopped, the bytes it removed shorten
+    // the buffered data.
+    if (!decoding_chunks_)
+    {
+      chunked_decoder_.reset();
+      decoding_chunks_ = true;
+    }
+    std::size_t size = buffer_end_ - buffer_begin_ - head_size;
+    request_parser::result_type result = chunked_decoder_.decode(begin + head_size, size);
+    buffer_end_ = buffer_begin_ + head_size + size;
+    if (result == request_parser::bad)
+    {
+      ex.rep = reply(reply::bad_request);
+      return request_parser::bad;
+    }
+    if (chunked_decoder_.decoded() > settings_.max_body_size)
+    {
+      ex.rep = reply(reply::payload_too_large);
+      return request_parser::bad;
+    }
+    if (result == request_parser::indeterminate)
+    {
+      return request_parser::indeterminate;
+    }
+    decoding_chunks_ = false;
+    ex.req.body = std::string_view(begin + head_size, chunked_decoder_.decoded());
+    request_size = head_size + chunked_decoder_.decoded();
+    return request_parser::good;
+  }
+  case body_framing::unsupported:
+    ex.rep = reply(reply::not_implemented);
+    return request_parser::bad;
+  default:
+    ex.rep = reply(reply::bad_request);
+    return request_parser::bad;
+  }
+}
+
+void connection::complete(std::size_t index, reply rep)
+{
+  // Every reply has its own slot, the one setting the last reply may come
+  // from another thread and writes on the executor of the connection.
+  batch_[index].rep = std::move(rep);
+  if (--unanswered_ == 0)
+  {
+    auto self(shared_from_this());
+    boost::asio::dispatch(handler_executor_, [this, self]() { do_write(); });
+  }
 }
 
 void connection::do_read()
 {
+  // The start of a request is moved to the front, the batch is written so
+  // no header points into the buffer.
+  if (buffer_begin_ != 0)
+  {
+    std::memmove(buffer_.data(), buffer_.data() + buffer_begin_, buffer_end_ - buffer_begin_);
+    buffer_end_ -= buffer_begin_;
+    buffer_begin_ = 0;
+  }
+  // A buffer grown for a large request goes back to the pool when empty, a
+  // full one grows by doubling or to the size of the body.
+  if (buffer_end_ == 0 && buffer_.capacity() > settings_.max_request_head_size)
+  {
+    buffer_.release();
+  }
+  std::size_t wanted = buffer_needed_;
+  if (buffer_end_ == buffer_.capacity())
+  {
+    wanted = std::max({wanted, buffer_end_ * 2, buffer_pool::min_size});
+  }
+  buffer_.reserve(wanted, buffer_end_);
   auto self(shared_from_this());
-  socket_.async_read_some(boost::asio::buffer(buffer_),
-      strand_.wrap([this, self](std::error_code ec, std::size_t bytes_transferred)
+  do_wait_idle();
+  socket_.async_read_some(boost::asio::buffer(buffer_.data() + buffer_end_, buffer_.capacity() - buffer_end_),
+      boost::asio::bind_executor(handler_executor_, [this, self](std::error_code ec, std::size_t bytes_transferred)
       {
+        boost::system::error_code ignored_ec;
+        idle_timer_.cancel(ignored_ec);
         if (!ec)
         {
-          request_parser::result_type result;
-          std::tie(result, std::ignore) = request_parser_.parse(
-              request_, buffer_.data(), buffer_.data() + bytes_transferred);
-
-          if (result == request_parser::good)
-          {
-            request_handler_.handle_request(request_, reply_);
-            do_write();
-          }
-          else if (result == request_parser::bad)
-          {
-            reply_ = reply(reply::bad_request);
-            do_write();
-          }
-          else
-          {
-            do_read();
-          }
+          buffer_end_ += bytes_transferred;
+          handle_input();
         }
       }));
 }
 
-void connection::do_write()
+void connection::do_wait_idle()
 {
+  if (settings_.idle_timeout <= std::chrono::steady_clock::duration::zero())
+  {
+    return;
+  }
   auto self(shared_from_this());
-  boost::asio::async_write(socket_, reply_.to_buffers(),
-                    strand_.wrap([this, self](std::error_code ec, std::size_t)
+  idle_timer_.expires_after(settings_.idle_timeout);
+  idle_timer_.async_wait(boost::asio::bind_executor(handler_executor_, [this, self](std::error_code ec)
       {
         if (!ec)
         {
-          // Initiate graceful connection closure.
-          boost::beast::error_code ignored_ec;
-          socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both,
-            ignored_ec);
+          // The pending read completes with an error and releases the
+          // connection.
+          boost::system::error_code ignored_ec;
+          socket_.close(ignored_ec);
+        }
+      }));
+}
+
+void connection::do_write()
+{
+  if (writing_continue_)
+  {
+    write_waiting_ = true;
+    return;
+  }
+  // The replies up to a streamed one are written at once, its content
+  // follows piece by piece before the replies after it.
+  auto self(shared_from_this());
+  reply_buffers_.clear();
+  bool streaming = false;
+  while (write_index_ < batch_.size() && !streaming)
+  {
+    exchange& ex = batch_[write_index_++];
+    streaming = static_cast<bool>(ex.rep.producer);
+    if (streaming && !is_http_1_1(ex.req) && ex.keep_alive)
+    {
+      // The end of the connection ends the content, the requests after it
+      // are not answered.
+      ex.keep_alive = false;
+      close_after_batch_ = true;
+      batch_.erase(batch_.begin() + write_index_, batch_.end());
+    }
+    reply_buffers_.add(ex.rep, is_http_1_1(ex.req), ex.keep_alive);
+  }
+  boost::asio::async_write(socket_, reply_buffers_.buffers(),
+                    boost::asio::bind_executor(handler_executor_, [this, self, streaming](std::error_code ec, std::size_t)
+      {
+        if (ec)
+        {
+          return;
+        }
+        if (streaming)
+        {
+          do_produce();
+          return;
+        }
+        finish_batch();
+      }));
+}
+
+void connection::do_produce()
+{
+  auto self(shared_from_this());
+  batch_[write_index_ - 1].rep.producer([this, self](std::string chunk)
+      {
+        boost::asio::dispatch(handler_executor_, [this, self, chunk = std::move(chunk)]() mutable
+            {
+              do_write_chunk(std::move(chunk));
+            });
+      });
+}
+
+void connection::do_write_chunk(std::string chunk)
+{
+  exchange& ex = batch_[write_index_ - 1];
+  bool chunked = is_http_1_1(ex.req);
+  bool last = chunk.empty();
+  if (last)
+  {
+    // The producer and the last piece are released before going on.
+    ex.rep.producer = nullptr;
+    if (!chunked)
+    {
+      finish_batch();
+      return;
+    }
+  }
+  chunk_ = std::move(chunk);
+  std::array<boost::asio::const_buffer, 3> buffers;
+  if (chunked)
+  {
+    char* end = chunk_size_.data();
+    if (!last)
+    {
+      end = std::to_chars(end, end + 16, chunk_.size(), 16).ptr;
+      *end++ = '\r';
+      *end++ = '\n';
+    }
+    buffers[0] = boost::asio::buffer(chunk_size_.data(), end - chunk_size_.data());
+    buffers[2] = boost::asio::buffer(last ? last_chunk : crlf, last ? sizeof(last_chunk) - 1 : 2);
+  }
+  buffers[1] = boost::asio::buffer(chunk_);
+  auto self(shared_from_this());
+  boost::asio::async_write(socket_, buffers,
+      boost::asio::bind_executor(handler_executor_, [this, self, last](std::error_code ec, std::size_t)
+      {
+        if (ec)
+        {
+          return;
+        }
+        if (!last)
+        {
+          do_produce();
+        }
+        else if (write_index_ < batch_.size())
+        {
+          do_write();
+        }
+        else
+        {
+          finish_batch();
+        }
+      }));
+}
+
+void connection::finish_batch()
+{
+  if (close_after_batch_)
+  {
+    // Initiate graceful connection closure.
+    boost::beast::error_code ignored_ec;
+    socket_.shutdown(boost::asio::ip::tcp::socket::shutdown_both,
+      ignored_ec);
+    return;
+  }
+  batch_.clear();
+  write_index_ = 0;
+  handle_input();
+}
+
+void connection::do_write_continue()
+{
+  // Only one write is in progress, the replies of a batch parsed meanwhile
+  // wait for this one.
+  auto self(shared_from_this());
+  continue_sent_ = true;
+  writing_continue_ = true;
+  boost::asio::async_write(socket_, boost::asio::buffer(continue_line, sizeof(continue_line) - 1),
+      boost::asio::bind_executor(handler_executor_, [this, self](std::error_code ec, std::size_t)
+      {
+        writing_continue_ = false;
+        if (!ec && write_waiting_)
+        {
+          write_waiting_ = false;
+          do_write();
         }
       }));
 }
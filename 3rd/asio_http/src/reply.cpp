@@ -9,7 +9,11 @@
 //
 
 #include "reply.hpp"
+#include <charconv>
+#include <ctime>
 #include <string>
+#include <string_view>
+#include "request.hpp"
 
 using namespace boost;
 namespace http {
@@ -17,38 +21,47 @@ namespace server {
 
 namespace status_strings {
 
+const std::string http_1_0 =
+  "HTTP/1.0 ";
+const std::string http_1_1 =
+  "HTTP/1.1 ";
+
 const std::string ok =
-  "HTTP/1.0 200 OK\r\n";
+  "200 OK\r\n";
 const std::string created =
-  "HTTP/1.0 201 Created\r\n";
+  "201 Created\r\n";
 const std::string accepted =
-  "HTTP/1.0 202 Accepted\r\n";
+  "202 Accepted\r\n";
 const std::string no_content =
-  "HTTP/1.0 204 No Content\r\n";
+  "204 No Content\r\n";
 const std::string multiple_choices =
-  "HTTP/1.0 300 Multiple Choices\r\n";
+  "300 Multiple Choices\r\n";
 const std::string moved_permanently =
-  "HTTP/1.0 301 Moved Permanently\r\n";
+  "301 Moved Permanently\r\n";
 const std::string moved_temporarily =
-  "HTTP/1.0 302 Moved Temporarily\r\n";
+  "302 Moved Temporarily\r\n";
 const std::string not_modified =
-  "HTTP/1.0 304 Not Modified\r\n";
+  "304 Not Modified\r\n";
 const std::string bad_request =
-  "HTTP/1.0 400 Bad Request\r\n";
+  "400 Bad Request\r\n";
 const std::string unauthorized =
-  "HTTP/1.0 401 Unauthorized\r\n";
+  "401 Unauthorized\r\n";
 const std::string forbidden =
-  "HTTP/1.0 403 Forbidden\r\n";
+  "403 Forbidden\r\n";
 const std::string not_found =
-  "HTTP/1.0 404 Not Found\r\n";
+  "404 Not Found\r\n";
+const std::string payload_too_large =
+  "413 Payload Too Large\r\n";
+const std::string request_header_fields_too_large =
+  "431 Request Header Fields Too Large\r\n";
 const std::string internal_server_error =
-  "HTTP/1.0 500 Internal Server Error\r\n";
+  "500 Internal Server Error\r\n";
 const std::string not_implemented =
-  "HTTP/1.0 501 Not Implemented\r\n";
+  "501 Not Implemented\r\n";
 const std::string bad_gateway =
-  "HTTP/1.0 502 Bad Gateway\r\n";
+  "502 Bad Gateway\r\n";
 const std::string service_unavailable =
-  "HTTP/1.0 503 Service Unavailable\r\n";
+  "503 Service Unavailable\r\n";
 
 static asio::const_buffer to_buffer(reply::status_type status)
 {
@@ -78,6 +91,10 @@ static asio::const_buffer to_buffer(reply::status_type status)
     return asio::buffer(forbidden);
   case reply::not_found:
     return asio::buffer(not_found);
+  case reply::payload_too_large:
+    return asio::buffer(payload_too_large);
+  case reply::request_header_fields_too_large:
+    return asio::buffer(request_header_fields_too_large);
   case reply::internal_server_error:
     return asio::buffer(internal_server_error);
   case reply::not_implemented:
@@ -100,20 +117,139 @@ const char crlf[] = { '\r', '\n' };
 
 } // namespace misc_strings
 
-std::vector<asio::const_buffer> reply::to_buffers()
+namespace header_lines {
+
+const std::string_view text_html = "Content-Type: text/html\r\n";
+const std::string_view text_plain = "Content-Type: text/plain\r\n";
+const std::string_view application_json = "Content-Type: application/json\r\n";
+const std::string_view application_octet_stream = "Content-Type: application/octet-stream\r\n";
+const std::string_view keep_alive = "Connection: keep-alive\r\n";
+const std::string_view close = "Connection: close\r\n";
+const std::string_view content_length = "Content-Length: ";
+const std::string_view chunked = "Transfer-Encoding: chunked\r\n";
+
+static std::string_view content_type(reply::content_type_type type)
+{
+  switch (type)
+  {
+  case reply::text_plain:
+    return text_plain;
+  case reply::application_json:
+    return application_json;
+  case reply::application_octet_stream:
+    return application_octet_stream;
+  default:
+    return text_html;
+  }
+}
+
+/// The Date header, formatted again by a thread when the second changes.
+static std::string_view date()
 {
-  std::vector<asio::const_buffer> buffers;
-  buffers.push_back(status_strings::to_buffer(status));
-  for (auto &h : headers)
+  static thread_local std::time_t formatted = -1;
+  static thread_local char line[64];
+  static thread_local std::size_t size = 0;
+  std::time_t now = std::time(nullptr);
+  if (now != formatted)
   {
-    buffers.push_back(asio::buffer(h.first));
-    buffers.push_back(asio::buffer(misc_strings::name_value_separator));
-    buffers.push_back(asio::buffer(h.second));
-    buffers.push_back(asio::buffer(misc_strings::crlf));
+    std::tm tm;
+#ifdef _WIN32
+    gmtime_s(&tm, &now);
+#else
+    gmtime_r(&now, &tm);
+#endif
+    size = std::strftime(line, sizeof(line), "Date: %a, %d %b %Y %H:%M:%S GMT\r\n", &tm);
+    formatted = now;
   }
-  buffers.push_back(asio::buffer(misc_strings::crlf));
-  buffers.push_back(asio::buffer(content));
-  return buffers;
+  return std::string_view(line, size);
+}
+
+} // namespace header_lines
+
+void reply_buffers::clear()
+{
+  block_.clear();
+  references_.clear();
+  buffers_.clear();
+}
+
+void reply_buffers::add(const reply& rep, bool http_1_1, bool keep_alive)
+{
+  asio::const_buffer status = status_strings::to_buffer(rep.status);
+  block_ += http_1_1 ? status_strings::http_1_1 : status_strings::http_1_0;
+  block_.append(static_cast<const char*>(status.data()), status.size());
+  block_ += header_lines::date();
+  bool has_type = false;
+  bool has_length = false;
+  for (auto &h : rep.headers)
+  {
+    if (iequals(h.first, "Connection"))
+    {
+      continue;
+    }
+    has_type = has_type || iequals(h.first, "Content-Type");
+    has_length = has_length || iequals(h.first, "Content-Length");
+    block_ += h.first;
+    block_.append(misc_strings::name_value_separator, sizeof(misc_strings::name_value_separator));
+    block_ += h.second;
+    block_.append(misc_strings::crlf, sizeof(misc_strings::crlf));
+  }
+  if (!has_type)
+  {
+    block_ += header_lines::content_type(rep.content_type);
+  }
+  if (rep.producer)
+  {
+    // An HTTP/1.0 client reads up to the end of the connection.
+    if (http_1_1)
+    {
+      block_ += header_lines::chunked;
+    }
+    block_ += keep_alive ? header_lines::keep_alive : header_lines::close;
+    block_.append(misc_strings::crlf, sizeof(misc_strings::crlf));
+    return;
+  }
+  const std::string& content = rep.shared_content ? *rep.shared_content : rep.content;
+  if (!has_length)
+  {
+    char digits[24];
+    char* end = std::to_chars(digits, digits + sizeof(digits), content.size()).ptr;
+    block_ += header_lines::content_length;
+    block_.append(digits, end - digits);
+    block_.append(misc_strings::crlf, sizeof(misc_strings::crlf));
+  }
+  block_ += keep_alive ? header_lines::keep_alive : header_lines::close;
+  block_.append(misc_strings::crlf, sizeof(misc_strings::crlf));
+  if (content.size() <= copy_threshold)
+  {
+    block_ += content;
+  }
+  else
+  {
+    references_.emplace_back(block_.size(), asio::buffer(content));
+  }
+}
+
+const std::vector<asio::const_buffer>& reply_buffers::buffers()
+{
+  // The block grows while replies are added, the pieces between the large
+  // contents are taken once it is complete.
+  buffers_.clear();
+  std::size_t begin = 0;
+  for (auto &r : references_)
+  {
+    if (r.first > begin)
+    {
+      buffers_.push_back(asio::buffer(block_.data() + begin, r.first - begin));
+    }
+    buffers_.push_back(r.second);
+    begin = r.first;
+  }
+  if (block_.size() > begin)
+  {
+    buffers_.push_back(asio::buffer(block_.data() + begin, block_.size() - begin));
+  }
+  return buffers_;
 }
 
 namespace stock_replies {
@@ -174,6 +310,16 @@ const char not_found[] =
   "<head><title>Not Found</title></head>"
   "<body><h1>404 Not Found</h1></body>"
   "</html>";
+const char payload_too_large[] =
+  "<html>"
+  "<head><title>Payload Too Large</title></head>"
+  "<body><h1>413 Payload Too Large</h1></body>"
+  "</html>";
+const char request_header_fields_too_large[] =
+  "<html>"
+  "<head><title>Request Header Fields Too Large</title></head>"
+  "<body><h1>431 Request Header Fields Too Large</h1></body>"
+  "</html>";
 const char internal_server_error[] =
   "<html>"
   "<head><title>Internal Server Error</title></head>"
@@ -223,6 +369,10 @@ static std::string to_string(reply::status_type status)
     return forbidden;
   case reply::not_found:
     return not_found;
+  case reply::payload_too_large:
+    return payload_too_large;
+  case reply::request_header_fields_too_large:
+    return request_header_fields_too_large;
   case reply::internal_server_error:
     return internal_server_error;
   case reply::not_implemented:
@@ -239,23 +389,34 @@ static std::string to_string(reply::status_type status)
 } // namespace stock_replies
 
 reply::reply()
-  : status(reply::ok) {}
+  : status(reply::ok),
+    content_type(reply::text_html) {}
 
 reply::reply(const std::string &c)
   : status(reply::ok),
-    content(c),
-    headers({{"Content-Length", std::to_string(content.size())},
-             {"Content-Type", "text/html"}}) {}
+    content_type(reply::text_html),
+    content(c) {}
+
+reply::reply(std::shared_ptr<const std::string> c)
+  : status(reply::ok),
+    content_type(reply::text_html),
+    shared_content(std::move(c)) {}
 
 reply::reply(status_type status_code)
   : status(status_code),
-    content(stock_replies::to_string(status)),
-    headers({{"Content-Length", std::to_string(content.size())},
-             {"Content-Type", "text/html"}}) {}
+    content_type(reply::text_html),
+    content(stock_replies::to_string(status)) {}
 
 reply reply::json_reply(const std::string &json) {
   reply rep(json);
-  rep.headers["Content-Type"] = "application/json";
+  rep.content_type = reply::application_json;
+  return rep;
+}
+
+reply reply::stream(chunk_producer producer, content_type_type type) {
+  reply rep;
+  rep.content_type = type;
+  rep.producer = std::move(producer);
   return rep;
 }
 
@@ -34,82 +34,128 @@
 //
 
 #include "request_handler.hpp"
-#include <sstream>
-#include <thread>
+#include <stdexcept>
 #include "reply.hpp"
 #include "request.hpp"
 
 namespace http {
 namespace server {
 
-request_handler::request_handler() {}
+namespace {
 
-void request_handler::handle_request(request& req, reply& rep) {
-  // Decode url to path.
-  std::string request_path;
-  if (!url_decode(req.uri, request_path)) {
-    rep = reply(reply::bad_request);
-    return;
+int hex_value(char c)
+{
+  if (c >= '0' && c <= '9')
+  {
+    return c - '0';
   }
-  req.uri = request_path;
-
-  for (auto &&item : handler_list_) {
-    const std::string& key = item.first;
-    if (req.uri.substr(0, key.length()) == key) {
-      rep = item.second(req);
-      return;
-    }
+  if (c >= 'a' && c <= 'f')
+  {
+    return c - 'a' + 10;
   }
-  rep = reply(reply::not_found);
+  if (c >= 'A' && c <= 'F')
+  {
+    return c - 'A' + 10;
+  }
+  return -1;
 }
 
-bool request_handler::url_decode(const std::string& in, std::string& out)
+/// Decode [in, in + size) to out, which may be in itself. Returns the size
+/// of the decoded string, or -1 if the encoding is invalid.
+long decode(const char* in, std::size_t size, char* out)
 {
-  out.clear();
-  out.reserve(in.size());
-  for (std::size_t i = 0; i < in.size(); ++i)
+  std::size_t n = 0;
+  for (std::size_t i = 0; i < size; ++i)
   {
     if (in[i] == '%')
     {
-      if (i + 3 <= in.size())
+      int high = i + 2 < size ? hex_value(in[i + 1]) : -1;
+      int low = high >= 0 ? hex_value(in[i + 2]) : -1;
+      if (low < 0)
       {
-        int value = 0;
-        std::istringstream is(in.substr(i + 1, 2));
-        if (is >> std::hex >> value)
-        {
-          out += static_cast<char>(value);
-          i += 2;
-        }
-        else
-        {
-          return false;
-        }
-      }
-      else
-      {
-        return false;
+        return -1;
       }
+      out[n++] = static_cast<char>(high * 16 + low);
+      i += 2;
     }
     else if (in[i] == '+')
     {
-      out += ' ';
+      out[n++] = ' ';
     }
     else
     {
-      out += in[i];
+      out[n++] = in[i];
     }
   }
+  return static_cast<long>(n);
+}
+
+} // namespace
+
+request_handler::request_handler() {}
+
+void request_handler::handle_request(request& req, reply& rep) {
+  // Synchronous handlers call back before returning.
+  handle_request(req, [&rep](reply r) { rep = std::move(r); });
+}
+
+void request_handler::handle_request(request& req, reply_callback done) {
+  if (!router_.frozen()) {
+    freeze();
+  }
+  // Decode url to path.
+  if (!url_decode(req.uri)) {
+    done(reply(reply::bad_request));
+    return;
+  }
+
+  std::size_t number;
+  if (!router_.match(req.uri, number, req.params)) {
+    done(reply(reply::not_found));
+    return;
+  }
+  handlers_[number](req, std::move(done));
+}
+
+bool request_handler::url_decode(const std::string& in, std::string& out)
+{
+  out.resize(in.size());
+  long n = decode(in.data(), in.size(), &out[0]);
+  if (n < 0)
+  {
+    out.clear();
+    return false;
+  }
+  out.resize(static_cast<std::size_t>(n));
+  return true;
+}
+
+bool request_handler::url_decode(std::string& s)
+{
+  long n = decode(s.data(), s.size(), &s[0]);
+  if (n < 0)
+  {
+    return false;
+  }
+  s.resize(static_cast<std::size_t>(n));
   return true;
 }
 
 void request_handler::reg(const std::string &url,
                           request_handler::handle handler) {
-  handler_list_.emplace_back(url, handler);
-  std::sort(handler_list_.begin(), handler_list_.end(),
-            [](const std::tuple<std::string, handle> &a,
-               const std::tuple<std::string, handle> &b) {
-              return std::get<0>(a).length() > std::get<0>(b).length();
-            });
+  reg_async(url, [handler](const request &req, reply_callback done) {
+    done(handler(req));
+  });
+}
+
+void request_handler::reg_async(const std::string &url,
+                                request_handler::async_handle handler) {
+  router_.add(url, handlers_.size());
+  handlers_.push_back(std::move(handler));
+}
+
+void request_handler::freeze() {
+  router_.freeze();
 }
 } // namespace server
 } // namespace http
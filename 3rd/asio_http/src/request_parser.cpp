@@ -9,194 +9,238 @@
 //
 
 #include "request_parser.hpp"
+#include <array>
+#include <cstring>
 #include "request.hpp"
+// MSVC has no __SSE4_2__, AVX implies it.
+#if defined(__SSE4_2__) || defined(__AVX__)
+#define HTTP_PARSER_SSE42
+#include <nmmintrin.h>
+#endif
 
 namespace http {
 namespace server {
 
-request_parser::request_parser() : state_(method_start) {}
+namespace {
 
-void request_parser::reset() { state_ = method_start; }
+/// The characters of a token (RFC 7230), a method or a header name.
+std::array<bool, 256> make_token_chars()
+{
+  std::array<bool, 256> chars{};
+  for (int c = '0'; c <= '9'; ++c)
+    chars[c] = true;
+  for (int c = 'a'; c <= 'z'; ++c)
+    chars[c] = chars[c - 'a' + 'A'] = true;
+  for (const char* c = "!#$%&'*+-.^_`|~"; *c; ++c)
+    chars[static_cast<unsigned char>(*c)] = true;
+  return chars;
+}
 
-request_parser::result_type request_parser::consume(request &req, char input) {
-  switch (state_) {
-  case method_start:
-    if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
-      return bad;
-    } else {
-      state_ = method;
-      req.method.push_back(input);
-      return indeterminate;
-    }
-  case method:
-    if (input == ' ') {
-      state_ = uri;
-      return indeterminate;
-    } else if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
-      return bad;
-    } else {
-      req.method.push_back(input);
-      return indeterminate;
-    }
-  case uri:
-    if (input == ' ') {
-      state_ = http_version_h;
-      return indeterminate;
-    } else if (is_ctl(input)) {
-      return bad;
-    } else {
-      req.uri.push_back(input);
-      return indeterminate;
-    }
-  case http_version_h:
-    if (input == 'H') {
-      state_ = http_version_t_1;
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case http_version_t_1:
-    if (input == 'T') {
-      state_ = http_version_t_2;
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case http_version_t_2:
-    if (input == 'T') {
-      state_ = http_version_p;
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case http_version_p:
-    if (input == 'P') {
-      state_ = http_version_slash;
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case http_version_slash:
-    if (input == '/') {
-      req.http_version_major = 0;
-      req.http_version_minor = 0;
-      state_ = http_version_major_start;
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case http_version_major_start:
-    if (is_digit(input)) {
-      req.http_version_major = req.http_version_major * 10 + input - '0';
-      state_ = http_version_major;
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case http_version_major:
-    if (input == '.') {
-      state_ = http_version_minor_start;
-      return indeterminate;
-    } else if (is_digit(input)) {
-      req.http_version_major = req.http_version_major * 10 + input - '0';
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case http_version_minor_start:
-    if (is_digit(input)) {
-      req.http_version_minor = req.http_version_minor * 10 + input - '0';
-      state_ = http_version_minor;
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case http_version_minor:
-    if (input == '\r') {
-      state_ = expecting_newline_1;
-      return indeterminate;
-    } else if (is_digit(input)) {
-      req.http_version_minor = req.http_version_minor * 10 + input - '0';
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case expecting_newline_1:
-    if (input == '\n') {
-      state_ = header_line_start;
-      return indeterminate;
-    } else {
-      return bad;
-    }
-  case header_line_start:
-    if (input == '\r') {
-      state_ = expecting_newline_3;
-      return indeterminate;
-    } else if (!req.headers.empty() && (input == ' ' || input == '\t')) {
-      state_ = header_lws;
-      return indeterminate;
-    } else if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
+const std::array<bool, 256> token_chars = make_token_chars();
+
+inline bool is_ctl(unsigned char c)
+{
+  return c <= 31 || c == 127;
+}
+
+inline bool is_digit(char c)
+{
+  return c >= '0' && c <= '9';
+}
+
+// Ranges of bytes for _mm_cmpestri, 16 bytes are loaded and one more holds
+// the terminating null.
+// The bytes which may end a token, the table decides.
+alignas(16) const char token_ranges[17] = "\x00 \"\"(),,//:@[]{\xff";
+// The bytes ending a uri, controls and space.
+alignas(16) const char uri_ranges[17] = "\x00 \x7f\x7f";
+// The bytes ending a header value, controls but tab.
+alignas(16) const char value_ranges[17] = "\x00\x08\x0a\x1f\x7f\x7f";
+
+/// Skip 16 bytes at a time to the first one in ranges, or close to end. The
+/// caller checks the bytes from there one by one.
+inline const char* find_fast(const char* p, const char* end, const char* ranges, int ranges_size)
+{
+#ifdef HTTP_PARSER_SSE42
+  if (end - p >= 16)
+  {
+    __m128i r = _mm_load_si128(reinterpret_cast<const __m128i*>(ranges));
+    do
+    {
+      __m128i b = _mm_loadu_si128(reinterpret_cast<const __m128i*>(p));
+      int index = _mm_cmpestri(r, ranges_size, b, 16,
+          _SIDD_LEAST_SIGNIFICANT | _SIDD_CMP_RANGES | _SIDD_UBYTE_OPS);
+      if (index != 16)
+      {
+        return p + index;
+      }
+      p += 16;
+    } while (end - p >= 16);
+  }
+#else
+  (void)end;
+  (void)ranges;
+  (void)ranges_size;
+#endif
+  return p;
+}
+
+/// The end of the token at p.
+inline const char* find_token_end(const char* p, const char* end)
+{
+  p = find_fast(p, end, token_ranges, 16);
+  while (p != end && token_chars[static_cast<unsigned char>(*p)])
+  {
+    ++p;
+  }
+  return p;
+}
+
+inline const char* find_uri_end(const char* p, const char* end)
+{
+  p = find_fast(p, end, uri_ranges, 4);
+  while (p != end && *p != ' ' && !is_ctl(static_cast<unsigned char>(*p)))
+  {
+    ++p;
+  }
+  return p;
+}
+
+inline const char* find_value_end(const char* p, const char* end)
+{
+  p = find_fast(p, end, value_ranges, 6);
+  while (p != end && (*p == '\t' || !is_ctl(static_cast<unsigned char>(*p))))
+  {
+    ++p;
+  }
+  return p;
+}
+
+/// Parse a version number at p, false if there is no digit.
+inline bool parse_version_number(const char*& p, const char* end, int& value)
+{
+  if (p == end || !is_digit(*p))
+  {
+    return false;
+  }
+  value = 0;
+  while (p != end && is_digit(*p))
+  {
+    if (value > 999)
+    {
+      return false;
+    }
+    value = value * 10 + (*p++ - '0');
+  }
+  return true;
+}
+
+} // namespace
+
+request_parser::request_parser() : scanned_(0) {}
+
+void request_parser::reset() { scanned_ = 0; }
+
+std::tuple<request_parser::result_type, const char*> request_parser::parse(
+    request& req, const char* begin, const char* end)
+{
+  // The head ends with an empty line, the search goes on where it stopped
+  // and looks back for the rest of "\r\n\r\n".
+  const char* p = begin + (scanned_ > 3 ? scanned_ - 3 : 0);
+  const char* head_end = nullptr;
+  while (p < end)
+  {
+    const char* lf = static_cast<const char*>(std::memchr(p, '\n', end - p));
+    if (!lf)
+    {
+      break;
+    }
+    if (lf - begin >= 3 && lf[-1] == '\r' && lf[-2] == '\n' && lf[-3] == '\r')
+    {
+      head_end = lf + 1;
+      break;
+    }
+    p = lf + 1;
+  }
+  if (!head_end)
+  {
+    scanned_ = end - begin;
+    return std::make_tuple(indeterminate, end);
+  }
+  scanned_ = 0;
+  return std::make_tuple(parse_head(req, begin, head_end), head_end);
+}
+
+request_parser::result_type request_parser::parse_head(
+    request& req, const char* p, const char* end)
+{
+  const char* q = find_token_end(p, end);
+  if (q == p || q == end || *q != ' ')
+  {
+    return bad;
+  }
+  req.method.assign(p, q);
+  p = q + 1;
+
+  q = find_uri_end(p, end);
+  if (q == p || q == end || *q != ' ')
+  {
+    return bad;
+  }
+  req.uri.assign(p, q);
+  p = q + 1;
+
+  if (end - p < 5 || std::memcmp(p, "HTTP/", 5) != 0)
+  {
+    return bad;
+  }
+  p += 5;
+  if (!parse_version_number(p, end, req.http_version_major) || p == end || *p++ != '.' ||
+      !parse_version_number(p, end, req.http_version_minor) || end - p < 2 ||
+      p[0] != '\r' || p[1] != '\n')
+  {
+    return bad;
+  }
+  p += 2;
+
+  // The head ends with the first empty line, every line before it ends
+  // with "\r\n". Folded lines are obsolete and rejected.
+  req.headers.clear();
+  while (true)
+  {
+    if (end - p < 2)
+    {
       return bad;
-    } else {
-      header_name_.clear();
-      header_value_.clear();
-      header_name_.push_back(input);
-      state_ = header_name;
-      return indeterminate;
     }
-  case header_lws:
-    if (input == '\r') {
-      state_ = expecting_newline_2;
-      return indeterminate;
-    } else if (input == ' ' || input == '\t') {
-      return indeterminate;
-    } else if (is_ctl(input)) {
-      return bad;
-    } else {
-      state_ = header_value;
-      header_value_.push_back(input);
-      return indeterminate;
+    if (p[0] == '\r' && p[1] == '\n')
+    {
+      break;
     }
-  case header_name:
-    if (input == ':') {
-      state_ = space_before_header_value;
-      return indeterminate;
-    } else if (!is_char(input) || is_ctl(input) || is_tspecial(input)) {
+    q = find_token_end(p, end);
+    if (q == p || q == end || *q != ':')
+    {
       return bad;
-    } else {
-      header_name_.push_back(input);
-      return indeterminate;
     }
-  case space_before_header_value:
-    if (input == ' ') {
-      state_ = header_value;
-      return indeterminate;
-    } else {
-      return bad;
+    std::string_view name(p, q - p);
+    p = q + 1;
+    while (p != end && (*p == ' ' || *p == '\t'))
+    {
+      ++p;
     }
-  case header_value:
-    if (input == '\r') {
-      req.headers[header_name_] = header_value_;
-      state_ = expecting_newline_2;
-      return indeterminate;
-    } else if (is_ctl(input)) {
+    q = find_value_end(p, end);
+    if (end - q < 2 || q[0] != '\r' || q[1] != '\n')
+    {
       return bad;
-    } else {
-      header_value_.push_back(input);
-      return indeterminate;
     }
-  case expecting_newline_2:
-    if (input == '\n') {
-      state_ = header_line_start;
-      return indeterminate;
-    } else {
-      return bad;
+    const char* value_end = q;
+    while (value_end != p && (value_end[-1] == ' ' || value_end[-1] == '\t'))
+    {
+      --value_end;
     }
-  case expecting_newline_3:
-    return (input == '\n') ? good : bad;
-  default:
-    return bad;
+    req.headers.push_back(header{name, std::string_view(p, value_end - p)});
+    p = q + 2;
   }
+  return good;
 }
 
 } // namespace server
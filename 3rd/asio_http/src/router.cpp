@@ -0,0 +1,269 @@
+//
+// router.cpp
+// ~~~~~~~~~~
+//
+// Distributed under the Boost Software License, Version 1.0. (See accompanying
+// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//
+
+#include "router.hpp"
+#include <algorithm>
+#include <array>
+#include <deque>
+#include <stdexcept>
+#include <utility>
+
+namespace http {
+namespace server {
+
+struct router::build_node
+{
+  /// The static text of the edge to the node, or the name of a parameter.
+  std::string label;
+
+  /// The static children, their labels start with different bytes.
+  std::vector<std::unique_ptr<build_node>> children;
+
+  std::unique_ptr<build_node> param_child;
+
+  /// The route ending here, or -1.
+  std::int32_t number = -1;
+};
+
+struct router::match_state
+{
+  std::array<param, max_params> params;
+
+  std::array<param, max_params> best_params;
+
+  std::size_t best_param_count = 0;
+
+  std::int32_t best_number = -1;
+
+  std::size_t best_pos = 0;
+};
+
+namespace {
+
+/// The end of the path segment starting at pos, a query ends it too.
+std::size_t segment_end(std::string_view path, std::size_t pos)
+{
+  std::size_t end = path.find_first_of("/?", pos);
+  return end == std::string_view::npos ? path.size() : end;
+}
+
+} // namespace
+
+router::router()
+  : root_(new build_node())
+{
+}
+
+router::~router()
+{
+}
+
+void router::add(const std::string& route, std::size_t number)
+{
+  if (!root_)
+  {
+    throw std::logic_error("route added to a frozen router: " + route);
+  }
+  build_node* n = root_.get();
+  std::size_t param_count = 0;
+  std::size_t pos = 0;
+  while (pos < route.size())
+  {
+    if (route[pos] == ':')
+    {
+      // A parameter up to the end of the segment.
+      std::size_t end = segment_end(route, pos);
+      std::string name = route.substr(pos + 1, end - pos - 1);
+      if (name.empty() || ++param_count > max_params)
+      {
+        throw std::invalid_argument("bad route parameter: " + route);
+      }
+      if (!n->param_child)
+      {
+        n->param_child.reset(new build_node());
+        n->param_child->label = name;
+      }
+      else if (n->param_child->label != name)
+      {
+        throw std::invalid_argument("route parameter :" + name + " conflicts with :" +
+            n->param_child->label + ": " + route);
+      }
+      n = n->param_child.get();
+      pos = end;
+      continue;
+    }
+
+    // The static text up to the next parameter, split into the edges of the
+    // tree. An edge sharing only a prefix with it is split there.
+    std::size_t end = route.find(':', pos);
+    if (end == std::string::npos)
+    {
+      end = route.size();
+    }
+    while (pos < end)
+    {
+      build_node* child = nullptr;
+      for (auto&& c : n->children)
+      {
+        if (c->label[0] == route[pos])
+        {
+          child = c.get();
+          break;
+        }
+      }
+      if (!child)
+      {
+        n->children.emplace_back(new build_node());
+        n->children.back()->label = route.substr(pos, end - pos);
+        n = n->children.back().get();
+        pos = end;
+        break;
+      }
+      std::size_t common = 0;
+      while (common < child->label.size() && pos + common < end &&
+          child->label[common] == route[pos + common])
+      {
+        ++common;
+      }
+      if (common < child->label.size())
+      {
+        std::unique_ptr<build_node> tail(new build_node());
+        tail->label = child->label.substr(common);
+        tail->children = std::move(child->children);
+        tail->param_child = std::move(child->param_child);
+        tail->number = child->number;
+        child->label.resize(common);
+        child->children.clear();
+        child->children.push_back(std::move(tail));
+        child->param_child.reset();
+        child->number = -1;
+      }
+      n = child;
+      pos += common;
+    }
+  }
+  if (n->number >= 0)
+  {
+    throw std::invalid_argument("route registered twice: " + route);
+  }
+  n->number = static_cast<std::int32_t>(number);
+}
+
+void router::freeze()
+{
+  if (!root_)
+  {
+    return;
+  }
+  // Breadth first, so the static children of a node are consecutive.
+  std::deque<std::pair<const build_node*, std::uint32_t>> queue;
+  nodes_.clear();
+  labels_.clear();
+  nodes_.push_back(node());
+  queue.emplace_back(root_.get(), 0);
+  while (!queue.empty())
+  {
+    const build_node* b = queue.front().first;
+    std::uint32_t index = queue.front().second;
+    queue.pop_front();
+    node n;
+    n.label_offset = static_cast<std::uint32_t>(labels_.size());
+    n.label_size = static_cast<std::uint32_t>(b->label.size());
+    labels_ += b->label;
+    n.number = b->number;
+    n.children_begin = static_cast<std::uint32_t>(nodes_.size());
+    for (auto&& c : b->children)
+    {
+      queue.emplace_back(c.get(), static_cast<std::uint32_t>(nodes_.size()));
+      nodes_.push_back(node());
+    }
+    n.children_end = static_cast<std::uint32_t>(nodes_.size());
+    n.param_child = -1;
+    if (b->param_child)
+    {
+      n.param_child = static_cast<std::int32_t>(nodes_.size());
+      queue.emplace_back(b->param_child.get(), static_cast<std::uint32_t>(nodes_.size()));
+      nodes_.push_back(node());
+    }
+    nodes_[index] = n;
+  }
+  root_.reset();
+}
+
+bool router::frozen() const
+{
+  return !root_;
+}
+
+std::string_view router::label(const node& n) const
+{
+  return std::string_view(labels_.data() + n.label_offset, n.label_size);
+}
+
+bool router::match(std::string_view path, std::size_t& number,
+    boost::container::small_vector<param, 8>& params) const
+{
+  params.clear();
+  if (nodes_.empty())
+  {
+    return false;
+  }
+  match_state state;
+  match_node(0, path, 0, 0, state);
+  if (state.best_number < 0)
+  {
+    return false;
+  }
+  number = static_cast<std::size_t>(state.best_number);
+  params.assign(state.best_params.begin(), state.best_params.begin() + state.best_param_count);
+  return true;
+}
+
+void router::match_node(std::uint32_t index, std::string_view path, std::size_t pos,
+    std::size_t param_count, match_state& state) const
+{
+  const node& n = nodes_[index];
+  // A route matches the paths starting with it, the longest match wins and
+  // static children are tried first, so they win a tie.
+  if (n.number >= 0 && (state.best_number < 0 || pos > state.best_pos))
+  {
+    state.best_number = n.number;
+    state.best_pos = pos;
+    state.best_param_count = param_count;
+    std::copy(state.params.begin(), state.params.begin() + param_count, state.best_params.begin());
+  }
+  if (pos == path.size())
+  {
+    return;
+  }
+  for (std::uint32_t c = n.children_begin; c != n.children_end; ++c)
+  {
+    std::string_view l = label(nodes_[c]);
+    if (l[0] == path[pos])
+    {
+      if (path.compare(pos, l.size(), l) == 0)
+      {
+        match_node(c, path, pos + l.size(), param_count, state);
+      }
+      break;
+    }
+  }
+  if (n.param_child >= 0)
+  {
+    std::size_t end = segment_end(path, pos);
+    if (end > pos)
+    {
+      const node& p = nodes_[n.param_child];
+      state.params[param_count] = param{label(p), pos, end - pos};
+      match_node(static_cast<std::uint32_t>(n.param_child), path, end, param_count + 1, state);
+    }
+  }
+}
+
+} // namespace server
+} // namespace http
@@ -33,6 +33,8 @@
 //
 
 #include "server.hpp"
+#include <condition_variable>
+#include <mutex>
 #include <thread>
 
 using namespace boost;
@@ -40,12 +42,60 @@ using namespace boost;
 namespace http {
 namespace server {
 
-server::server(const std::string& address, const std::string& port, std::size_t thread_num)
-  : signals_(io_service_),
-    acceptor_(io_service_),
-    new_connection_(),
+namespace {
+
+/// The core run by this thread, set by server::run in per_core mode.
+thread_local std::size_t this_core = 0;
+
+/// Holds the threads of run until all of them are initialised.
+class startup_barrier
+{
+public:
+  explicit startup_barrier(std::size_t count)
+    : count_(count)
+  {
+  }
+
+  void arrive_and_wait()
+  {
+    std::unique_lock<std::mutex> lock(mutex_);
+    if (--count_ == 0) {
+      cond_.notify_all();
+      return;
+    }
+    cond_.wait(lock, [this]() { return count_ == 0; });
+  }
+
+private:
+  std::mutex mutex_;
+
+  std::condition_variable cond_;
+
+  std::size_t count_;
+};
+
+#if defined(SO_REUSEPORT)
+typedef asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT> reuse_port;
+#endif
+
+} // namespace
+
+server::core::core(boost::asio::io_service& io_service)
+  : io_service_(io_service),
+    acceptor_(io_service),
+    new_connection_()
+{
+}
+
+server::server(const std::string& address, const std::string& port, std::size_t thread_num,
+    execution_mode mode)
+  : io_service_(mode != execution_mode::shared || thread_num <= 1 ? 1 : BOOST_ASIO_CONCURRENCY_HINT_DEFAULT),
+    signals_(io_service_),
+    next_core_(0),
     request_handler_(),
-    thread_num_(thread_num)
+    connection_settings_(),
+    thread_num_(thread_num),
+    mode_(mode)
 {
   // Register to handle the signals that indicate when the server should exit.
   // It is safe to register for the same signal multiple times in a program,
@@ -58,26 +108,87 @@ server::server(const std::string& address, const std::string& port, std::size_t
 
   do_await_stop();
 
+  // An io_service run by one thread needs no strand, and its scheduler is
+  // told so by the concurrency hint.
+  connection_settings_.single_threaded_io = mode_ != execution_mode::shared || thread_num_ <= 1;
+  cores_.emplace_back(new core(io_service_));
+  if (mode_ == execution_mode::threaded_io) {
+    executor_.reset(new command_executor());
+  }
+  if (mode_ != execution_mode::shared) {
+    for (std::size_t i = 1; i < thread_num_; i ++) {
+      core_io_services_.emplace_back(new asio::io_service(1));
+      cores_.emplace_back(new core(*core_io_services_.back()));
+    }
+    for (auto&& c : cores_) {
+      work_guards_.push_back(asio::make_work_guard(c->io_service_));
+    }
+  }
+
   // Open the acceptor with the option to reuse the address (i.e. SO_REUSEADDR).
+  // In per_core mode every core binds its own acceptor to the same endpoint
+  // with SO_REUSEPORT, and the kernel balances the connections.
   asio::ip::tcp::resolver resolver(io_service_);
   asio::ip::tcp::endpoint endpoint = *resolver.resolve({address, port});
-  acceptor_.open(endpoint.protocol());
-  acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
-  acceptor_.bind(endpoint);
-  acceptor_.listen();
-
-  do_accept();
+  for (auto&& c : cores_) {
+    c->acceptor_.open(endpoint.protocol());
+    c->acceptor_.set_option(asio::ip::tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+    if (mode_ != execution_mode::shared) {
+      c->acceptor_.set_option(reuse_port(true));
+    }
+#endif
+    c->acceptor_.bind(endpoint);
+    c->acceptor_.listen();
+    do_accept(*c);
+#if !defined(SO_REUSEPORT)
+    break;
+#endif
+  }
 }
 
 void server::run() {
+  // The routes are read by all threads from here on.
+  request_handler_.freeze();
+
   // The io_service::run() call will block until all asynchronous operations
   // have finished. While the server is running, there is always at least one
   // asynchronous operation outstanding: the asynchronous accept call waiting
   // for new incoming connections.
-  if (thread_num_ > 1) {
+  std::size_t thread_count = mode_ != execution_mode::shared ? cores_.size() + (executor_ ? 1 : 0) : thread_num_;
+  startup_barrier barrier(thread_count > 0 ? thread_count : 1);
+  auto init = [this, &barrier](thread_role role, std::size_t index) {
+    if (thread_init_) {
+      thread_init_(role, index);
+    }
+    barrier.arrive_and_wait();
+  };
+  if (mode_ != execution_mode::shared) {
+    if (executor_) {
+      executor_->start([init]() { init(thread_role::executor, 0); });
+    }
+    std::vector<std::shared_ptr<std::thread>> threads;
+    for (std::size_t i = 1; i < cores_.size(); i ++) {
+      threads.push_back(std::make_shared<std::thread>([this, i, init]() {
+        this_core = i;
+        init(thread_role::io, i);
+        run_io_loop(*cores_[i]);
+      }));
+    }
+    this_core = 0;
+    init(thread_role::io, 0);
+    run_io_loop(*cores_[0]);
+    for (auto&& thread : threads) {
+      thread->join();
+    }
+    if (executor_) {
+      executor_->stop();
+    }
+  } else if (thread_num_ > 1) {
     std::vector<std::shared_ptr<std::thread>> threads;
     for (std::size_t i = 0; i < thread_num_; i ++) {
-      std::shared_ptr<std::thread> thread = std::make_shared<std::thread>([&]() {
+      std::shared_ptr<std::thread> thread = std::make_shared<std::thread>([this, i, init]() {
+        init(thread_role::io, i);
         io_service_.run();
       });
       threads.push_back(thread);
@@ -86,29 +197,60 @@ void server::run() {
       thread->join();
     }
   } else {
+    init(thread_role::io, 0);
     io_service_.run();
   }
 }
 
-void server::do_accept()
+void server::run_io_loop(core& c)
+{
+  if (!executor_) {
+    c.io_service_.run();
+    return;
+  }
+  // Every iteration waits for one handler and runs the ready ones, then the
+  // requests parsed by them are handed to the executor together.
+  while (c.io_service_.run_one() > 0) {
+    c.io_service_.poll();
+    executor_->flush();
+  }
+}
+
+void server::do_accept(core& c)
 {
-  new_connection_.reset(new connection(io_service_, request_handler_));
-  acceptor_.async_accept(new_connection_->socket(),
-      [this](std::error_code ec)
+  // Without SO_REUSEPORT only core 0 accepts, the socket is created on the
+  // core which will own the connection.
+#if defined(SO_REUSEPORT)
+  core& owner = c;
+#else
+  core& owner = *cores_[next_core_++ % cores_.size()];
+#endif
+  c.new_connection_.reset(new connection(owner.io_service_, request_handler_,
+      connection_settings_, executor_.get()));
+  c.acceptor_.async_accept(c.new_connection_->socket(),
+      [this, &c, &owner](std::error_code ec)
       {
         // Check whether the server was stopped by a signal before this
         // completion handler had a chance to run.
-        if (!acceptor_.is_open())
+        if (!c.acceptor_.is_open())
         {
           return;
         }
 
         if (!ec)
         {
-          new_connection_->start();
+          if (&owner == &c)
+          {
+            c.new_connection_->start();
+          }
+          else
+          {
+            connection_ptr conn = c.new_connection_;
+            owner.io_service_.post([conn]() { conn->start(); });
+          }
         }
 
-        do_accept();
+        do_accept(c);
       });
 }
 
@@ -117,16 +259,81 @@ void server::do_await_stop()
   signals_.async_wait(
       [this](std::error_code /*ec*/, int /*signo*/)
       {
-        // The server is stopped by cancelling all outstanding asynchronous
-        // operations. Once all operations have finished the io_service::run()
-        // call will exit.
-        io_service_.stop();
-        acceptor_.close();
+        do_stop();
       });
 }
 
+void server::do_stop()
+{
+  // The server is stopped by cancelling all outstanding asynchronous
+  // operations. Once all operations have finished the io_service::run()
+  // call will exit. The acceptors of the other cores are closed by their
+  // own threads.
+  for (std::size_t i = 1; i < cores_.size(); i ++) {
+    core& c = *cores_[i];
+    asio::post(c.io_service_, [&c]() {
+      boost::system::error_code ignored_ec;
+      c.acceptor_.close(ignored_ec);
+      c.io_service_.stop();
+    });
+  }
+  io_service_.stop();
+  boost::system::error_code ignored_ec;
+  cores_[0]->acceptor_.close(ignored_ec);
+}
+
+void server::stop() {
+  asio::post(io_service_, [this]() { do_stop(); });
+}
+
+void server::set_thread_init(thread_init_handler handler) {
+  thread_init_ = std::move(handler);
+}
+
+void server::set_idle_timeout(std::chrono::steady_clock::duration timeout) {
+  connection_settings_.idle_timeout = timeout;
+}
+
+void server::set_max_pipelined_requests(std::size_t max_requests) {
+  connection_settings_.max_pipelined_requests = max_requests > 0 ? max_requests : 1;
+}
+
+void server::set_max_body_size(std::size_t max_size) {
+  connection_settings_.max_body_size = max_size;
+}
+
 void server::add_handler(const std::string &url, request_handler::handle handler) {
   request_handler_.reg(url, std::move(handler));
 }
+
+void server::add_async_handler(const std::string &url, request_handler::async_handle handler) {
+  request_handler_.reg_async(url, std::move(handler));
+}
+
+std::size_t server::core_num() const {
+  return cores_.size();
+}
+
+asio::io_service& server::get_io_service(std::size_t core) {
+  return cores_[core]->io_service_;
+}
+
+std::size_t server::current_core() {
+  return this_core;
+}
+
+const char* server::io_backend() {
+#if defined(BOOST_ASIO_HAS_IO_URING_AS_DEFAULT)
+  return "io_uring";
+#elif defined(BOOST_ASIO_HAS_EPOLL)
+  return "epoll";
+#elif defined(BOOST_ASIO_HAS_KQUEUE)
+  return "kqueue";
+#elif defined(BOOST_ASIO_HAS_IOCP)
+  return "iocp";
+#else
+  return "select";
+#endif
+}
 } // namespace server
 } // namespace http
@@ -0,0 +1,694 @@
+#ifndef BPLUSTREE_H
+#define BPLUSTREE_H
+
+#include <vector>
+#include <iterator>
+#include <algorithm>
+#include <stdexcept>
+#include "redisIterator.h"
+#include "SkipList.h"
+
+#if defined(__SSE2__) || defined(_M_X64) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#include <emmintrin.h>
+#define BPLUSTREE_SSE2
+#endif
+
+namespace RedisDataStructure
+{
+    const int BPLUSTREE_CACHE_LINE = 64;
+    const int BPLUSTREE_KEY_BYTES = 4 * BPLUSTREE_CACHE_LINE; /* the key array of a node spans 4 cache lines */
+    const int BPLUSTREE_MAX_HEIGHT = 32;                      /* fanout is at least 4, enough for any length */
+
+    /* entries are linked in key order, like level 0 of SkipList, so the
+     * iterators are RedisBidirectionalIterator on entries and stay valid while
+     * the tree nodes are split and merged.
+     */
+    template <typename Key, typename Value>
+    struct BPlusTreeEntry
+    {
+        BPlusTreeEntry *mNext;
+        BPlusTreeEntry *mPrev;
+        Key mKey;
+        Value mValue;
+        BPlusTreeEntry(const Key &k, const Value &v) : mNext(nullptr), mPrev(nullptr), mKey(k), mValue(v) {}
+
+        BPlusTreeEntry<Key, Value> *next() { return mNext; }
+        BPlusTreeEntry<Key, Value> *prev() { return mPrev; }
+    };
+
+    //position of k in the sorted keys[0, n): the number of keys less than k, or not greater than k if inclusive.
+    template <typename Key>
+    struct BPlusTreeKeySearch
+    {
+        static int position(const Key *keys, int n, const Key &k, bool inclusive)
+        {
+            return static_cast<int>(inclusive ? std::upper_bound(keys, keys + n, k) - keys : std::lower_bound(keys, keys + n, k) - keys);
+        }
+    };
+
+#ifdef BPLUSTREE_SSE2
+    /* a node holds a few cache lines of keys, a linear scan which compares
+     * several keys per instruction has no branch miss per key like the binary
+     * search. keys are sorted, so the compare mask of a block is a run of ones
+     * from bit 0, the scan stops at the first block which is not all ones.
+     */
+    template <>
+    struct BPlusTreeKeySearch<double>
+    {
+        static int position(const double *keys, int n, double k, bool inclusive)
+        {
+            const __m128d kk = _mm_set1_pd(k);
+            int i = 0;
+            for (; i + 2 <= n; i += 2)
+            {
+                __m128d block = _mm_loadu_pd(keys + i);
+                int mask = _mm_movemask_pd(inclusive ? _mm_cmple_pd(block, kk) : _mm_cmplt_pd(block, kk));
+                if (mask != 0x3)
+                    return i + (mask & 1);
+            }
+            for (; i < n && (inclusive ? !(k < keys[i]) : keys[i] < k); i++)
+                ;
+            return i;
+        }
+    };
+
+    template <>
+    struct BPlusTreeKeySearch<int>
+    {
+        static int position(const int *keys, int n, int k, bool inclusive)
+        {
+            const __m128i kk = _mm_set1_epi32(k);
+            int i = 0;
+            for (; i + 4 <= n; i += 4)
+            {
+                __m128i block = _mm_loadu_si128(reinterpret_cast<const __m128i *>(keys + i));
+                int mask = inclusive ? ~_mm_movemask_ps(_mm_castsi128_ps(_mm_cmpgt_epi32(block, kk))) & 0xF
+                                     : _mm_movemask_ps(_mm_castsi128_ps(_mm_cmplt_epi32(block, kk)));
+                if (mask != 0xF)
+                {
+                    for (; mask & 1; mask >>= 1)
+                        i++;
+                    return i;
+                }
+            }
+            for (; i < n && (inclusive ? !(k < keys[i]) : keys[i] < k); i++)
+                ;
+            return i;
+        }
+    };
+#endif
+
+    /* BPlusTree is an ordered index with the same interface as SkipList. the
+     * search reads a few contiguous cache lines per level instead of one node
+     * per step, which matters once the index is much larger than the cache.
+     * inner nodes keep the entry count of every child, so the rank is the sum
+     * of the counts on the left of the path. duplicate keys are allowed, the
+     * new one goes after the equal keys.
+     * the child c of an inner node holds the keys in [mKeys[c], mKeys[c + 1]],
+     * mKeys[0] is not used. a key equal to a separator may be on both sides,
+     * that's fine because the entries are linked and the search only needs a
+     * start point.
+     */
+    template <typename Key, typename Value>
+    class BPlusTree
+    {
+    public:
+        using Entry = BPlusTreeEntry<Key, Value>;
+        using iterator = RedisBidirectionalIterator<Entry>;
+        using const_iterator = RedisBidirectionalIterator<const Entry>;
+        using reverse_iterator = RedisBidirectionalReverseIterator<Entry>;
+        using const_reverse_iterator = RedisBidirectionalReverseIterator<const Entry>;
+        BPlusTree();
+        ~BPlusTree() noexcept;
+        BPlusTree(const BPlusTree<Key, Value> &tree) = delete;
+        BPlusTree(BPlusTree<Key, Value> &&tree) = delete;
+        BPlusTree &operator=(const BPlusTree<Key, Value> &tree) = delete;
+        BPlusTree &operator=(BPlusTree<Key, Value> &&tree) = delete;
+        //getter
+        int getLength() { return mLength; }
+        int getHeight() { return mHeight; }
+        //basic operation: insert, erase, query.
+        bool insert(const Key &k, const Value &v);
+        /* replace the content with the pairs(key, value) in [first, last), which
+         * must be sorted by key already. the leaves and inner nodes are filled
+         * level by level in O(n).
+         */
+        template <typename ForwardIt>
+        void assignSorted(ForwardIt first, ForwardIt last);
+        void clear();
+        bool erase(const Key &k);
+        //erase the entry which matches both key and value, used when keys are not unique.
+        bool erase(const Key &k, const Value &v);
+        //return nullptr if there is no such entry
+        Entry *lower_bound(const Key &k);
+        Entry *upper_bound(const Key &k);
+        //rank of the last entry whose key is k, starts from 1, 0 if k does not exist
+        int getRank(const Key &k);
+        //iterators of tree
+        iterator begin() { return iterator(mHead->mNext); }
+        iterator end() { return iterator(mTail); }
+        const_iterator cbegin() { return const_iterator(mHead->mNext); }
+        const_iterator cend() { return const_iterator(mTail); }
+        reverse_iterator rbegin() { return reverse_iterator(mTail->mPrev); }
+        reverse_iterator rend() { return reverse_iterator(mHead); }
+        const_reverse_iterator crbegin() { return const_reverse_iterator(mTail->mPrev); }
+        const_reverse_iterator crend() { return const_reverse_iterator(mHead); }
+
+    private:
+        using Search = BPlusTreeKeySearch<Key>;
+        static constexpr int CAPACITY = sizeof(Key) * 8 > BPLUSTREE_KEY_BYTES ? 8 : BPLUSTREE_KEY_BYTES / sizeof(Key);
+        static constexpr int MIN_COUNT = CAPACITY / 2;
+
+        struct Node
+        {
+            int mCount; //keys in leaf, children in inner node
+            bool mIsLeaf;
+            alignas(BPLUSTREE_CACHE_LINE) Key mKeys[CAPACITY];
+            explicit Node(bool isLeaf) : mCount(0), mIsLeaf(isLeaf) {}
+        };
+        struct Leaf : Node
+        {
+            Entry *mEntries[CAPACITY];
+            Leaf() : Node(true) {}
+        };
+        struct Inner : Node
+        {
+            Node *mChildren[CAPACITY];
+            int mCounts[CAPACITY]; //entries in the subtree of each child
+            Inner() : Node(false) {}
+        };
+        struct PathItem
+        {
+            Inner *mNode;
+            int mIndex;
+        };
+
+        //walk down to the leaf of k, return the number of entries less than k, or not greater than k if inclusive.
+        int locate(const Key &k, bool inclusive, Leaf *&leaf, int &pos);
+        //entry at pos of leaf, the entry after the leaf if pos is the end
+        Entry *entryAt(Leaf *leaf, int pos) { return pos < leaf->mCount ? leaf->mEntries[pos] : (pos > 0 ? leaf->mEntries[pos - 1]->mNext : mTail); }
+        void eraseAtIndex(int index);
+        void insertEntryAt(Leaf *leaf, int pos, Entry *entry);
+        void insertChildAt(Inner *inner, int pos, const Key &sep, Node *child);
+        //insert child at pos of inner, split inner if it is full, return the new right node and its separator
+        Node *insertChild(Inner *inner, int pos, Key &sep, Node *child);
+        //child c of inner has less than MIN_COUNT items, borrow from a sibling or merge with it
+        void rebalanceChild(Inner *inner, int c);
+        //merge child c + 1 into child c
+        void mergeChild(Inner *inner, int c);
+        static int subtreeCount(Node *nd);
+        static void freeNode(Node *nd);
+        static void destroyTree(Node *nd);
+
+    private:
+        Node *mRoot;
+        Entry *mHead, *mTail; //dummy entries, the same as SkipList
+        int mLength;
+        int mHeight; //1 if the root is a leaf
+        SkipListNodePool<Entry> mPool;
+    };
+
+    template <typename Key, typename Value>
+    BPlusTree<Key, Value>::BPlusTree() : mRoot(new Leaf()), mLength(0), mHeight(1)
+    {
+        Key k{};
+        Value v{};
+        mHead = new Entry(k, v);
+        mTail = new Entry(k, v);
+        mHead->mNext = mTail;
+        mTail->mPrev = mHead;
+    }
+
+    template <typename Key, typename Value>
+    BPlusTree<Key, Value>::~BPlusTree() noexcept
+    {
+        clear();
+        freeNode(mRoot);
+        delete mHead;
+        delete mTail;
+        mRoot = nullptr;
+        mHead = nullptr;
+        mTail = nullptr;
+    }
+
+    template <typename Key, typename Value>
+    void BPlusTree<Key, Value>::clear()
+    {
+        for (auto it = mHead->mNext; it != mTail;)
+        {
+            auto next = it->mNext;
+            mPool.destroy(it);
+            it = next;
+        }
+        mHead->mNext = mTail;
+        mTail->mPrev = mHead;
+        destroyTree(mRoot);
+        mRoot = new Leaf();
+        mLength = 0;
+        mHeight = 1;
+    }
+
+    template <typename Key, typename Value>
+    template <typename ForwardIt>
+    void BPlusTree<Key, Value>::assignSorted(ForwardIt first, ForwardIt last)
+    {
+        //check the input first, so that the tree is untouched if it is not sorted
+        if (!std::is_sorted(first, last, [](const auto &a, const auto &b) { return a.first < b.first; }))
+            throw std::invalid_argument("input of assignSorted is not sorted");
+        clear();
+        int length = static_cast<int>(std::distance(first, last));
+        if (length == 0)
+            return;
+        mPool.reserve(length);
+        freeNode(mRoot);
+        //the items are spread evenly, so every node except a single root has at least MIN_COUNT
+        std::vector<Node *> level;
+        int nodeNumber = (length + CAPACITY - 1) / CAPACITY;
+        Entry *prev = mHead;
+        for (int i = 0; i < nodeNumber; i++)
+        {
+            Leaf *leaf = new Leaf();
+            leaf->mCount = length / nodeNumber + (i < length % nodeNumber ? 1 : 0);
+            for (int j = 0; j < leaf->mCount; j++, ++first)
+            {
+                Entry *entry = mPool.create(first->first, first->second);
+                entry->mPrev = prev;
+                prev->mNext = entry;
+                prev = entry;
+                leaf->mKeys[j] = entry->mKey;
+                leaf->mEntries[j] = entry;
+            }
+            level.push_back(leaf);
+        }
+        prev->mNext = mTail;
+        mTail->mPrev = prev;
+        //the separator of a child is its first key
+        std::vector<Key> firsts;
+        for (auto nd : level)
+            firsts.push_back(nd->mKeys[0]);
+        mHeight = 1;
+        while (level.size() > 1)
+        {
+            std::vector<Node *> upper;
+            std::vector<Key> upperFirsts;
+            int childNumber = static_cast<int>(level.size());
+            nodeNumber = (childNumber + CAPACITY - 1) / CAPACITY;
+            for (int i = 0, c = 0; i < nodeNumber; i++)
+            {
+                Inner *inner = new Inner();
+                inner->mCount = childNumber / nodeNumber + (i < childNumber % nodeNumber ? 1 : 0);
+                upperFirsts.push_back(firsts[c]);
+                for (int j = 0; j < inner->mCount; j++, c++)
+                {
+                    inner->mKeys[j] = firsts[c];
+                    inner->mChildren[j] = level[c];
+                    inner->mCounts[j] = subtreeCount(level[c]);
+                }
+                upper.push_back(inner);
+            }
+            level.swap(upper);
+            firsts.swap(upperFirsts);
+            mHeight++;
+        }
+        mRoot = level[0];
+        mLength = length;
+    }
+
+    template <typename Key, typename Value>
+    int BPlusTree<Key, Value>::subtreeCount(Node *nd)
+    {
+        if (nd->mIsLeaf)
+            return nd->mCount;
+        Inner *inner = static_cast<Inner *>(nd);
+        int count = 0;
+        for (int i = 0; i < inner->mCount; i++)
+            count += inner->mCounts[i];
+        return count;
+    }
+
+    template <typename Key, typename Value>
+    void BPlusTree<Key, Value>::freeNode(Node *nd)
+    {
+        if (nd->mIsLeaf)
+            delete static_cast<Leaf *>(nd);
+        else
+            delete static_cast<Inner *>(nd);
+    }
+
+    template <typename Key, typename Value>
+    void BPlusTree<Key, Value>::destroyTree(Node *nd)
+    {
+        if (!nd->mIsLeaf)
+        {
+            Inner *inner = static_cast<Inner *>(nd);
+            for (int i = 0; i < inner->mCount; i++)
+                destroyTree(inner->mChildren[i]);
+        }
+        freeNode(nd);
+    }
+
+    template <typename Key, typename Value>
+    int BPlusTree<Key, Value>::locate(const Key &k, bool inclusive, Leaf *&leaf, int &pos)
+    {
+        int index = 0;
+        Node *nd = mRoot;
+        while (!nd->mIsLeaf)
+        {
+            Inner *inner = static_cast<Inner *>(nd);
+            int c = Search::position(inner->mKeys + 1, inner->mCount - 1, k, inclusive);
+            for (int i = 0; i < c; i++)
+                index += inner->mCounts[i];
+            nd = inner->mChildren[c];
+        }
+        leaf = static_cast<Leaf *>(nd);
+        pos = Search::position(leaf->mKeys, leaf->mCount, k, inclusive);
+        return index + pos;
+    }
+
+    template <typename Key, typename Value>
+    void BPlusTree<Key, Value>::insertEntryAt(Leaf *leaf, int pos, Entry *entry)
+    {
+        std::move_backward(leaf->mKeys + pos, leaf->mKeys + leaf->mCount, leaf->mKeys + leaf->mCount + 1);
+        std::move_backward(leaf->mEntries + pos, leaf->mEntries + leaf->mCount, leaf->mEntries + leaf->mCount + 1);
+        leaf->mKeys[pos] = entry->mKey;
+        leaf->mEntries[pos] = entry;
+        leaf->mCount++;
+    }
+
+    template <typename Key, typename Value>
+    void BPlusTree<Key, Value>::insertChildAt(Inner *inner, int pos, const Key &sep, Node *child)
+    {
+        std::move_backward(inner->mKeys + pos, inner->mKeys + inner->mCount, inner->mKeys + inner->mCount + 1);
+        std::move_backward(inner->mChildren + pos, inner->mChildren + inner->mCount, inner->mChildren + inner->mCount + 1);
+        std::move_backward(inner->mCounts + pos, inner->mCounts + inner->mCount, inner->mCounts + inner->mCount + 1);
+        inner->mKeys[pos] = sep;
+        inner->mChildren[pos] = child;
+        inner->mCounts[pos] = subtreeCount(child);
+        inner->mCount++;
+    }
+
+    template <typename Key, typename Value>
+    typename BPlusTree<Key, Value>::Node *BPlusTree<Key, Value>::insertChild(Inner *inner, int pos, Key &sep, Node *child)
+    {
+        if (inner->mCount < CAPACITY)
+        {
+            insertChildAt(inner, pos, sep, child);
+            return nullptr;
+        }
+        //the separator before child mid moves up, it is mKeys[0] of the right node
+        const int mid = CAPACITY / 2;
+        Inner *right = new Inner();
+        Key up = std::move(inner->mKeys[mid]);
+        std::move(inner->mKeys + mid + 1, inner->mKeys + CAPACITY, right->mKeys + 1);
+        std::move(inner->mChildren + mid, inner->mChildren + CAPACITY, right->mChildren);
+        std::move(inner->mCounts + mid, inner->mCounts + CAPACITY, right->mCounts);
+        right->mCount = CAPACITY - mid;
+        inner->mCount = mid;
+        if (pos <= mid)
+            insertChildAt(inner, pos, sep, child);
+        else
+            insertChildAt(right, pos - mid, sep, child);
+        sep = std::move(up);
+        return right;
+    }
+
+    template <typename Key, typename Value>
+    bool BPlusTree<Key, Value>::insert(const Key &k, const Value &v)
+    {
+        PathItem path[BPLUSTREE_MAX_HEIGHT];
+        int depth = 0;
+        Node *nd = mRoot;
+        while (!nd->mIsLeaf)
+        {
+            Inner *inner = static_cast<Inner *>(nd);
+            int c = Search::position(inner->mKeys + 1, inner->mCount - 1, k, true);
+            inner->mCounts[c]++;
+            path[depth++] = PathItem{inner, c};
+            nd = inner->mChildren[c];
+        }
+        Leaf *leaf = static_cast<Leaf *>(nd);
+        int pos = Search::position(leaf->mKeys, leaf->mCount, k, true);
+        //link the new entry after all the equal keys
+        Entry *entry = mPool.create(k, v);
+        Entry *next = entryAt(leaf, pos);
+        entry->mNext = next;
+        entry->mPrev = next->mPrev;
+        next->mPrev->mNext = entry;
+        next->mPrev = entry;
+        mLength++;
+
+        Node *right = nullptr;
+        Key sep;
+        if (leaf->mCount < CAPACITY)
+        {
+            insertEntryAt(leaf, pos, entry);
+        }
+        else
+        {
+            const int mid = CAPACITY / 2;
+            Leaf *newLeaf = new Leaf();
+            std::move(leaf->mKeys + mid, leaf->mKeys + CAPACITY, newLeaf->mKeys);
+            std::move(leaf->mEntries + mid, leaf->mEntries + CAPACITY, newLeaf->mEntries);
+            newLeaf->mCount = CAPACITY - mid;
+            leaf->mCount = mid;
+            if (pos <= mid)
+                insertEntryAt(leaf, pos, entry);
+            else
+                insertEntryAt(newLeaf, pos - mid, entry);
+            sep = newLeaf->mKeys[0];
+            right = newLeaf;
+        }
+        //the split goes up until an inner node has room
+        for (int level = depth - 1; level >= 0 && right; level--)
+        {
+            Inner *parent = path[level].mNode;
+            int c = path[level].mIndex;
+            parent->mCounts[c] = subtreeCount(parent->mChildren[c]);
+            right = insertChild(parent, c + 1, sep, right);
+        }
+        if (right)
+        {
+            Inner *root = new Inner();
+            root->mCount = 2;
+            root->mChildren[0] = mRoot;
+            root->mChildren[1] = right;
+            root->mKeys[1] = sep;
+            root->mCounts[0] = subtreeCount(mRoot);
+            root->mCounts[1] = subtreeCount(right);
+            mRoot = root;
+            mHeight++;
+        }
+        return true;
+    }
+
+    template <typename Key, typename Value>
+    void BPlusTree<Key, Value>::mergeChild(Inner *inner, int c)
+    {
+        Node *left = inner->mChildren[c], *right = inner->mChildren[c + 1];
+        if (left->mIsLeaf)
+        {
+            Leaf *l = static_cast<Leaf *>(left), *r = static_cast<Leaf *>(right);
+            std::move(r->mKeys, r->mKeys + r->mCount, l->mKeys + l->mCount);
+            std::move(r->mEntries, r->mEntries + r->mCount, l->mEntries + l->mCount);
+        }
+        else
+        {
+            //the separator between them comes down as the key of the first moved child
+            Inner *l = static_cast<Inner *>(left), *r = static_cast<Inner *>(right);
+            l->mKeys[l->mCount] = std::move(inner->mKeys[c + 1]);
+            std::move(r->mKeys + 1, r->mKeys + r->mCount, l->mKeys + l->mCount + 1);
+            std::move(r->mChildren, r->mChildren + r->mCount, l->mChildren + l->mCount);
+            std::move(r->mCounts, r->mCounts + r->mCount, l->mCounts + l->mCount);
+        }
+        left->mCount += right->mCount;
+        inner->mCounts[c] += inner->mCounts[c + 1];
+        freeNode(right);
+        std::move(inner->mKeys + c + 2, inner->mKeys + inner->mCount, inner->mKeys + c + 1);
+        std::move(inner->mChildren + c + 2, inner->mChildren + inner->mCount, inner->mChildren + c + 1);
+        std::move(inner->mCounts + c + 2, inner->mCounts + inner->mCount, inner->mCounts + c + 1);
+        inner->mCount--;
+    }
+
+    template <typename Key, typename Value>
+    void BPlusTree<Key, Value>::rebalanceChild(Inner *inner, int c)
+    {
+        Node *child = inner->mChildren[c];
+        if (c > 0 && inner->mChildren[c - 1]->mCount > MIN_COUNT)
+        {
+            //move the last item of the left sibling to the front of child
+            Node *left = inner->mChildren[c - 1];
+            int moved;
+            if (child->mIsLeaf)
+            {
+                Leaf *l = static_cast<Leaf *>(left), *r = static_cast<Leaf *>(child);
+                insertEntryAt(r, 0, l->mEntries[l->mCount - 1]);
+                l->mCount--;
+                moved = 1;
+                inner->mKeys[c] = r->mKeys[0];
+            }
+            else
+            {
+                Inner *l = static_cast<Inner *>(left), *r = static_cast<Inner *>(child);
+                moved = l->mCounts[l->mCount - 1];
+                //the old separator becomes the key before the old first child
+                std::move_backward(r->mKeys + 1, r->mKeys + r->mCount, r->mKeys + r->mCount + 1);
+                r->mKeys[1] = std::move(inner->mKeys[c]);
+                std::move_backward(r->mChildren, r->mChildren + r->mCount, r->mChildren + r->mCount + 1);
+                std::move_backward(r->mCounts, r->mCounts + r->mCount, r->mCounts + r->mCount + 1);
+                r->mChildren[0] = l->mChildren[l->mCount - 1];
+                r->mCounts[0] = moved;
+                r->mCount++;
+                inner->mKeys[c] = std::move(l->mKeys[l->mCount - 1]);
+                l->mCount--;
+            }
+            inner->mCounts[c - 1] -= moved;
+            inner->mCounts[c] += moved;
+        }
+        else if (c + 1 < inner->mCount && inner->mChildren[c + 1]->mCount > MIN_COUNT)
+        {
+            //move the first item of the right sibling to the end of child
+            Node *right = inner->mChildren[c + 1];
+            int moved;
+            if (child->mIsLeaf)
+            {
+                Leaf *l = static_cast<Leaf *>(child), *r = static_cast<Leaf *>(right);
+                insertEntryAt(l, l->mCount, r->mEntries[0]);
+                std::move(r->mKeys + 1, r->mKeys + r->mCount, r->mKeys);
+                std::move(r->mEntries + 1, r->mEntries + r->mCount, r->mEntries);
+                r->mCount--;
+                moved = 1;
+                inner->mKeys[c + 1] = r->mKeys[0];
+            }
+            else
+            {
+                Inner *l = static_cast<Inner *>(child), *r = static_cast<Inner *>(right);
+                moved = r->mCounts[0];
+                l->mKeys[l->mCount] = std::move(inner->mKeys[c + 1]);
+                l->mChildren[l->mCount] = r->mChildren[0];
+                l->mCounts[l->mCount] = moved;
+                l->mCount++;
+                inner->mKeys[c + 1] = std::move(r->mKeys[1]);
+                std::move(r->mKeys + 2, r->mKeys + r->mCount, r->mKeys + 1);
+                std::move(r->mChildren + 1, r->mChildren + r->mCount, r->mChildren);
+                std::move(r->mCounts + 1, r->mCounts + r->mCount, r->mCounts);
+                r->mCount--;
+            }
+            inner->mCounts[c + 1] -= moved;
+            inner->mCounts[c] += moved;
+        }
+        else
+        {
+            mergeChild(inner, c > 0 ? c - 1 : c);
+        }
+    }
+
+    template <typename Key, typename Value>
+    void BPlusTree<Key, Value>::eraseAtIndex(int index)
+    {
+        PathItem path[BPLUSTREE_MAX_HEIGHT];
+        int depth = 0;
+        Node *nd = mRoot;
+        while (!nd->mIsLeaf)
+        {
+            Inner *inner = static_cast<Inner *>(nd);
+            int c = 0;
+            for (; index >= inner->mCounts[c]; c++)
+                index -= inner->mCounts[c];
+            inner->mCounts[c]--;
+            path[depth++] = PathItem{inner, c};
+            nd = inner->mChildren[c];
+        }
+        Leaf *leaf = static_cast<Leaf *>(nd);
+        Entry *entry = leaf->mEntries[index];
+        entry->mPrev->mNext = entry->mNext;
+        entry->mNext->mPrev = entry->mPrev;
+        mPool.destroy(entry);
+        std::move(leaf->mKeys + index + 1, leaf->mKeys + leaf->mCount, leaf->mKeys + index);
+        std::move(leaf->mEntries + index + 1, leaf->mEntries + leaf->mCount, leaf->mEntries + index);
+        leaf->mCount--;
+        mLength--;
+        //the underflow goes up until a node is still half full
+        for (int level = depth - 1; level >= 0; level--)
+        {
+            Inner *parent = path[level].mNode;
+            int c = path[level].mIndex;
+            if (parent->mChildren[c]->mCount >= MIN_COUNT)
+                break;
+            rebalanceChild(parent, c);
+        }
+        if (!mRoot->mIsLeaf && mRoot->mCount == 1)
+        {
+            Inner *root = static_cast<Inner *>(mRoot);
+            mRoot = root->mChildren[0];
+            freeNode(root);
+            mHeight--;
+        }
+    }
+
+    template <typename Key, typename Value>
+    bool BPlusTree<Key, Value>::erase(const Key &k)
+    {
+        Leaf *leaf;
+        int pos;
+        int index = locate(k, false, leaf, pos);
+        Entry *entry = entryAt(leaf, pos);
+        if (entry == mTail || !(entry->mKey == k))
+            return false;
+        eraseAtIndex(index);
+        return true;
+    }
+
+    template <typename Key, typename Value>
+    bool BPlusTree<Key, Value>::erase(const Key &k, const Value &v)
+    {
+        Leaf *leaf;
+        int pos;
+        int index = locate(k, false, leaf, pos);
+        Entry *entry = entryAt(leaf, pos);
+        //walk through the entries with the same key
+        while (entry != mTail && entry->mKey == k && !(entry->mValue == v))
+        {
+            entry = entry->mNext;
+            index++;
+        }
+        if (entry == mTail || !(entry->mKey == k))
+            return false;
+        eraseAtIndex(index);
+        return true;
+    }
+
+    template <typename Key, typename Value>
+    BPlusTreeEntry<Key, Value> *BPlusTree<Key, Value>::lower_bound(const Key &k)
+    {
+        Leaf *leaf;
+        int pos;
+        locate(k, false, leaf, pos);
+        Entry *entry = entryAt(leaf, pos);
+        return entry == mTail ? nullptr : entry;
+    }
+
+    template <typename Key, typename Value>
+    BPlusTreeEntry<Key, Value> *BPlusTree<Key, Value>::upper_bound(const Key &k)
+    {
+        Leaf *leaf;
+        int pos;
+        locate(k, true, leaf, pos);
+        Entry *entry = entryAt(leaf, pos);
+        return entry == mTail ? nullptr : entry;
+    }
+
+    template <typename Key, typename Value>
+    int BPlusTree<Key, Value>::getRank(const Key &k)
+    {
+        Leaf *leaf;
+        int pos;
+        int rank = locate(k, true, leaf, pos);
+        if (rank == 0)
+            return 0;
+        Entry *entry = entryAt(leaf, pos)->mPrev;
+        return entry->mKey == k ? rank : 0;
+    }
+
+}; // namespace RedisDataStructure
+
+#endif
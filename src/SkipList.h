@@ -5,7 +5,11 @@
 #include <limits>
 #include <iterator>
 #include <cstdlib>
+#include <cmath>
+#include <iostream>
 #include <algorithm>
+#include <stdexcept>
+#include <new>
 #include "redisIterator.h"
 
 namespace RedisDataStructure
@@ -54,6 +58,79 @@ namespace RedisDataStructure
         }
     };
 
+    /* allocate skiplist nodes from contiguous chunks instead of one heap block
+     * per node. destroyed nodes are kept in a free list and reused by the
+     * following allocation, the chunks are released with the pool.
+     */
+    template <typename Node>
+    class SkipListNodePool
+    {
+    public:
+        SkipListNodePool() : mFreeList(nullptr), mCursor(nullptr), mEnd(nullptr), mSlotNumber(0), mNextChunkSize(MIN_CHUNK_SIZE) {}
+        ~SkipListNodePool()
+        {
+            for (auto chunk : mChunks)
+                ::operator delete(chunk);
+        }
+        SkipListNodePool(const SkipListNodePool &) = delete;
+        SkipListNodePool &operator=(const SkipListNodePool &) = delete;
+
+        //make sure the next n allocations come from one chunk
+        void reserve(size_t n)
+        {
+            if (static_cast<size_t>(mEnd - mCursor) / SLOT_SIZE < n)
+                newChunk(n);
+        }
+
+        template <typename... Args>
+        Node *create(Args &&...args)
+        {
+            void *slot;
+            if (mFreeList)
+            {
+                slot = mFreeList;
+                mFreeList = *static_cast<void **>(mFreeList);
+            }
+            else
+            {
+                if (mCursor == mEnd)
+                {
+                    //grow with the pool size, small lists do not waste a big chunk
+                    newChunk(mNextChunkSize);
+                    mNextChunkSize = std::min(mSlotNumber, MAX_CHUNK_SIZE);
+                }
+                slot = mCursor;
+                mCursor += SLOT_SIZE;
+            }
+            return new (slot) Node(std::forward<Args>(args)...);
+        }
+
+        void destroy(Node *nd)
+        {
+            nd->~Node();
+            *reinterpret_cast<void **>(nd) = mFreeList;
+            mFreeList = nd;
+        }
+
+    private:
+        void newChunk(size_t n)
+        {
+            mCursor = static_cast<char *>(::operator new(n * SLOT_SIZE));
+            mEnd = mCursor + n * SLOT_SIZE;
+            mChunks.push_back(mCursor);
+            mSlotNumber += n;
+        }
+
+        static constexpr size_t SLOT_SIZE = sizeof(Node) > sizeof(void *) ? sizeof(Node) : sizeof(void *);
+        static constexpr size_t MIN_CHUNK_SIZE = 16;
+        static constexpr size_t MAX_CHUNK_SIZE = 4096;
+        std::vector<void *> mChunks;
+        void *mFreeList;
+        char *mCursor, *mEnd;
+        size_t mSlotNumber;
+        size_t mNextChunkSize;
+    };
+
     //SkipList do allow duplicate key
     template <typename Key, typename Value>
     class SkipList
@@ -75,7 +152,25 @@ namespace RedisDataStructure
         int getLength() { return mLength; }
         //basic operation: insert, erase, query.
         bool insert(const Key &k, const Value &v);
+        /* replace the content with the pairs(key, value) in [first, last), which
+         * must be sorted by key already. all levels and spans are linked in one
+         * pass, the node of rank r gets one more level every time r divides by 4,
+         * so the build is O(n) instead of O(nlogn) of repeated insert.
+         */
+        template <typename ForwardIt>
+        void assignSorted(ForwardIt first, ForwardIt last);
+        /* insert and lookup which start from the finger instead of mHead. the
+         * finger is the insert path of the last insert (the path to
+         * mTail->mBackword after assignSorted), it climbs only as high as the
+         * distance to k needs, so near sequential inserts cost O(log distance).
+         * if k is before the finger, they fall back to the search from mHead.
+         */
+        bool insertWithFinger(const Key &k, const Value &v);
+        SkipListNode<Key, Value> *lowerBoundWithFinger(const Key &k);
+        void clear();
         bool erase(const Key &k);
+        //erase the node which matches both key and value, used when keys are not unique.
+        bool erase(const Key &k, const Value &v);
         SkipListNode<Key, Value> *lower_bound(const Key &k);
         SkipListNode<Key, Value> *upper_bound(const Key &k);
         int getRank(const Key &k);
@@ -95,12 +190,32 @@ namespace RedisDataStructure
         int generateRandomLevel(void);
         //only check the start of the list, because tail is not valid.
         bool isInRange(const Key &k);
-        bool doubleEqual(double d1, double d2) { return fabs(d1 - d2) < ep; }
+        bool doubleEqual(double d1, double d2) { return fabs(d1 - d2) < EP; }
+        //find the last node whose key is less than k in each level, return the one in level 0.
+        SkipListNode<Key, Value> *findPrevs(const Key &k, std::vector<SkipListNode<Key, Value> *> &prevs);
+        //unlink nd from every level, prevs is the node just before nd in each level.
+        void eraseNode(SkipListNode<Key, Value> *nd, std::vector<SkipListNode<Key, Value> *> &prevs);
+        /* walk down from nd at level to level 0, fill the last node before k and
+         * its rank in each level. with inclusive the nodes whose key equals to k
+         * are passed, otherwise not. with useFinger the walk jumps to the finger
+         * of a level when the finger is ahead.
+         */
+        SkipListNode<Key, Value> *findPath(const Key &k, bool inclusive, int level, SkipListNode<Key, Value> *nd, int rank, bool useFinger,
+                                           std::vector<SkipListNode<Key, Value> *> &prevs, std::vector<int> &ranks);
+        //the highest level from which the finger search for k has to walk, -1 means the finger is the path of k
+        int climbFinger(const Key &k, bool inclusive);
+        /* link a new node after prevs, ranks is the rank of prevs in each level.
+         * prevs and ranks are left as the insert path of the new node.
+         */
+        void insertNode(const Key &k, const Value &v, std::vector<SkipListNode<Key, Value> *> &prevs, std::vector<int> &ranks);
 
     private:
         SkipListNode<Key, Value> *mHead, *mTail; //mhead and mtail is dummy node for code elegant
         int mMaxLevel;                           //mMaxLevel starts from 0
         int mLength;
+        SkipListNodePool<SkipListNode<Key, Value>> mPool; //data nodes are allocated from pool, head and tail are not
+        std::vector<SkipListNode<Key, Value> *> mFinger;   //insert path of the last insert, empty if invalid
+        std::vector<int> mFingerRanks;                    //rank of the finger node in each level
     };
 
     template <typename Key, typename Value>
@@ -119,14 +234,81 @@ namespace RedisDataStructure
     template <typename Key, typename Value>
     SkipList<Key, Value>::~SkipList() noexcept
     {
-        for (auto it = mHead; it != nullptr;)
+        clear();
+        delete mHead;
+        delete mTail;
+        mHead = nullptr;
+        mTail = nullptr;
+    }
+
+    template <typename Key, typename Value>
+    void SkipList<Key, Value>::clear()
+    {
+        for (auto it = mHead->mNexts[0]; it != mTail;)
         {
             auto next = it->mNexts[0];
-            delete it;
+            mPool.destroy(it);
             it = next;
         }
-        mHead = nullptr;
-        mTail = nullptr;
+        mHead->setLevelNum(1);
+        mHead->mNexts[0] = mTail;
+        mHead->mSpans[0] = 0;
+        mTail->mBackword = mHead;
+        mMaxLevel = 0;
+        mLength = 0;
+        mFinger.clear();
+        mFingerRanks.clear();
+    }
+
+    template <typename Key, typename Value>
+    template <typename ForwardIt>
+    void SkipList<Key, Value>::assignSorted(ForwardIt first, ForwardIt last)
+    {
+        //check the input first, so that the list is untouched if it is not sorted
+        if (!std::is_sorted(first, last, [](const auto &a, const auto &b) { return a.first < b.first; }))
+            throw std::invalid_argument("input of assignSorted is not sorted");
+        clear();
+        mPool.reserve(std::distance(first, last));
+        //the last node and its rank in each level, new node is linked after them
+        std::vector<SkipListNode<Key, Value> *> lasts(1, mHead);
+        std::vector<int> ranks(1, 0);
+        SkipListNode<Key, Value> *prev = mHead;
+        int rank = 0;
+        for (; first != last; ++first)
+        {
+            rank++;
+            int level = 0;
+            for (int r = rank; (r & 3) == 0 && level < ZSKIPLIST_MAXLEVEL - 1; r >>= 2)
+                level++;
+            auto nd = mPool.create(first->first, first->second, level + 1);
+            if (level >= (int)lasts.size())
+            {
+                mHead->setLevelNum(level + 1);
+                lasts.resize(level + 1, mHead);
+                ranks.resize(level + 1, 0);
+            }
+            for (int i = 0; i <= level; i++)
+            {
+                lasts[i]->mNexts[i] = nd;
+                lasts[i]->mSpans[i] = rank - ranks[i];
+                lasts[i] = nd;
+                ranks[i] = rank;
+            }
+            nd->mBackword = prev;
+            prev = nd;
+        }
+        //the span to the tail is the number of nodes after the last node
+        for (int i = 0; i < (int)lasts.size(); i++)
+        {
+            lasts[i]->mNexts[i] = mTail;
+            lasts[i]->mSpans[i] = rank - ranks[i];
+        }
+        mTail->mBackword = prev;
+        mMaxLevel = lasts.size() - 1;
+        mLength = rank;
+        //the path to the last node is the finger, appending goes on from there
+        mFinger.swap(lasts);
+        mFingerRanks.swap(ranks);
     }
 
     template <typename Key, typename Value>
@@ -139,39 +321,60 @@ namespace RedisDataStructure
     }
 
     template <typename Key, typename Value>
-    bool SkipList<Key, Value>::insert(const Key &k, const Value &v)
+    SkipListNode<Key, Value> *SkipList<Key, Value>::findPath(const Key &k, bool inclusive, int level, SkipListNode<Key, Value> *nd, int rank, bool useFinger,
+                                                             std::vector<SkipListNode<Key, Value> *> &prevs, std::vector<int> &ranks)
     {
-        int level = generateRandomLevel();
-        auto newNode = new SkipListNode<Key, Value>(k, v, level + 1);
-        SkipListNode<Key, Value> *nd = this->mHead;
-        int newMaxLevel = std::max(this->mMaxLevel, level);
-        std::vector<SkipListNode<Key, Value> *> prevs(newMaxLevel + 1, nullptr);
-        std::vector<int> ranks(newMaxLevel + 1, 0);
-        //find the node just before insert node in each level
-        int currLevel = this->mMaxLevel;
-        while (currLevel >= 0)
+        for (int currLevel = level; currLevel >= 0; currLevel--)
         {
-            //because of the mtail is specified, we need not to do next pointer null judge
-            if (nd->mNexts[currLevel] == mTail || nd->mNexts[currLevel]->mKey > k)
+            if (useFinger && mFingerRanks[currLevel] > rank)
             {
-                prevs[currLevel] = nd;
-                currLevel--;
-                if (currLevel >= 0)
-                    ranks[currLevel] = ranks[currLevel + 1];
+                nd = mFinger[currLevel];
+                rank = mFingerRanks[currLevel];
             }
-            else
+            //because of the mtail is specified, we need not to do next pointer null judge
+            for (auto next = nd->mNexts[currLevel]; next != mTail && (inclusive ? !(next->mKey > k) : next->mKey < k); next = nd->mNexts[currLevel])
             {
-                ranks[currLevel] += nd->mSpans[currLevel];
-                nd = nd->mNexts[currLevel];
+                rank += nd->mSpans[currLevel];
+                nd = next;
             }
+            prevs[currLevel] = nd;
+            ranks[currLevel] = rank;
         }
+        return nd;
+    }
+
+    template <typename Key, typename Value>
+    int SkipList<Key, Value>::climbFinger(const Key &k, bool inclusive)
+    {
+        /* if the finger of level i+1 has to walk, so does the finger of level i,
+         * because the finger is the last node before the previous key in each level.
+         * so climb up until the next node of the finger is after k.
+         */
+        int level = -1;
+        while (level < this->mMaxLevel)
+        {
+            auto next = mFinger[level + 1]->mNexts[level + 1];
+            if (next == mTail || (inclusive ? next->mKey > k : !(next->mKey < k)))
+                break;
+            level++;
+        }
+        return level;
+    }
+
+    template <typename Key, typename Value>
+    void SkipList<Key, Value>::insertNode(const Key &k, const Value &v, std::vector<SkipListNode<Key, Value> *> &prevs, std::vector<int> &ranks)
+    {
+        int level = generateRandomLevel();
+        auto newNode = mPool.create(k, v, level + 1);
+        int newMaxLevel = std::max(this->mMaxLevel, level);
         //add pre node for the level who is higher than curr max level.
         if (level > this->mMaxLevel)
         {
             mHead->setLevelNum(level + 1);
+            prevs.resize(level + 1, mHead);
+            ranks.resize(level + 1, 0);
             for (int i = level; i > this->mMaxLevel; i--)
             {
-                prevs[i] = mHead;
                 mHead->mNexts[i] = mTail;
                 mHead->mSpans[i] = this->mLength;
             }
@@ -199,15 +402,71 @@ namespace RedisDataStructure
         this->mMaxLevel = newMaxLevel;
         //update list node len
         this->mLength += 1;
-        return true;
+        //the new node replaces the prevs in its levels
+        int newRank = ranks[0] + 1;
+        for (int i = 0; i <= level; i++)
+        {
+            prevs[i] = newNode;
+            ranks[i] = newRank;
+        }
     }
 
     template <typename Key, typename Value>
-    bool SkipList<Key, Value>::erase(const Key &k)
+    bool SkipList<Key, Value>::insert(const Key &k, const Value &v)
     {
-        SkipListNode<Key, Value> *nd = this->mHead;
         std::vector<SkipListNode<Key, Value> *> prevs(this->mMaxLevel + 1, nullptr);
+        std::vector<int> ranks(this->mMaxLevel + 1, 0);
         //find the node just before insert node in each level
+        findPath(k, true, this->mMaxLevel, mHead, 0, false, prevs, ranks);
+        insertNode(k, v, prevs, ranks);
+        //the insert path becomes the finger
+        mFinger.swap(prevs);
+        mFingerRanks.swap(ranks);
+        return true;
+    }
+
+    template <typename Key, typename Value>
+    bool SkipList<Key, Value>::insertWithFinger(const Key &k, const Value &v)
+    {
+        //the finger is after k, search from mHead
+        if (mFinger.empty() || (mFinger[0] != mHead && mFinger[0]->mKey > k))
+            return insert(k, v);
+        /* the finger is updated in place. findPath reads the finger of a level
+         * before it writes the path of that level, and the levels above the
+         * walk keep their finger, which is already the path of k.
+         */
+        int level = climbFinger(k, true);
+        if (level >= 0)
+            findPath(k, true, level, mFinger[level], mFingerRanks[level], true, mFinger, mFingerRanks);
+        insertNode(k, v, mFinger, mFingerRanks);
+        return true;
+    }
+
+    template <typename Key, typename Value>
+    SkipListNode<Key, Value> *SkipList<Key, Value>::lowerBoundWithFinger(const Key &k)
+    {
+        std::vector<SkipListNode<Key, Value> *> prevs(this->mMaxLevel + 1, nullptr);
+        std::vector<int> ranks(this->mMaxLevel + 1, 0);
+        SkipListNode<Key, Value> *nd;
+        if (mFinger.empty() || (mFinger[0] != mHead && !(mFinger[0]->mKey < k)))
+        {
+            nd = findPath(k, false, this->mMaxLevel, mHead, 0, false, prevs, ranks);
+        }
+        else
+        {
+            int level = climbFinger(k, false);
+            nd = level >= 0 ? findPath(k, false, level, mFinger[level], mFingerRanks[level], true, prevs, ranks) : mFinger[0];
+        }
+        nd = nd->mNexts[0];
+        return nd == mTail ? nullptr : nd;
+    }
+
+    template <typename Key, typename Value>
+    SkipListNode<Key, Value> *SkipList<Key, Value>::findPrevs(const Key &k, std::vector<SkipListNode<Key, Value> *> &prevs)
+    {
+        SkipListNode<Key, Value> *nd = this->mHead;
+        prevs.assign(this->mMaxLevel + 1, nullptr);
+        //find the node just before the first node whose key is k in each level
         int currLevel = this->mMaxLevel;
         while (currLevel >= 0)
         {
@@ -222,10 +481,12 @@ namespace RedisDataStructure
                 nd = nd->mNexts[currLevel];
             }
         }
-        //if node not exist return
-        nd = nd->mNexts[0];
-        if (nd == mTail || nd->mKey != k)
-            return false;
+        return nd;
+    }
+
+    template <typename Key, typename Value>
+    void SkipList<Key, Value>::eraseNode(SkipListNode<Key, Value> *nd, std::vector<SkipListNode<Key, Value> *> &prevs)
+    {
         //update pointer and span for each pre, insert node.
         for (int i = 0; i <= this->mMaxLevel; i++)
         {
@@ -246,6 +507,40 @@ namespace RedisDataStructure
             this->mMaxLevel--;
         //update list len
         this->mLength--;
+        mPool.destroy(nd);
+        //nd may be a part of the finger
+        mFinger.clear();
+        mFingerRanks.clear();
+    }
+
+    template <typename Key, typename Value>
+    bool SkipList<Key, Value>::erase(const Key &k)
+    {
+        std::vector<SkipListNode<Key, Value> *> prevs;
+        SkipListNode<Key, Value> *nd = findPrevs(k, prevs);
+        //if node not exist return
+        nd = nd->mNexts[0];
+        if (nd == mTail || nd->mKey != k)
+            return false;
+        eraseNode(nd, prevs);
+        return true;
+    }
+
+    template <typename Key, typename Value>
+    bool SkipList<Key, Value>::erase(const Key &k, const Value &v)
+    {
+        std::vector<SkipListNode<Key, Value> *> prevs;
+        SkipListNode<Key, Value> *nd = findPrevs(k, prevs)->mNexts[0];
+        //walk through the nodes with the same key, the passed nodes become the new prevs.
+        while (nd != mTail && nd->mKey == k && !(nd->mValue == v))
+        {
+            for (int i = 0; i < (int)nd->mNexts.size(); i++)
+                prevs[i] = nd;
+            nd = nd->mNexts[0];
+        }
+        if (nd == mTail || nd->mKey != k)
+            return false;
+        eraseNode(nd, prevs);
         return true;
     }
 
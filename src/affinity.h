@@ -0,0 +1,337 @@
+#ifndef AFFINITY_H
+#define AFFINITY_H
+
+#include <algorithm>
+#include <atomic>
+#include <cctype>
+#include <cstdint>
+#include <fstream>
+#include <memory>
+#include <mutex>
+#include <sstream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+#ifdef __linux__
+#include <pthread.h>
+#include <sched.h>
+#endif
+
+namespace Redis
+{
+	//"0-3,8,10-11" to {0, 1, 2, 3, 8, 10, 11}
+	inline std::vector<int> parseCpuList(const std::string &text)
+	{
+		std::vector<int> cpus;
+		std::istringstream in(text);
+		for (std::string part; std::getline(in, part, ',');)
+		{
+			part.erase(std::remove_if(part.begin(), part.end(), [](unsigned char c) { return std::isspace(c); }), part.end());
+			if (part.empty())
+				continue;
+			size_t dash = part.find('-');
+			try
+			{
+				size_t used = 0;
+				int first = std::stoi(part.substr(0, dash), &used);
+				if (used != (dash == std::string::npos ? part.size() : dash))
+					throw std::invalid_argument(part);
+				int last = first;
+				if (dash != std::string::npos)
+				{
+					last = std::stoi(part.substr(dash + 1), &used);
+					if (used != part.size() - dash - 1)
+						throw std::invalid_argument(part);
+				}
+				if (first < 0 || last < first)
+					throw std::invalid_argument(part);
+				for (int cpu = first; cpu <= last; cpu++)
+					cpus.push_back(cpu);
+			}
+			catch (const std::logic_error &)
+			{
+				throw std::invalid_argument("bad cpu list: " + text);
+			}
+		}
+		std::sort(cpus.begin(), cpus.end());
+		cpus.erase(std::unique(cpus.begin(), cpus.end()), cpus.end());
+		return cpus;
+	}
+
+	/* the cpus of each NUMA node, read from sysfs. without it, e.g. not on
+	 * linux, all the cpus are in node 0.
+	 */
+	class CpuTopology
+	{
+	public:
+		CpuTopology()
+		{
+			for (int node = 0;; node++)
+			{
+				std::ifstream in("/sys/devices/system/node/node" + std::to_string(node) + "/cpulist");
+				std::string line;
+				if (!in || !std::getline(in, line))
+					break;
+				mNodes.push_back(parseCpuList(line));
+			}
+			if (mNodes.empty())
+			{
+				mNodes.emplace_back();
+				for (int cpu = 0; cpu < static_cast<int>(std::max(1u, std::thread::hardware_concurrency())); cpu++)
+					mNodes[0].push_back(cpu);
+			}
+			for (size_t node = 0; node < mNodes.size(); node++)
+			{
+				for (int cpu : mNodes[node])
+				{
+					if (cpu >= static_cast<int>(mNodeOfCpu.size()))
+						mNodeOfCpu.resize(cpu + 1, -1);
+					mNodeOfCpu[cpu] = static_cast<int>(node);
+				}
+			}
+		}
+
+		static const CpuTopology &get()
+		{
+			static CpuTopology topology;
+			return topology;
+		}
+
+		size_t getNodeNumber() const { return mNodes.size(); }
+		const std::vector<int> &getCpus(size_t node) const { return mNodes[node]; }
+		//-1 if unknown
+		int nodeOf(int cpu) const { return cpu >= 0 && cpu < static_cast<int>(mNodeOfCpu.size()) ? mNodeOfCpu[cpu] : -1; }
+
+		//the cpus node by node, consecutive threads placed in this order share a node
+		std::vector<int> getCompactOrder() const
+		{
+			std::vector<int> cpus;
+			for (auto &node : mNodes)
+				cpus.insert(cpus.end(), node.begin(), node.end());
+			return cpus;
+		}
+
+	private:
+		std::vector<std::vector<int>> mNodes;
+		std::vector<int> mNodeOfCpu;
+	};
+
+	//restrict the calling thread to cpus, return false if it is not supported or refused
+	inline bool pinCurrentThread(const std::vector<int> &cpus)
+	{
+#ifdef __linux__
+		if (cpus.empty())
+			return false;
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		for (int cpu : cpus)
+		{
+			if (cpu < 0 || cpu >= CPU_SETSIZE)
+				return false;
+			CPU_SET(cpu, &set);
+		}
+		return pthread_setaffinity_np(pthread_self(), sizeof(set), &set) == 0;
+#else
+		return false;
+#endif
+	}
+
+	//the cpus the calling thread may run on, empty if unknown
+	inline std::vector<int> getCurrentAffinity()
+	{
+		std::vector<int> cpus;
+#ifdef __linux__
+		cpu_set_t set;
+		CPU_ZERO(&set);
+		if (pthread_getaffinity_np(pthread_self(), sizeof(set), &set) == 0)
+		{
+			for (int cpu = 0; cpu < CPU_SETSIZE; cpu++)
+			{
+				if (CPU_ISSET(cpu, &set))
+					cpus.push_back(cpu);
+			}
+		}
+#endif
+		return cpus;
+	}
+
+	//-1 if unknown
+	inline int getCurrentCpu()
+	{
+#ifdef __linux__
+		return sched_getcpu();
+#else
+		return -1;
+#endif
+	}
+
+	/* which cpus a group of threads is pinned to. "compact" gives thread i
+	 * the i-th cpu in node order, a cpu list gives thread i the i-th cpu of
+	 * the list round robin, "none" or empty leaves the threads to the
+	 * scheduler. with shared, every thread gets the whole list instead.
+	 */
+	class CpuPlacement
+	{
+	public:
+		CpuPlacement() = default;
+		explicit CpuPlacement(const std::string &spec, bool shared = false) : mShared(shared)
+		{
+			if (spec.empty() || spec == "none")
+				return;
+			mCpus = spec == "compact" ? CpuTopology::get().getCompactOrder() : parseCpuList(spec);
+			if (mCpus.empty())
+				throw std::invalid_argument("bad cpu placement: " + spec);
+		}
+
+		bool isEnabled() const { return !mCpus.empty(); }
+
+		//empty when disabled
+		std::vector<int> cpusOf(size_t thread) const
+		{
+			if (mCpus.empty() || mShared)
+				return mCpus;
+			return {mCpus[thread % mCpus.size()]};
+		}
+
+	private:
+		std::vector<int> mCpus;
+		bool mShared = false;
+	};
+
+	/* the placement in effect for the threads of the server. a thread calls
+	 * place once when it starts, which pins it and records where it landed,
+	 * and sample from time to time to count the moves to another cpu and to
+	 * another NUMA node. the memory a thread allocates after place is first
+	 * touched on its node, so per thread buffers and shard data should be
+	 * created from there.
+	 */
+	class PlacementMonitor
+	{
+	public:
+		//pin the calling thread to cpus, empty to leave it unpinned
+		void place(const std::string &name, const std::vector<int> &cpus)
+		{
+			std::unique_ptr<Entry> entry(new Entry());
+			entry->mName = name;
+			entry->mRequested = cpus;
+			entry->mPinned = !cpus.empty() && pinCurrentThread(cpus);
+			entry->mAffinity = getCurrentAffinity();
+			int cpu = getCurrentCpu();
+			entry->mLastCpu = cpu;
+			entry->mLastNode = CpuTopology::get().nodeOf(cpu);
+			std::lock_guard<std::mutex> lock(mMutex);
+			currentEntry() = EntryRef{mId, entry.get()};
+			mEntries.push_back(std::move(entry));
+		}
+
+		//record where the calling thread runs now, a thread which did not place itself is ignored
+		void sample()
+		{
+			EntryRef &ref = currentEntry();
+			if (ref.mMonitorId != mId)
+				return;
+			Entry &entry = *ref.mEntry;
+			int cpu = getCurrentCpu();
+			if (cpu == entry.mLastCpu.load(std::memory_order_relaxed))
+				return;
+			entry.mCpuMigrations.fetch_add(1, std::memory_order_relaxed);
+			int node = CpuTopology::get().nodeOf(cpu);
+			if (node != entry.mLastNode.load(std::memory_order_relaxed))
+				entry.mNodeMigrations.fetch_add(1, std::memory_order_relaxed);
+			entry.mLastCpu.store(cpu, std::memory_order_relaxed);
+			entry.mLastNode.store(node, std::memory_order_relaxed);
+		}
+
+		//the moves to another node seen by sample, of all threads
+		uint64_t getNodeMigrations() const
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			uint64_t total = 0;
+			for (auto &entry : mEntries)
+				total += entry->mNodeMigrations.load(std::memory_order_relaxed);
+			return total;
+		}
+
+		//a line per thread: what was asked, the affinity in effect, where it runs and how often it moved
+		std::string report() const
+		{
+			const CpuTopology &topology = CpuTopology::get();
+			std::ostringstream out;
+			std::lock_guard<std::mutex> lock(mMutex);
+			out << topology.getNodeNumber() << " NUMA nodes" << std::endl;
+			for (auto &entry : mEntries)
+			{
+				out << entry->mName << ": ";
+				if (entry->mRequested.empty())
+					out << "unpinned";
+				else
+					out << (entry->mPinned ? "pinned to " : "pinning refused for ") << formatCpus(entry->mRequested);
+				out << ", allowed " << formatCpus(entry->mAffinity);
+				int cpu = entry->mLastCpu.load(std::memory_order_relaxed);
+				out << ", on cpu " << cpu << " node " << topology.nodeOf(cpu);
+				out << ", " << entry->mCpuMigrations.load(std::memory_order_relaxed) << " cpu moves, "
+					<< entry->mNodeMigrations.load(std::memory_order_relaxed) << " node moves" << std::endl;
+			}
+			return out.str();
+		}
+
+	private:
+		struct Entry
+		{
+			std::string mName;
+			std::vector<int> mRequested;
+			std::vector<int> mAffinity;
+			bool mPinned = false;
+			std::atomic<int> mLastCpu{-1};
+			std::atomic<int> mLastNode{-1};
+			std::atomic<uint64_t> mCpuMigrations{0};
+			std::atomic<uint64_t> mNodeMigrations{0};
+		};
+
+		//by id, a monitor created later at the same address must not see the entry
+		struct EntryRef
+		{
+			uint64_t mMonitorId;
+			Entry *mEntry;
+		};
+
+		static EntryRef &currentEntry()
+		{
+			static thread_local EntryRef ref{0, nullptr};
+			return ref;
+		}
+
+		static uint64_t nextId()
+		{
+			static std::atomic<uint64_t> id{0};
+			return ++id;
+		}
+
+		static std::string formatCpus(const std::vector<int> &cpus)
+		{
+			if (cpus.empty())
+				return "?";
+			std::string text;
+			for (size_t i = 0; i < cpus.size();)
+			{
+				size_t j = i;
+				while (j + 1 < cpus.size() && cpus[j + 1] == cpus[j] + 1)
+					j++;
+				if (!text.empty())
+					text += ",";
+				text += std::to_string(cpus[i]);
+				if (j > i)
+					text += "-" + std::to_string(cpus[j]);
+				i = j + 1;
+			}
+			return text;
+		}
+
+		const uint64_t mId = nextId();
+		mutable std::mutex mMutex;
+		std::vector<std::unique_ptr<Entry>> mEntries;
+	};
+} // namespace Redis
+
+#endif
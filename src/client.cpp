@@ -1,153 +1,148 @@
-//
-// Copyright (c) 2016-2019 Vinnie Falco (vinnie dot falco at gmail dot com)
-//
-// Distributed under the Boost Software License, Version 1.0. (See accompanying
-// file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
-//
-// Official repository: https://github.com/boostorg/beast
-//
-
-//------------------------------------------------------------------------------
-//
-// Example: WebSocket client, coroutine
-//
-//------------------------------------------------------------------------------
-
-#include <boost/beast/core.hpp>
-#include <boost/beast/websocket.hpp>
-#include <boost/asio/spawn.hpp>
-#include <cstdlib>
-#include <functional>
+#include <atomic>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <random>
 #include <string>
+#include <thread>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include "respClient.h"
 
-namespace beast = boost::beast;         // from <boost/beast.hpp>
-namespace http = beast::http;           // from <boost/beast/http.hpp>
-namespace websocket = beast::websocket; // from <boost/beast/websocket.hpp>
-namespace net = boost::asio;            // from <boost/asio.hpp>
-using tcp = boost::asio::ip::tcp;       // from <boost/asio/ip/tcp.hpp>
-
-//------------------------------------------------------------------------------
-
-// Report a failure
-void
-fail(beast::error_code ec, char const* what)
+namespace
 {
-    std::cerr << what << ": " << ec.message() << "\n";
-}
-
-// Sends a WebSocket message and prints the response
-void
-do_session(
-    std::string host,
-    std::string const& port,
-    std::string const& text,
-    net::io_context& ioc,
-    net::yield_context yield)
+	//the progress of a run, shared by the threads
+	struct Load
+	{
+		uint64_t mRequests = 0;
+		std::atomic<uint64_t> mSent{0};
+		std::atomic<uint64_t> mDone{0};
+		std::atomic<uint64_t> mErrors{0};
+		std::atomic<uint64_t> mLatencyNs{0};
+	};
+
+	//a SET or GET of a random key, half each
+	std::vector<std::string> nextCommand(std::minstd_rand &random)
+	{
+		std::string key = "key:" + std::to_string(random() % 100000);
+		if (random() % 2 == 0)
+			return {"SET", key, "value"};
+		return {"GET", key};
+	}
+
+	void finish(Load &load, Redis::RespClient &client, std::chrono::steady_clock::time_point start, bool error)
+	{
+		load.mLatencyNs += std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+		if (error)
+			load.mErrors++;
+		if (++load.mDone == load.mRequests)
+			client.close();
+	}
+
+	/* one command in flight on a connection, the next one is sent from the
+	 * callback of its reply.
+	 */
+	void sendNext(Load &load, Redis::RespConnection &connection, Redis::RespClient &client, std::shared_ptr<std::minstd_rand> random)
+	{
+		if (load.mSent++ >= load.mRequests)
+			return;
+		auto start = std::chrono::steady_clock::now();
+		connection.execute(nextCommand(*random), [&load, &connection, &client, random, start](const boost::system::error_code &ec, const Redis::RespValue &value) {
+			finish(load, client, start, ec || value.isError());
+			sendNext(load, connection, client, random);
+		});
+	}
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+	//the same with a coroutine awaiting every reply
+	boost::asio::awaitable<void> runCoroutine(Load &load, Redis::RespConnection &connection, Redis::RespClient &client, unsigned seed)
+	{
+		std::minstd_rand random(seed);
+		while (load.mSent++ < load.mRequests)
+		{
+			auto start = std::chrono::steady_clock::now();
+			std::vector<std::string> command = nextCommand(random);
+			try
+			{
+				Redis::RespResult result = co_await connection.asyncExecute(command, boost::asio::use_awaitable);
+				finish(load, client, start, result.getValue().isError());
+			}
+			catch (const boost::system::system_error &)
+			{
+				finish(load, client, start, true);
+			}
+		}
+	}
+#endif
+} // namespace
+
+/* a load generator for the RESP port, SET and GET of random keys:
+ * RedisDBClient [host] [port] [connections] [in flight per connection]
+ *     [requests] [threads] [callback|coroutine]
+ * the connections are spread over the threads, every thread runs an
+ * io_service.
+ */
+int main(int argc, char *argv[])
 {
-    beast::error_code ec;
-
-    // These objects perform our I/O
-    tcp::resolver resolver(ioc);
-    websocket::stream<beast::tcp_stream> ws(ioc);
-
-    // Look up the domain name
-    auto const results = resolver.async_resolve(host, port, yield[ec]);
-    if(ec)
-        return fail(ec, "resolve");
-
-    // Set a timeout on the operation
-    beast::get_lowest_layer(ws).expires_after(std::chrono::seconds(30));
-
-    // Make the connection on the IP address we get from a lookup
-    auto ep = beast::get_lowest_layer(ws).async_connect(results, yield[ec]);
-    if(ec)
-        return fail(ec, "connect");
-
-    // Update the host_ string. This will provide the value of the
-    // Host HTTP header during the WebSocket handshake.
-    // See https://tools.ietf.org/html/rfc7230#section-5.4
-    host += ':' + std::to_string(ep.port());
-
-    // Turn off the timeout on the tcp_stream, because
-    // the websocket stream has its own timeout system.
-    beast::get_lowest_layer(ws).expires_never();
-
-    // Set suggested timeout settings for the websocket
-    ws.set_option(
-        websocket::stream_base::timeout::suggested(
-            beast::role_type::client));
-
-    // Set a decorator to change the User-Agent of the handshake
-    ws.set_option(websocket::stream_base::decorator(
-        [](websocket::request_type& req)
-        {
-            req.set(http::field::user_agent,
-                std::string(BOOST_BEAST_VERSION_STRING) +
-                    " websocket-client-coro");
-        }));
-
-    // Perform the websocket handshake
-    ws.async_handshake(host, "/", yield[ec]);
-    if(ec)
-        return fail(ec, "handshake");
-
-    // Send the message
-    ws.async_write(net::buffer(std::string(text)), yield[ec]);
-    if(ec)
-        return fail(ec, "write");
-
-    // This buffer will hold the incoming message
-    beast::flat_buffer buffer;
-
-    // Read a message into our buffer
-    ws.async_read(buffer, yield[ec]);
-    if(ec)
-        return fail(ec, "read");
-
-    // Close the WebSocket connection
-    ws.async_close(websocket::close_code::normal, yield[ec]);
-    if(ec)
-        return fail(ec, "close");
-
-    // If we get here then the connection is closed gracefully
-
-    // The make_printable() function helps print a ConstBufferSequence
-    std::cout << beast::make_printable(buffer.data()) << std::endl;
+	std::string host = argc > 1 ? argv[1] : "127.0.0.1";
+	std::string port = argc > 2 ? argv[2] : "6379";
+	size_t connections = argc > 3 ? std::stoul(argv[3]) : 4;
+	size_t depth = argc > 4 ? std::stoul(argv[4]) : 32;
+	Load load;
+	load.mRequests = argc > 5 ? std::stoull(argv[5]) : 1000000;
+	size_t threadNumber = argc > 6 ? std::stoul(argv[6]) : 1;
+	std::string api = argc > 7 ? argv[7] : "callback";
+#if !defined(BOOST_ASIO_HAS_CO_AWAIT)
+	if (api == "coroutine")
+	{
+		std::cerr << "coroutines need a C++20 build" << std::endl;
+		return 1;
+	}
+#endif
+	if (threadNumber == 0)
+		threadNumber = 1;
+
+	std::vector<std::unique_ptr<boost::asio::io_service>> ioServices;
+	std::vector<boost::asio::io_service *> pointers;
+	for (size_t i = 0; i < threadNumber; i++)
+	{
+		ioServices.emplace_back(new boost::asio::io_service(1));
+		pointers.push_back(ioServices.back().get());
+	}
+	Redis::RespClient client(pointers, host, port, connections);
+
+	//every connection starts its commands on its own io_service
+	auto start = std::chrono::steady_clock::now();
+	for (size_t i = 0; i < client.getConnectionNumber(); i++)
+	{
+		Redis::RespConnection &connection = client.getConnection(i);
+		boost::asio::post(connection.getIoService(), [&, i]() {
+			for (size_t j = 0; j < depth; j++)
+			{
+				unsigned seed = static_cast<unsigned>(i * depth + j + 1);
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+				if (api == "coroutine")
+				{
+					boost::asio::co_spawn(connection.getIoService(), runCoroutine(load, connection, client, seed), boost::asio::detached);
+					continue;
+				}
+#endif
+				sendNext(load, connection, client, std::make_shared<std::minstd_rand>(seed));
+			}
+		});
+	}
+	std::vector<std::thread> threads;
+	for (auto &ioService : ioServices)
+		threads.emplace_back([&ioService]() { ioService->run(); });
+	for (auto &thread : threads)
+		thread.join();
+
+	auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	uint64_t done = load.mDone;
+	std::cout << done << " requests, " << load.mErrors << " errors, " << cost << " ms, "
+			  << (cost ? done * 1000 / cost : 0) << " requests/s, "
+			  << (done ? load.mLatencyNs / done / 1000 : 0) << " us average latency" << std::endl;
+	return load.mErrors == 0 ? 0 : 1;
 }
-
-//------------------------------------------------------------------------------
-
-int main(int argc, char** argv)
-{
-    // Check command line arguments.
-    if(argc != 4)
-    {
-        std::cerr <<
-            "Usage: websocket-client-coro <host> <port> <text>\n" <<
-            "Example:\n" <<
-            "    websocket-client-coro echo.websocket.org 80 \"Hello, world!\"\n";
-        return EXIT_FAILURE;
-    }
-    auto const host = argv[1];
-    auto const port = argv[2];
-    auto const text = argv[3];
-
-    // The io_context is required for all I/O
-    net::io_context ioc;
-
-    // Launch the asynchronous operation
-    boost::asio::spawn(ioc, std::bind(
-        &do_session,
-        std::string(host),
-        std::string(port),
-        std::string(text),
-        std::ref(ioc),
-        std::placeholders::_1));
-
-    // Run the I/O service. The call will return when
-    // the socket is closed.
-    ioc.run();
-
-    return EXIT_SUCCESS;
-}
\ No newline at end of file
@@ -0,0 +1,358 @@
+#ifndef CONCURRENT_SKIPLIST_H
+#define CONCURRENT_SKIPLIST_H
+
+#include <atomic>
+#include <cstdint>
+#include <new>
+#include <thread>
+#include <unordered_set>
+#include "SkipList.h"
+#include "epoch.h"
+#include "redisIterator.h"
+
+namespace RedisDataStructure
+{
+    /* node of ConcurrentSkipList. the lowest bit of a next pointer is the
+     * deletion mark of the node in that level. the next pointers are allocated
+     * in the same block just after the node.
+     */
+    template <typename Key, typename Value>
+    struct ConcurrentSkipListNode
+    {
+        Key mKey;
+        Value mValue;
+        int mLevel;
+        //links to this node plus the hold of the inserting thread, node is retired when it drops to 0
+        std::atomic<int> mRefs;
+        std::atomic<uintptr_t> *mNexts;
+
+        static ConcurrentSkipListNode *create(const Key &k, const Value &v, int level)
+        {
+            void *mem = ::operator new(sizeof(ConcurrentSkipListNode) + level * sizeof(std::atomic<uintptr_t>));
+            return new (mem) ConcurrentSkipListNode(k, v, level);
+        }
+
+        static void destroy(ConcurrentSkipListNode *nd)
+        {
+            nd->~ConcurrentSkipListNode();
+            ::operator delete(nd);
+        }
+
+        static ConcurrentSkipListNode *getPtr(uintptr_t p) { return reinterpret_cast<ConcurrentSkipListNode *>(p & ~uintptr_t(1)); }
+        static bool isMarked(uintptr_t p) { return p & 1; }
+
+        bool isDeleted() const { return isMarked(mNexts[0].load(std::memory_order_acquire)); }
+
+        //next node which is not deleted in level 0, iterators only move forward
+        ConcurrentSkipListNode *next()
+        {
+            auto nd = getPtr(mNexts[0].load(std::memory_order_acquire));
+            while (nd && nd->isDeleted())
+                nd = getPtr(nd->mNexts[0].load(std::memory_order_acquire));
+            return nd;
+        }
+
+    private:
+        ConcurrentSkipListNode(const Key &k, const Value &v, int level) : mKey(k), mValue(v), mLevel(level), mRefs(0)
+        {
+            mNexts = reinterpret_cast<std::atomic<uintptr_t> *>(reinterpret_cast<char *>(this) + sizeof(ConcurrentSkipListNode));
+            for (int i = 0; i < level; i++)
+                new (&mNexts[i]) std::atomic<uintptr_t>(0);
+        }
+    };
+
+    /* lock-free skiplist with unique keys, based on the algorithm of Fraser and
+     * Herlihy/Shavit: search never blocks, insert links the node level by level
+     * with CAS, erase marks the next pointers of the node from top to bottom,
+     * the thread who marks level 0 owns the deletion. marked nodes are unlinked
+     * by the writers (insert, erase) passing them in find, the readers
+     * (contains, lower_bound, upper_bound) only skip them and never write.
+     *
+     * unlinked nodes are retired to an EpochDomain, the default one unless
+     * the list is given its own. every operation pins the domain, a retired
+     * node is freed once all operations that may still see it have finished.
+     * the nodes returned by lower_bound/upper_bound and the iterators are only
+     * valid while a Guard from pin() is alive.
+     *
+     * getLength is maintained with an atomic counter, getRank walks the list
+     * and is exact only when there is no concurrent writer.
+     */
+    template <typename Key, typename Value>
+    class ConcurrentSkipList
+    {
+    public:
+        using Node = ConcurrentSkipListNode<Key, Value>;
+        using iterator = RedisBidirectionalIterator<Node>;
+
+        using Guard = EpochDomain::Guard;
+
+        explicit ConcurrentSkipList(EpochDomain &domain = EpochDomain::getDefault());
+        ~ConcurrentSkipList() noexcept;
+        ConcurrentSkipList(const ConcurrentSkipList &) = delete;
+        ConcurrentSkipList &operator=(const ConcurrentSkipList &) = delete;
+
+        //readers hold the guard while using the nodes and iterators
+        Guard pin() { return mDomain.pin(); }
+
+        int getLength() const { return mLength.load(std::memory_order_relaxed); }
+        //return false if the key exists already
+        bool insert(const Key &k, const Value &v);
+        bool erase(const Key &k);
+        bool contains(const Key &k);
+        //first node whose key is not less than k, nullptr if not found
+        Node *lower_bound(const Key &k);
+        //first node whose key is greater than k, nullptr if not found
+        Node *upper_bound(const Key &k);
+        int getRank(const Key &k);
+        iterator begin() { return iterator(mHead->next()); }
+        iterator end() { return iterator(nullptr); }
+
+    private:
+        void release(Node *nd)
+        {
+            if (nd->mRefs.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                mDomain.retire(nd, [](void *p) { Node::destroy(static_cast<Node *>(p)); });
+        }
+        int generateRandomLevel();
+        void raiseMaxLevel(int level);
+        //fill the last node before k and the first node not less than k in each level, unlink the marked nodes on the way.
+        bool find(const Key &k, Node **preds, Node **succs);
+        //first node which is not deleted and (inclusive ? key > k : key >= k)
+        Node *search(const Key &k, bool inclusive);
+
+    private:
+        Node *mHead;
+        std::atomic<int> mMaxLevel; //highest level in use, starts from 0
+        std::atomic<int> mLength;
+        EpochDomain &mDomain;
+    };
+
+    template <typename Key, typename Value>
+    ConcurrentSkipList<Key, Value>::ConcurrentSkipList(EpochDomain &domain) : mMaxLevel(0), mLength(0), mDomain(domain)
+    {
+        mHead = Node::create(Key(), Value(), ZSKIPLIST_MAXLEVEL);
+    }
+
+    template <typename Key, typename Value>
+    ConcurrentSkipList<Key, Value>::~ConcurrentSkipList() noexcept
+    {
+        //a node unlinked from level 0 may still be linked in a higher level, so collect from all levels.
+        //the retired nodes belong to the domain and are freed by it.
+        std::unordered_set<Node *> nodes;
+        for (int i = 0; i < ZSKIPLIST_MAXLEVEL; i++)
+        {
+            for (auto nd = Node::getPtr(mHead->mNexts[i].load()); nd; nd = Node::getPtr(nd->mNexts[i].load()))
+                nodes.insert(nd);
+        }
+        for (auto nd : nodes)
+            Node::destroy(nd);
+        Node::destroy(mHead);
+    }
+
+    template <typename Key, typename Value>
+    int ConcurrentSkipList<Key, Value>::generateRandomLevel()
+    {
+        //std::rand is not thread safe, use a xorshift generator for each thread
+        thread_local uint32_t seed = static_cast<uint32_t>(std::hash<std::thread::id>()(std::this_thread::get_id())) | 1;
+        int level = 1;
+        while (level < ZSKIPLIST_MAXLEVEL)
+        {
+            seed ^= seed << 13;
+            seed ^= seed >> 17;
+            seed ^= seed << 5;
+            if ((seed & 0xFFFF) >= ZSKIPLIST_P * 0xFFFF)
+                break;
+            level++;
+        }
+        return level;
+    }
+
+    template <typename Key, typename Value>
+    void ConcurrentSkipList<Key, Value>::raiseMaxLevel(int level)
+    {
+        int curr = mMaxLevel.load();
+        while (curr < level && !mMaxLevel.compare_exchange_weak(curr, level))
+            ;
+    }
+
+    template <typename Key, typename Value>
+    bool ConcurrentSkipList<Key, Value>::find(const Key &k, Node **preds, Node **succs)
+    {
+    retry:
+        Node *pred = mHead;
+        for (int level = mMaxLevel.load(); level >= 0; level--)
+        {
+            Node *curr = Node::getPtr(pred->mNexts[level].load(std::memory_order_acquire));
+            while (curr)
+            {
+                uintptr_t succ = curr->mNexts[level].load(std::memory_order_acquire);
+                if (Node::isMarked(succ))
+                {
+                    //curr is deleted in this level, unlink it. if pred is deleted or changed, search again.
+                    uintptr_t expected = reinterpret_cast<uintptr_t>(curr);
+                    if (!pred->mNexts[level].compare_exchange_strong(expected, succ & ~uintptr_t(1), std::memory_order_acq_rel))
+                        goto retry;
+                    release(curr);
+                    curr = Node::getPtr(succ);
+                }
+                else if (curr->mKey < k)
+                {
+                    pred = curr;
+                    curr = Node::getPtr(succ);
+                }
+                else
+                {
+                    break;
+                }
+            }
+            preds[level] = pred;
+            succs[level] = curr;
+        }
+        return succs[0] && succs[0]->mKey == k;
+    }
+
+    template <typename Key, typename Value>
+    bool ConcurrentSkipList<Key, Value>::insert(const Key &k, const Value &v)
+    {
+        Guard guard = mDomain.pin();
+        Node *preds[ZSKIPLIST_MAXLEVEL], *succs[ZSKIPLIST_MAXLEVEL];
+        int level = generateRandomLevel();
+        raiseMaxLevel(level - 1);
+        Node *nd = nullptr;
+        while (true)
+        {
+            if (find(k, preds, succs))
+            {
+                if (nd)
+                    Node::destroy(nd);
+                return false;
+            }
+            if (!nd)
+                nd = Node::create(k, v, level);
+            for (int i = 0; i < level; i++)
+                nd->mNexts[i].store(reinterpret_cast<uintptr_t>(succs[i]), std::memory_order_relaxed);
+            //the hold of this thread and the link of level 0
+            nd->mRefs.store(2, std::memory_order_relaxed);
+            uintptr_t expected = reinterpret_cast<uintptr_t>(succs[0]);
+            if (preds[0]->mNexts[0].compare_exchange_strong(expected, reinterpret_cast<uintptr_t>(nd), std::memory_order_acq_rel))
+                break;
+        }
+        mLength.fetch_add(1, std::memory_order_relaxed);
+        //link the higher levels, stop if the node is being deleted
+        for (int i = 1; i < level; i++)
+        {
+            while (true)
+            {
+                uintptr_t next = nd->mNexts[i].load(std::memory_order_acquire);
+                uintptr_t succ = reinterpret_cast<uintptr_t>(succs[i]);
+                if (Node::isMarked(next) || (next != succ && !nd->mNexts[i].compare_exchange_strong(next, succ, std::memory_order_acq_rel)))
+                    goto done;
+                nd->mRefs.fetch_add(1, std::memory_order_relaxed);
+                uintptr_t expected = succ;
+                if (preds[i]->mNexts[i].compare_exchange_strong(expected, reinterpret_cast<uintptr_t>(nd), std::memory_order_acq_rel))
+                    break;
+                nd->mRefs.fetch_sub(1, std::memory_order_relaxed);
+                if (!find(k, preds, succs) || succs[0] != nd)
+                    goto done;
+            }
+        }
+    done:
+        //the deleting thread may unlink before some link is made, unlink them again
+        if (nd->isDeleted())
+            find(k, preds, succs);
+        release(nd);
+        return true;
+    }
+
+    template <typename Key, typename Value>
+    bool ConcurrentSkipList<Key, Value>::erase(const Key &k)
+    {
+        Guard guard = mDomain.pin();
+        Node *preds[ZSKIPLIST_MAXLEVEL], *succs[ZSKIPLIST_MAXLEVEL];
+        if (!find(k, preds, succs))
+            return false;
+        Node *nd = succs[0];
+        //mark from top to bottom, so the node disappears from level 0 last
+        for (int i = nd->mLevel - 1; i > 0; i--)
+        {
+            uintptr_t next = nd->mNexts[i].load(std::memory_order_acquire);
+            while (!Node::isMarked(next) && !nd->mNexts[i].compare_exchange_weak(next, next | 1, std::memory_order_acq_rel))
+                ;
+        }
+        uintptr_t next = nd->mNexts[0].load(std::memory_order_acquire);
+        while (true)
+        {
+            if (Node::isMarked(next))
+                return false;
+            if (nd->mNexts[0].compare_exchange_weak(next, next | 1, std::memory_order_acq_rel))
+                break;
+        }
+        mLength.fetch_sub(1, std::memory_order_relaxed);
+        //unlink the node from all levels
+        find(k, preds, succs);
+        return true;
+    }
+
+    template <typename Key, typename Value>
+    typename ConcurrentSkipList<Key, Value>::Node *ConcurrentSkipList<Key, Value>::search(const Key &k, bool inclusive)
+    {
+        //search does not unlink, it just skips the deleted nodes
+        Node *pred = mHead;
+        Node *curr = nullptr;
+        for (int level = mMaxLevel.load(); level >= 0; level--)
+        {
+            curr = Node::getPtr(pred->mNexts[level].load(std::memory_order_acquire));
+            while (curr)
+            {
+                uintptr_t succ = curr->mNexts[level].load(std::memory_order_acquire);
+                if (Node::isMarked(succ) || (inclusive ? !(k < curr->mKey) : curr->mKey < k))
+                {
+                    if (!Node::isMarked(succ))
+                        pred = curr;
+                    curr = Node::getPtr(succ);
+                }
+                else
+                {
+                    break;
+                }
+            }
+        }
+        return curr;
+    }
+
+    template <typename Key, typename Value>
+    bool ConcurrentSkipList<Key, Value>::contains(const Key &k)
+    {
+        Guard guard = mDomain.pin();
+        Node *nd = search(k, false);
+        return nd && nd->mKey == k;
+    }
+
+    template <typename Key, typename Value>
+    typename ConcurrentSkipList<Key, Value>::Node *ConcurrentSkipList<Key, Value>::lower_bound(const Key &k)
+    {
+        return search(k, false);
+    }
+
+    template <typename Key, typename Value>
+    typename ConcurrentSkipList<Key, Value>::Node *ConcurrentSkipList<Key, Value>::upper_bound(const Key &k)
+    {
+        return search(k, true);
+    }
+
+    template <typename Key, typename Value>
+    int ConcurrentSkipList<Key, Value>::getRank(const Key &k)
+    {
+        Guard guard = mDomain.pin();
+        int rank = 0;
+        for (auto nd = mHead->next(); nd && !(k < nd->mKey); nd = nd->next())
+        {
+            rank++;
+            if (nd->mKey == k)
+                return rank;
+        }
+        return 0;
+    }
+}; // namespace RedisDataStructure
+
+#endif
@@ -0,0 +1,420 @@
+#ifndef EPOCH_H
+#define EPOCH_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+
+namespace RedisDataStructure
+{
+    //counters of an EpochDomain
+    struct EpochStats
+    {
+        uint64_t mEpoch = 0;
+        //retired and not freed yet, of all threads
+        uint64_t mPending = 0;
+        uint64_t mFreed = 0;
+        //unpins which had to wait for the epoch to move
+        uint64_t mStalls = 0;
+    };
+
+    /* epoch based reclamation for the lock-free structures. a reader pins the
+     * domain while it uses the shared nodes, a writer retires a node after
+     * unlinking it and the node is freed once every thread pinned at that time
+     * has unpinned.
+     *
+     * the domain keeps a global epoch, every thread has a record with the epoch
+     * it is pinned in. the epoch moves from e to e + 1 only when every pinned
+     * thread is in e, so a node retired in e is unreachable for everyone once
+     * the epoch is e + 2.
+     *
+     * the retired nodes are kept in a list of the retiring thread, no lock is
+     * taken on retire. every batchSize retires the thread tries to move the
+     * epoch and frees the expired part of its list at once. the list of an
+     * exited thread is handed to the domain and freed by the others.
+     *
+     * a thread which stays pinned stops the epoch, so the lists only grow. an
+     * unpin which leaves more than maxPending nodes in the list of its thread
+     * waits until the stalled thread moves on, which bounds the memory of each
+     * thread; 0 disables the wait. a pinned thread must not wait for another
+     * thread, long readers call Guard::repin at the points they hold no node.
+     *
+     * pins nest, only the outermost one publishes the epoch. a guard is bound
+     * to the thread which pinned it.
+     */
+    class EpochDomain
+    {
+        struct Record;
+        struct State;
+
+    public:
+        class Guard
+        {
+        public:
+            Guard() : mDomain(nullptr), mRecord(nullptr) {}
+            Guard(Guard &&other) noexcept : mDomain(other.mDomain), mRecord(other.mRecord) { other.mDomain = nullptr; }
+            Guard &operator=(Guard &&other) noexcept
+            {
+                if (this != &other)
+                {
+                    unpin();
+                    mDomain = other.mDomain;
+                    mRecord = other.mRecord;
+                    other.mDomain = nullptr;
+                }
+                return *this;
+            }
+            Guard(const Guard &) = delete;
+            Guard &operator=(const Guard &) = delete;
+            ~Guard() { unpin(); }
+
+            void unpin()
+            {
+                if (!mDomain)
+                    return;
+                mDomain->exit(mRecord);
+                mDomain = nullptr;
+            }
+            //let the epoch move during a long operation, every node read before is invalid after
+            void repin()
+            {
+                if (mDomain)
+                    mDomain->repin(mRecord);
+            }
+            bool isPinned() const { return mDomain != nullptr; }
+
+        private:
+            friend class EpochDomain;
+            Guard(EpochDomain *domain, Record *record) : mDomain(domain), mRecord(record) {}
+
+            EpochDomain *mDomain;
+            Record *mRecord;
+        };
+
+        explicit EpochDomain(size_t batchSize = 64, size_t maxPending = 64 * 1024) : mState(std::make_shared<State>(batchSize > 0 ? batchSize : 1, maxPending)) {}
+        //no thread may be pinned or retiring, everything retired is freed
+        ~EpochDomain() noexcept
+        {
+            State &s = *mState;
+            std::lock_guard<std::mutex> lock(s.mMutex);
+            s.mClosed.store(true, std::memory_order_release);
+            for (Record *r = s.mRecords.load(std::memory_order_acquire); r; r = r->mNext)
+            {
+                freeAll(r->mRetired);
+                r->mPendingCount.store(0, std::memory_order_relaxed);
+            }
+            freeAll(s.mOrphans);
+            s.mOrphanCount.store(0, std::memory_order_relaxed);
+        }
+        EpochDomain(const EpochDomain &) = delete;
+        EpochDomain &operator=(const EpochDomain &) = delete;
+
+        //shared by the structures which do not bring their own domain
+        static EpochDomain &getDefault()
+        {
+            static EpochDomain domain;
+            return domain;
+        }
+
+        Guard pin()
+        {
+            Record *record = getRecord();
+            enter(record);
+            return Guard(this, record);
+        }
+
+        template <typename T>
+        void retire(T *p)
+        {
+            retire(p, [](void *q) { delete static_cast<T *>(q); });
+        }
+
+        void retire(void *p, void (*deleter)(void *))
+        {
+            Record *record = getRecord();
+            //the node is unlinked before, the epoch read here is not older than any reader which can see it
+            record->mRetired.push_back({p, deleter, mState->mEpoch.load(std::memory_order_seq_cst)});
+            record->mPendingCount.store(record->mRetired.size(), std::memory_order_relaxed);
+            if (++record->mSinceCollect >= mState->mBatchSize)
+            {
+                record->mSinceCollect = 0;
+                tryAdvance();
+                reclaim(record);
+            }
+        }
+
+        //move the epoch if every pinned thread is in the current one, return false if some thread is behind
+        bool tryAdvance()
+        {
+            State &s = *mState;
+            uint64_t epoch = s.mEpoch.load(std::memory_order_seq_cst);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            for (Record *r = s.mRecords.load(std::memory_order_acquire); r; r = r->mNext)
+            {
+                uint64_t local = r->mLocal.load(std::memory_order_acquire);
+                if ((local & 1) && (local >> 1) != epoch)
+                    return false;
+            }
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            //failing means another thread moved it
+            s.mEpoch.compare_exchange_strong(epoch, epoch + 1, std::memory_order_seq_cst);
+            return true;
+        }
+
+        //free the expired nodes of this thread and of the exited threads, return the number freed
+        size_t collect()
+        {
+            tryAdvance();
+            return reclaim(getRecord());
+        }
+
+        EpochStats getStats() const
+        {
+            const State &s = *mState;
+            EpochStats stats;
+            stats.mEpoch = s.mEpoch.load(std::memory_order_relaxed);
+            for (Record *r = s.mRecords.load(std::memory_order_acquire); r; r = r->mNext)
+                stats.mPending += r->mPendingCount.load(std::memory_order_relaxed);
+            stats.mPending += s.mOrphanCount.load(std::memory_order_relaxed);
+            stats.mFreed = s.mFreed.load(std::memory_order_relaxed);
+            stats.mStalls = s.mStalls.load(std::memory_order_relaxed);
+            return stats;
+        }
+
+    private:
+        struct Retired
+        {
+            void *mPtr;
+            void (*mDeleter)(void *);
+            uint64_t mEpoch;
+        };
+
+        //one per thread using the domain, reused after the thread exits
+        struct alignas(64) Record
+        {
+            //epoch << 1 | pinned
+            std::atomic<uint64_t> mLocal{0};
+            std::atomic<size_t> mPendingCount{0};
+            bool mOwned = true;
+            //set before the record is published, never changed
+            Record *mNext = nullptr;
+            //only used by the owner thread
+            unsigned mDepth = 0;
+            size_t mSinceCollect = 0;
+            std::deque<Retired> mRetired;
+        };
+
+        //outlives the domain while a thread still caches its record
+        struct State
+        {
+            State(size_t batchSize, size_t maxPending) : mBatchSize(batchSize), mMaxPending(maxPending) {}
+            ~State()
+            {
+                Record *r = mRecords.load(std::memory_order_relaxed);
+                while (r)
+                {
+                    Record *next = r->mNext;
+                    delete r;
+                    r = next;
+                }
+            }
+
+            const size_t mBatchSize;
+            const size_t mMaxPending;
+            alignas(64) std::atomic<uint64_t> mEpoch{0};
+            alignas(64) std::atomic<Record *> mRecords{nullptr};
+            std::atomic<bool> mClosed{false};
+            std::atomic<uint64_t> mFreed{0};
+            std::atomic<uint64_t> mStalls{0};
+            //record acquisition and release, the nodes left by the exited threads
+            std::mutex mMutex;
+            std::deque<Retired> mOrphans;
+            std::atomic<size_t> mOrphanCount{0};
+        };
+
+        //the records of the current thread, released when it exits
+        struct ThreadCache
+        {
+            std::vector<std::pair<std::shared_ptr<State>, Record *>> mEntries;
+
+            ~ThreadCache()
+            {
+                for (auto &entry : mEntries)
+                    release(*entry.first, entry.second);
+            }
+        };
+
+        static ThreadCache &getCache()
+        {
+            thread_local ThreadCache cache;
+            return cache;
+        }
+
+        Record *getRecord()
+        {
+            auto &entries = getCache().mEntries;
+            for (auto &entry : entries)
+            {
+                if (entry.first == mState)
+                    return entry.second;
+            }
+            //drop the records of the destroyed domains before adding one
+            for (size_t i = 0; i < entries.size();)
+            {
+                if (entries[i].first->mClosed.load(std::memory_order_acquire))
+                {
+                    release(*entries[i].first, entries[i].second);
+                    entries[i] = std::move(entries.back());
+                    entries.pop_back();
+                }
+                else
+                {
+                    i++;
+                }
+            }
+            Record *record = acquire(*mState);
+            entries.emplace_back(mState, record);
+            return record;
+        }
+
+        static Record *acquire(State &s)
+        {
+            std::lock_guard<std::mutex> lock(s.mMutex);
+            for (Record *r = s.mRecords.load(std::memory_order_relaxed); r; r = r->mNext)
+            {
+                if (!r->mOwned)
+                {
+                    r->mOwned = true;
+                    return r;
+                }
+            }
+            Record *record = new Record();
+            record->mNext = s.mRecords.load(std::memory_order_relaxed);
+            s.mRecords.store(record, std::memory_order_release);
+            return record;
+        }
+
+        static void release(State &s, Record *record)
+        {
+            std::lock_guard<std::mutex> lock(s.mMutex);
+            record->mLocal.store(0, std::memory_order_release);
+            record->mDepth = 0;
+            record->mSinceCollect = 0;
+            if (!s.mClosed.load(std::memory_order_acquire))
+            {
+                for (auto &retired : record->mRetired)
+                    s.mOrphans.push_back(retired);
+                s.mOrphanCount.store(s.mOrphans.size(), std::memory_order_relaxed);
+            }
+            record->mRetired.clear();
+            record->mPendingCount.store(0, std::memory_order_relaxed);
+            record->mOwned = false;
+        }
+
+        void enter(Record *record)
+        {
+            if (record->mDepth++ > 0)
+                return;
+            publish(record);
+        }
+
+        void publish(Record *record)
+        {
+            uint64_t epoch = mState->mEpoch.load(std::memory_order_seq_cst);
+            record->mLocal.store(epoch << 1 | 1, std::memory_order_relaxed);
+            //the epoch must be visible before any shared node is read
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+        }
+
+        void repin(Record *record)
+        {
+            if (record->mDepth != 1)
+                return;
+            record->mLocal.store(0, std::memory_order_release);
+            publish(record);
+        }
+
+        void exit(Record *record)
+        {
+            if (--record->mDepth > 0)
+                return;
+            record->mLocal.store(0, std::memory_order_release);
+            State &s = *mState;
+            if (s.mMaxPending == 0 || record->mRetired.size() < s.mMaxPending)
+                return;
+            tryAdvance();
+            reclaim(record);
+            if (record->mRetired.size() < s.mMaxPending)
+                return;
+            //some thread is stalled in an old epoch, wait for it instead of growing further
+            s.mStalls.fetch_add(1, std::memory_order_relaxed);
+            while (record->mRetired.size() >= s.mMaxPending)
+            {
+                std::this_thread::yield();
+                tryAdvance();
+                reclaim(record);
+            }
+        }
+
+        size_t reclaim(Record *record)
+        {
+            State &s = *mState;
+            uint64_t epoch = s.mEpoch.load(std::memory_order_acquire);
+            size_t freed = freeExpired(record->mRetired, epoch);
+            record->mPendingCount.store(record->mRetired.size(), std::memory_order_relaxed);
+            if (s.mOrphanCount.load(std::memory_order_relaxed) > 0)
+            {
+                //freed out of the lock, a deleter may retire again
+                std::deque<Retired> expired;
+                {
+                    std::unique_lock<std::mutex> lock(s.mMutex, std::try_to_lock);
+                    if (lock.owns_lock())
+                    {
+                        while (!s.mOrphans.empty() && s.mOrphans.front().mEpoch + 2 <= epoch)
+                        {
+                            expired.push_back(s.mOrphans.front());
+                            s.mOrphans.pop_front();
+                        }
+                        s.mOrphanCount.store(s.mOrphans.size(), std::memory_order_relaxed);
+                    }
+                }
+                freed += expired.size();
+                freeAll(expired);
+            }
+            if (freed > 0)
+                s.mFreed.fetch_add(freed, std::memory_order_relaxed);
+            return freed;
+        }
+
+        //stop at the first node not expired, a list is in retire order so its epochs mostly increase
+        static size_t freeExpired(std::deque<Retired> &retired, uint64_t epoch)
+        {
+            size_t freed = 0;
+            while (!retired.empty() && retired.front().mEpoch + 2 <= epoch)
+            {
+                Retired r = retired.front();
+                retired.pop_front();
+                r.mDeleter(r.mPtr);
+                freed++;
+            }
+            return freed;
+        }
+
+        static void freeAll(std::deque<Retired> &retired)
+        {
+            for (auto &r : retired)
+                r.mDeleter(r.mPtr);
+            retired.clear();
+        }
+
+        std::shared_ptr<State> mState;
+    };
+} // namespace RedisDataStructure
+
+#endif
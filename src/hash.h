@@ -691,6 +691,23 @@ namespace RedisDataStructure
                 throw std::out_of_range("key not exist in hash");
             }
         }
+
+        /* lookup without the rehash step of get, so the map is not modified
+         * and several threads can read it at the same time. return nullptr if
+         * the key does not exist.
+         */
+        const ValueType* peek(const KeyType& key) const{
+            HashNode<EncyType>* node = nullptr;
+            if(mRehashIndex != (size_t)-1){
+                node = mBackup->get(mHasher(key) & mBucketsMask, key);
+                if(!node){
+                    node = mActive->get(mHasher(key) & (mActive->mBucketsNumber - 1), key);
+                }
+            }else{
+                node = mActive->get(mHasher(key) & mBucketsMask, key);
+            }
+            return node ? &node->mValue.second : nullptr;
+        }
     };
 
     template<typename K, typename Hasher = HashFunction<K>>
@@ -0,0 +1,121 @@
+#ifndef LISTPACK_H
+#define LISTPACK_H
+
+#include <cstdint>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <algorithm>
+
+namespace RedisDataStructure
+{
+    /* ListPack is the compact encoding of small sorted sets. all entries live in
+     * two contiguous buffers: a fixed size entry array sorted by score, which
+     * makes binary search by score possible, and a byte buffer holding the
+     * members back to back in the same order. compared with a skiplist node
+     * plus a hash node per member, the cost of one entry is 16 bytes plus the
+     * member bytes, and there is no per entry allocation at all.
+     * entries with the same score keep the insertion order, the same as SkipList.
+     */
+    class ListPack
+    {
+    public:
+        static constexpr size_t npos = static_cast<size_t>(-1);
+
+        ListPack() = default;
+
+        size_t getLength() const { return mEntries.size(); }
+        bool empty() const { return mEntries.empty(); }
+
+        double scoreAt(size_t index) const { return mEntries[index].mScore; }
+        std::string_view memberAt(size_t index) const
+        {
+            return std::string_view(mMembers.data() + mEntries[index].mOffset, mEntries[index].mLength);
+        }
+
+        //index of the first entry whose score is not less than score
+        size_t lowerBound(double score) const
+        {
+            return std::lower_bound(mEntries.begin(), mEntries.end(), score,
+                                    [](const Entry &e, double s) { return e.mScore < s; }) -
+                   mEntries.begin();
+        }
+
+        //index of the first entry whose score is greater than score
+        size_t upperBound(double score) const
+        {
+            return std::upper_bound(mEntries.begin(), mEntries.end(), score,
+                                    [](double s, const Entry &e) { return s < e.mScore; }) -
+                   mEntries.begin();
+        }
+
+        //members are not ordered, so find is a linear scan over the packed bytes.
+        size_t find(std::string_view member) const
+        {
+            for (size_t i = 0; i < mEntries.size(); i++)
+            {
+                if (memberAt(i) == member)
+                    return i;
+            }
+            return npos;
+        }
+
+        //insert after all the entries with the same score, return the index of new entry.
+        size_t insert(double score, std::string_view member)
+        {
+            size_t index = upperBound(score);
+            uint32_t offset = index < mEntries.size() ? mEntries[index].mOffset : static_cast<uint32_t>(mMembers.size());
+            mMembers.insert(offset, member.data(), member.size());
+            for (size_t i = index; i < mEntries.size(); i++)
+                mEntries[i].mOffset += static_cast<uint32_t>(member.size());
+            mEntries.insert(mEntries.begin() + index, Entry{score, offset, static_cast<uint32_t>(member.size())});
+            return index;
+        }
+
+        //append to the end, the caller makes sure score is not less than the last one.
+        void append(double score, std::string_view member)
+        {
+            mEntries.push_back(Entry{score, static_cast<uint32_t>(mMembers.size()), static_cast<uint32_t>(member.size())});
+            mMembers.append(member.data(), member.size());
+        }
+
+        void reserve(size_t entries, size_t bytes)
+        {
+            mEntries.reserve(entries);
+            mMembers.reserve(bytes);
+        }
+
+        void erase(size_t index)
+        {
+            const Entry e = mEntries[index];
+            mMembers.erase(e.mOffset, e.mLength);
+            mEntries.erase(mEntries.begin() + index);
+            for (size_t i = index; i < mEntries.size(); i++)
+                mEntries[i].mOffset -= e.mLength;
+        }
+
+        void clear()
+        {
+            mEntries.clear();
+            mMembers.clear();
+        }
+
+        //bytes held by the encoding, used for memory report.
+        size_t getMemoryUsage() const
+        {
+            return sizeof(*this) + mEntries.capacity() * sizeof(Entry) + mMembers.capacity();
+        }
+
+    private:
+        struct Entry
+        {
+            double mScore;
+            uint32_t mOffset;
+            uint32_t mLength;
+        };
+        std::vector<Entry> mEntries;
+        std::string mMembers;
+    };
+}; // namespace RedisDataStructure
+
+#endif
@@ -0,0 +1,274 @@
+#ifndef LOCK_MANAGER_H
+#define LOCK_MANAGER_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <deque>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <utility>
+#include <vector>
+#include "hash.h"
+
+namespace Redis
+{
+	enum class LockMode
+	{
+		SHARED,
+		EXCLUSIVE
+	};
+
+	//contention counters of a lock stripe
+	struct LockStats
+	{
+		uint64_t mAcquired = 0;
+		//acquisitions which had to wait
+		uint64_t mContended = 0;
+		uint64_t mWaitNanos = 0;
+	};
+
+	/* key level shared/exclusive locks for commands touching several keys.
+	 * keys are hashed to a fixed table of stripes, each stripe is a fair
+	 * reader writer lock: a request which can not be granted at once waits in
+	 * FIFO order, and later requests queue behind it even if they would be
+	 * compatible with the holders, so a stream of readers on a hot key does
+	 * not starve a writer. the consecutive shared requests at the head of the
+	 * queue are granted together.
+	 * a multi key request locks its stripes in increasing index order, every
+	 * stripe once with the strongest mode asked for it, so two requests can
+	 * never wait for each other in a cycle.
+	 * the counters are kept per stripe, with the default table size different
+	 * hot keys rarely share one.
+	 */
+	class LockManager
+	{
+		struct Stripe;
+
+	public:
+		//releases the stripes on destruction, move only
+		class Guard
+		{
+		public:
+			Guard() : mManager(nullptr) {}
+			Guard(Guard &&other) noexcept : mManager(other.mManager), mLocked(std::move(other.mLocked)) { other.mManager = nullptr; }
+			Guard &operator=(Guard &&other) noexcept
+			{
+				if (this != &other)
+				{
+					unlock();
+					mManager = other.mManager;
+					mLocked = std::move(other.mLocked);
+					other.mManager = nullptr;
+				}
+				return *this;
+			}
+			Guard(const Guard &) = delete;
+			Guard &operator=(const Guard &) = delete;
+			~Guard() { unlock(); }
+
+			void unlock()
+			{
+				if (!mManager)
+					return;
+				//reverse order, not needed for correctness but keeps the hand over short
+				for (auto it = mLocked.rbegin(); it != mLocked.rend(); ++it)
+					mManager->release(it->first, it->second);
+				mLocked.clear();
+				mManager = nullptr;
+			}
+			bool ownsLock() const { return mManager != nullptr; }
+
+		private:
+			friend class LockManager;
+			Guard(LockManager *manager, std::vector<std::pair<size_t, LockMode>> locked) : mManager(manager), mLocked(std::move(locked)) {}
+
+			LockManager *mManager;
+			std::vector<std::pair<size_t, LockMode>> mLocked;
+		};
+
+		explicit LockManager(size_t stripeNumber = 4096) : mStripeNumber(stripeNumber > 0 ? stripeNumber : 1), mStripes(new Stripe[mStripeNumber]) {}
+		LockManager(const LockManager &) = delete;
+		LockManager &operator=(const LockManager &) = delete;
+
+		size_t getStripeNumber() const { return mStripeNumber; }
+
+		size_t stripeOf(const std::string &key) const
+		{
+			uint64_t hash = static_cast<uint64_t>(mHasher(key)) * 0x9E3779B97F4A7C15ull;
+			return static_cast<size_t>(hash >> 32) % mStripeNumber;
+		}
+
+		Guard lock(const std::string &key, LockMode mode)
+		{
+			size_t stripe = stripeOf(key);
+			acquire(stripe, mode);
+			return Guard(this, {{stripe, mode}});
+		}
+
+		Guard lock(const std::vector<std::string> &keys, LockMode mode)
+		{
+			std::vector<std::pair<size_t, LockMode>> stripes;
+			stripes.reserve(keys.size());
+			for (auto &key : keys)
+				stripes.emplace_back(stripeOf(key), mode);
+			return lockStripes(std::move(stripes));
+		}
+
+		//every key with its own mode, e.g. write the destination and read the sources
+		Guard lock(const std::vector<std::pair<std::string, LockMode>> &requests)
+		{
+			std::vector<std::pair<size_t, LockMode>> stripes;
+			stripes.reserve(requests.size());
+			for (auto &request : requests)
+				stripes.emplace_back(stripeOf(request.first), request.second);
+			return lockStripes(std::move(stripes));
+		}
+
+		/* lock stripes given by stripeOf, for callers which keep the stripes of
+		 * their keys. they are sorted and the duplicates are merged into the
+		 * strongest mode.
+		 */
+		Guard lockStripes(std::vector<std::pair<size_t, LockMode>> stripes)
+		{
+			std::sort(stripes.begin(), stripes.end());
+			size_t n = 0;
+			for (size_t i = 0; i < stripes.size(); i++)
+			{
+				if (n > 0 && stripes[n - 1].first == stripes[i].first)
+					stripes[n - 1].second = std::max(stripes[n - 1].second, stripes[i].second);
+				else
+					stripes[n++] = stripes[i];
+			}
+			stripes.resize(n);
+			for (auto &stripe : stripes)
+				acquire(stripe.first, stripe.second);
+			return Guard(this, std::move(stripes));
+		}
+
+		LockStats getStats(const std::string &key) const { return getStripeStats(stripeOf(key)); }
+
+		LockStats getStripeStats(size_t stripe) const
+		{
+			const Stripe &s = mStripes[stripe];
+			LockStats stats;
+			stats.mAcquired = s.mAcquired.load(std::memory_order_relaxed);
+			stats.mContended = s.mContended.load(std::memory_order_relaxed);
+			stats.mWaitNanos = s.mWaitNanos.load(std::memory_order_relaxed);
+			return stats;
+		}
+
+		//the n stripes with the most contended acquisitions, the most contended first
+		std::vector<std::pair<size_t, LockStats>> getHotStripes(size_t n) const
+		{
+			std::vector<std::pair<size_t, LockStats>> result;
+			for (size_t i = 0; i < mStripeNumber; i++)
+			{
+				LockStats stats = getStripeStats(i);
+				if (stats.mContended > 0)
+					result.emplace_back(i, stats);
+			}
+			auto more = [](const std::pair<size_t, LockStats> &a, const std::pair<size_t, LockStats> &b) { return a.second.mContended > b.second.mContended; };
+			if (result.size() > n)
+			{
+				std::partial_sort(result.begin(), result.begin() + n, result.end(), more);
+				result.resize(n);
+			}
+			else
+			{
+				std::sort(result.begin(), result.end(), more);
+			}
+			return result;
+		}
+
+		void resetStats()
+		{
+			for (size_t i = 0; i < mStripeNumber; i++)
+			{
+				mStripes[i].mAcquired.store(0, std::memory_order_relaxed);
+				mStripes[i].mContended.store(0, std::memory_order_relaxed);
+				mStripes[i].mWaitNanos.store(0, std::memory_order_relaxed);
+			}
+		}
+
+	private:
+		struct Waiter
+		{
+			explicit Waiter(LockMode mode) : mMode(mode), mGranted(false) {}
+			LockMode mMode;
+			bool mGranted;
+			std::condition_variable mCond;
+		};
+
+		struct alignas(64) Stripe
+		{
+			std::mutex mMutex;
+			int mShared = 0;
+			bool mExclusive = false;
+			std::deque<Waiter *> mQueue;
+			std::atomic<uint64_t> mAcquired{0};
+			std::atomic<uint64_t> mContended{0};
+			std::atomic<uint64_t> mWaitNanos{0};
+		};
+
+		static bool compatible(const Stripe &s, LockMode mode)
+		{
+			return mode == LockMode::SHARED ? !s.mExclusive : !s.mExclusive && s.mShared == 0;
+		}
+
+		static void grant(Stripe &s, LockMode mode)
+		{
+			if (mode == LockMode::SHARED)
+				s.mShared++;
+			else
+				s.mExclusive = true;
+		}
+
+		void acquire(size_t stripe, LockMode mode)
+		{
+			Stripe &s = mStripes[stripe];
+			std::unique_lock<std::mutex> lock(s.mMutex);
+			s.mAcquired.fetch_add(1, std::memory_order_relaxed);
+			if (s.mQueue.empty() && compatible(s, mode))
+			{
+				grant(s, mode);
+				return;
+			}
+			s.mContended.fetch_add(1, std::memory_order_relaxed);
+			auto start = std::chrono::steady_clock::now();
+			Waiter waiter(mode);
+			s.mQueue.push_back(&waiter);
+			waiter.mCond.wait(lock, [&]() { return waiter.mGranted; });
+			auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			s.mWaitNanos.fetch_add(static_cast<uint64_t>(cost), std::memory_order_relaxed);
+		}
+
+		void release(size_t stripe, LockMode mode)
+		{
+			Stripe &s = mStripes[stripe];
+			std::lock_guard<std::mutex> lock(s.mMutex);
+			if (mode == LockMode::SHARED)
+				s.mShared--;
+			else
+				s.mExclusive = false;
+			//the granted flag is set under the mutex, the waiter owns the lock once it is set
+			while (!s.mQueue.empty() && compatible(s, s.mQueue.front()->mMode))
+			{
+				Waiter *waiter = s.mQueue.front();
+				s.mQueue.pop_front();
+				grant(s, waiter->mMode);
+				waiter->mGranted = true;
+				waiter->mCond.notify_one();
+			}
+		}
+
+		const size_t mStripeNumber;
+		RedisDataStructure::HashFunction<std::string> mHasher;
+		std::unique_ptr<Stripe[]> mStripes;
+	};
+} // namespace Redis
+
+#endif
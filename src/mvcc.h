@@ -0,0 +1,539 @@
+#ifndef MVCC_H
+#define MVCC_H
+
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <cstdint>
+#include <functional>
+#include <mutex>
+#include <optional>
+#include <set>
+#include <shared_mutex>
+#include <thread>
+#include <utility>
+#include <vector>
+#include "hash.h"
+#include "SkipList.h"
+
+namespace RedisDataStructure
+{
+    /* the global commit timestamp and the open snapshots. every committed
+     * write gets the next timestamp, a snapshot sees the writes committed up
+     * to the timestamp it was opened at.
+     */
+    class MvccClock : public Util::noncopyable
+    {
+    public:
+        MvccClock() : mCommitTs(0) {}
+
+        static MvccClock &getDefault()
+        {
+            static MvccClock clock;
+            return clock;
+        }
+
+        uint64_t getCommitTs() const { return mCommitTs.load(std::memory_order_acquire); }
+
+        //called by a store with its write lock held, the version is published under the same lock
+        uint64_t tick() { return mCommitTs.fetch_add(1, std::memory_order_acq_rel) + 1; }
+
+        uint64_t openSnapshot()
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            uint64_t ts = mCommitTs.load(std::memory_order_acquire);
+            mActive.insert(ts);
+            return ts;
+        }
+
+        void closeSnapshot(uint64_t ts)
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            auto it = mActive.find(ts);
+            if (it != mActive.end())
+                mActive.erase(it);
+        }
+
+        //the oldest timestamp a snapshot may read at, now or later
+        uint64_t getOldestVisible() const
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            return mActive.empty() ? mCommitTs.load(std::memory_order_acquire) : *mActive.begin();
+        }
+
+        size_t getActiveSnapshots() const
+        {
+            std::lock_guard<std::mutex> lock(mMutex);
+            return mActive.size();
+        }
+
+    private:
+        std::atomic<uint64_t> mCommitTs;
+        mutable std::mutex mMutex;
+        std::multiset<uint64_t> mActive;
+    };
+
+    //an open snapshot, closed on destruction
+    class MvccSnapshot
+    {
+    public:
+        explicit MvccSnapshot(MvccClock &clock) : mClock(&clock), mTs(clock.openSnapshot()) {}
+        MvccSnapshot(MvccSnapshot &&other) noexcept : mClock(other.mClock), mTs(other.mTs) { other.mClock = nullptr; }
+        MvccSnapshot(const MvccSnapshot &) = delete;
+        MvccSnapshot &operator=(const MvccSnapshot &) = delete;
+        MvccSnapshot &operator=(MvccSnapshot &&) = delete;
+        ~MvccSnapshot()
+        {
+            if (mClock)
+                mClock->closeSnapshot(mTs);
+        }
+
+        uint64_t getTs() const { return mTs; }
+
+    private:
+        MvccClock *mClock;
+        uint64_t mTs;
+    };
+
+    template <typename V>
+    struct MvccVersion
+    {
+        uint64_t mTs;
+        bool mDeleted;
+        V mValue;
+        MvccVersion *mOlder;
+    };
+
+    //the versions of one key, the newest first
+    template <typename V>
+    class MvccChain : public Util::noncopyable
+    {
+    public:
+        MvccChain() : mHead(nullptr) {}
+        ~MvccChain() { freeFrom(mHead); }
+
+        void push(uint64_t ts, const V *value)
+        {
+            mHead = new MvccVersion<V>{ts, value == nullptr, value ? *value : V(), mHead};
+        }
+
+        //the newest version committed at or before ts, nullptr if the key did not exist then
+        const MvccVersion<V> *visible(uint64_t ts) const
+        {
+            const MvccVersion<V> *v = mHead;
+            while (v && v->mTs > ts)
+                v = v->mOlder;
+            return v && !v->mDeleted ? v : nullptr;
+        }
+
+        /* free the versions older than the one visible at oldest, no snapshot
+         * can read them. return the number freed, dead is set when only a
+         * tombstone visible to everyone is left.
+         */
+        size_t trim(uint64_t oldest, bool &dead)
+        {
+            MvccVersion<V> *v = mHead;
+            while (v && v->mTs > oldest)
+                v = v->mOlder;
+            dead = v == mHead && v && v->mDeleted;
+            if (!v)
+                return 0;
+            size_t freed = freeFrom(v->mOlder);
+            v->mOlder = nullptr;
+            return freed;
+        }
+
+    private:
+        static size_t freeFrom(MvccVersion<V> *v)
+        {
+            size_t freed = 0;
+            while (v)
+            {
+                MvccVersion<V> *older = v->mOlder;
+                delete v;
+                v = older;
+                freed++;
+            }
+            return freed;
+        }
+
+        MvccVersion<V> *mHead;
+    };
+
+    //calls collect every interval on a background thread until stopped
+    class MvccGarbageCollector : public Util::noncopyable
+    {
+    public:
+        MvccGarbageCollector() : mStopping(false) {}
+        ~MvccGarbageCollector() { stop(); }
+
+        void start(std::chrono::milliseconds interval, std::function<void()> collect)
+        {
+            stop();
+            mStopping = false;
+            mThread = std::thread([this, interval, collect]() {
+                std::unique_lock<std::mutex> lock(mMutex);
+                while (!mCond.wait_for(lock, interval, [this]() { return mStopping; }))
+                {
+                    lock.unlock();
+                    collect();
+                    lock.lock();
+                }
+            });
+        }
+
+        void stop()
+        {
+            {
+                std::lock_guard<std::mutex> lock(mMutex);
+                mStopping = true;
+            }
+            mCond.notify_all();
+            if (mThread.joinable())
+                mThread.join();
+        }
+
+    private:
+        std::thread mThread;
+        std::mutex mMutex;
+        std::condition_variable mCond;
+        bool mStopping;
+    };
+
+    /* multi version HashMap. a write appends a version stamped with the next
+     * commit timestamp, erase appends a tombstone, so a reader holding a
+     * snapshot sees the map as it was when the snapshot was opened while the
+     * writers continue. the index is guarded by a reader writer lock which
+     * readers hold for one chunk of buckets only, a long scan never blocks
+     * the writers for more than a chunk.
+     * the garbage collector frees the versions no open snapshot can read, and
+     * erases dead keys only when no snapshot is open, so the table does not
+     * shrink under a running scan and every key is visited once.
+     */
+    template <typename K, typename V, typename Hasher = HashFunction<K>>
+    class MvccHashMap : public Util::noncopyable
+    {
+    public:
+        using Chain = MvccChain<V>;
+        //a missing value erases the key
+        using Write = std::pair<K, std::optional<V>>;
+
+        explicit MvccHashMap(MvccClock &clock = MvccClock::getDefault()) : mClock(clock) {}
+        ~MvccHashMap()
+        {
+            mCollector.stop();
+            std::vector<std::pair<K, Chain *>> entries;
+            size_t cursor = 0;
+            do
+            {
+                cursor = mIndex.scan(cursor, entries);
+            } while (cursor != 0);
+            for (auto &e : entries)
+                delete e.second;
+        }
+
+        MvccSnapshot snapshot() { return MvccSnapshot(mClock); }
+
+        //return the commit timestamp
+        uint64_t put(const K &key, const V &value) { return apply({Write(key, value)}); }
+        uint64_t erase(const K &key) { return apply({Write(key, std::nullopt)}); }
+
+        //the writes are committed with one timestamp, a snapshot sees all or none of them
+        uint64_t apply(const std::vector<Write> &writes)
+        {
+            std::unique_lock<std::shared_mutex> lock(mMutex);
+            uint64_t ts = mClock.tick();
+            for (auto &w : writes)
+            {
+                Chain *const *found = mIndex.peek(w.first);
+                Chain *chain = found ? *found : nullptr;
+                if (!chain)
+                {
+                    if (!w.second)
+                        continue;
+                    chain = new Chain();
+                    mIndex.insert(w.first, chain);
+                }
+                chain->push(ts, w.second ? &*w.second : nullptr);
+            }
+            return ts;
+        }
+
+        //read the latest committed value
+        bool get(const K &key, V &value) const { return getAt(mClock.getCommitTs(), key, value); }
+        bool get(const MvccSnapshot &snapshot, const K &key, V &value) const { return getAt(snapshot.getTs(), key, value); }
+
+        /* visit up to count buckets from cursor like Hash::scan, the entries
+         * visible in the snapshot are appended to out. start with cursor 0,
+         * the scan is done when 0 is returned.
+         */
+        size_t scan(const MvccSnapshot &snapshot, size_t cursor, std::vector<std::pair<K, V>> &out, size_t count = 16)
+        {
+            std::vector<std::pair<K, Chain *>> entries;
+            std::shared_lock<std::shared_mutex> lock(mMutex);
+            do
+            {
+                cursor = mIndex.scan(cursor, entries);
+            } while (cursor != 0 && --count > 0);
+            for (auto &e : entries)
+            {
+                const MvccVersion<V> *v = e.second->visible(snapshot.getTs());
+                if (v)
+                    out.emplace_back(e.first, v->mValue);
+            }
+            return cursor;
+        }
+
+        //fn(key, value) for every entry of the snapshot, the lock is taken per chunk
+        template <typename Fn>
+        void forEach(const MvccSnapshot &snapshot, Fn fn, size_t chunk = 16)
+        {
+            std::vector<std::pair<K, V>> out;
+            size_t cursor = 0;
+            do
+            {
+                out.clear();
+                cursor = scan(snapshot, cursor, out, chunk);
+                for (auto &e : out)
+                    fn(e.first, e.second);
+            } while (cursor != 0);
+        }
+
+        /* one pass over the index in chunks, return the number of versions
+         * freed. called by the background collector, or directly.
+         */
+        size_t collectGarbage(size_t chunk = 64)
+        {
+            size_t freed = 0, cursor = 0;
+            std::vector<std::pair<K, Chain *>> entries;
+            do
+            {
+                entries.clear();
+                std::unique_lock<std::shared_mutex> lock(mMutex);
+                size_t count = chunk;
+                do
+                {
+                    cursor = mIndex.scan(cursor, entries);
+                } while (cursor != 0 && --count > 0);
+                uint64_t oldest = mClock.getOldestVisible();
+                bool eraseDead = mClock.getActiveSnapshots() == 0;
+                for (auto &e : entries)
+                {
+                    bool dead;
+                    freed += e.second->trim(oldest, dead);
+                    if (dead && eraseDead)
+                    {
+                        delete e.second;
+                        mIndex.erase(e.first);
+                        freed++;
+                    }
+                }
+            } while (cursor != 0);
+            return freed;
+        }
+
+        void startGarbageCollector(std::chrono::milliseconds interval)
+        {
+            mCollector.start(interval, [this]() { collectGarbage(); });
+        }
+        void stopGarbageCollector() { mCollector.stop(); }
+
+    private:
+        bool getAt(uint64_t ts, const K &key, V &value) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mMutex);
+            Chain *const *found = mIndex.peek(key);
+            const MvccVersion<V> *v = found ? (*found)->visible(ts) : nullptr;
+            if (v)
+                value = v->mValue;
+            return v != nullptr;
+        }
+
+        MvccClock &mClock;
+        mutable std::shared_mutex mMutex;
+        //scan does not modify the map, it is called under the shared lock
+        mutable HashMap<K, Chain *, Hasher> mIndex;
+        MvccGarbageCollector mCollector;
+    };
+
+    /* multi version ordered map on SkipList, the same scheme as MvccHashMap.
+     * range reads walk the snapshot in key order, in chunks which resume
+     * after the last key read.
+     */
+    template <typename K, typename V>
+    class MvccSkipList : public Util::noncopyable
+    {
+    public:
+        using Chain = MvccChain<V>;
+        using Write = std::pair<K, std::optional<V>>;
+
+        explicit MvccSkipList(MvccClock &clock = MvccClock::getDefault()) : mClock(clock) {}
+        ~MvccSkipList()
+        {
+            mCollector.stop();
+            for (auto it = mIndex.begin(); it != mIndex.end(); it++)
+                delete it->mValue;
+        }
+
+        MvccSnapshot snapshot() { return MvccSnapshot(mClock); }
+
+        uint64_t put(const K &key, const V &value) { return apply({Write(key, value)}); }
+        uint64_t erase(const K &key) { return apply({Write(key, std::nullopt)}); }
+
+        uint64_t apply(const std::vector<Write> &writes)
+        {
+            std::unique_lock<std::shared_mutex> lock(mMutex);
+            uint64_t ts = mClock.tick();
+            for (auto &w : writes)
+            {
+                Chain *chain = find(w.first);
+                if (!chain)
+                {
+                    if (!w.second)
+                        continue;
+                    chain = new Chain();
+                    mIndex.insert(w.first, chain);
+                }
+                chain->push(ts, w.second ? &*w.second : nullptr);
+            }
+            return ts;
+        }
+
+        bool get(const K &key, V &value) const { return getAt(mClock.getCommitTs(), key, value); }
+        bool get(const MvccSnapshot &snapshot, const K &key, V &value) const { return getAt(snapshot.getTs(), key, value); }
+
+        /* fn(key, value) for the entries of the snapshot with from <= key <= to
+         * in key order, return the number visited. the lock is taken for chunk
+         * keys at a time.
+         */
+        template <typename Fn>
+        size_t range(const MvccSnapshot &snapshot, const K &from, const K &to, Fn fn, size_t chunk = 64)
+        {
+            size_t visited = 0;
+            std::vector<std::pair<K, V>> out;
+            K next = from;
+            bool inclusive = true, done = false;
+            while (!done)
+            {
+                out.clear();
+                {
+                    std::shared_lock<std::shared_mutex> lock(mMutex);
+                    SkipListNode<K, Chain *> *nd = seek(next, inclusive);
+                    size_t count = 0;
+                    for (; nd != mIndex.end().getPtr() && !(to < nd->mKey) && count < chunk; nd = nd->next(), count++)
+                    {
+                        const MvccVersion<V> *v = nd->mValue->visible(snapshot.getTs());
+                        if (v)
+                            out.emplace_back(nd->mKey, v->mValue);
+                        next = nd->mKey;
+                    }
+                    done = count < chunk;
+                    inclusive = false;
+                }
+                for (auto &e : out)
+                    fn(e.first, e.second);
+                visited += out.size();
+            }
+            return visited;
+        }
+
+        template <typename Fn>
+        size_t forEach(const MvccSnapshot &snapshot, Fn fn, size_t chunk = 64)
+        {
+            K first, last;
+            {
+                std::shared_lock<std::shared_mutex> lock(mMutex);
+                if (mIndex.getLength() == 0)
+                    return 0;
+                first = mIndex.begin()->mKey;
+                last = mIndex.rbegin()->mKey;
+            }
+            //keys inserted after last are newer than the snapshot anyway
+            return range(snapshot, first, last, fn, chunk);
+        }
+
+        size_t collectGarbage(size_t chunk = 64)
+        {
+            size_t freed = 0;
+            K next;
+            bool inclusive = true, started = false, done = false;
+            std::vector<K> dead;
+            while (!done)
+            {
+                dead.clear();
+                std::unique_lock<std::shared_mutex> lock(mMutex);
+                if (!started)
+                {
+                    if (mIndex.getLength() == 0)
+                        break;
+                    next = mIndex.begin()->mKey;
+                    started = true;
+                }
+                uint64_t oldest = mClock.getOldestVisible();
+                bool eraseDead = mClock.getActiveSnapshots() == 0;
+                SkipListNode<K, Chain *> *nd = seek(next, inclusive);
+                size_t count = 0;
+                for (; nd != mIndex.end().getPtr() && count < chunk; nd = nd->next(), count++)
+                {
+                    bool isDead;
+                    freed += nd->mValue->trim(oldest, isDead);
+                    if (isDead && eraseDead)
+                        dead.push_back(nd->mKey);
+                    next = nd->mKey;
+                }
+                done = count < chunk;
+                inclusive = false;
+                for (auto &key : dead)
+                {
+                    delete find(key);
+                    mIndex.erase(key);
+                    freed++;
+                }
+            }
+            return freed;
+        }
+
+        void startGarbageCollector(std::chrono::milliseconds interval)
+        {
+            mCollector.start(interval, [this]() { collectGarbage(); });
+        }
+        void stopGarbageCollector() { mCollector.stop(); }
+
+    private:
+        //the first node with key >= k, or > k if not inclusive. SkipList::lower_bound returns nullptr below the first key
+        SkipListNode<K, Chain *> *seek(const K &k, bool inclusive) const
+        {
+            if (mIndex.getLength() == 0)
+                return mIndex.end().getPtr();
+            SkipListNode<K, Chain *> *nd = inclusive ? mIndex.lower_bound(k) : mIndex.upper_bound(k);
+            if (!nd)
+                nd = k < mIndex.begin()->mKey ? mIndex.begin().getPtr() : mIndex.end().getPtr();
+            return nd;
+        }
+
+        Chain *find(const K &k) const
+        {
+            SkipListNode<K, Chain *> *nd = seek(k, true);
+            return nd != mIndex.end().getPtr() && !(k < nd->mKey) ? nd->mValue : nullptr;
+        }
+
+        bool getAt(uint64_t ts, const K &key, V &value) const
+        {
+            std::shared_lock<std::shared_mutex> lock(mMutex);
+            Chain *chain = find(key);
+            const MvccVersion<V> *v = chain ? chain->visible(ts) : nullptr;
+            if (v)
+                value = v->mValue;
+            return v != nullptr;
+        }
+
+        MvccClock &mClock;
+        mutable std::shared_mutex mMutex;
+        //the lookups do not modify the list, they are called under the shared lock
+        mutable SkipList<K, Chain *> mIndex;
+        MvccGarbageCollector mCollector;
+    };
+}; // namespace RedisDataStructure
+
+#endif
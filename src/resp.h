@@ -0,0 +1,604 @@
+#ifndef RESP_H
+#define RESP_H
+
+#include <charconv>
+#include <cstdint>
+#include <cstdio>
+#include <cstdlib>
+#include <cstring>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+
+namespace Redis
+{
+	enum class RespVersion
+	{
+		RESP2 = 2,
+		RESP3 = 3
+	};
+
+	/* incremental RESP request parser, for multibulk ("*2\r\n$3\r\nGET\r\n$1\r\na\r\n")
+	 * and inline ("GET a\r\n") commands. parse is given the unconsumed bytes
+	 * starting at the current command, a complete command is returned as views
+	 * into them, nothing is copied. an incomplete command keeps its progress
+	 * as offsets from its start, so the caller may move the bytes, e.g. to the
+	 * front of its buffer, and call again with more of them without scanning
+	 * the known part again.
+	 * the limits and the error messages are the ones of redis.
+	 */
+	class RespParser
+	{
+	public:
+		enum class Result
+		{
+			COMMAND,
+			NEED_MORE,
+			PROTOCOL_ERROR
+		};
+
+		static constexpr size_t MAX_INLINE_SIZE = 64 * 1024;
+		static constexpr long long MAX_MULTIBULK_LENGTH = 1024 * 1024;
+		static constexpr long long MAX_BULK_LENGTH = 512LL * 1024 * 1024;
+
+		/* on COMMAND, args has the arguments and consumed the size of the
+		 * command, an empty inline line gives a command without arguments.
+		 * on PROTOCOL_ERROR the connection should be closed after replying
+		 * getError.
+		 */
+		Result parse(const char *data, size_t size, std::vector<std::string_view> &args, size_t &consumed)
+		{
+			if (mState == State::START)
+			{
+				if (size == 0)
+					return Result::NEED_MORE;
+				mState = data[0] == '*' ? State::MULTIBULK_LENGTH : State::INLINE;
+			}
+			Result result = mState == State::INLINE ? parseInline(data, size, args, consumed) : parseMultibulk(data, size, args, consumed);
+			if (result != Result::NEED_MORE)
+			{
+				mState = State::START;
+				mPos = 0;
+				mArgs.clear();
+			}
+			return result;
+		}
+
+		const std::string &getError() const { return mError; }
+
+		//after NEED_MORE inside a bulk argument, the size the command has at least, so a buffer can grow once
+		size_t getExpectedSize() const { return mState == State::BULK ? mPos + static_cast<size_t>(mBulkLength) + 2 : 0; }
+
+	private:
+		enum class State
+		{
+			START,
+			INLINE,
+			MULTIBULK_LENGTH,
+			BULK_LENGTH,
+			BULK
+		};
+
+		Result fail(const char *error)
+		{
+			mError = std::string("Protocol error: ") + error;
+			return Result::PROTOCOL_ERROR;
+		}
+
+		//the offset of the next "\r\n" from mPos, npos if not there yet
+		size_t findLine(const char *data, size_t size) const
+		{
+			const void *cr = mPos < size ? std::memchr(data + mPos, '\r', size - mPos) : nullptr;
+			if (!cr)
+				return std::string::npos;
+			size_t at = static_cast<const char *>(cr) - data;
+			return at + 1 < size ? at : std::string::npos;
+		}
+
+		static bool parseNumber(const char *begin, const char *end, long long &value)
+		{
+			auto result = std::from_chars(begin, end, value);
+			return result.ec == std::errc() && result.ptr == end;
+		}
+
+		Result parseInline(const char *data, size_t size, std::vector<std::string_view> &args, size_t &consumed)
+		{
+			const void *lf = std::memchr(data + mPos, '\n', size - mPos);
+			if (!lf)
+			{
+				if (size > MAX_INLINE_SIZE)
+					return fail("too big inline request");
+				mPos = size;
+				return Result::NEED_MORE;
+			}
+			size_t end = static_cast<const char *>(lf) - data;
+			consumed = end + 1;
+			if (end > 0 && data[end - 1] == '\r')
+				end--;
+			args.clear();
+			for (size_t i = 0; i < end;)
+			{
+				while (i < end && (data[i] == ' ' || data[i] == '\t'))
+					i++;
+				size_t begin = i;
+				while (i < end && data[i] != ' ' && data[i] != '\t')
+					i++;
+				if (i > begin)
+					args.emplace_back(data + begin, i - begin);
+			}
+			return Result::COMMAND;
+		}
+
+		Result parseMultibulk(const char *data, size_t size, std::vector<std::string_view> &args, size_t &consumed)
+		{
+			while (true)
+			{
+				if (mState == State::BULK)
+				{
+					if (size - mPos < static_cast<size_t>(mBulkLength) + 2)
+						return Result::NEED_MORE;
+					mArgs.emplace_back(mPos, static_cast<size_t>(mBulkLength));
+					mPos += static_cast<size_t>(mBulkLength) + 2;
+					mState = State::BULK_LENGTH;
+					continue;
+				}
+				if (mState == State::BULK_LENGTH && static_cast<long long>(mArgs.size()) == mMultibulkLength)
+					break;
+				size_t line = findLine(data, size);
+				if (line == std::string::npos)
+				{
+					if (size - mPos > MAX_INLINE_SIZE)
+						return fail(mState == State::MULTIBULK_LENGTH ? "too big mbulk count string" : "too big bulk count string");
+					return Result::NEED_MORE;
+				}
+				if (data[line + 1] != '\n')
+					return fail("invalid line ending");
+				if (mState == State::MULTIBULK_LENGTH)
+				{
+					if (!parseNumber(data + mPos + 1, data + line, mMultibulkLength) || mMultibulkLength > MAX_MULTIBULK_LENGTH)
+						return fail("invalid multibulk length");
+					mPos = line + 2;
+					mState = State::BULK_LENGTH;
+					//"*0" and "*-1" are empty commands
+					if (mMultibulkLength <= 0)
+						break;
+					mArgs.reserve(static_cast<size_t>(mMultibulkLength));
+					continue;
+				}
+				if (data[mPos] != '$')
+					return fail(("expected '$', got '" + std::string(1, data[mPos]) + "'").c_str());
+				if (!parseNumber(data + mPos + 1, data + line, mBulkLength) || mBulkLength < 0 || mBulkLength > MAX_BULK_LENGTH)
+					return fail("invalid bulk length");
+				mPos = line + 2;
+				mState = State::BULK;
+			}
+			args.clear();
+			for (auto &arg : mArgs)
+				args.emplace_back(data + arg.first, arg.second);
+			consumed = mPos;
+			return Result::COMMAND;
+		}
+
+		State mState = State::START;
+		//where to go on from the start of the command
+		size_t mPos = 0;
+		long long mMultibulkLength = 0;
+		long long mBulkLength = 0;
+		//offset and size of the complete arguments
+		std::vector<std::pair<size_t, size_t>> mArgs;
+		std::string mError;
+	};
+
+	/* serializes replies into a buffer which is kept between writes, so a
+	 * connection reuses the same memory for all of its replies. the types of
+	 * RESP3 are written in their RESP2 form when the version is RESP2.
+	 */
+	class RespWriter
+	{
+	public:
+		explicit RespWriter(RespVersion version = RespVersion::RESP2) : mVersion(version) {}
+
+		RespVersion getVersion() const { return mVersion; }
+		void setVersion(RespVersion version) { mVersion = version; }
+
+		void simple(std::string_view s) { line('+', s); }
+		void error(std::string_view s) { line('-', s); }
+		void integer(long long value) { number(':', value); }
+
+		void bulk(std::string_view s)
+		{
+			number('$', static_cast<long long>(s.size()));
+			mBuffer.append(s.data(), s.size());
+			mBuffer.append("\r\n", 2);
+		}
+
+		void null() { mBuffer.append(mVersion == RespVersion::RESP3 ? "_\r\n" : "$-1\r\n"); }
+		void nullArray() { mBuffer.append(mVersion == RespVersion::RESP3 ? "_\r\n" : "*-1\r\n"); }
+
+		//the header, the elements are written after it
+		void array(size_t size) { number('*', static_cast<long long>(size)); }
+		//size pairs of key and value, a flat array in RESP2
+		void map(size_t size) { mVersion == RespVersion::RESP3 ? number('%', static_cast<long long>(size)) : number('*', static_cast<long long>(size * 2)); }
+		void set(size_t size) { number(mVersion == RespVersion::RESP3 ? '~' : '*', static_cast<long long>(size)); }
+
+		void boolean(bool value)
+		{
+			if (mVersion == RespVersion::RESP3)
+				mBuffer.append(value ? "#t\r\n" : "#f\r\n");
+			else
+				integer(value ? 1 : 0);
+		}
+
+		//a bulk string in RESP2
+		void doubleValue(double value)
+		{
+			char text[32];
+			int n = std::snprintf(text, sizeof(text), "%.17g", value);
+			if (mVersion == RespVersion::RESP3)
+				line(',', std::string_view(text, n));
+			else
+				bulk(std::string_view(text, n));
+		}
+
+		//bytes already encoded
+		void raw(std::string_view s) { mBuffer.append(s.data(), s.size()); }
+
+		std::string &getBuffer() { return mBuffer; }
+		const char *data() const { return mBuffer.data(); }
+		size_t size() const { return mBuffer.size(); }
+		bool empty() const { return mBuffer.empty(); }
+		//the capacity is kept
+		void clear() { mBuffer.clear(); }
+
+	private:
+		void line(char type, std::string_view s)
+		{
+			mBuffer.push_back(type);
+			mBuffer.append(s.data(), s.size());
+			mBuffer.append("\r\n", 2);
+		}
+
+		void number(char type, long long value)
+		{
+			char text[24];
+			text[0] = type;
+			char *end = std::to_chars(text + 1, text + sizeof(text) - 2, value).ptr;
+			end[0] = '\r';
+			end[1] = '\n';
+			mBuffer.append(text, end + 2 - text);
+		}
+
+		RespVersion mVersion;
+		std::string mBuffer;
+	};
+	enum class RespType
+	{
+		SIMPLE_STRING,
+		BULK_STRING,
+		ERROR,
+		INTEGER,
+		NIL,
+		DOUBLE,
+		BOOLEAN,
+		BIG_NUMBER,
+		ARRAY,
+		MAP,
+		SET,
+		PUSH
+	};
+
+	/* one value of a parsed reply. the values are stored flat in the order
+	 * of the reply, the elements of an aggregate follow it.
+	 */
+	struct RespNode
+	{
+		RespType mType;
+		//the bytes of a string, error, double or big number, from the start of the reply
+		size_t mOffset;
+		size_t mLength;
+		//an integer or boolean, the number of elements of an aggregate, two per pair of a map
+		long long mInteger;
+		//the index after the last element, nested ones included
+		size_t mEnd;
+	};
+
+	/* a view of a value in a parsed reply, the strings point into the bytes
+	 * of the reply. the elements of an aggregate are iterated in order, a map
+	 * gives its keys and values alternately.
+	 */
+	class RespValue
+	{
+	public:
+		class Iterator
+		{
+		public:
+			Iterator(const RespNode *nodes, size_t index, const char *data) : mNodes(nodes), mIndex(index), mData(data) {}
+
+			RespValue operator*() const { return RespValue(mNodes, mIndex, mData); }
+			Iterator &operator++()
+			{
+				mIndex = mNodes[mIndex].mEnd;
+				return *this;
+			}
+			bool operator==(const Iterator &other) const { return mIndex == other.mIndex; }
+			bool operator!=(const Iterator &other) const { return mIndex != other.mIndex; }
+
+		private:
+			const RespNode *mNodes;
+			size_t mIndex;
+			const char *mData;
+		};
+
+		RespValue(const RespNode *nodes, size_t index, const char *data) : mNodes(nodes), mIndex(index), mData(data) {}
+
+		RespType getType() const { return node().mType; }
+		bool isError() const { return node().mType == RespType::ERROR; }
+		bool isNil() const { return node().mType == RespType::NIL; }
+		bool isAggregate() const { return node().mType >= RespType::ARRAY; }
+
+		//a string, error, double or big number, empty for the other types
+		std::string_view getString() const { return std::string_view(mData + node().mOffset, node().mLength); }
+		//an integer or boolean
+		long long getInteger() const { return node().mInteger; }
+		double getDouble() const { return std::strtod(std::string(getString()).c_str(), nullptr); }
+
+		//the elements of an aggregate
+		size_t size() const { return isAggregate() ? static_cast<size_t>(node().mInteger) : 0; }
+		Iterator begin() const { return Iterator(mNodes, mIndex + 1, mData); }
+		Iterator end() const { return Iterator(mNodes, node().mEnd, mData); }
+		//walks the elements before it
+		RespValue operator[](size_t i) const
+		{
+			Iterator it = begin();
+			while (i-- > 0)
+				++it;
+			return *it;
+		}
+
+	private:
+		friend class RespResult;
+
+		const RespNode &node() const { return mNodes[mIndex]; }
+
+		const RespNode *mNodes;
+		size_t mIndex;
+		const char *mData;
+	};
+
+	/* incremental RESP2 and RESP3 reply parser, the counterpart of RespParser
+	 * for a client. parse is given the unconsumed bytes starting at the
+	 * current reply, a complete reply is kept as offsets into them, nothing is
+	 * copied, and getValue views it until the next call. like RespParser, an
+	 * incomplete reply keeps its progress as offsets, the bytes may be moved
+	 * between calls. attributes are not supported.
+	 */
+	class RespReplyParser
+	{
+	public:
+		enum class Result
+		{
+			REPLY,
+			NEED_MORE,
+			PROTOCOL_ERROR
+		};
+
+		static constexpr size_t MAX_LINE_SIZE = 64 * 1024;
+		static constexpr long long MAX_BULK_LENGTH = 512LL * 1024 * 1024;
+
+		//on REPLY consumed is the size of the reply
+		Result parse(const char *data, size_t size, size_t &consumed)
+		{
+			if (mState == State::START)
+			{
+				mNodes.clear();
+				mOpen.clear();
+				mPos = 0;
+				mState = State::LINE;
+			}
+			while (true)
+			{
+				if (mState == State::BULK)
+				{
+					size_t length = static_cast<size_t>(mBulkLength);
+					if (size - mPos < length + 2)
+						return Result::NEED_MORE;
+					if (data[mPos + length] != '\r' || data[mPos + length + 1] != '\n')
+						return fail("invalid bulk ending");
+					//a verbatim string starts with its format, e.g. "txt:"
+					size_t skip = mBulkType == '=' && length >= 4 ? 4 : 0;
+					add(mBulkType == '!' ? RespType::ERROR : RespType::BULK_STRING, mPos + skip, length - skip, 0);
+					mPos += length + 2;
+					mState = State::LINE;
+					if (closeValue())
+						break;
+					continue;
+				}
+				size_t line = findLine(data, size);
+				if (line == std::string::npos)
+				{
+					if (size - mPos > MAX_LINE_SIZE)
+						return fail("too big reply line");
+					return Result::NEED_MORE;
+				}
+				if (data[line + 1] != '\n')
+					return fail("invalid line ending");
+				char type = data[mPos];
+				size_t begin = mPos + 1;
+				mPos = line + 2;
+				long long number = 0;
+				switch (type)
+				{
+				case '+':
+					add(RespType::SIMPLE_STRING, begin, line - begin, 0);
+					break;
+				case '-':
+					add(RespType::ERROR, begin, line - begin, 0);
+					break;
+				case ',':
+					add(RespType::DOUBLE, begin, line - begin, 0);
+					break;
+				case '(':
+					add(RespType::BIG_NUMBER, begin, line - begin, 0);
+					break;
+				case '_':
+					add(RespType::NIL, begin, 0, 0);
+					break;
+				case ':':
+					if (!parseNumber(data + begin, data + line, number))
+						return fail("invalid integer");
+					add(RespType::INTEGER, begin, 0, number);
+					break;
+				case '#':
+					if (line - begin != 1 || (data[begin] != 't' && data[begin] != 'f'))
+						return fail("invalid boolean");
+					add(RespType::BOOLEAN, begin, 0, data[begin] == 't' ? 1 : 0);
+					break;
+				case '$':
+				case '!':
+				case '=':
+					if (!parseNumber(data + begin, data + line, mBulkLength) || mBulkLength < -1 || mBulkLength > MAX_BULK_LENGTH || (mBulkLength == -1 && type != '$'))
+						return fail("invalid bulk length");
+					if (mBulkLength == -1)
+					{
+						add(RespType::NIL, begin, 0, 0);
+						break;
+					}
+					mBulkType = type;
+					mState = State::BULK;
+					continue;
+				case '*':
+				case '%':
+				case '~':
+				case '>':
+					if (!parseNumber(data + begin, data + line, number) || number < -1 || (number == -1 && type != '*'))
+						return fail("invalid aggregate length");
+					if (number == -1)
+					{
+						add(RespType::NIL, begin, 0, 0);
+						break;
+					}
+					number *= type == '%' ? 2 : 1;
+					add(type == '*' ? RespType::ARRAY : type == '%' ? RespType::MAP : type == '~' ? RespType::SET : RespType::PUSH, begin - 1, 0, number);
+					//the elements follow, an empty aggregate is complete
+					if (number > 0)
+					{
+						mOpen.push_back({mNodes.size() - 1, static_cast<size_t>(number)});
+						continue;
+					}
+					break;
+				default:
+					return fail(("unknown reply type '" + std::string(1, type) + "'").c_str());
+				}
+				if (closeValue())
+					break;
+			}
+			consumed = mPos;
+			mState = State::START;
+			return Result::REPLY;
+		}
+
+		//the reply of the last REPLY, data is where it starts
+		RespValue getValue(const char *data) const { return RespValue(mNodes.data(), 0, data); }
+
+		const std::string &getError() const { return mError; }
+
+		//after NEED_MORE inside a bulk string, the size the reply has at least, so a buffer can grow once
+		size_t getExpectedSize() const { return mState == State::BULK ? mPos + static_cast<size_t>(mBulkLength) + 2 : 0; }
+
+	private:
+		enum class State
+		{
+			START,
+			LINE,
+			BULK
+		};
+
+		//an aggregate waiting for its elements
+		struct Open
+		{
+			size_t mIndex;
+			size_t mLeft;
+		};
+
+		Result fail(const char *error)
+		{
+			mError = std::string("Protocol error: ") + error;
+			mState = State::START;
+			return Result::PROTOCOL_ERROR;
+		}
+
+		size_t findLine(const char *data, size_t size) const
+		{
+			const void *cr = mPos < size ? std::memchr(data + mPos, '\r', size - mPos) : nullptr;
+			if (!cr)
+				return std::string::npos;
+			size_t at = static_cast<const char *>(cr) - data;
+			return at + 1 < size ? at : std::string::npos;
+		}
+
+		static bool parseNumber(const char *begin, const char *end, long long &value)
+		{
+			auto result = std::from_chars(begin, end, value);
+			return result.ec == std::errc() && result.ptr == end;
+		}
+
+		void add(RespType type, size_t offset, size_t length, long long integer)
+		{
+			mNodes.push_back({type, offset, length, integer, mNodes.size() + 1});
+		}
+
+		//a value is complete, so are the aggregates it completes. true at the end of the reply
+		bool closeValue()
+		{
+			while (!mOpen.empty())
+			{
+				if (--mOpen.back().mLeft > 0)
+					return false;
+				mNodes[mOpen.back().mIndex].mEnd = mNodes.size();
+				mOpen.pop_back();
+			}
+			return true;
+		}
+
+		State mState = State::START;
+		size_t mPos = 0;
+		long long mBulkLength = 0;
+		char mBulkType = '$';
+		std::vector<RespNode> mNodes;
+		std::vector<Open> mOpen;
+		std::string mError;
+	};
+
+	/* a value which owns a copy of its bytes, for a reply used after the
+	 * buffer it was parsed from has moved on. the bytes of the value are
+	 * copied at once, its strings are not allocated one by one.
+	 */
+	class RespResult
+	{
+	public:
+		RespResult() : mNodes({{RespType::NIL, 0, 0, 0, 1}}) {}
+
+		explicit RespResult(const RespValue &value)
+		{
+			//the values are in the order of their bytes, the last one ends the value
+			const RespNode *first = &value.node();
+			const RespNode *last = &value.mNodes[first->mEnd - 1];
+			mData.assign(value.mData + first->mOffset, last->mOffset + last->mLength - first->mOffset);
+			mNodes.assign(first, last + 1);
+			for (auto &node : mNodes)
+			{
+				node.mOffset -= first->mOffset;
+				node.mEnd -= value.mIndex;
+			}
+		}
+
+		RespValue getValue() const { return RespValue(mNodes.data(), 0, mData.data()); }
+
+	private:
+		std::string mData;
+		std::vector<RespNode> mNodes;
+	};
+} // namespace Redis
+
+#endif
@@ -0,0 +1,390 @@
+#ifndef RESP_CLIENT_H
+#define RESP_CLIENT_H
+
+#include <algorithm>
+#include <atomic>
+#include <deque>
+#include <functional>
+#include <initializer_list>
+#include <iterator>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include <boost/asio.hpp>
+#include "resp.h"
+
+namespace Redis
+{
+	/* one pipelined client connection. the commands are sent without waiting
+	 * for the replies before them, the ones given while a write is in flight
+	 * or in the same turn of the loop go out together in the next write. the
+	 * replies are parsed in the read buffer and handed to the callbacks in the
+	 * order of the commands as views into it, valid until the callback
+	 * returns. the connection runs on its io_service, execute may be called
+	 * from any thread and the callbacks run on the io_service.
+	 * the connection is made on the first command. when it fails, the
+	 * commands waiting get the error and the next command connects again.
+	 */
+	class RespConnection : public std::enable_shared_from_this<RespConnection>
+	{
+	public:
+		using Callback = std::function<void(const boost::system::error_code &ec, const RespValue &value)>;
+		//a RESP3 push message, e.g. of pub/sub, it is not the reply to a command
+		using PushHandler = std::function<void(const RespValue &value)>;
+
+		static constexpr size_t INITIAL_BUFFER_SIZE = 16 * 1024;
+
+		RespConnection(boost::asio::io_service &ioService, const boost::asio::ip::tcp::endpoint &endpoint)
+			: mIoService(ioService), mEndpoint(endpoint), mSocket(ioService), mInput(INITIAL_BUFFER_SIZE) {}
+		RespConnection(const RespConnection &) = delete;
+		RespConnection &operator=(const RespConnection &) = delete;
+
+		boost::asio::io_service &getIoService() { return mIoService; }
+
+		//args is a range of strings, e.g. {"SET", "key", "value"}
+		template <typename Args>
+		void execute(const Args &args, Callback callback)
+		{
+			if (mIoService.get_executor().running_in_this_thread())
+			{
+				encode(mOutput, args);
+				queue(std::move(callback));
+				return;
+			}
+			RespWriter command;
+			encode(command, args);
+			executeEncoded(std::move(command.getBuffer()), std::move(callback));
+		}
+
+		void execute(std::initializer_list<std::string_view> args, Callback callback) { execute<std::initializer_list<std::string_view>>(args, std::move(callback)); }
+
+		/* the reply is given to a completion token as an owning RespResult,
+		 * void(boost::system::error_code, RespResult), e.g.
+		 * co_await connection->asyncExecute(args, boost::asio::use_awaitable)
+		 * in a C++20 coroutine, or boost::asio::use_future. the handler runs
+		 * on its associated executor.
+		 */
+		template <typename Args, typename CompletionToken>
+		auto asyncExecute(const Args &args, CompletionToken &&token)
+		{
+			RespWriter command;
+			encode(command, args);
+			return boost::asio::async_initiate<CompletionToken, void(boost::system::error_code, RespResult)>(
+				[this](auto handler, std::string command) {
+					executeEncoded(std::move(command), toCallback(std::move(handler), mIoService.get_executor()));
+				},
+				token, std::move(command.getBuffer()));
+		}
+
+		template <typename CompletionToken>
+		auto asyncExecute(std::initializer_list<std::string_view> args, CompletionToken &&token)
+		{
+			return asyncExecute<std::initializer_list<std::string_view>>(args, std::forward<CompletionToken>(token));
+		}
+
+		//set before the first command
+		void setPushHandler(PushHandler handler) { mPushHandler = std::move(handler); }
+
+		//the commands without a reply yet, on the thread of the io_service
+		size_t getPending() const { return mCallbacks.size(); }
+
+		//the commands waiting get operation_aborted, thread safe
+		void close()
+		{
+			auto self = shared_from_this();
+			boost::asio::dispatch(mIoService, [this, self]() { fail(boost::asio::error::operation_aborted); });
+		}
+
+		template <typename Args>
+		static void encode(RespWriter &out, const Args &args)
+		{
+			out.array(static_cast<size_t>(std::distance(std::begin(args), std::end(args))));
+			for (auto &arg : args)
+				out.bulk(std::string_view(arg));
+		}
+
+		/* the callback of a completion handler, the reply is copied once
+		 * before the read buffer moves on. the handler keeps its executor
+		 * busy until it runs.
+		 */
+		template <typename Handler, typename Executor>
+		static Callback toCallback(Handler handler, const Executor &ioExecutor)
+		{
+			auto executor = boost::asio::get_associated_executor(handler, ioExecutor);
+			using Work = decltype(boost::asio::make_work_guard(executor));
+			struct Pending
+			{
+				Handler mHandler;
+				Work mWork;
+			};
+			auto pending = std::make_shared<Pending>(Pending{std::move(handler), boost::asio::make_work_guard(executor)});
+			return [pending](const boost::system::error_code &ec, const RespValue &value) {
+				RespResult result = ec ? RespResult() : RespResult(value);
+				auto executor = pending->mWork.get_executor();
+				boost::asio::dispatch(executor, [pending, ec, result = std::move(result)]() mutable {
+					pending->mHandler(ec, std::move(result));
+					pending->mWork.reset();
+				});
+			};
+		}
+
+	private:
+		enum class State
+		{
+			CLOSED,
+			CONNECTING,
+			CONNECTED
+		};
+
+		void executeEncoded(std::string command, Callback callback)
+		{
+			auto self = shared_from_this();
+			boost::asio::dispatch(mIoService, [this, self, command = std::move(command), callback = std::move(callback)]() mutable {
+				mOutput.raw(command);
+				queue(std::move(callback));
+			});
+		}
+
+		//the command is in mOutput
+		void queue(Callback callback)
+		{
+			mCallbacks.push_back(std::move(callback));
+			if (mState == State::CLOSED)
+			{
+				connect();
+				return;
+			}
+			if (mState == State::CONNECTED && !mWriting && !mFlushPosted)
+			{
+				//the commands of this turn of the loop go out together
+				mFlushPosted = true;
+				auto self = shared_from_this();
+				uint64_t generation = mGeneration;
+				boost::asio::post(mIoService, [this, self, generation]() {
+					if (generation != mGeneration)
+						return;
+					mFlushPosted = false;
+					flush();
+				});
+			}
+		}
+
+		void connect()
+		{
+			mState = State::CONNECTING;
+			mSocket = boost::asio::ip::tcp::socket(mIoService);
+			auto self = shared_from_this();
+			uint64_t generation = mGeneration;
+			mSocket.async_connect(mEndpoint, [this, self, generation](const boost::system::error_code &ec) {
+				if (generation != mGeneration)
+					return;
+				if (ec)
+				{
+					fail(ec);
+					return;
+				}
+				boost::system::error_code ignored;
+				mSocket.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+				mState = State::CONNECTED;
+				flush();
+				doRead();
+			});
+		}
+
+		void flush()
+		{
+			if (mWriting || mOutput.empty())
+				return;
+			mWriting = true;
+			std::swap(mSending, mOutput.getBuffer());
+			auto self = shared_from_this();
+			uint64_t generation = mGeneration;
+			boost::asio::async_write(mSocket, boost::asio::buffer(mSending), [this, self, generation](const boost::system::error_code &ec, size_t) {
+				if (generation != mGeneration)
+					return;
+				mWriting = false;
+				mSending.clear();
+				if (ec)
+				{
+					fail(ec);
+					return;
+				}
+				flush();
+			});
+		}
+
+		void doRead()
+		{
+			//room for the rest of a large bulk string, or at least one byte
+			size_t need = std::max(mParser.getExpectedSize(), mInEnd - mInStart + 1);
+			if (mInStart > 0 && mInStart + need > mInput.size())
+			{
+				std::copy(mInput.begin() + mInStart, mInput.begin() + mInEnd, mInput.begin());
+				mInEnd -= mInStart;
+				mInStart = 0;
+			}
+			if (need > mInput.size())
+				mInput.resize(std::max(need, mInput.size() * 2));
+			auto self = shared_from_this();
+			uint64_t generation = mGeneration;
+			mSocket.async_read_some(boost::asio::buffer(mInput.data() + mInEnd, mInput.size() - mInEnd),
+									[this, self, generation](const boost::system::error_code &ec, size_t n) {
+										if (generation != mGeneration)
+											return;
+										if (ec)
+										{
+											fail(ec);
+											return;
+										}
+										onRead(n);
+									});
+		}
+
+		void onRead(size_t n)
+		{
+			mInEnd += n;
+			uint64_t generation = mGeneration;
+			while (true)
+			{
+				size_t consumed = 0;
+				const char *reply = mInput.data() + mInStart;
+				auto result = mParser.parse(reply, mInEnd - mInStart, consumed);
+				if (result == RespReplyParser::Result::NEED_MORE)
+					break;
+				if (result == RespReplyParser::Result::PROTOCOL_ERROR)
+				{
+					fail(boost::asio::error::invalid_argument);
+					return;
+				}
+				mInStart += consumed;
+				RespValue value = mParser.getValue(reply);
+				if (value.getType() == RespType::PUSH)
+				{
+					if (mPushHandler)
+						mPushHandler(value);
+				}
+				else if (mCallbacks.empty())
+				{
+					//a reply to no command
+					fail(boost::asio::error::invalid_argument);
+					return;
+				}
+				else
+				{
+					Callback callback = std::move(mCallbacks.front());
+					mCallbacks.pop_front();
+					callback(boost::system::error_code(), value);
+				}
+				//closed by a callback
+				if (generation != mGeneration)
+					return;
+			}
+			if (mInStart == mInEnd)
+				mInStart = mInEnd = 0;
+			doRead();
+		}
+
+		//the commands waiting get ec, the next command connects again
+		void fail(const boost::system::error_code &ec)
+		{
+			if (mState == State::CLOSED)
+				return;
+			mGeneration++;
+			mState = State::CLOSED;
+			boost::system::error_code ignored;
+			mSocket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+			mSocket.close(ignored);
+			mParser = RespReplyParser();
+			mInStart = mInEnd = 0;
+			mOutput.clear();
+			mSending.clear();
+			mWriting = false;
+			mFlushPosted = false;
+			std::deque<Callback> callbacks;
+			callbacks.swap(mCallbacks);
+			//a callback may already send the next command
+			RespResult nil;
+			for (auto &callback : callbacks)
+				callback(ec, nil.getValue());
+		}
+
+		boost::asio::io_service &mIoService;
+		const boost::asio::ip::tcp::endpoint mEndpoint;
+		boost::asio::ip::tcp::socket mSocket;
+		State mState = State::CLOSED;
+		//changes when the connection fails, the handlers of the old socket do nothing
+		uint64_t mGeneration = 0;
+		//the commands sent or waiting to be sent, in order
+		std::deque<Callback> mCallbacks;
+		PushHandler mPushHandler;
+		//the commands not sent yet
+		RespWriter mOutput;
+		//the buffer being written to the socket
+		std::string mSending;
+		bool mWriting = false;
+		bool mFlushPosted = false;
+		RespReplyParser mParser;
+		//the unparsed bytes are mInput[mInStart, mInEnd)
+		std::vector<char> mInput;
+		size_t mInStart = 0;
+		size_t mInEnd = 0;
+	};
+
+	/* a pool of pipelined connections to one server, spread over a set of
+	 * io_services, e.g. one per thread of a load generator. the commands go
+	 * to the connections round robin, so only the commands of one connection
+	 * are answered in order, getConnection keeps related commands together.
+	 */
+	class RespClient
+	{
+	public:
+		using Callback = RespConnection::Callback;
+
+		RespClient(const std::vector<boost::asio::io_service *> &ioServices, const std::string &host, const std::string &port, size_t connectionNumber)
+		{
+			boost::asio::ip::tcp::resolver resolver(*ioServices[0]);
+			boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(host, port).begin();
+			for (size_t i = 0; i < std::max<size_t>(connectionNumber, 1); i++)
+				mConnections.push_back(std::make_shared<RespConnection>(*ioServices[i % ioServices.size()], endpoint));
+		}
+
+		RespClient(boost::asio::io_service &ioService, const std::string &host, const std::string &port, size_t connectionNumber = 1)
+			: RespClient(std::vector<boost::asio::io_service *>{&ioService}, host, port, connectionNumber) {}
+
+		RespClient(const RespClient &) = delete;
+		RespClient &operator=(const RespClient &) = delete;
+
+		~RespClient() { close(); }
+
+		template <typename Args>
+		void execute(const Args &args, Callback callback) { next().execute(args, std::move(callback)); }
+
+		void execute(std::initializer_list<std::string_view> args, Callback callback) { next().execute(args, std::move(callback)); }
+
+		template <typename Args, typename CompletionToken>
+		auto asyncExecute(const Args &args, CompletionToken &&token) { return next().asyncExecute(args, std::forward<CompletionToken>(token)); }
+
+		template <typename CompletionToken>
+		auto asyncExecute(std::initializer_list<std::string_view> args, CompletionToken &&token) { return next().asyncExecute(args, std::forward<CompletionToken>(token)); }
+
+		size_t getConnectionNumber() const { return mConnections.size(); }
+		RespConnection &getConnection(size_t index) { return *mConnections[index]; }
+
+		//thread safe
+		void close()
+		{
+			for (auto &connection : mConnections)
+				connection->close();
+		}
+
+	private:
+		RespConnection &next() { return *mConnections[mNext.fetch_add(1, std::memory_order_relaxed) % mConnections.size()]; }
+
+		std::vector<std::shared_ptr<RespConnection>> mConnections;
+		std::atomic<size_t> mNext{0};
+	};
+} // namespace Redis
+
+#endif
@@ -0,0 +1,361 @@
+#ifndef RESP_SERVER_H
+#define RESP_SERVER_H
+
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <utility>
+#include <vector>
+#include "resp.h"
+
+namespace Redis
+{
+	class RespSession;
+
+	/* the reply to one command. a connection sends its replies in the order
+	 * of the commands, a reply ready before the earlier ones waits for them.
+	 * send is called once, on the thread running the connection.
+	 */
+	class RespReply
+	{
+	public:
+		//fn(RespWriter &) writes the reply
+		template <typename Fn>
+		void send(Fn &&fn);
+
+		RespSession &getSession() const { return *mSession; }
+
+	private:
+		friend class RespSession;
+		RespReply(std::shared_ptr<RespSession> session, uint64_t slot, RespVersion version) : mSession(std::move(session)), mSlot(slot), mVersion(version) {}
+
+		std::shared_ptr<RespSession> mSession;
+		uint64_t mSlot;
+		//of the session when the command was read, HELLO only changes the later replies
+		RespVersion mVersion;
+	};
+
+	/* one client connection. the commands are parsed from the read buffer
+	 * and handed to the handler as views into it, valid until the handler
+	 * returns. the replies written while a read is handled, including the
+	 * ones of all the pipelined commands in it, go out in one write. the
+	 * reply buffers are swapped between the writer and the socket, so they
+	 * keep their memory. the session stops reading while too many replies
+	 * are waiting to be sent.
+	 */
+	class RespSession : public std::enable_shared_from_this<RespSession>
+	{
+	public:
+		using Handler = std::function<void(const std::vector<std::string_view> &args, RespReply reply)>;
+
+		static constexpr size_t INITIAL_BUFFER_SIZE = 16 * 1024;
+		static constexpr size_t MAX_QUERY_BUFFER_SIZE = 1024 * 1024 * 1024;
+		static constexpr size_t MAX_OUTPUT_SIZE = 1024 * 1024;
+		static constexpr size_t MAX_WAITING_REPLIES = 1024;
+
+		RespSession(boost::asio::io_service &ioService, size_t core, std::shared_ptr<const Handler> handler, size_t maxQueryBufferSize = MAX_QUERY_BUFFER_SIZE)
+			: mSocket(ioService), mCore(core), mHandler(std::move(handler)), mMaxQueryBufferSize(maxQueryBufferSize), mInput(INITIAL_BUFFER_SIZE) {}
+		RespSession(const RespSession &) = delete;
+		RespSession &operator=(const RespSession &) = delete;
+
+		boost::asio::ip::tcp::socket &getSocket() { return mSocket; }
+		//the index of the io_service running the session
+		size_t getCore() const { return mCore; }
+		RespVersion getVersion() const { return mVersion; }
+		//for the replies of the commands read after this one
+		void setVersion(RespVersion version) { mVersion = version; }
+
+		//read no more commands, close once the waiting replies are sent, e.g. for QUIT
+		void closeAfterReplies() { mClosing = true; }
+
+		void start()
+		{
+			boost::system::error_code ignored;
+			mSocket.set_option(boost::asio::ip::tcp::no_delay(true), ignored);
+			doRead();
+		}
+
+	private:
+		friend class RespReply;
+
+		struct Slot
+		{
+			bool mDone = false;
+			std::string mData;
+		};
+
+		void doRead()
+		{
+			if (mReading || mClosing)
+				return;
+			//room for the rest of a large bulk argument, or at least one byte
+			size_t need = std::max(mParser.getExpectedSize(), mInEnd - mInStart + 1);
+			if (mInStart > 0 && mInStart + need > mInput.size())
+			{
+				std::copy(mInput.begin() + mInStart, mInput.begin() + mInEnd, mInput.begin());
+				mInEnd -= mInStart;
+				mInStart = 0;
+			}
+			if (need > mInput.size())
+			{
+				if (need > mMaxQueryBufferSize)
+				{
+					protocolError("Protocol error: query buffer limit reached");
+					return;
+				}
+				mInput.resize(std::max(need, std::min(mInput.size() * 2, mMaxQueryBufferSize)));
+			}
+			mReading = true;
+			auto self = shared_from_this();
+			mSocket.async_read_some(boost::asio::buffer(mInput.data() + mInEnd, mInput.size() - mInEnd),
+									[this, self](const boost::system::error_code &ec, size_t n) {
+										mReading = false;
+										if (ec)
+										{
+											//the client is gone, the replies still waiting are dropped
+											mClosing = true;
+											close();
+											return;
+										}
+										onRead(n);
+									});
+		}
+
+		void onRead(size_t n)
+		{
+			mInEnd += n;
+			mHandling = true;
+			while (!mClosing)
+			{
+				size_t consumed = 0;
+				auto result = mParser.parse(mInput.data() + mInStart, mInEnd - mInStart, mArgs, consumed);
+				if (result == RespParser::Result::NEED_MORE)
+					break;
+				if (result == RespParser::Result::PROTOCOL_ERROR)
+				{
+					protocolError(mParser.getError());
+					break;
+				}
+				mInStart += consumed;
+				if (!mArgs.empty())
+					(*mHandler)(mArgs, newReply());
+			}
+			mHandling = false;
+			if (mInStart == mInEnd)
+				mInStart = mInEnd = 0;
+			flush();
+			if (!isThrottled())
+				doRead();
+		}
+
+		RespReply newReply()
+		{
+			mSlots.emplace_back();
+			return RespReply(shared_from_this(), mFirstSlot + mSlots.size() - 1, mVersion);
+		}
+
+		void protocolError(const std::string &error)
+		{
+			//closing before the reply is sent, or the send would read the same bad input again
+			mClosing = true;
+			std::string message = "ERR " + error;
+			newReply().send([&](RespWriter &out) { out.error(message); });
+			flush();
+		}
+
+		template <typename Fn>
+		void complete(uint64_t slot, RespVersion version, Fn &&fn)
+		{
+			if (slot == mFirstSlot)
+			{
+				mOutput.setVersion(version);
+				fn(mOutput);
+				mSlots.pop_front();
+				mFirstSlot++;
+				while (!mSlots.empty() && mSlots.front().mDone)
+				{
+					mOutput.raw(mSlots.front().mData);
+					mSlots.pop_front();
+					mFirstSlot++;
+				}
+			}
+			else
+			{
+				RespWriter writer(version);
+				fn(writer);
+				Slot &waiting = mSlots[slot - mFirstSlot];
+				waiting.mData = std::move(writer.getBuffer());
+				waiting.mDone = true;
+			}
+			//the replies given while a read is handled are sent together after it
+			if (!mHandling)
+			{
+				flush();
+				if (!isThrottled())
+					doRead();
+			}
+		}
+
+		bool isThrottled() const { return mOutput.size() + mSending.size() > MAX_OUTPUT_SIZE || mSlots.size() >= MAX_WAITING_REPLIES; }
+
+		void flush()
+		{
+			if (mWriting)
+				return;
+			if (mOutput.empty())
+			{
+				if (mClosing && mSlots.empty())
+					close();
+				return;
+			}
+			mWriting = true;
+			std::swap(mSending, mOutput.getBuffer());
+			auto self = shared_from_this();
+			boost::asio::async_write(mSocket, boost::asio::buffer(mSending), [this, self](const boost::system::error_code &ec, size_t) {
+				mWriting = false;
+				mSending.clear();
+				if (ec)
+				{
+					mClosing = true;
+					close();
+					return;
+				}
+				flush();
+				if (!isThrottled())
+					doRead();
+			});
+		}
+
+		void close()
+		{
+			boost::system::error_code ignored;
+			mSocket.shutdown(boost::asio::ip::tcp::socket::shutdown_both, ignored);
+			mSocket.close(ignored);
+		}
+
+		boost::asio::ip::tcp::socket mSocket;
+		const size_t mCore;
+		std::shared_ptr<const Handler> mHandler;
+		const size_t mMaxQueryBufferSize;
+		RespVersion mVersion = RespVersion::RESP2;
+		RespParser mParser;
+		std::vector<std::string_view> mArgs;
+		//the unparsed bytes are mInput[mInStart, mInEnd)
+		std::vector<char> mInput;
+		size_t mInStart = 0;
+		size_t mInEnd = 0;
+		//the replies not sent yet in command order, the first has the number mFirstSlot
+		std::deque<Slot> mSlots;
+		uint64_t mFirstSlot = 0;
+		RespWriter mOutput;
+		//the buffer being written to the socket
+		std::string mSending;
+		bool mReading = false;
+		bool mWriting = false;
+		bool mHandling = false;
+		bool mClosing = false;
+	};
+
+	template <typename Fn>
+	void RespReply::send(Fn &&fn)
+	{
+		mSession->complete(mSlot, mVersion, std::forward<Fn>(fn));
+	}
+
+	/* RESP listener over a set of io_services, e.g. the cores of the http
+	 * server, a connection stays on the io_service which accepted it. with
+	 * SO_REUSEPORT every io_service has its own acceptor and the kernel
+	 * spreads the connections, otherwise the first one accepts them round
+	 * robin.
+	 */
+	class RespServer
+	{
+	public:
+		using Handler = RespSession::Handler;
+
+		//maxQueryBufferSize bounds the unparsed input of a connection, like client-query-buffer-limit
+		RespServer(const std::vector<boost::asio::io_service *> &ioServices, const std::string &address, const std::string &port, Handler handler,
+				   size_t maxQueryBufferSize = RespSession::MAX_QUERY_BUFFER_SIZE)
+			: mHandler(std::make_shared<const Handler>(std::move(handler))), mIoServices(ioServices), mMaxQueryBufferSize(maxQueryBufferSize)
+		{
+			boost::asio::ip::tcp::resolver resolver(*mIoServices[0]);
+			boost::asio::ip::tcp::endpoint endpoint = *resolver.resolve(address, port).begin();
+#if defined(SO_REUSEPORT)
+			mPerCore = mIoServices.size() > 1;
+#endif
+			size_t listenerNumber = mPerCore ? mIoServices.size() : 1;
+			for (size_t i = 0; i < listenerNumber; i++)
+			{
+				mListeners.emplace_back(new Listener(*mIoServices[i], i));
+				auto &acceptor = mListeners.back()->mAcceptor;
+				acceptor.open(endpoint.protocol());
+				acceptor.set_option(boost::asio::ip::tcp::acceptor::reuse_address(true));
+#if defined(SO_REUSEPORT)
+				if (mPerCore)
+					acceptor.set_option(boost::asio::detail::socket_option::boolean<SOL_SOCKET, SO_REUSEPORT>(true));
+#endif
+				acceptor.bind(endpoint);
+				acceptor.listen();
+				doAccept(*mListeners.back());
+			}
+		}
+		RespServer(const RespServer &) = delete;
+		RespServer &operator=(const RespServer &) = delete;
+
+		//close the acceptors, thread safe. the connections end with their io_services
+		void stop()
+		{
+			for (auto &listener : mListeners)
+			{
+				Listener *l = listener.get();
+				boost::asio::post(l->mIoService, [l]() {
+					boost::system::error_code ignored;
+					l->mAcceptor.close(ignored);
+				});
+			}
+		}
+
+	private:
+		struct Listener
+		{
+			Listener(boost::asio::io_service &ioService, size_t core) : mIoService(ioService), mAcceptor(ioService), mCore(core) {}
+
+			boost::asio::io_service &mIoService;
+			boost::asio::ip::tcp::acceptor mAcceptor;
+			size_t mCore;
+		};
+
+		void doAccept(Listener &listener)
+		{
+			size_t owner = mPerCore ? listener.mCore : mNextCore++ % mIoServices.size();
+			auto session = std::make_shared<RespSession>(*mIoServices[owner], owner, mHandler, mMaxQueryBufferSize);
+			listener.mAcceptor.async_accept(session->getSocket(), [this, &listener, session, owner](const boost::system::error_code &ec) {
+				if (!listener.mAcceptor.is_open())
+					return;
+				if (!ec)
+				{
+					if (owner == listener.mCore)
+						session->start();
+					else
+						boost::asio::post(*mIoServices[owner], [session]() { session->start(); });
+				}
+				doAccept(listener);
+			});
+		}
+
+		std::shared_ptr<const Handler> mHandler;
+		std::vector<boost::asio::io_service *> mIoServices;
+		std::vector<std::unique_ptr<Listener>> mListeners;
+		const size_t mMaxQueryBufferSize;
+		//an acceptor per io_service
+		bool mPerCore = false;
+		size_t mNextCore = 0;
+	};
+} // namespace Redis
+
+#endif
@@ -1,20 +1,260 @@
+#include <algorithm>
+#include <cctype>
+#include <chrono>
+#include <cstdint>
 #include <iostream>
+#include <memory>
+#include <sstream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
 #include <http/server.hpp>
 #include <http/request.hpp>
 #include <http/reply.hpp>
+#include "affinity.h"
+#include "respServer.h"
+#include "shard.h"
+
+namespace {
+
+/// Sample where the calling thread runs every second, a move to another
+/// NUMA node is logged when it happens.
+void sample_placement(Redis::PlacementMonitor &monitor, std::shared_ptr<boost::asio::steady_timer> timer) {
+  timer->expires_after(std::chrono::seconds(1));
+  timer->async_wait([&monitor, timer](const boost::system::error_code &ec) {
+    if (ec) {
+      return;
+    }
+    std::uint64_t before = monitor.getNodeMigrations();
+    monitor.sample();
+    if (monitor.getNodeMigrations() != before) {
+      std::cout << "thread moved to another NUMA node" << std::endl << monitor.report();
+    }
+    sample_placement(monitor, timer);
+  });
+}
+
+/// Write a keyspace result as RESP, one reply type per result type.
+void write_result(Redis::RespWriter &out, const Redis::KeyspaceResult &result) {
+  using type = Redis::KeyspaceResult::Type;
+  switch (result.mType) {
+  case type::STATUS:
+    out.simple(result.mValue);
+    break;
+  case type::VALUE:
+    out.bulk(result.mValue);
+    break;
+  case type::NIL:
+    out.null();
+    break;
+  case type::INTEGER:
+    out.integer(result.mInteger);
+    break;
+  case type::ERROR:
+    out.error(result.mValue);
+    break;
+  }
+}
+
+/// The same result as the text of an HTTP reply, an error is a bad request
+/// and a missing key reads (nil).
+http::server::reply make_reply(const Redis::KeyspaceResult &result) {
+  using type = Redis::KeyspaceResult::Type;
+  http::server::reply rep(result.mType == type::NIL ? std::string("(nil)")
+      : result.mType == type::INTEGER ? std::to_string(result.mInteger) : result.mValue);
+  if (result.mType == type::ERROR) {
+    rep.status = http::server::reply::bad_request;
+  }
+  rep.content_type = http::server::reply::text_plain;
+  return rep;
+}
+
+/// A RESP command, the connection commands are answered here and the others
+/// go to the shards like /cmd/. The views are copied into the arguments of
+/// the shard runtime.
+void handle_resp(Redis::ShardRuntime &shards, const std::vector<std::string_view> &args, Redis::RespReply reply) {
+  std::string name(args[0]);
+  std::transform(name.begin(), name.end(), name.begin(), [](unsigned char c) { return std::toupper(c); });
+  if (name == "HELLO") {
+    if (args.size() > 1 && args[1] != "2" && args[1] != "3") {
+      reply.send([](Redis::RespWriter &out) { out.error("NOPROTO unsupported protocol version"); });
+      return;
+    }
+    // The reply to HELLO is already in the new version.
+    Redis::RespVersion version = args.size() > 1 && args[1] == "3" ? Redis::RespVersion::RESP3 : Redis::RespVersion::RESP2;
+    reply.getSession().setVersion(version);
+    reply.send([version](Redis::RespWriter &out) {
+      out.setVersion(version);
+      out.map(3);
+      out.bulk("server");
+      out.bulk("redisd");
+      out.bulk("proto");
+      out.integer(static_cast<int>(version));
+      out.bulk("mode");
+      out.bulk("standalone");
+    });
+    return;
+  }
+  if (name == "QUIT") {
+    reply.send([](Redis::RespWriter &out) { out.simple("OK"); });
+    reply.getSession().closeAfterReplies();
+    return;
+  }
+  // Asked by redis-cli and redis-benchmark when they connect.
+  if (name == "COMMAND" || name == "CONFIG") {
+    reply.send([](Redis::RespWriter &out) { out.array(0); });
+    return;
+  }
+  Redis::Keyspace::Args command(args.begin(), args.end());
+  command[0] = name;
+  std::size_t core = reply.getSession().getCore();
+  shards.execute(core, std::move(command), [reply](Redis::KeyspaceResult result) mutable {
+    reply.send([&](Redis::RespWriter &out) { write_result(out, result); });
+  });
+}
+
+/// Where a /keys stream is: the shard being scanned and its cursor.
+struct key_scan {
+  std::size_t shard = 0;
+  std::size_t cursor = 0;
+};
+
+/// Give the next keys of the scan to next, one per line, an empty piece
+/// when every shard is done. The scan of a shard runs on its owner, which
+/// moves the cursor before the reply comes back over the mailbox.
+void scan_keys(Redis::ShardRuntime &shards, std::size_t core, std::shared_ptr<key_scan> scan,
+    http::server::reply::chunk_callback next) {
+  if (scan->shard == shards.getShardNumber()) {
+    next(std::string());
+    return;
+  }
+  shards.run(core, scan->shard, [scan](Redis::Keyspace &keyspace) {
+    std::vector<std::string> keys;
+    scan->cursor = keyspace.scan(scan->cursor, keys, 256);
+    std::string chunk;
+    for (auto &key : keys) {
+      chunk += key;
+      chunk += '\n';
+    }
+    return chunk;
+  }, [&shards, core, scan, next](std::string chunk) {
+    if (scan->cursor == 0) {
+      scan->shard++;
+    }
+    // An empty piece would end the reply, an empty shard is skipped.
+    if (chunk.empty()) {
+      scan_keys(shards, core, scan, next);
+      return;
+    }
+    next(std::move(chunk));
+  });
+}
+
+} // namespace
 
 int main(int argc, char *argv[]) {
-  // Initialise the server.
+  // Initialise the server, one thread per hardware thread unless given. The
+  // mode is per_core (default), threaded_io or shared. The I/O threads are
+  // pinned by the third argument, "compact" for one cpu each node by node,
+  // a cpu list like 0-7 for one cpu each from the list, or none (default).
+  // The fourth argument is the cpu list shared by the executor thread.
   using namespace http::server;
-  server s("127.0.0.1", "8086", 1);
+  std::size_t cores = argc > 1 ? std::stoul(argv[1]) : std::thread::hardware_concurrency();
+  if (cores == 0) {
+    cores = 1;
+  }
+  std::string mode_name = argc > 2 ? argv[2] : "per_core";
+  server::execution_mode mode = mode_name == "threaded_io" ? server::execution_mode::threaded_io
+      : mode_name == "shared" ? server::execution_mode::shared : server::execution_mode::per_core;
+  Redis::CpuPlacement io_cpus(argc > 3 ? argv[3] : "none");
+  Redis::CpuPlacement executor_cpus(argc > 4 ? argv[4] : "none", true);
+  server s("127.0.0.1", "8086", cores, mode);
+
+  // In per_core mode every core owns a partition of the keyspace and the
+  // mailboxes of a core are drained on its own io_service. In threaded_io
+  // mode all commands run on the executor thread, one partition is enough.
+  // The shared mode runs handlers concurrently, it only serves /hello.
+  Redis::ShardRuntime shards(mode == server::execution_mode::per_core ? s.core_num() : 1);
+  for (std::size_t i = 0; i < shards.getShardNumber(); i++) {
+    auto &io_service = s.get_io_service(i);
+    shards.setWakeup(i, [&shards, &io_service, i]() {
+      io_service.post([&shards, i]() { shards.poll(i); });
+    });
+  }
+
+  // Every thread pins itself first, then allocates the data of the shard it
+  // runs, so the data is first touched on its NUMA node. The executor runs
+  // shard 0 in threaded_io mode. No thread serves before all are placed.
+  Redis::PlacementMonitor placement;
+  s.set_thread_init([&](server::thread_role role, std::size_t index) {
+    if (role == server::thread_role::executor) {
+      placement.place("executor", executor_cpus.cpusOf(0));
+      shards.placeShard(0);
+      return;
+    }
+    placement.place("io-" + std::to_string(index), io_cpus.cpusOf(index));
+    if (mode == server::execution_mode::per_core) {
+      shards.placeShard(index);
+    }
+  });
+  for (std::size_t i = 0; i < s.core_num(); i++) {
+    auto &io_service = s.get_io_service(i);
+    io_service.post([&placement, &io_service, i]() {
+      if (i == 0) {
+        std::cout << "io backend: " << server::io_backend() << std::endl << placement.report();
+      }
+      sample_placement(placement, std::make_shared<boost::asio::steady_timer>(io_service));
+    });
+  }
 
   s.add_handler("/hello", [](const request &req) {
     reply rep("hello world");
-    rep.headers["Content-Type"] = "text/plain";
+    rep.content_type = reply::text_plain;
     return rep;
   });
 
+  // /cmd/SET/key/value, /cmd/GET/key, ...
+  if (mode != server::execution_mode::shared) {
+    s.add_async_handler("/cmd/", [&shards](const request &req, request_handler::reply_callback done) {
+      std::vector<std::string> args;
+      std::istringstream path(req.uri.substr(5));
+      for (std::string arg; std::getline(path, arg, '/');) {
+        args.push_back(arg);
+      }
+      shards.execute(server::current_core(), std::move(args), [done](Redis::KeyspaceResult result) {
+        done(make_reply(result));
+      });
+    });
+  }
+
+  // /keys streams every key, one per line, in chunks from a cursor over the
+  // shards. The scan waits while the client is slow to read.
+  if (mode == server::execution_mode::per_core) {
+    s.add_handler("/keys", [&shards](const request &) {
+      std::size_t core = server::current_core();
+      auto scan = std::make_shared<key_scan>();
+      return reply::stream([&shards, core, scan](reply::chunk_callback next) {
+        scan_keys(shards, core, scan, std::move(next));
+      });
+    });
+  }
+
+  // RESP on port 6379 in per_core mode, a connection runs on the core which
+  // accepted it, like the HTTP ones.
+  std::unique_ptr<Redis::RespServer> resp;
+  if (mode == server::execution_mode::per_core) {
+    std::vector<boost::asio::io_service *> io_services;
+    for (std::size_t i = 0; i < s.core_num(); i++) {
+      io_services.push_back(&s.get_io_service(i));
+    }
+    resp.reset(new Redis::RespServer(io_services, "127.0.0.1", "6379",
+        [&shards](const std::vector<std::string_view> &args, Redis::RespReply reply) {
+          handle_resp(shards, args, std::move(reply));
+        }));
+  }
+
   // Run the server until stopped.
   s.run();
   return 0;
-}
\ No newline at end of file
+}
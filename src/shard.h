@@ -0,0 +1,325 @@
+#ifndef SHARD_H
+#define SHARD_H
+
+#include <atomic>
+#include <cstdint>
+#include <deque>
+#include <functional>
+#include <memory>
+#include <string>
+#include <utility>
+#include <vector>
+#include "hash.h"
+#include "threadPool.h"
+
+namespace Redis
+{
+	/* the reply of a keyspace command, typed so that a value is never taken
+	 * for an error or a nil. mValue is the text of STATUS, VALUE and ERROR,
+	 * mInteger the number of INTEGER.
+	 */
+	struct KeyspaceResult
+	{
+		enum class Type
+		{
+			STATUS,
+			VALUE,
+			NIL,
+			INTEGER,
+			ERROR
+		};
+
+		Type mType = Type::NIL;
+		std::string mValue;
+		int64_t mInteger = 0;
+
+		static KeyspaceResult status(std::string text) { return KeyspaceResult{Type::STATUS, std::move(text), 0}; }
+		static KeyspaceResult value(std::string value) { return KeyspaceResult{Type::VALUE, std::move(value), 0}; }
+		static KeyspaceResult nil() { return KeyspaceResult{Type::NIL, std::string(), 0}; }
+		static KeyspaceResult integer(int64_t n) { return KeyspaceResult{Type::INTEGER, std::string(), n}; }
+		static KeyspaceResult error(std::string message) { return KeyspaceResult{Type::ERROR, std::move(message), 0}; }
+	};
+
+	/* the string keyspace of one shard. it is not synchronized, only the
+	 * thread owning the shard touches it.
+	 */
+	class Keyspace
+	{
+	public:
+		using Args = std::vector<std::string>;
+		using Result = KeyspaceResult;
+
+		//GET key, SET key value, DEL key, EXISTS key, PING
+		Result execute(const Args &args)
+		{
+			if (args.empty())
+				return Result::error("ERR empty command");
+			const std::string &name = args[0];
+			if (name == "PING" && args.size() == 1)
+				return Result::status("PONG");
+			if (name == "GET" && args.size() == 2)
+			{
+				const std::string *value = mDict.peek(args[1]);
+				return value ? Result::value(*value) : Result::nil();
+			}
+			if (name == "SET" && args.size() == 3)
+			{
+				if (mDict.isExist(args[1]))
+					mDict.get(args[1]) = args[2];
+				else
+					mDict.insert(args[1], args[2]);
+				return Result::status("OK");
+			}
+			if (name == "DEL" && args.size() == 2)
+				return Result::integer(mDict.erase(args[1]) ? 1 : 0);
+			if (name == "EXISTS" && args.size() == 2)
+				return Result::integer(mDict.isExist(args[1]) ? 1 : 0);
+			return Result::error("ERR unknown command or wrong number of arguments for '" + name + "'");
+		}
+
+		/* append the keys of the buckets from cursor on until count keys are
+		 * found, like HashMap::scan. return the cursor to go on from, 0 when
+		 * the scan is done.
+		 */
+		size_t scan(size_t cursor, std::vector<std::string> &keys, size_t count = 64)
+		{
+			size_t found = 0;
+			do
+			{
+				mScanned.clear();
+				cursor = mDict.scan(cursor, mScanned);
+				for (auto &entry : mScanned)
+					keys.push_back(entry.first);
+				found += mScanned.size();
+			} while (cursor != 0 && found < count);
+			return cursor;
+		}
+
+	private:
+		RedisDataStructure::HashMap<std::string, std::string> mDict;
+		std::vector<std::pair<std::string, std::string>> mScanned;
+	};
+
+	/* shared nothing execution over shardNumber shards, one per core. every
+	 * key is owned by the shard selected by its hash, and the keyspace of a
+	 * shard is only touched by the thread running it, so there is no lock on
+	 * the data. a command for a key of another shard is sent to the owner over
+	 * a lock free SPSC mailbox, one per (sender, receiver) pair, and the reply
+	 * comes back the same way, so the callback always runs on the thread which
+	 * called execute.
+	 * the owner of a shard calls execute and poll from its own thread only.
+	 * setWakeup registers how a shard is told that its mailboxes have work,
+	 * e.g. by posting poll to its io_context. the wakeups are coalesced, one
+	 * wakeup is pending per shard at most.
+	 */
+	class ShardRuntime
+	{
+	public:
+		using Args = Keyspace::Args;
+		using Callback = std::function<void(Keyspace::Result)>;
+		using Task = std::function<std::string(Keyspace &)>;
+		using TaskCallback = std::function<void(std::string)>;
+
+		explicit ShardRuntime(size_t shardNumber, size_t mailboxSize = 1024) : mShardNumber(shardNumber > 0 ? shardNumber : 1), mMailboxSize(mailboxSize)
+		{
+			for (size_t i = 0; i < mShardNumber; i++)
+				mShards.emplace_back(new Shard(mShardNumber));
+			mMailboxes.resize(mShardNumber * mShardNumber);
+			for (size_t from = 0; from < mShardNumber; from++)
+			{
+				for (size_t to = 0; to < mShardNumber; to++)
+				{
+					if (from != to)
+						mMailboxes[from * mShardNumber + to].reset(new Mailbox(mailboxSize));
+				}
+			}
+		}
+		ShardRuntime(const ShardRuntime &) = delete;
+		ShardRuntime &operator=(const ShardRuntime &) = delete;
+
+		size_t getShardNumber() const { return mShardNumber; }
+
+		//the low bits of the hash pick the bucket inside the shard, so the shard is taken from the high bits
+		size_t shardOf(const std::string &key) const
+		{
+			uint64_t hash = static_cast<uint64_t>(mHasher(key)) * 0x9E3779B97F4A7C15ull;
+			return static_cast<size_t>(hash >> 32) % mShardNumber;
+		}
+
+		//call before the shards start running
+		void setWakeup(size_t shard, std::function<void()> wakeup) { mShards[shard]->mWakeup = std::move(wakeup); }
+
+		Keyspace &getKeyspace(size_t shard) { return mShards[shard]->mKeyspace; }
+
+		/* allocate the data of shard and the mailboxes it reads again from the
+		 * calling thread, so a thread pinned to a NUMA node gets them in its
+		 * local memory by first touch. called by the thread which will run the
+		 * shard before any shard runs, the data is dropped.
+		 */
+		void placeShard(size_t shard)
+		{
+			std::unique_ptr<Shard> placed(new Shard(mShardNumber));
+			placed->mWakeup = std::move(mShards[shard]->mWakeup);
+			mShards[shard] = std::move(placed);
+			for (size_t from = 0; from < mShardNumber; from++)
+			{
+				if (from != shard)
+					mMailboxes[from * mShardNumber + shard].reset(new Mailbox(mMailboxSize));
+			}
+		}
+
+		/* run args on behalf of shard from. a command on a local key, or
+		 * without key, is executed and done is called before returning,
+		 * otherwise done is called later from poll(from).
+		 */
+		void execute(size_t from, Args args, Callback done)
+		{
+			size_t owner = args.size() > 1 ? shardOf(args[1]) : from;
+			if (owner == from)
+			{
+				done(mShards[from]->mKeyspace.execute(args));
+				return;
+			}
+			Message message;
+			message.mArgs = std::move(args);
+			message.mDone = std::move(done);
+			message.mFrom = from;
+			send(from, owner, std::move(message));
+		}
+
+		/* run task on the keyspace of shard on behalf of shard from, like
+		 * execute. the result of the task is given to done.
+		 */
+		void run(size_t from, size_t shard, Task task, TaskCallback done)
+		{
+			if (shard == from)
+			{
+				done(task(mShards[from]->mKeyspace));
+				return;
+			}
+			Message message;
+			message.mTask = std::move(task);
+			//the text comes back as the value of a result
+			message.mDone = [done = std::move(done)](Keyspace::Result result) { done(std::move(result.mValue)); };
+			message.mFrom = from;
+			send(from, shard, std::move(message));
+		}
+
+		/* drain the mailboxes of shard: execute the forwarded commands, run
+		 * the callbacks of the replies and retry the messages which did not
+		 * fit in a full mailbox. return the number of messages handled.
+		 */
+		size_t poll(size_t shard)
+		{
+			Shard &self = *mShards[shard];
+			self.mNotified.store(false);
+			bool again = flushPending(shard);
+			size_t handled = 0;
+			Message message;
+			for (size_t from = 0; from < mShardNumber; from++)
+			{
+				if (from == shard)
+					continue;
+				Mailbox &mailbox = *mMailboxes[from * mShardNumber + shard];
+				//bounded so a busy peer can not starve the connections of this shard
+				size_t limit = mailbox.getMaxSize();
+				while (limit-- > 0 && mailbox.tryPop(message))
+				{
+					handled++;
+					if (message.mIsReply)
+					{
+						message.mDone(std::move(message.mResult));
+						continue;
+					}
+					message.mResult = message.mTask ? Keyspace::Result::value(message.mTask(self.mKeyspace)) : self.mKeyspace.execute(message.mArgs);
+					message.mArgs.clear();
+					message.mTask = nullptr;
+					message.mIsReply = true;
+					size_t to = message.mFrom;
+					send(shard, to, std::move(message));
+				}
+				if (limit == static_cast<size_t>(-1) && !mailbox.empty())
+					again = true;
+			}
+			if (again)
+				notify(shard);
+			return handled;
+		}
+
+	private:
+		struct Message
+		{
+			Args mArgs;
+			//run instead of the command when set
+			Task mTask;
+			Callback mDone;
+			Keyspace::Result mResult;
+			size_t mFrom = 0;
+			bool mIsReply = false;
+		};
+		using Mailbox = ConcurrentQueueSPSC<Message>;
+
+		struct alignas(64) Shard
+		{
+			explicit Shard(size_t shardNumber) : mPending(shardNumber), mNotified(false) {}
+
+			Keyspace mKeyspace;
+			//messages to each shard which did not fit in the mailbox, only touched by the owner
+			std::vector<std::deque<Message>> mPending;
+			std::function<void()> mWakeup;
+			std::atomic<bool> mNotified;
+		};
+
+		void send(size_t from, size_t to, Message message)
+		{
+			auto &pending = mShards[from]->mPending[to];
+			if (!pending.empty() || !mMailboxes[from * mShardNumber + to]->tryPush(std::move(message)))
+			{
+				pending.push_back(std::move(message));
+				notify(from);
+				return;
+			}
+			notify(to);
+		}
+
+		//return true if some messages are still pending
+		bool flushPending(size_t from)
+		{
+			bool left = false;
+			for (size_t to = 0; to < mShardNumber; to++)
+			{
+				auto &pending = mShards[from]->mPending[to];
+				if (pending.empty())
+					continue;
+				Mailbox &mailbox = *mMailboxes[from * mShardNumber + to];
+				bool pushed = false;
+				while (!pending.empty() && mailbox.tryPush(std::move(pending.front())))
+				{
+					pending.pop_front();
+					pushed = true;
+				}
+				if (pushed)
+					notify(to);
+				left = left || !pending.empty();
+			}
+			return left;
+		}
+
+		//pairs with the store in poll, either poll sees the new message or we see the flag cleared
+		void notify(size_t shard)
+		{
+			Shard &target = *mShards[shard];
+			if (!target.mNotified.exchange(true) && target.mWakeup)
+				target.mWakeup();
+		}
+
+		const size_t mShardNumber;
+		const size_t mMailboxSize;
+		RedisDataStructure::HashFunction<std::string> mHasher;
+		std::vector<std::unique_ptr<Shard>> mShards;
+		//mMailboxes[from * mShardNumber + to]
+		std::vector<std::unique_ptr<Mailbox>> mMailboxes;
+	};
+} // namespace Redis
+
+#endif
@@ -1,19 +1,599 @@
 #ifndef THREADPOOL_H
 #define THREADPOOL_H
 
+#include <cassert>
 #include <thread>
 #include <mutex>
 #include <condition_variable>
 #include <queue>
 #include <atomic>
+#include <deque>
+#include <functional>
+#include <iterator>
+#include <future>
+#include <memory>
+#include <stdexcept>
+#include <tuple>
+#include <type_traits>
+#include <utility>
+#include <vector>
 #include <spdlog/spdlog.h>
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+#include <immintrin.h>
+#endif
 
 namespace Redis
 {
+	//hint the cpu that this is a spin wait loop
+	inline void cpuRelax()
+	{
+#if defined(__x86_64__) || defined(__i386__) || defined(_M_X64) || defined(_M_IX86)
+		_mm_pause();
+#else
+		std::this_thread::yield();
+#endif
+	}
+
+	/* bounded MPMC queue with sequence numbered slots, by Dmitry Vyukov. a
+	 * push or pop is one CAS on the position plus the store of the slot
+	 * sequence, there is no lock and no allocation per element, and T may be
+	 * move only. the capacity is rounded up to a power of 2.
+	 * waitPush/waitPop spin for a while, then park on a condition variable.
+	 * the waiters are counted, so the other side only takes the mutex and
+	 * notifies when someone is parked.
+	 */
+	template <typename T>
+	class ConcurrentQueueLockFree
+	{
+	public:
+		explicit ConcurrentQueueLockFree(size_t s) : mMask(roundUpPower2(s) - 1), mCells(new Cell[mMask + 1]), mEnqueuePos(0), mDequeuePos(0),
+													 mPushWaiters(0), mPopWaiters(0)
+		{
+			for (size_t i = 0; i <= mMask; i++)
+				mCells[i].mSequence.store(i, std::memory_order_relaxed);
+		}
+		~ConcurrentQueueLockFree()
+		{
+			//no one else uses the queue now, so every slot between the positions is filled
+			size_t enqueuePos = mEnqueuePos.load(std::memory_order_relaxed);
+			for (size_t pos = mDequeuePos.load(std::memory_order_relaxed); pos != enqueuePos; pos++)
+				reinterpret_cast<T *>(&mCells[pos & mMask].mStorage)->~T();
+		}
+		ConcurrentQueueLockFree(const ConcurrentQueueLockFree &) = delete;
+		ConcurrentQueueLockFree &operator=(const ConcurrentQueueLockFree &) = delete;
+
+		template <typename U>
+		bool tryPush(U &&value)
+		{
+			if (!enqueue(std::forward<U>(value)))
+				return false;
+			wake(mPopWaiters, mNotEmpty);
+			return true;
+		}
+
+		bool tryPop(T &value)
+		{
+			if (!dequeue(value))
+				return false;
+			wake(mPushWaiters, mNotFull);
+			return true;
+		}
+
+		template <typename U>
+		void waitPush(U &&value)
+		{
+			for (int i = 0; i < getSpinCount(); i++)
+			{
+				if (tryPush(std::forward<U>(value)))
+					return;
+				cpuRelax();
+			}
+			park(mPushWaiters, mNotFull, [&]() { return enqueue(std::forward<U>(value)); });
+			wake(mPopWaiters, mNotEmpty);
+		}
+
+		void waitPop(T &value)
+		{
+			for (int i = 0; i < getSpinCount(); i++)
+			{
+				if (tryPop(value))
+					return;
+				cpuRelax();
+			}
+			park(mPopWaiters, mNotEmpty, [&]() { return dequeue(value); });
+			wake(mPushWaiters, mNotFull);
+		}
+
+		/* bulk versions claim a run of ready slots with one CAS and wake the
+		 * other side once per batch. tryPushBulk pushes what fits and returns
+		 * the number pushed, pushBulk waits until all are pushed. the elements
+		 * are copied, pass std::make_move_iterator to move them, e.g. for a move
+		 * only T. if constructing a T may throw, the elements are pushed one by
+		 * one, and a throw leaves the elements before it pushed.
+		 */
+		template <typename ForwardIt>
+		size_t tryPushBulk(ForwardIt first, ForwardIt last)
+		{
+			size_t pushed = 0, n;
+			while (first != last && (n = enqueueBulk(first, std::distance(first, last))) > 0)
+				pushed += n;
+			if (pushed > 0)
+				wake(mPopWaiters, mNotEmpty, pushed > 1);
+			return pushed;
+		}
+
+		template <typename ForwardIt>
+		void pushBulk(ForwardIt first, ForwardIt last)
+		{
+			int spins = 0;
+			while (first != last)
+			{
+				size_t n = enqueueBulk(first, std::distance(first, last));
+				if (n == 0 && spins++ < getSpinCount())
+				{
+					cpuRelax();
+					continue;
+				}
+				if (n == 0)
+					park(mPushWaiters, mNotFull, [&]() { return (n = enqueueBulk(first, std::distance(first, last))) > 0; });
+				wake(mPopWaiters, mNotEmpty, n > 1);
+				spins = 0;
+			}
+		}
+
+		//pop up to max elements to out, return the number popped
+		template <typename OutputIt>
+		size_t tryPopBulk(OutputIt out, size_t max)
+		{
+			size_t popped = 0, n;
+			while (popped < max && (n = dequeueBulk(out, max - popped)) > 0)
+				popped += n;
+			if (popped > 0)
+				wake(mPushWaiters, mNotFull, popped > 1);
+			return popped;
+		}
+
+		//wait until at least one element is popped
+		template <typename OutputIt>
+		size_t popBulk(OutputIt out, size_t max)
+		{
+			for (int i = 0; i < getSpinCount(); i++)
+			{
+				size_t n = tryPopBulk(out, max);
+				if (n > 0)
+					return n;
+				cpuRelax();
+			}
+			size_t n = 0;
+			park(mPopWaiters, mNotEmpty, [&]() { return (n = dequeueBulk(out, max)) > 0; });
+			wake(mPushWaiters, mNotFull, n > 1);
+			return n;
+		}
+
+		//approximate while other threads are pushing or popping
+		std::size_t getSize() const
+		{
+			size_t enqueuePos = mEnqueuePos.load(std::memory_order_relaxed);
+			size_t dequeuePos = mDequeuePos.load(std::memory_order_relaxed);
+			return enqueuePos > dequeuePos ? enqueuePos - dequeuePos : 0;
+		}
+		bool empty() const { return getSize() == 0; }
+		std::size_t getMaxSize() const { return mMask + 1; }
+
+	private:
+		static constexpr int SPIN_COUNT = 128;
+
+		//spinning only wastes the time slice of the other side on a single core
+		static int getSpinCount()
+		{
+			static const int spinCount = std::thread::hardware_concurrency() > 1 ? SPIN_COUNT : 1;
+			return spinCount;
+		}
+
+		struct Cell
+		{
+			std::atomic<size_t> mSequence;
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type mStorage;
+		};
+
+		static size_t roundUpPower2(size_t s)
+		{
+			size_t result = 2;
+			while (result < s)
+				result <<= 1;
+			return result;
+		}
+
+		//push and pop without waking the other side
+		template <typename U>
+		bool enqueue(U &&value)
+		{
+			size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+			Cell *cell;
+			while (true)
+			{
+				cell = &mCells[pos & mMask];
+				size_t seq = cell->mSequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos);
+				if (diff == 0)
+				{
+					if (mEnqueuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					//the slot of the last round is not popped yet
+					return false;
+				}
+				else
+				{
+					pos = mEnqueuePos.load(std::memory_order_relaxed);
+				}
+			}
+			new (&cell->mStorage) T(std::forward<U>(value));
+			cell->mSequence.store(pos + 1, std::memory_order_release);
+			return true;
+		}
+
+		bool dequeue(T &value)
+		{
+			size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+			Cell *cell;
+			while (true)
+			{
+				cell = &mCells[pos & mMask];
+				size_t seq = cell->mSequence.load(std::memory_order_acquire);
+				intptr_t diff = static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1);
+				if (diff == 0)
+				{
+					if (mDequeuePos.compare_exchange_weak(pos, pos + 1, std::memory_order_relaxed))
+						break;
+				}
+				else if (diff < 0)
+				{
+					return false;
+				}
+				else
+				{
+					pos = mDequeuePos.load(std::memory_order_relaxed);
+				}
+			}
+			T *item = reinterpret_cast<T *>(&cell->mStorage);
+			value = std::move(*item);
+			item->~T();
+			//the slot is free for the push of the next round
+			cell->mSequence.store(pos + mMask + 1, std::memory_order_release);
+			return true;
+		}
+
+		//claim the run of free slots from the enqueue position, at most n
+		template <typename ForwardIt>
+		size_t enqueueBulk(ForwardIt &first, size_t n)
+		{
+			/* a claimed slot must be filled, or the consumers wait for it forever.
+			 * so a T which may throw is constructed before its slot is claimed.
+			 */
+			if constexpr (!std::is_nothrow_constructible<T, decltype(*first)>::value)
+			{
+				static_assert(std::is_nothrow_move_constructible<T>::value, "the move of T into its slot must not throw");
+				if (!enqueue(T(*first)))
+					return 0;
+				++first;
+				return 1;
+			}
+			size_t pos = mEnqueuePos.load(std::memory_order_relaxed);
+			size_t count;
+			while (true)
+			{
+				count = 0;
+				while (count < n && mCells[(pos + count) & mMask].mSequence.load(std::memory_order_acquire) == pos + count)
+					count++;
+				if (count > 0)
+				{
+					if (mEnqueuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+						break;
+					continue;
+				}
+				size_t seq = mCells[pos & mMask].mSequence.load(std::memory_order_acquire);
+				if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos) < 0)
+					return 0;
+				pos = mEnqueuePos.load(std::memory_order_relaxed);
+			}
+			for (size_t i = 0; i < count; i++, ++first)
+			{
+				Cell *cell = &mCells[(pos + i) & mMask];
+				new (&cell->mStorage) T(*first);
+				cell->mSequence.store(pos + i + 1, std::memory_order_release);
+			}
+			return count;
+		}
+
+		//claim the run of filled slots from the dequeue position, at most n
+		template <typename OutputIt>
+		size_t dequeueBulk(OutputIt &out, size_t n)
+		{
+			size_t pos = mDequeuePos.load(std::memory_order_relaxed);
+			size_t count;
+			while (true)
+			{
+				count = 0;
+				while (count < n && mCells[(pos + count) & mMask].mSequence.load(std::memory_order_acquire) == pos + count + 1)
+					count++;
+				if (count > 0)
+				{
+					if (mDequeuePos.compare_exchange_weak(pos, pos + count, std::memory_order_relaxed))
+						break;
+					continue;
+				}
+				size_t seq = mCells[pos & mMask].mSequence.load(std::memory_order_acquire);
+				if (static_cast<intptr_t>(seq) - static_cast<intptr_t>(pos + 1) < 0)
+					return 0;
+				pos = mDequeuePos.load(std::memory_order_relaxed);
+			}
+			for (size_t i = 0; i < count; i++)
+			{
+				Cell *cell = &mCells[(pos + i) & mMask];
+				T *item = reinterpret_cast<T *>(&cell->mStorage);
+				*out++ = std::move(*item);
+				item->~T();
+				cell->mSequence.store(pos + i + mMask + 1, std::memory_order_release);
+			}
+			return count;
+		}
+
+		//the fence pairs with the one in park, either the waiter sees the new state or we see the waiter
+		void wake(std::atomic<int> &waiters, std::condition_variable &cond, bool all = false)
+		{
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			if (waiters.load(std::memory_order_relaxed) > 0)
+			{
+				std::lock_guard<std::mutex> lock(mMutex);
+				if (all)
+					cond.notify_all();
+				else
+					cond.notify_one();
+			}
+		}
+
+		template <typename Pred>
+		void park(std::atomic<int> &waiters, std::condition_variable &cond, Pred pred)
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			waiters.fetch_add(1, std::memory_order_relaxed);
+			std::atomic_thread_fence(std::memory_order_seq_cst);
+			cond.wait(lock, pred);
+			waiters.fetch_sub(1, std::memory_order_relaxed);
+		}
+
+		const size_t mMask;
+		std::unique_ptr<Cell[]> mCells;
+		alignas(64) std::atomic<size_t> mEnqueuePos;
+		alignas(64) std::atomic<size_t> mDequeuePos;
+		alignas(64) std::atomic<int> mPushWaiters;
+		std::atomic<int> mPopWaiters;
+		std::mutex mMutex;
+		std::condition_variable mNotFull, mNotEmpty;
+	};
+
+	/* bounded queue for exactly one producer thread and one consumer thread.
+	 * each side owns its position and keeps a cached copy of the other one, so
+	 * a push or pop is a plain store plus a load of the other position only
+	 * when the cache says the ring is full or empty. there is no waiting, the
+	 * caller decides what to do when tryPush or tryPop fails.
+	 */
+	template <typename T>
+	class ConcurrentQueueSPSC
+	{
+	public:
+		explicit ConcurrentQueueSPSC(size_t s) : mMask(roundUpPower2(s) - 1), mSlots(new Slot[mMask + 1]), mHead(0), mTailCache(0), mTail(0), mHeadCache(0) {}
+		~ConcurrentQueueSPSC()
+		{
+			T value;
+			while (tryPop(value))
+				;
+		}
+		ConcurrentQueueSPSC(const ConcurrentQueueSPSC &) = delete;
+		ConcurrentQueueSPSC &operator=(const ConcurrentQueueSPSC &) = delete;
+
+		//producer side
+		template <typename U>
+		bool tryPush(U &&value)
+		{
+			size_t tail = mTail.load(std::memory_order_relaxed);
+			if (tail - mHeadCache > mMask)
+			{
+				mHeadCache = mHead.load(std::memory_order_acquire);
+				if (tail - mHeadCache > mMask)
+					return false;
+			}
+			new (&mSlots[tail & mMask].mStorage) T(std::forward<U>(value));
+			mTail.store(tail + 1, std::memory_order_release);
+			return true;
+		}
+
+		//consumer side
+		bool tryPop(T &value)
+		{
+			size_t head = mHead.load(std::memory_order_relaxed);
+			if (head == mTailCache)
+			{
+				mTailCache = mTail.load(std::memory_order_acquire);
+				if (head == mTailCache)
+					return false;
+			}
+			T *item = reinterpret_cast<T *>(&mSlots[head & mMask].mStorage);
+			value = std::move(*item);
+			item->~T();
+			mHead.store(head + 1, std::memory_order_release);
+			return true;
+		}
+
+		//approximate unless called by one of the two sides
+		size_t getSize() const
+		{
+			size_t head = mHead.load(std::memory_order_relaxed);
+			size_t tail = mTail.load(std::memory_order_relaxed);
+			return tail > head ? tail - head : 0;
+		}
+		bool empty() const { return getSize() == 0; }
+		std::size_t getMaxSize() const { return mMask + 1; }
+
+	private:
+		struct Slot
+		{
+			typename std::aligned_storage<sizeof(T), alignof(T)>::type mStorage;
+		};
+
+		static size_t roundUpPower2(size_t s)
+		{
+			size_t result = 2;
+			while (result < s)
+				result <<= 1;
+			return result;
+		}
+
+		const size_t mMask;
+		std::unique_ptr<Slot[]> mSlots;
+		//consumer line
+		alignas(64) std::atomic<size_t> mHead;
+		size_t mTailCache;
+		//producer line
+		alignas(64) std::atomic<size_t> mTail;
+		size_t mHeadCache;
+	};
+
+	/* type erased, move only callable, so a task can own a packaged_task or
+	 * a buffer which is freed in background.
+	 */
 	class ThreadTask
 	{
 	public:
-		void run() {}
+		ThreadTask() = default;
+		template <typename Fn, typename = std::enable_if_t<!std::is_same<std::decay_t<Fn>, ThreadTask>::value>>
+		explicit ThreadTask(Fn &&fn) : mImpl(new Impl<std::decay_t<Fn>>(std::forward<Fn>(fn))) {}
+		ThreadTask(ThreadTask &&) = default;
+		ThreadTask &operator=(ThreadTask &&) = default;
+
+		void run()
+		{
+			if (mImpl)
+				mImpl->run();
+		}
+		explicit operator bool() const { return static_cast<bool>(mImpl); }
+
+	private:
+		struct ImplBase
+		{
+			virtual ~ImplBase() {}
+			virtual void run() = 0;
+		};
+		template <typename Fn>
+		struct Impl : ImplBase
+		{
+			explicit Impl(Fn &&fn) : mFn(std::move(fn)) {}
+			explicit Impl(const Fn &fn) : mFn(fn) {}
+			void run() override { mFn(); }
+			Fn mFn;
+		};
+		std::unique_ptr<ImplBase> mImpl;
+	};
+
+	/* Chase-Lev work stealing deque, as in "Correct and Efficient Work-Stealing
+	 * for Weak Memory Models". the owner pushes and pops at the bottom, other
+	 * threads steal from the top. T must be trivially copyable, the pool keeps
+	 * ThreadTask pointers in it. the array grows when it is full, the old arrays
+	 * may still be read by a thief so they are freed with the deque.
+	 */
+	template <typename T>
+	class WorkStealingDeque
+	{
+	public:
+		explicit WorkStealingDeque(size_t capacity = 1024) : mTop(0), mBottom(0), mArray(new Array(capacity)) {}
+		~WorkStealingDeque()
+		{
+			delete mArray.load();
+			for (auto array : mGarbage)
+				delete array;
+		}
+		WorkStealingDeque(const WorkStealingDeque &) = delete;
+		WorkStealingDeque &operator=(const WorkStealingDeque &) = delete;
+
+		//only called by the owner
+		void push(T item)
+		{
+			int64_t b = mBottom.load(std::memory_order_relaxed);
+			int64_t t = mTop.load(std::memory_order_acquire);
+			Array *array = mArray.load(std::memory_order_relaxed);
+			if (b - t > static_cast<int64_t>(array->mCapacity) - 1)
+			{
+				mGarbage.push_back(array);
+				array = array->grow(b, t);
+				mArray.store(array, std::memory_order_release);
+			}
+			array->put(b, item);
+			mBottom.store(b + 1, std::memory_order_release);
+		}
+
+		//only called by the owner, the last pushed item is taken first
+		bool pop(T &item)
+		{
+			int64_t b = mBottom.load(std::memory_order_relaxed) - 1;
+			Array *array = mArray.load(std::memory_order_relaxed);
+			mBottom.store(b, std::memory_order_seq_cst);
+			int64_t t = mTop.load(std::memory_order_seq_cst);
+			if (t > b)
+			{
+				mBottom.store(b + 1, std::memory_order_relaxed);
+				return false;
+			}
+			item = array->get(b);
+			if (t == b)
+			{
+				//the last item, race with the thieves
+				bool won = mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+				mBottom.store(b + 1, std::memory_order_relaxed);
+				return won;
+			}
+			return true;
+		}
+
+		//called by any thread, the first pushed item is taken first
+		bool steal(T &item)
+		{
+			int64_t t = mTop.load(std::memory_order_seq_cst);
+			int64_t b = mBottom.load(std::memory_order_seq_cst);
+			if (t >= b)
+				return false;
+			Array *array = mArray.load(std::memory_order_acquire);
+			item = array->get(t);
+			return mTop.compare_exchange_strong(t, t + 1, std::memory_order_seq_cst, std::memory_order_relaxed);
+		}
+
+		bool empty() const { return mBottom.load(std::memory_order_relaxed) <= mTop.load(std::memory_order_relaxed); }
+
+	private:
+		struct Array
+		{
+			explicit Array(size_t capacity) : mCapacity(capacity), mMask(capacity - 1), mData(new std::atomic<T>[capacity]) {}
+			~Array() { delete[] mData; }
+			T get(int64_t i) const { return mData[i & mMask].load(std::memory_order_relaxed); }
+			void put(int64_t i, T item) { mData[i & mMask].store(item, std::memory_order_relaxed); }
+			Array *grow(int64_t b, int64_t t) const
+			{
+				Array *array = new Array(mCapacity * 2);
+				for (int64_t i = t; i < b; i++)
+					array->put(i, get(i));
+				return array;
+			}
+			size_t mCapacity; //power of 2
+			size_t mMask;
+			std::atomic<T> *mData;
+		};
+
+		alignas(64) std::atomic<int64_t> mTop;
+		alignas(64) std::atomic<int64_t> mBottom;
+		std::atomic<Array *> mArray;
+		std::vector<Array *> mGarbage;
 	};
 
 	template <typename T, typename Container = std::queue<T>>
@@ -63,6 +643,47 @@ namespace Redis
 			return true;
 		}
 
+		/* push [first, last) under one lock and wake the consumers once per
+		 * batch, wait like waitPush while the queue is full.
+		 */
+		template <typename InputIt>
+		void pushBulk(InputIt first, InputIt last)
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			while (first != last)
+			{
+				size_t pushed = 0;
+				for (; first != last && mData.size() < mMaxSize; ++first, ++pushed)
+					mData.emplace(*first);
+				if (pushed > 1)
+					mCond.notify_all();
+				else if (pushed == 1)
+					mCond.notify_one();
+				if (first != last)
+				{
+					lock.unlock();
+					std::this_thread::yield();
+					lock.lock();
+				}
+			}
+		}
+
+		//pop up to max elements to out under one lock, wait until the queue is not empty. return the number popped.
+		template <typename OutputIt>
+		size_t popBulk(OutputIt out, size_t max)
+		{
+			std::unique_lock<std::mutex> lock(mMutex);
+			mCond.wait(lock, [&]() { return !mData.empty(); });
+			return popAvailable(out, max);
+		}
+
+		template <typename OutputIt>
+		size_t tryPopBulk(OutputIt out, size_t max)
+		{
+			std::lock_guard<std::mutex> lock(mMutex);
+			return popAvailable(out, max);
+		}
+
 		bool empty() const
 		{
 			std::lock_guard<std::mutex> lock(mMutex);
@@ -100,6 +721,18 @@ namespace Redis
 		}
 
 	private:
+		template <typename OutputIt>
+		size_t popAvailable(OutputIt &out, size_t max)
+		{
+			size_t popped = 0;
+			for (; popped < max && !mData.empty(); popped++)
+			{
+				*out++ = std::move(mData.front());
+				mData.pop();
+			}
+			return popped;
+		}
+
 		mutable std::mutex mMutex;
 		std::condition_variable mCond;
 		Container mData;
@@ -107,9 +740,265 @@ namespace Redis
 		std::size_t mMaxSize;
 	};
 
+	/* work stealing thread pool. every worker owns one deque per priority, a
+	 * task submitted by a worker goes to its own deque and is popped LIFO
+	 * while it is hot in cache, idle workers steal the oldest tasks from the
+	 * others. tasks from other threads go to a global queue per priority.
+	 * a worker always looks for HIGH work everywhere before BACKGROUND work,
+	 * so lazy free, rehash and snapshot do not delay the commands.
+	 * shutdown stops new submits from other threads, runs all the queued
+	 * tasks, then joins the workers.
+	 */
 	class ThreadPool
 	{
+	public:
+		enum class Priority
+		{
+			HIGH,
+			BACKGROUND
+		};
+
+		explicit ThreadPool(size_t threadNumber = std::thread::hardware_concurrency());
+		//threadInit(index) runs first in every worker, e.g. to pin it to a cpu set
+		ThreadPool(size_t threadNumber, std::function<void(size_t)> threadInit);
+		//a pool destroyed by its own worker is a bug, it must not throw from here
+		~ThreadPool()
+		{
+			assert(currentContext().mPool != this);
+			stop();
+		}
+		ThreadPool(const ThreadPool &) = delete;
+		ThreadPool &operator=(const ThreadPool &) = delete;
+
+		//run fn(args...) with HIGH priority, the future gets the result or the exception
+		template <typename Fn, typename... Args>
+		auto submit(Fn &&fn, Args &&...args) -> std::future<std::invoke_result_t<std::decay_t<Fn>, std::decay_t<Args>...>>
+		{
+			return submit(Priority::HIGH, std::forward<Fn>(fn), std::forward<Args>(args)...);
+		}
+
+		template <typename Fn, typename... Args>
+		auto submit(Priority priority, Fn &&fn, Args &&...args) -> std::future<std::invoke_result_t<std::decay_t<Fn>, std::decay_t<Args>...>>
+		{
+			using Result = std::invoke_result_t<std::decay_t<Fn>, std::decay_t<Args>...>;
+			std::packaged_task<Result()> task(
+				[fn = std::forward<Fn>(fn), args = std::make_tuple(std::forward<Args>(args)...)]() mutable { return std::apply(fn, std::move(args)); });
+			auto future = task.get_future();
+			post(priority, std::move(task));
+			return future;
+		}
+
+		//fire and forget, an exception thrown by fn terminates the process like std::thread
+		template <typename Fn>
+		void post(Priority priority, Fn &&fn)
+		{
+			schedule(priority, new ThreadTask(std::forward<Fn>(fn)));
+		}
+
+		void shutdown();
+		size_t getThreadNumber() const { return mWorkers.size(); }
+
+		//the shared pool of the process, sized by the number of cores
+		static ThreadPool &getDefault()
+		{
+			static ThreadPool pool;
+			return pool;
+		}
+
+	private:
+		static constexpr int PRIORITY_NUMBER = 2;
+		static constexpr int SPIN_ROUNDS = 64;
+
+		struct Worker
+		{
+			WorkStealingDeque<ThreadTask *> mDeques[PRIORITY_NUMBER];
+			std::thread mThread;
+		};
+
+		struct GlobalQueue
+		{
+			std::mutex mMutex;
+			std::deque<ThreadTask *> mTasks;
+		};
+
+		//the pool and index of the current thread, nullptr if it is not a worker
+		struct WorkerContext
+		{
+			ThreadPool *mPool;
+			size_t mIndex;
+		};
+		static WorkerContext &currentContext()
+		{
+			static thread_local WorkerContext context{nullptr, 0};
+			return context;
+		}
+
+		void schedule(Priority priority, ThreadTask *task);
+		void stop();
+		ThreadTask *findTask(size_t index);
+		void workerLoop(size_t index);
+
+		std::function<void(size_t)> mThreadInit;
+		std::vector<std::unique_ptr<Worker>> mWorkers;
+		GlobalQueue mGlobalQueues[PRIORITY_NUMBER];
+		std::atomic<int64_t> mQueued; //submitted but not taken, may be ahead of the queues for a moment
+		std::atomic<int> mSleepers;
+		std::atomic<bool> mStopping;
+		std::mutex mSleepMutex;
+		std::condition_variable mSleepCond;
+		std::mutex mShutdownMutex;
 	};
+
+	inline ThreadPool::ThreadPool(size_t threadNumber) : ThreadPool(threadNumber, nullptr) {}
+
+	inline ThreadPool::ThreadPool(size_t threadNumber, std::function<void(size_t)> threadInit)
+		: mThreadInit(std::move(threadInit)), mQueued(0), mSleepers(0), mStopping(false)
+	{
+		threadNumber = std::max<size_t>(1, threadNumber);
+		for (size_t i = 0; i < threadNumber; i++)
+			mWorkers.emplace_back(new Worker());
+		//the deques are all created before any worker may steal from them
+		for (size_t i = 0; i < threadNumber; i++)
+			mWorkers[i]->mThread = std::thread(&ThreadPool::workerLoop, this, i);
+	}
+
+	inline void ThreadPool::schedule(Priority priority, ThreadTask *task)
+	{
+		int lane = static_cast<int>(priority);
+		WorkerContext &context = currentContext();
+		mQueued.fetch_add(1);
+		if (context.mPool == this)
+		{
+			mWorkers[context.mIndex]->mDeques[lane].push(task);
+		}
+		else
+		{
+			std::lock_guard<std::mutex> lock(mGlobalQueues[lane].mMutex);
+			if (mStopping)
+			{
+				mQueued.fetch_sub(1);
+				delete task;
+				throw std::runtime_error("submit to a ThreadPool which is shut down");
+			}
+			mGlobalQueues[lane].mTasks.push_back(task);
+		}
+		if (mSleepers.load() > 0)
+		{
+			std::lock_guard<std::mutex> lock(mSleepMutex);
+			mSleepCond.notify_one();
+		}
+	}
+
+	inline ThreadTask *ThreadPool::findTask(size_t index)
+	{
+		ThreadTask *task = nullptr;
+		for (int lane = 0; lane < PRIORITY_NUMBER; lane++)
+		{
+			if (mWorkers[index]->mDeques[lane].pop(task))
+				return task;
+			{
+				GlobalQueue &queue = mGlobalQueues[lane];
+				std::lock_guard<std::mutex> lock(queue.mMutex);
+				if (!queue.mTasks.empty())
+				{
+					task = queue.mTasks.front();
+					queue.mTasks.pop_front();
+					return task;
+				}
+			}
+			//start from the next worker, so the thieves spread over the victims
+			for (size_t i = 1; i < mWorkers.size(); i++)
+			{
+				if (mWorkers[(index + i) % mWorkers.size()]->mDeques[lane].steal(task))
+					return task;
+			}
+		}
+		return nullptr;
+	}
+
+	inline void ThreadPool::workerLoop(size_t index)
+	{
+		if (mThreadInit)
+			mThreadInit(index);
+		currentContext() = WorkerContext{this, index};
+		int idle = 0;
+		while (true)
+		{
+			ThreadTask *task = findTask(index);
+			if (task)
+			{
+				mQueued.fetch_sub(1);
+				//the sleepers of a stopping pool wait for mQueued to change, see below
+				if (mStopping && mSleepers.load() > 0)
+				{
+					std::lock_guard<std::mutex> lock(mSleepMutex);
+					mSleepCond.notify_all();
+				}
+				task->run();
+				delete task;
+				idle = 0;
+				continue;
+			}
+			if (mStopping && mQueued.load() <= 0)
+				break;
+			if (++idle < SPIN_ROUNDS)
+			{
+				std::this_thread::yield();
+				continue;
+			}
+			std::unique_lock<std::mutex> lock(mSleepMutex);
+			mSleepers.fetch_add(1);
+			if (mStopping)
+			{
+				/* mStopping is true from now on, so waiting for it would spin while
+				 * the other workers finish the last tasks. wait until a task is
+				 * taken or added instead, both wake the sleepers while stopping.
+				 */
+				int64_t queued = mQueued.load();
+				mSleepCond.wait(lock, [&]() { return queued <= 0 || mQueued.load() != queued; });
+			}
+			else
+			{
+				mSleepCond.wait(lock, [&]() { return mQueued.load() > 0 || mStopping; });
+			}
+			mSleepers.fetch_sub(1);
+			idle = 0;
+		}
+		currentContext() = WorkerContext{nullptr, 0};
+	}
+
+	inline void ThreadPool::shutdown()
+	{
+		//a worker would join itself
+		if (currentContext().mPool == this)
+			throw std::runtime_error("shutdown of a ThreadPool from its own worker");
+		stop();
+	}
+
+	inline void ThreadPool::stop()
+	{
+		std::lock_guard<std::mutex> shutdownLock(mShutdownMutex);
+		if (mWorkers.empty())
+			return;
+		for (auto &queue : mGlobalQueues)
+		{
+			std::lock_guard<std::mutex> lock(queue.mMutex);
+			mStopping = true;
+		}
+		{
+			std::lock_guard<std::mutex> lock(mSleepMutex);
+			mSleepCond.notify_all();
+		}
+		for (auto &worker : mWorkers)
+		{
+			//only reached from the destructor when the assert is compiled out
+			if (worker->mThread.get_id() == std::this_thread::get_id())
+				worker->mThread.detach();
+			else
+				worker->mThread.join();
+		}
+		mWorkers.clear();
+	}
 } // namespace Redis
 
 #endif
\ No newline at end of file
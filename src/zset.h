@@ -0,0 +1,285 @@
+#ifndef ZSET_H
+#define ZSET_H
+
+#include <memory>
+#include <stdexcept>
+#include <string>
+#include <string_view>
+#include <type_traits>
+#include <utility>
+#include "SkipList.h"
+#include "BPlusTree.h"
+#include "hash.h"
+#include "listpack.h"
+
+namespace RedisDataStructure
+{
+    //thresholds of the listpack encoding, same meaning as zset-max-listpack-entries/value in redis.
+    struct SortedSetConfig
+    {
+        size_t mMaxListPackEntries = 128;
+        size_t mMaxListPackValue = 64;
+    };
+
+    /* SortedSet maps member to score and keeps the members ordered by score.
+     * small sets are stored in a ListPack, once the set grows past the entries
+     * threshold, or a member longer than the value threshold is added, it is
+     * converted to a SkipList ordered by score plus a HashMap from member to
+     * score. the conversion is one way, like redis.
+     * the ordered index of the big encoding is chosen at compile time, it is
+     * SkipList or BPlusTree, or anything with the same interface. getEncoding
+     * reports BPLUSTREE for a BPlusTree and SKIPLIST for the others.
+     */
+    template <template <typename, typename> class OrderedIndex = SkipList>
+    class BasicSortedSet : public Util::noncopyable
+    {
+    public:
+        enum class Encoding
+        {
+            LISTPACK,
+            SKIPLIST,
+            BPLUSTREE
+        };
+
+        using Index = OrderedIndex<double, std::string>;
+        //the encoding once the set is converted, named after the ordered index
+        static constexpr Encoding INDEX_ENCODING =
+            std::is_same<Index, BPlusTree<double, std::string>>::value ? Encoding::BPLUSTREE : Encoding::SKIPLIST;
+
+        explicit BasicSortedSet(const SortedSetConfig &config = SortedSetConfig()) : mConfig(config), mEncoding(Encoding::LISTPACK) {}
+
+        Encoding getEncoding() const { return mEncoding; }
+        size_t getLength() const { return mEncoding == Encoding::LISTPACK ? mPack.getLength() : mList->getLength(); }
+
+        //add member or update its score, return true if the member is new.
+        bool add(const std::string &member, double score);
+        bool remove(const std::string &member);
+        bool getScore(const std::string &member, double &score);
+        //same as getScore, but it does not step the rehash of the dict, so several threads can read the set at the same time.
+        bool peekScore(const std::string &member, double &score) const;
+
+        //visit all members ordered by score, fn(std::string_view member, double score)
+        template <typename Fn>
+        void forEach(Fn fn);
+        //visit members whose score is in [min, max] ordered by score
+        template <typename Fn>
+        void forEachInRange(double min, double max, Fn fn);
+
+        /* replace the content with pairs(score, member) in [first, last), which are
+         * sorted by score and have unique members, e.g. a zset read from a snapshot
+         * or the output of union/intersection. the skiplist encoding is built by
+         * assignSorted of the index in O(n) instead of n inserts. unsorted input or
+         * a repeated member throws std::invalid_argument and leaves the set as it was.
+         */
+        template <typename ForwardIt>
+        void loadSorted(ForwardIt first, ForwardIt last);
+
+        void convertToSkipList();
+
+    private:
+        SortedSetConfig mConfig;
+        Encoding mEncoding;
+        ListPack mPack;
+        std::unique_ptr<Index> mList;
+        std::unique_ptr<HashMap<std::string, double>> mDict;
+    };
+
+    using SortedSet = BasicSortedSet<SkipList>;
+    using BPlusTreeSortedSet = BasicSortedSet<BPlusTree>;
+
+    template <template <typename, typename> class OrderedIndex>
+    bool BasicSortedSet<OrderedIndex>::add(const std::string &member, double score)
+    {
+        if (mEncoding == Encoding::LISTPACK)
+        {
+            size_t index = mPack.find(member);
+            if (index != ListPack::npos)
+            {
+                if (mPack.scoreAt(index) == score)
+                    return false;
+                mPack.erase(index);
+                mPack.insert(score, member);
+                return false;
+            }
+            if (mPack.getLength() + 1 <= mConfig.mMaxListPackEntries && member.size() <= mConfig.mMaxListPackValue)
+            {
+                mPack.insert(score, member);
+                return true;
+            }
+            convertToSkipList();
+        }
+        if (mDict->isExist(member))
+        {
+            double &old = mDict->get(member);
+            if (old != score)
+            {
+                mList->erase(old, member);
+                mList->insert(score, member);
+                old = score;
+            }
+            return false;
+        }
+        mList->insert(score, member);
+        mDict->insert(member, score);
+        return true;
+    }
+
+    template <template <typename, typename> class OrderedIndex>
+    bool BasicSortedSet<OrderedIndex>::remove(const std::string &member)
+    {
+        if (mEncoding == Encoding::LISTPACK)
+        {
+            size_t index = mPack.find(member);
+            if (index == ListPack::npos)
+                return false;
+            mPack.erase(index);
+            return true;
+        }
+        if (!mDict->isExist(member))
+            return false;
+        mList->erase(mDict->get(member), member);
+        mDict->erase(member);
+        return true;
+    }
+
+    template <template <typename, typename> class OrderedIndex>
+    bool BasicSortedSet<OrderedIndex>::getScore(const std::string &member, double &score)
+    {
+        if (mEncoding == Encoding::LISTPACK)
+        {
+            size_t index = mPack.find(member);
+            if (index == ListPack::npos)
+                return false;
+            score = mPack.scoreAt(index);
+            return true;
+        }
+        if (!mDict->isExist(member))
+            return false;
+        score = mDict->get(member);
+        return true;
+    }
+
+    template <template <typename, typename> class OrderedIndex>
+    bool BasicSortedSet<OrderedIndex>::peekScore(const std::string &member, double &score) const
+    {
+        if (mEncoding == Encoding::LISTPACK)
+        {
+            size_t index = mPack.find(member);
+            if (index == ListPack::npos)
+                return false;
+            score = mPack.scoreAt(index);
+            return true;
+        }
+        const double *value = mDict->peek(member);
+        if (!value)
+            return false;
+        score = *value;
+        return true;
+    }
+
+    template <template <typename, typename> class OrderedIndex>
+    template <typename Fn>
+    void BasicSortedSet<OrderedIndex>::forEach(Fn fn)
+    {
+        if (mEncoding == Encoding::LISTPACK)
+        {
+            for (size_t i = 0; i < mPack.getLength(); i++)
+                fn(mPack.memberAt(i), mPack.scoreAt(i));
+            return;
+        }
+        for (auto it = mList->begin(); it != mList->end(); it++)
+            fn(std::string_view(it->mValue), it->mKey);
+    }
+
+    template <template <typename, typename> class OrderedIndex>
+    template <typename Fn>
+    void BasicSortedSet<OrderedIndex>::forEachInRange(double min, double max, Fn fn)
+    {
+        if (mEncoding == Encoding::LISTPACK)
+        {
+            for (size_t i = mPack.lowerBound(min); i < mPack.getLength() && mPack.scoreAt(i) <= max; i++)
+                fn(mPack.memberAt(i), mPack.scoreAt(i));
+            return;
+        }
+        auto it = mList->begin();
+        if (it == mList->end())
+            return;
+        //lower_bound of SkipList returns nullptr when min is out of the list range
+        if (min > it->mKey)
+        {
+            auto node = mList->lower_bound(min);
+            if (!node)
+                return;
+            it = typename Index::iterator(node);
+        }
+        for (; it != mList->end() && it->mKey <= max; it++)
+            fn(std::string_view(it->mValue), it->mKey);
+    }
+
+    template <template <typename, typename> class OrderedIndex>
+    template <typename ForwardIt>
+    void BasicSortedSet<OrderedIndex>::loadSorted(ForwardIt first, ForwardIt last)
+    {
+        //both encodings check the input before the set is touched, and throw the same exception
+        size_t length = 0, bytes = 0;
+        bool fitListPack = true;
+        for (auto it = first, prev = first; it != last; prev = it, ++it)
+        {
+            if (it != first && it->first < prev->first)
+                throw std::invalid_argument("input of loadSorted is not sorted");
+            length++;
+            bytes += it->second.size();
+            fitListPack = fitListPack && it->second.size() <= mConfig.mMaxListPackValue;
+        }
+        fitListPack = fitListPack && length <= mConfig.mMaxListPackEntries;
+        if (fitListPack)
+        {
+            ListPack pack;
+            pack.reserve(length, bytes);
+            for (auto it = first; it != last; ++it)
+            {
+                //a linear scan, like add on a listpack
+                if (pack.find(it->second) != ListPack::npos)
+                    throw std::invalid_argument("input of loadSorted has duplicate members");
+                pack.append(it->first, it->second);
+            }
+            mList.reset();
+            mDict.reset();
+            mPack = std::move(pack);
+            mEncoding = Encoding::LISTPACK;
+            return;
+        }
+        std::unique_ptr<HashMap<std::string, double>> dict(new HashMap<std::string, double>());
+        for (auto it = first; it != last; ++it)
+        {
+            if (dict->isExist(it->second))
+                throw std::invalid_argument("input of loadSorted has duplicate members");
+            dict->insert(it->second, it->first);
+        }
+        std::unique_ptr<Index> list(new Index());
+        list->assignSorted(first, last);
+        mPack = ListPack();
+        mList = std::move(list);
+        mDict = std::move(dict);
+        mEncoding = INDEX_ENCODING;
+    }
+
+    template <template <typename, typename> class OrderedIndex>
+    void BasicSortedSet<OrderedIndex>::convertToSkipList()
+    {
+        if (mEncoding != Encoding::LISTPACK)
+            return;
+        mList.reset(new Index());
+        mDict.reset(new HashMap<std::string, double>());
+        for (size_t i = 0; i < mPack.getLength(); i++)
+        {
+            std::string member(mPack.memberAt(i));
+            mList->insert(mPack.scoreAt(i), member);
+            mDict->insert(member, mPack.scoreAt(i));
+        }
+        mPack = ListPack();
+        mEncoding = INDEX_ENCODING;
+    }
+}; // namespace RedisDataStructure
+
+#endif
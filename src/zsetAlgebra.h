@@ -0,0 +1,292 @@
+#ifndef ZSET_ALGEBRA_H
+#define ZSET_ALGEBRA_H
+
+#include <algorithm>
+#include <atomic>
+#include <cmath>
+#include <condition_variable>
+#include <exception>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <numeric>
+#include <queue>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <unordered_map>
+#include <utility>
+#include <vector>
+#include "zset.h"
+#include "threadPool.h"
+
+namespace RedisDataStructure
+{
+    //how the scores of the same member are combined, the same as AGGREGATE of ZUNIONSTORE
+    enum class Aggregate
+    {
+        SUM,
+        MIN,
+        MAX
+    };
+
+    //inputs with less entries than this are computed in the calling thread
+    const size_t ZSET_PARALLEL_THRESHOLD = 1 << 16;
+
+    namespace ZSetAlgebra
+    {
+        using ScoredMember = std::pair<double, std::string_view>;
+
+        //inf * 0 and inf - inf are nan, redis takes them as 0
+        inline double weighted(double score, double weight)
+        {
+            double result = score * weight;
+            return std::isnan(result) ? 0 : result;
+        }
+
+        inline double combine(double a, double b, Aggregate aggregate)
+        {
+            switch (aggregate)
+            {
+            case Aggregate::MIN:
+                return std::min(a, b);
+            case Aggregate::MAX:
+                return std::max(a, b);
+            default:
+            {
+                double result = a + b;
+                return std::isnan(result) ? 0 : result;
+            }
+            }
+        }
+
+        //members with the same score are ordered by member, like redis
+        inline bool lessScored(const ScoredMember &a, const ScoredMember &b)
+        {
+            return a.first < b.first || (a.first == b.first && a.second < b.second);
+        }
+
+        inline size_t resolveParallelism(size_t parallelism, size_t entries)
+        {
+            if (entries < ZSET_PARALLEL_THRESHOLD)
+                return 1;
+            if (parallelism == 0)
+                parallelism = std::max(1u, std::thread::hardware_concurrency());
+            return parallelism;
+        }
+
+        /* run fn(i) for i in [0, n) on up to parallelism threads of the default
+         * pool. the calling thread takes items as well and only waits for the
+         * items taken by others, so it is fine to call it from a pool task.
+         */
+        template <typename Fn>
+        void parallelFor(size_t n, size_t parallelism, Fn fn)
+        {
+            if (parallelism <= 1 || n <= 1)
+            {
+                for (size_t i = 0; i < n; i++)
+                    fn(i);
+                return;
+            }
+            struct State
+            {
+                std::atomic<size_t> mNext{0};
+                size_t mDone = 0;
+                std::exception_ptr mError;
+                std::mutex mMutex;
+                std::condition_variable mCond;
+            };
+            //a posted task may start after all items are done, it only touches state then
+            auto state = std::make_shared<State>();
+            auto work = [state, n, &fn]() {
+                for (size_t i; (i = state->mNext++) < n;)
+                {
+                    std::exception_ptr error;
+                    try
+                    {
+                        fn(i);
+                    }
+                    catch (...)
+                    {
+                        error = std::current_exception();
+                    }
+                    std::lock_guard<std::mutex> lock(state->mMutex);
+                    if (error && !state->mError)
+                        state->mError = error;
+                    if (++state->mDone == n)
+                        state->mCond.notify_one();
+                }
+            };
+            Redis::ThreadPool &pool = Redis::ThreadPool::getDefault();
+            for (size_t t = 1; t < std::min(parallelism, n); t++)
+                pool.post(Redis::ThreadPool::Priority::HIGH, work);
+            work();
+            std::unique_lock<std::mutex> lock(state->mMutex);
+            state->mCond.wait(lock, [&]() { return state->mDone == n; });
+            if (state->mError)
+                std::rethrow_exception(state->mError);
+        }
+
+        //k-way merge of the sorted parts, fn(const ScoredMember &) gets the entries in order
+        template <typename Fn>
+        void forEachMerged(const std::vector<std::vector<ScoredMember>> &parts, Fn fn)
+        {
+            //cursor is (part, index)
+            using Cursor = std::pair<size_t, size_t>;
+            auto greater = [&](const Cursor &a, const Cursor &b) { return lessScored(parts[b.first][b.second], parts[a.first][a.second]); };
+            std::priority_queue<Cursor, std::vector<Cursor>, decltype(greater)> heap(greater);
+            for (size_t p = 0; p < parts.size(); p++)
+            {
+                if (!parts[p].empty())
+                    heap.push(Cursor(p, 0));
+            }
+            while (!heap.empty())
+            {
+                Cursor cursor = heap.top();
+                heap.pop();
+                fn(parts[cursor.first][cursor.second]);
+                if (++cursor.second < parts[cursor.first].size())
+                    heap.push(cursor);
+            }
+        }
+
+        //the merge of the sorted parts, the members are copied out so dst may be one of the inputs
+        inline std::vector<std::pair<double, std::string>> mergeSorted(const std::vector<std::vector<ScoredMember>> &parts)
+        {
+            size_t total = 0;
+            for (auto &part : parts)
+                total += part.size();
+            std::vector<std::pair<double, std::string>> result;
+            result.reserve(total);
+            forEachMerged(parts, [&](const ScoredMember &e) { result.emplace_back(e.first, std::string(e.second)); });
+            return result;
+        }
+
+        //entries ordered by score only, sort the runs of equal scores by member
+        inline void sortTies(std::vector<ScoredMember> &entries)
+        {
+            for (size_t i = 0, j; i < entries.size(); i = j)
+            {
+                for (j = i + 1; j < entries.size() && entries[j].first == entries[i].first; j++)
+                    ;
+                if (j - i > 1)
+                    std::sort(entries.begin() + i, entries.begin() + j, lessScored);
+            }
+        }
+    }; // namespace ZSetAlgebra
+
+    /* ZUNIONSTORE: store the union of sets in dst, the score of a member is the
+     * aggregate of its weighted scores, a missing weight is 1. every set is
+     * already ordered by score, and a weight keeps that order (a negative one
+     * reverses it), so the weighted sets are merged linearly and dst is built
+     * by loadSorted. a member in several sets is placed by its first weighted
+     * score in the merge for MIN and by its last for MAX, which is the
+     * aggregate. only SUM moves such a member away from all its scores, so
+     * those members, and only those, are summed, sorted and merged back in.
+     * dst may be one of the inputs. the sets are read by tasks on
+     * ThreadPool::getDefault(), parallelism 0 means the number of cores.
+     * return the length of dst.
+     */
+    template <template <typename, typename> class OrderedIndex>
+    size_t zunionstore(BasicSortedSet<OrderedIndex> &dst, const std::vector<BasicSortedSet<OrderedIndex> *> &sets,
+                       const std::vector<double> &weights = std::vector<double>(), Aggregate aggregate = Aggregate::SUM,
+                       size_t parallelism = 0)
+    {
+        using namespace ZSetAlgebra;
+        size_t total = 0;
+        for (auto set : sets)
+            total += set->getLength();
+        //sources[i] is set i with weighted scores, sorted like the result
+        std::vector<std::vector<ScoredMember>> sources(sets.size());
+        parallelFor(sets.size(), resolveParallelism(parallelism, total), [&](size_t i) {
+            double weight = i < weights.size() ? weights[i] : 1;
+            auto &source = sources[i];
+            source.reserve(sets[i]->getLength());
+            sets[i]->forEach([&](std::string_view member, double score) { source.emplace_back(weighted(score, weight), member); });
+            if (weight < 0)
+                std::reverse(source.begin(), source.end());
+            //the set orders equal scores by insertion, and a zero weight makes all scores equal
+            sortTies(source);
+        });
+        //how often each member occurs and the aggregate of its scores so far
+        struct Occurrence
+        {
+            size_t mCount = 0;
+            size_t mSeen = 0;
+            double mScore = 0;
+        };
+        std::unordered_map<std::string_view, Occurrence> occurrences;
+        occurrences.reserve(total);
+        for (auto &source : sources)
+        {
+            for (auto &e : source)
+                occurrences[e.second].mCount++;
+        }
+        std::vector<ScoredMember> inPlace, moved;
+        inPlace.reserve(occurrences.size());
+        forEachMerged(sources, [&](const ScoredMember &e) {
+            Occurrence &occurrence = occurrences.find(e.second)->second;
+            occurrence.mScore = occurrence.mSeen++ == 0 ? e.first : combine(occurrence.mScore, e.first, aggregate);
+            if (occurrence.mCount == 1 || (aggregate == Aggregate::MIN && occurrence.mSeen == 1) ||
+                (aggregate == Aggregate::MAX && occurrence.mSeen == occurrence.mCount))
+                inPlace.push_back(e);
+            else if (aggregate == Aggregate::SUM && occurrence.mSeen == occurrence.mCount)
+                moved.emplace_back(occurrence.mScore, e.second);
+        });
+        std::sort(moved.begin(), moved.end(), lessScored);
+        std::vector<std::vector<ScoredMember>> parts;
+        parts.push_back(std::move(inPlace));
+        parts.push_back(std::move(moved));
+        auto result = mergeSorted(parts);
+        dst.loadSorted(result.begin(), result.end());
+        return result.size();
+    }
+
+    /* ZINTERSTORE: store the intersection of sets in dst. the members of the
+     * smallest set are probed in the other sets by peekScore, which does not
+     * modify the sets, so the smallest set is split in chunks probed by
+     * different tasks. every chunk is sorted and the chunks are merged like
+     * zunionstore.
+     */
+    template <template <typename, typename> class OrderedIndex>
+    size_t zinterstore(BasicSortedSet<OrderedIndex> &dst, const std::vector<BasicSortedSet<OrderedIndex> *> &sets,
+                       const std::vector<double> &weights = std::vector<double>(), Aggregate aggregate = Aggregate::SUM,
+                       size_t parallelism = 0)
+    {
+        using namespace ZSetAlgebra;
+        std::vector<std::vector<ScoredMember>> parts;
+        if (!sets.empty())
+        {
+            auto weightOf = [&](size_t i) { return i < weights.size() ? weights[i] : 1.0; };
+            std::vector<size_t> order(sets.size());
+            std::iota(order.begin(), order.end(), 0);
+            std::stable_sort(order.begin(), order.end(), [&](size_t a, size_t b) { return sets[a]->getLength() < sets[b]->getLength(); });
+            std::vector<ScoredMember> members;
+            members.reserve(sets[order[0]]->getLength());
+            sets[order[0]]->forEach([&](std::string_view member, double score) { members.emplace_back(weighted(score, weightOf(order[0])), member); });
+            const size_t length = members.size();
+            const size_t chunkNumber = std::max<size_t>(1, std::min(length, resolveParallelism(parallelism, length * sets.size())));
+            parts.resize(chunkNumber);
+            parallelFor(chunkNumber, chunkNumber, [&](size_t c) {
+                auto &part = parts[c];
+                std::string member;
+                for (size_t i = length * c / chunkNumber; i < length * (c + 1) / chunkNumber; i++)
+                {
+                    member.assign(members[i].second);
+                    double score = members[i].first, other;
+                    size_t j = 1;
+                    for (; j < order.size() && sets[order[j]]->peekScore(member, other); j++)
+                        score = combine(score, weighted(other, weightOf(order[j])), aggregate);
+                    if (j == order.size())
+                        part.emplace_back(score, members[i].second);
+                }
+                std::sort(part.begin(), part.end(), lessScored);
+            });
+        }
+        auto result = mergeSorted(parts);
+        dst.loadSorted(result.begin(), result.end());
+        return result.size();
+    }
+}; // namespace RedisDataStructure
+
+#endif
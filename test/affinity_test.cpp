@@ -0,0 +1,153 @@
+#include <gtest/gtest.h>
+#include <affinity.h>
+#include <shard.h>
+#include <atomic>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TestAffinity : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+TEST_F(TestAffinity, CpuListTest)
+{
+	EXPECT_EQ(Redis::parseCpuList("0-3, 8,10-11"), std::vector<int>({0, 1, 2, 3, 8, 10, 11}));
+	EXPECT_EQ(Redis::parseCpuList("5,1-2,2"), std::vector<int>({1, 2, 5}));
+	EXPECT_TRUE(Redis::parseCpuList("").empty());
+	for (auto bad : {"3-1", "a", "1-", "-1", "1x", "2-3y"})
+		EXPECT_THROW(Redis::parseCpuList(bad), std::invalid_argument);
+
+	Redis::CpuPlacement none("none");
+	EXPECT_FALSE(none.isEnabled());
+	EXPECT_TRUE(none.cpusOf(3).empty());
+	Redis::CpuPlacement list("4-5");
+	EXPECT_EQ(list.cpusOf(0), std::vector<int>({4}));
+	EXPECT_EQ(list.cpusOf(3), std::vector<int>({5}));
+	EXPECT_EQ(Redis::CpuPlacement("4-5", true).cpusOf(3), std::vector<int>({4, 5}));
+	EXPECT_THROW(Redis::CpuPlacement(","), std::invalid_argument);
+}
+
+TEST_F(TestAffinity, TopologyTest)
+{
+	const Redis::CpuTopology &topology = Redis::CpuTopology::get();
+	ASSERT_GE(topology.getNodeNumber(), 1);
+	auto cpus = topology.getCompactOrder();
+	size_t total = 0;
+	for (size_t node = 0; node < topology.getNodeNumber(); node++)
+	{
+		for (int cpu : topology.getCpus(node))
+			EXPECT_EQ(topology.nodeOf(cpu), static_cast<int>(node));
+		total += topology.getCpus(node).size();
+	}
+	EXPECT_EQ(cpus.size(), total);
+	EXPECT_EQ(topology.nodeOf(-1), -1);
+	EXPECT_EQ(Redis::CpuPlacement("compact").cpusOf(0), std::vector<int>({cpus[0]}));
+	std::cout << topology.getNodeNumber() << " nodes, " << total << " cpus" << std::endl;
+}
+
+//a thread pinned to one of the cpus it may use runs there, the report shows it
+TEST_F(TestAffinity, PlacementTest)
+{
+	Redis::PlacementMonitor monitor;
+	std::thread([&]() {
+		auto allowed = Redis::getCurrentAffinity();
+		ASSERT_FALSE(allowed.empty());
+		int cpu = allowed.back();
+		monitor.place("pinned", {cpu});
+		EXPECT_EQ(Redis::getCurrentAffinity(), std::vector<int>({cpu}));
+		EXPECT_EQ(Redis::getCurrentCpu(), cpu);
+		for (int i = 0; i < 100; i++)
+			monitor.sample();
+	}).join();
+	std::thread([&]() { monitor.place("free", {}); }).join();
+	//sample is ignored on a thread which did not place itself
+	monitor.sample();
+	EXPECT_EQ(monitor.getNodeMigrations(), 0);
+	std::string report = monitor.report();
+	std::cout << report;
+	EXPECT_NE(report.find("pinned: pinned to"), std::string::npos);
+	EXPECT_NE(report.find("0 cpu moves, 0 node moves"), std::string::npos);
+	EXPECT_NE(report.find("free: unpinned"), std::string::npos);
+}
+
+/* every shard thread pins itself and allocates its shard, all of them wait
+ * until the shards are placed, then they run the cross shard traffic.
+ */
+TEST_F(TestAffinity, ShardPlacementTest)
+{
+	const int shardNumber = 4, keyNumber = 2000;
+	Redis::ShardRuntime runtime(shardNumber, 16);
+	//a key set before placement is dropped
+	runtime.getKeyspace(0).execute({"SET", "old", "1"});
+	Redis::CpuPlacement cpus("compact");
+	Redis::PlacementMonitor monitor;
+	std::atomic<int> placed{0}, finished{0};
+	std::vector<std::thread> threads;
+	for (int t = 0; t < shardNumber; t++)
+	{
+		threads.emplace_back([&, t]() {
+			monitor.place("shard-" + std::to_string(t), cpus.cpusOf(t));
+			runtime.placeShard(t);
+			placed++;
+			while (placed < shardNumber)
+				std::this_thread::yield();
+			int replies = 0;
+			for (int i = 0; i < keyNumber; i++)
+			{
+				std::string key = std::to_string(t) + ":" + std::to_string(i);
+				runtime.execute(t, {"SET", key, key}, [&](Redis::KeyspaceResult result) {
+					EXPECT_EQ(result.mValue, "OK");
+					replies++;
+				});
+				runtime.poll(t);
+			}
+			//the others still forward commands to this shard until all are done
+			auto pollUntil = [&](auto done) {
+				while (!done())
+				{
+					if (runtime.poll(t) == 0)
+						std::this_thread::yield();
+				}
+			};
+			pollUntil([&]() { return replies == keyNumber; });
+			finished++;
+			pollUntil([&]() { return finished == shardNumber; });
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	EXPECT_EQ(runtime.getKeyspace(0).execute({"EXISTS", "old"}).mInteger, 0);
+	for (int t = 0; t < shardNumber; t++)
+	{
+		std::string key = std::to_string(t) + ":7";
+		EXPECT_EQ(runtime.getKeyspace(runtime.shardOf(key)).execute({"GET", key}).mValue, key);
+	}
+	std::cout << monitor.report();
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
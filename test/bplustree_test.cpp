@@ -0,0 +1,201 @@
+#include <gtest/gtest.h>
+#include <BPlusTree.h>
+#include <SkipList.h>
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <random>
+#include <string>
+#include <utility>
+#include <vector>
+
+class TestBPlusTree : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+TEST_F(TestBPlusTree, BasicTest)
+{
+	RedisDataStructure::BPlusTree<int, std::string> tree;
+	tree.insert(1, "he");
+	tree.insert(8, "world");
+	tree.insert(3, "llo");
+	tree.insert(3, "fun");
+	EXPECT_EQ(tree.getLength(), 4);
+	std::vector<std::string> values{"he", "llo", "fun", "world"};
+	int index = 0;
+	for (auto it = tree.begin(); it != tree.end(); it++)
+	{
+		EXPECT_EQ(it->mValue, values[index++]);
+	}
+	for (auto it = tree.rbegin(); it != tree.rend(); it++)
+	{
+		EXPECT_EQ(it->mValue, values[--index]);
+	}
+	EXPECT_EQ(tree.lower_bound(3)->mValue, "llo");
+	EXPECT_EQ(tree.upper_bound(3)->mKey, 8);
+	EXPECT_EQ(tree.lower_bound(9), nullptr);
+	EXPECT_EQ(tree.getRank(3), 3);
+	EXPECT_EQ(tree.getRank(2), 0);
+	EXPECT_TRUE(tree.erase(3, "fun"));
+	EXPECT_FALSE(tree.erase(3, "fun"));
+	EXPECT_TRUE(tree.erase(1));
+	EXPECT_FALSE(tree.erase(1));
+	EXPECT_EQ(tree.getLength(), 2);
+	EXPECT_EQ(tree.begin()->mValue, "llo");
+}
+
+//random operations checked against std::multimap, enough entries for a tree of several levels.
+TEST_F(TestBPlusTree, RandomOperationTest)
+{
+	RedisDataStructure::BPlusTree<double, int> tree;
+	std::multimap<double, int> expect;
+	std::mt19937 gen(7);
+	for (int i = 0; i < 200000; i++)
+	{
+		double k = gen() % 5000;
+		int v = gen() % 4;
+		if (gen() % 3 != 0)
+		{
+			tree.insert(k, v);
+			expect.emplace(k, v);
+		}
+		else
+		{
+			auto range = expect.equal_range(k);
+			auto it = range.first;
+			while (it != range.second && it->second != v)
+				it++;
+			EXPECT_EQ(tree.erase(k, v), it != range.second);
+			if (it != range.second)
+				expect.erase(it);
+		}
+		if (i % 1000 == 0)
+		{
+			auto lower = tree.lower_bound(k);
+			auto expectLower = expect.lower_bound(k);
+			EXPECT_EQ(lower == nullptr, expectLower == expect.end());
+			if (lower)
+			{
+				EXPECT_EQ(lower->mKey, expectLower->first);
+			}
+			int rank = std::distance(expect.begin(), expect.upper_bound(k));
+			EXPECT_EQ(tree.getRank(k), expect.count(k) ? rank : 0);
+		}
+	}
+	EXPECT_EQ(tree.getLength(), (int)expect.size());
+	auto it = tree.begin();
+	for (auto &kv : expect)
+	{
+		EXPECT_EQ(it->mKey, kv.first);
+		EXPECT_EQ(it->mValue, kv.second);
+		it++;
+	}
+	//erase everything, the tree shrinks back to a single leaf
+	for (auto &kv : expect)
+		EXPECT_TRUE(tree.erase(kv.first));
+	EXPECT_EQ(tree.getLength(), 0);
+	EXPECT_EQ(tree.getHeight(), 1);
+	EXPECT_EQ(tree.begin(), tree.end());
+}
+
+TEST_F(TestBPlusTree, AssignSortedTest)
+{
+	std::vector<std::pair<int, int>> input;
+	for (int i = 0; i < 100000; i++)
+		input.emplace_back(i / 2, i);
+	RedisDataStructure::BPlusTree<int, int> tree;
+	tree.insert(-1, -1);
+	tree.assignSorted(input.begin(), input.end());
+	EXPECT_EQ(tree.getLength(), 100000);
+	EXPECT_EQ(tree.getRank(777), 1556);
+	EXPECT_EQ(tree.lower_bound(777)->mValue, 1554);
+	int index = 0;
+	for (auto it = tree.begin(); it != tree.end(); it++)
+		EXPECT_EQ(it->mValue, index++);
+	for (int i = 0; i < 100000; i += 2)
+		EXPECT_TRUE(tree.erase(i / 2, i));
+	tree.insert(5, 5);
+	EXPECT_EQ(tree.getLength(), 50001);
+	EXPECT_EQ(tree.getRank(5), 7);
+
+	std::swap(input[10], input[20]);
+	EXPECT_THROW(tree.assignSorted(input.begin(), input.end()), std::invalid_argument);
+	EXPECT_EQ(tree.getLength(), 50001);
+}
+
+/* insert, lower_bound and getRank of SkipList and BPlusTree with random double
+ * keys. 1M entries by default, set BPLUSTREE_BENCH_ENTRIES to run it at 10M or
+ * 100M.
+ */
+TEST_F(TestBPlusTree, DISABLED_BPlusTreeBenchmark)
+{
+	const char *env = std::getenv("BPLUSTREE_BENCH_ENTRIES");
+	const int length = env ? std::atoi(env) : 1000000;
+	const int queryNumber = 1000000;
+	std::mt19937_64 gen(1);
+	std::uniform_real_distribution<double> dist(0, 1e9);
+	std::vector<double> keys(length), queries(queryNumber);
+	for (auto &k : keys)
+		k = dist(gen);
+	for (auto &k : queries)
+		k = dist(gen);
+	auto measure = [](const char *name, int number, auto fn) {
+		auto start = std::chrono::steady_clock::now();
+		fn();
+		auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		std::cout << name << ": " << cost << " ms, " << (cost ? number / cost / 1000.0 : 0) << " Mops/s" << std::endl;
+	};
+	auto run = [&](auto &index, const char *name) {
+		std::cout << name << " with " << length << " entries" << std::endl;
+		measure("  insert", length, [&]() {
+			for (auto k : keys)
+				index.insert(k, 0);
+		});
+		long long sum = 0;
+		measure("  lower_bound", queryNumber, [&]() {
+			for (auto k : queries)
+			{
+				auto nd = index.lower_bound(k);
+				sum += nd ? nd->mValue : 1;
+			}
+		});
+		measure("  getRank", queryNumber, [&]() {
+			for (int i = 0; i < queryNumber; i++)
+				sum += index.getRank(keys[i % length]);
+		});
+		EXPECT_GT(sum, 0);
+	};
+	{
+		RedisDataStructure::SkipList<double, int> skiplist;
+		run(skiplist, "SkipList");
+	}
+	{
+		RedisDataStructure::BPlusTree<double, int> tree;
+		run(tree, "BPlusTree");
+	}
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,179 @@
+#include <gtest/gtest.h>
+#include <concurrentSkipList.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+class TestConcurrentSkipList : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+TEST_F(TestConcurrentSkipList, BasicTest)
+{
+	RedisDataStructure::ConcurrentSkipList<int, std::string> sortedlist;
+	EXPECT_TRUE(sortedlist.insert(1, "he"));
+	EXPECT_TRUE(sortedlist.insert(8, "world"));
+	EXPECT_TRUE(sortedlist.insert(3, "llo"));
+	EXPECT_FALSE(sortedlist.insert(3, "fun"));
+	EXPECT_EQ(sortedlist.getLength(), 3);
+	EXPECT_EQ(sortedlist.getRank(3), 2);
+	EXPECT_EQ(sortedlist.getRank(2), 0);
+	{
+		auto guard = sortedlist.pin();
+		std::vector<int> keys{1, 3, 8};
+		int keyIndex = 0;
+		for (auto it = sortedlist.begin(); it != sortedlist.end(); it++)
+		{
+			EXPECT_EQ(it->mKey, keys[keyIndex++]);
+		}
+		EXPECT_EQ(sortedlist.lower_bound(3)->mValue, "llo");
+		EXPECT_EQ(sortedlist.upper_bound(3)->mKey, 8);
+		EXPECT_EQ(sortedlist.lower_bound(9), nullptr);
+	}
+	EXPECT_TRUE(sortedlist.erase(3));
+	EXPECT_FALSE(sortedlist.erase(3));
+	EXPECT_FALSE(sortedlist.contains(3));
+	EXPECT_TRUE(sortedlist.contains(8));
+	EXPECT_EQ(sortedlist.getLength(), 2);
+}
+
+//every thread owns the keys k % threads == id, the result is checked after all threads finish.
+TEST_F(TestConcurrentSkipList, DisjointStressTest)
+{
+	const int threadNumber = 8, keyNumber = 20000;
+	RedisDataStructure::ConcurrentSkipList<int, int> sortedlist;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadNumber; t++)
+	{
+		threads.emplace_back([&, t]() {
+			for (int k = t; k < keyNumber; k += threadNumber)
+				EXPECT_TRUE(sortedlist.insert(k, k));
+			for (int k = t; k < keyNumber; k += threadNumber * 2)
+				EXPECT_TRUE(sortedlist.erase(k));
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	int expect = 0;
+	auto guard = sortedlist.pin();
+	for (auto it = sortedlist.begin(); it != sortedlist.end(); it++)
+	{
+		while ((expect / threadNumber) % 2 == 0)
+			expect++;
+		EXPECT_EQ(it->mKey, expect++);
+	}
+	EXPECT_EQ(sortedlist.getLength(), keyNumber / 2);
+}
+
+//all threads fight for a small key range, every key must be inserted and erased in turn.
+TEST_F(TestConcurrentSkipList, ContendedStressTest)
+{
+	const int threadNumber = 16, keyNumber = 64, opNumber = 50000;
+	RedisDataStructure::ConcurrentSkipList<int, int> sortedlist;
+	std::atomic<int> balance[keyNumber];
+	for (auto &b : balance)
+		b = 0;
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadNumber; t++)
+	{
+		threads.emplace_back([&, t]() {
+			std::mt19937 gen(t);
+			for (int i = 0; i < opNumber; i++)
+			{
+				int k = gen() % keyNumber;
+				switch (gen() % 3)
+				{
+				case 0:
+					if (sortedlist.insert(k, t))
+						balance[k]++;
+					break;
+				case 1:
+					if (sortedlist.erase(k))
+						balance[k]--;
+					break;
+				default:
+				{
+					auto guard = sortedlist.pin();
+					auto nd = sortedlist.lower_bound(k);
+					if (nd)
+					{
+						EXPECT_GE(nd->mKey, k);
+					}
+				}
+				}
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	int length = 0;
+	for (int k = 0; k < keyNumber; k++)
+	{
+		EXPECT_TRUE(balance[k] == 0 || balance[k] == 1);
+		EXPECT_EQ(sortedlist.contains(k), balance[k] == 1);
+		length += balance[k];
+	}
+	EXPECT_EQ(sortedlist.getLength(), length);
+}
+
+//90% lookup, 5% insert, 5% erase on 1M keys, from 1 to 64 threads.
+TEST_F(TestConcurrentSkipList, DISABLED_ScalingBenchmark)
+{
+	const int keyRange = 1000000, opNumber = 400000;
+	RedisDataStructure::ConcurrentSkipList<int, int> sortedlist;
+	for (int k = 0; k < keyRange; k += 2)
+		sortedlist.insert(k, k);
+	for (int threadNumber = 1; threadNumber <= 64; threadNumber *= 2)
+	{
+		std::vector<std::thread> threads;
+		auto start = std::chrono::steady_clock::now();
+		for (int t = 0; t < threadNumber; t++)
+		{
+			threads.emplace_back([&, t]() {
+				std::mt19937 gen(t);
+				for (int i = 0; i < opNumber / threadNumber; i++)
+				{
+					int k = gen() % keyRange;
+					int op = gen() % 20;
+					if (op == 0)
+						sortedlist.insert(k, k);
+					else if (op == 1)
+						sortedlist.erase(k);
+					else
+						sortedlist.contains(k);
+				}
+			});
+		}
+		for (auto &t : threads)
+			t.join();
+		auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		std::cout << threadNumber << " threads: " << static_cast<double>(opNumber) / (cost > 0 ? cost : 1) << " Mops/s" << std::endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
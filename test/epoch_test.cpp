@@ -0,0 +1,248 @@
+#include <gtest/gtest.h>
+#include <epoch.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <random>
+#include <thread>
+#include <vector>
+
+class TestEpoch : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+//counts the live objects, a freed one has its value poisoned
+struct Counted
+{
+	static std::atomic<long> sLive;
+	explicit Counted(long v) : mValue(v) { sLive++; }
+	~Counted()
+	{
+		mValue = -1;
+		sLive--;
+	}
+	long mValue;
+};
+std::atomic<long> Counted::sLive{0};
+
+TEST_F(TestEpoch, BasicTest)
+{
+	{
+		RedisDataStructure::EpochDomain domain(1);
+		std::atomic<bool> pinned{false}, done{false};
+		std::thread reader([&]() {
+			auto guard = domain.pin();
+			pinned = true;
+			while (!done)
+				std::this_thread::yield();
+		});
+		while (!pinned)
+			std::this_thread::yield();
+		for (int i = 0; i < 100; i++)
+			domain.retire(new Counted(i));
+		//the reader may still hold them
+		domain.collect();
+		EXPECT_EQ(Counted::sLive, 100);
+		EXPECT_EQ(domain.getStats().mPending, 100);
+		done = true;
+		reader.join();
+		domain.collect();
+		domain.collect();
+		EXPECT_EQ(Counted::sLive, 0);
+		auto stats = domain.getStats();
+		EXPECT_EQ(stats.mPending, 0);
+		EXPECT_EQ(stats.mFreed, 100);
+
+		//nested pins publish once, the outer one keeps the nodes
+		auto outer = domain.pin();
+		{
+			auto inner = domain.pin();
+			domain.retire(new Counted(0));
+		}
+		domain.collect();
+		domain.collect();
+		EXPECT_EQ(Counted::sLive, 1);
+		outer.unpin();
+		EXPECT_FALSE(outer.isPinned());
+		domain.collect();
+		domain.collect();
+		EXPECT_EQ(Counted::sLive, 0);
+
+		//the nodes of an exited thread are freed by the others
+		std::thread([&]() {
+			for (int i = 0; i < 10; i++)
+				domain.retire(new Counted(i));
+		}).join();
+		domain.collect();
+		domain.collect();
+		EXPECT_EQ(Counted::sLive, 0);
+
+		//the domain frees what is left
+		domain.retire(new Counted(0));
+	}
+	EXPECT_EQ(Counted::sLive, 0);
+}
+
+/* a Treiber stack, a popped node is retired while other threads may still
+ * read it. a node freed too early has its value poisoned, and ASan or TSan
+ * report the access.
+ */
+TEST_F(TestEpoch, StressTest)
+{
+	struct Node
+	{
+		Counted mData;
+		std::atomic<Node *> mNext;
+		explicit Node(long v) : mData(v), mNext(nullptr) {}
+	};
+	const int threadNumber = 4, opNumber = 100000;
+	{
+		RedisDataStructure::EpochDomain domain(32);
+		std::atomic<Node *> top{nullptr};
+		std::atomic<long> pushed{0}, popped{0};
+		std::vector<std::thread> threads;
+		for (int t = 0; t < threadNumber; t++)
+		{
+			threads.emplace_back([&, t]() {
+				std::mt19937 gen(t);
+				for (int i = 0; i < opNumber; i++)
+				{
+					auto guard = domain.pin();
+					if (gen() % 2 == 0)
+					{
+						Node *nd = new Node(i);
+						Node *head = top.load(std::memory_order_acquire);
+						do
+						{
+							nd->mNext.store(head, std::memory_order_relaxed);
+						} while (!top.compare_exchange_weak(head, nd, std::memory_order_acq_rel));
+						pushed++;
+						continue;
+					}
+					Node *head = top.load(std::memory_order_acquire);
+					while (head && !top.compare_exchange_weak(head, head->mNext.load(std::memory_order_acquire), std::memory_order_acq_rel))
+						;
+					if (!head)
+						continue;
+					EXPECT_GE(head->mData.mValue, 0);
+					domain.retire(head);
+					popped++;
+				}
+			});
+		}
+		for (auto &t : threads)
+			t.join();
+		long left = 0;
+		for (Node *nd = top.load(); nd;)
+		{
+			Node *next = nd->mNext.load();
+			delete nd;
+			nd = next;
+			left++;
+		}
+		EXPECT_EQ(pushed, popped + left);
+		auto stats = domain.getStats();
+		EXPECT_EQ(stats.mFreed + stats.mPending, popped);
+		std::cout << "epoch " << stats.mEpoch << ", freed " << stats.mFreed << ", pending " << stats.mPending << std::endl;
+	}
+	EXPECT_EQ(Counted::sLive, 0);
+}
+
+//a reader stays pinned, the writer stops at maxPending instead of growing
+TEST_F(TestEpoch, StallTest)
+{
+	const size_t maxPending = 256;
+	{
+		RedisDataStructure::EpochDomain domain(16, maxPending);
+		std::atomic<bool> pinned{false};
+		std::thread reader([&]() {
+			auto guard = domain.pin();
+			pinned = true;
+			std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		});
+		while (!pinned)
+			std::this_thread::yield();
+		uint64_t peak = 0;
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < 10000; i++)
+		{
+			auto guard = domain.pin();
+			domain.retire(new Counted(i));
+			guard.unpin();
+			peak = std::max<uint64_t>(peak, domain.getStats().mPending);
+		}
+		auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		reader.join();
+		EXPECT_LE(peak, maxPending);
+		EXPECT_GE(cost, 50);
+		EXPECT_GT(domain.getStats().mStalls, 0);
+		std::cout << "peak pending " << peak << ", writer waited " << cost << " ms" << std::endl;
+
+		//a long reader lets the epoch move with repin
+		auto guard = domain.pin();
+		for (int i = 0; i < 10000; i++)
+		{
+			domain.retire(new Counted(i));
+			if (i % 100 == 0)
+				guard.repin();
+		}
+		EXPECT_LT(domain.getStats().mPending, 1000);
+	}
+	EXPECT_EQ(Counted::sLive, 0);
+}
+
+/* cost of an enter/exit pair against the counter of the former skiplist
+ * scheme, where every operation hits one shared cache line.
+ */
+TEST_F(TestEpoch, DISABLED_EnterExitBenchmark)
+{
+	const int opNumber = 4000000;
+	for (int threadNumber : {1, 2, 4})
+	{
+		auto run = [&](const char *name, auto fn) {
+			std::vector<std::thread> threads;
+			auto start = std::chrono::steady_clock::now();
+			for (int t = 0; t < threadNumber; t++)
+				threads.emplace_back([&]() {
+					for (int i = 0; i < opNumber / threadNumber; i++)
+						fn();
+				});
+			for (auto &t : threads)
+				t.join();
+			auto cost = std::chrono::duration_cast<std::chrono::nanoseconds>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "  " << name << ": " << static_cast<double>(cost) * threadNumber / opNumber << " ns per pin" << std::endl;
+		};
+		std::cout << threadNumber << " threads" << std::endl;
+		std::atomic<long> active{0};
+		run("shared counter", [&]() {
+			active.fetch_add(1);
+			active.fetch_sub(1);
+		});
+		RedisDataStructure::EpochDomain domain;
+		run("epoch domain", [&]() { auto guard = domain.pin(); });
+	}
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
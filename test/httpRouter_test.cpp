@@ -0,0 +1,191 @@
+#include <gtest/gtest.h>
+#include <http/request_handler.hpp>
+#include <http/router.hpp>
+#include <algorithm>
+#include <chrono>
+#include <iostream>
+#include <stdexcept>
+#include <string>
+#include <utility>
+#include <vector>
+
+class TestHttpRouter : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+using http::server::param;
+using http::server::router;
+
+//the number of the matching route, -1 for none, and its parameters as name=value
+static std::pair<int, std::string> route(const router &r, const std::string &path)
+{
+	size_t number;
+	boost::container::small_vector<param, 8> params;
+	if (!r.match(path, number, params))
+		return {-1, ""};
+	std::string text;
+	for (auto &p : params)
+		text += (text.empty() ? "" : ",") + std::string(p.name) + "=" + path.substr(p.offset, p.size);
+	return {static_cast<int>(number), text};
+}
+
+TEST_F(TestHttpRouter, RouterTest)
+{
+	router r;
+	r.add("/cmd/", 0);
+	r.add("/cmd/GET/", 1);
+	r.add("/users/:id", 2);
+	r.add("/users/:id/posts/:post", 3);
+	r.add("/users/me", 4);
+	r.add("/c", 5);
+	r.add("/", 6);
+	r.add("/files/:name/raw", 7);
+	EXPECT_THROW(r.add("/cmd/", 8), std::invalid_argument);
+	EXPECT_THROW(r.add("/users/:name/x", 8), std::invalid_argument);
+	EXPECT_THROW(r.add("/a/:", 8), std::invalid_argument);
+	r.freeze();
+	EXPECT_TRUE(r.frozen());
+	EXPECT_THROW(r.add("/late", 8), std::logic_error);
+
+	//the longest prefix wins
+	EXPECT_EQ(route(r, "/cmd/SET/k/v"), std::make_pair(0, std::string()));
+	EXPECT_EQ(route(r, "/cmd/GET/k"), std::make_pair(1, std::string()));
+	EXPECT_EQ(route(r, "/cm"), std::make_pair(5, std::string()));
+	EXPECT_EQ(route(r, "/other"), std::make_pair(6, std::string()));
+	EXPECT_EQ(route(r, ""), std::make_pair(-1, std::string()));
+	//parameters take a segment, a static segment wins over them
+	EXPECT_EQ(route(r, "/users/42"), std::make_pair(2, std::string("id=42")));
+	EXPECT_EQ(route(r, "/users/42?full=1"), std::make_pair(2, std::string("id=42")));
+	EXPECT_EQ(route(r, "/users/42/posts/7/comments"), std::make_pair(3, std::string("id=42,post=7")));
+	EXPECT_EQ(route(r, "/users/42/posts/"), std::make_pair(2, std::string("id=42")));
+	EXPECT_EQ(route(r, "/users/me"), std::make_pair(4, std::string()));
+	EXPECT_EQ(route(r, "/users/me/posts/1"), std::make_pair(3, std::string("id=me,post=1")));
+	EXPECT_EQ(route(r, "/users/"), std::make_pair(6, std::string()));
+	//a longer match through a parameter wins over a shorter static one
+	EXPECT_EQ(route(r, "/files/a.txt/raw"), std::make_pair(7, std::string("name=a.txt")));
+	EXPECT_EQ(route(r, "/files/a.txt/cooked"), std::make_pair(6, std::string()));
+
+	router empty;
+	empty.freeze();
+	EXPECT_EQ(route(empty, "/"), std::make_pair(-1, std::string()));
+}
+
+TEST_F(TestHttpRouter, RequestHandlerTest)
+{
+	using namespace http::server;
+	request_handler handler;
+	handler.reg("/users/:id", [](const request &req) { return reply("user " + std::string(req.find_param("id"))); });
+	handler.reg("/echo", [](const request &req) { return reply(req.uri); });
+
+	request req;
+	reply rep;
+	req.uri = "/users/a%20b/x";
+	handler.handle_request(req, rep);
+	EXPECT_EQ(rep.content, "user a b");
+	req.uri = "/echo+1";
+	handler.handle_request(req, rep);
+	EXPECT_EQ(rep.content, "/echo 1");
+	req.uri = "/echo%zz";
+	handler.handle_request(req, rep);
+	EXPECT_EQ(rep.status, reply::bad_request);
+	req.uri = "/none";
+	handler.handle_request(req, rep);
+	EXPECT_EQ(rep.status, reply::not_found);
+	//the first request froze the routes
+	EXPECT_THROW(handler.reg("/late", [](const request &) { return reply(""); }), std::logic_error);
+
+	std::string decoded;
+	EXPECT_TRUE(request_handler::url_decode("/a%2Fb+c", decoded));
+	EXPECT_EQ(decoded, "/a/b c");
+	EXPECT_FALSE(request_handler::url_decode("/a%2", decoded));
+}
+
+/* 250 REST style routes, the radix tree against scanning them longest first
+ * with a substr per candidate as request_handler did.
+ */
+TEST_F(TestHttpRouter, DISABLED_RouterBenchmark)
+{
+	const int lookupNumber = 1000000;
+	std::vector<std::string> routes;
+	for (auto resource : {"users", "orders", "products", "carts", "invoices", "accounts", "teams", "projects", "tickets", "reports"})
+	{
+		for (int version = 1; version <= 5; version++)
+		{
+			std::string base = "/api/v" + std::to_string(version) + "/" + resource;
+			for (auto suffix : {"", "/:id", "/:id/history", "/:id/owner", "/search"})
+				routes.push_back(base + suffix);
+		}
+	}
+	std::vector<std::string> paths;
+	for (size_t i = 0; i < routes.size(); i++)
+	{
+		std::string path = routes[(i * 7) % routes.size()];
+		size_t colon = path.find(':');
+		if (colon != std::string::npos)
+			path = path.substr(0, colon) + std::to_string(i) + path.substr(path.find('/', colon) == std::string::npos ? path.size() : path.find('/', colon));
+		paths.push_back(path);
+	}
+
+	router r;
+	for (size_t i = 0; i < routes.size(); i++)
+		r.add(routes[i], i);
+	r.freeze();
+	boost::container::small_vector<param, 8> params;
+	size_t found = 0;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < lookupNumber; i++)
+	{
+		size_t number;
+		found += r.match(paths[i % paths.size()], number, params) ? 1 : 0;
+	}
+	auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	EXPECT_EQ(found, lookupNumber);
+	std::cout << routes.size() << " routes, radix tree: " << static_cast<double>(lookupNumber) / (cost > 0 ? cost : 1) << " M lookups/s" << std::endl;
+
+	//the static prefixes only, the linear scan has no parameters
+	std::vector<std::string> prefixes;
+	for (auto &route : routes)
+		prefixes.push_back(route.substr(0, route.find(':')));
+	std::sort(prefixes.begin(), prefixes.end(), [](const std::string &a, const std::string &b) { return a.length() > b.length(); });
+	found = 0;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < lookupNumber; i++)
+	{
+		const std::string &path = paths[i % paths.size()];
+		for (auto &prefix : prefixes)
+		{
+			if (path.substr(0, prefix.length()) == prefix)
+			{
+				found++;
+				break;
+			}
+		}
+	}
+	cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	EXPECT_EQ(found, lookupNumber);
+	std::cout << routes.size() << " routes, linear scan: " << static_cast<double>(lookupNumber) / (cost > 0 ? cost : 1) << " M lookups/s" << std::endl;
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,877 @@
+#include <gtest/gtest.h>
+#include <http/server.hpp>
+#include <http/buffer_pool.hpp>
+#include <http/reply.hpp>
+#include <http/request.hpp>
+#include <hash.h>
+#include <boost/asio.hpp>
+#include <algorithm>
+#include <array>
+#include <atomic>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TestHttpServer : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+/* clientNumber concurrent clients, each sends requestNumber requests to uri one
+ * after another, a new connection per request. return the number of 200 replies.
+ */
+static int runClients(const std::string &port, const std::string &uri, int clientNumber, int requestNumber)
+{
+	using boost::asio::ip::tcp;
+	struct Client : std::enable_shared_from_this<Client>
+	{
+		Client(boost::asio::io_service &ios, tcp::endpoint ep, const std::string &uri, int n, std::atomic<int> &ok)
+			: mSocket(ios), mEndpoint(ep), mRequest("GET " + uri + " HTTP/1.0\r\n\r\n"), mLeft(n), mOk(ok) {}
+
+		void start()
+		{
+			if (mLeft-- == 0)
+				return;
+			auto self = shared_from_this();
+			mSocket = tcp::socket(mSocket.get_executor());
+			mResponse.clear();
+			mSocket.async_connect(mEndpoint, [this, self](boost::system::error_code ec) {
+				if (ec)
+					return start();
+				boost::asio::async_write(mSocket, boost::asio::buffer(mRequest), [this, self](boost::system::error_code ec, size_t) {
+					if (ec)
+						return start();
+					read();
+				});
+			});
+		}
+
+		void read()
+		{
+			auto self = shared_from_this();
+			mSocket.async_read_some(boost::asio::buffer(mBuffer), [this, self](boost::system::error_code ec, size_t n) {
+				mResponse.append(mBuffer.data(), n);
+				if (!ec)
+					return read();
+				if (mResponse.compare(0, 12, "HTTP/1.0 200") == 0)
+					mOk++;
+				start();
+			});
+		}
+
+		tcp::socket mSocket;
+		tcp::endpoint mEndpoint;
+		std::string mRequest, mResponse;
+		std::array<char, 4096> mBuffer;
+		int mLeft;
+		std::atomic<int> &mOk;
+	};
+	boost::asio::io_service ios;
+	tcp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), static_cast<unsigned short>(std::stoi(port)));
+	std::atomic<int> ok{0};
+	for (int i = 0; i < clientNumber; i++)
+		std::make_shared<Client>(ios, endpoint, uri, requestNumber, ok)->start();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 2; i++)
+		threads.emplace_back([&]() { ios.run(); });
+	for (auto &t : threads)
+		t.join();
+	return ok;
+}
+
+//the handlers of threaded_io mode never run at the same time, the counter has no lock
+TEST_F(TestHttpServer, ThreadedIOTest)
+{
+	using namespace http::server;
+	const int clientNumber = 1000, requestNumber = 2;
+	server s("127.0.0.1", "18086", 4, server::execution_mode::threaded_io);
+	int counter = 0;
+	std::thread::id executor;
+	bool sameThread = true;
+	s.add_handler("/incr", [&](const request &) {
+		if (counter == 0)
+			executor = std::this_thread::get_id();
+		sameThread = sameThread && executor == std::this_thread::get_id();
+		return reply(std::to_string(++counter));
+	});
+	std::thread runner([&]() { s.run(); });
+	EXPECT_EQ(runClients("18086", "/incr", clientNumber, requestNumber), clientNumber * requestNumber);
+	EXPECT_EQ(runClients("18086", "/none", 10, 1), 0);
+	s.stop();
+	runner.join();
+	EXPECT_EQ(counter, clientNumber * requestNumber);
+	EXPECT_TRUE(sameThread);
+}
+
+//every thread of the server is initialised once before any request is served
+TEST_F(TestHttpServer, ThreadInitTest)
+{
+	using namespace http::server;
+	const int threadNumber = 3;
+	server s("127.0.0.1", "18089", threadNumber, server::execution_mode::threaded_io);
+	std::mutex mutex;
+	std::vector<std::pair<server::thread_role, std::size_t>> inits;
+	s.set_thread_init([&](server::thread_role role, std::size_t index) {
+		std::lock_guard<std::mutex> lock(mutex);
+		inits.emplace_back(role, index);
+	});
+	std::atomic<int> served{0}, early{0};
+	s.add_handler("/init", [&](const request &) {
+		std::lock_guard<std::mutex> lock(mutex);
+		if (inits.size() != threadNumber + 1)
+			early++;
+		served++;
+		return reply("ok");
+	});
+	std::thread runner([&]() { s.run(); });
+	EXPECT_EQ(runClients("18089", "/init", 10, 5), 50);
+	s.stop();
+	runner.join();
+	EXPECT_EQ(early, 0);
+	std::sort(inits.begin(), inits.end());
+	ASSERT_EQ(inits.size(), threadNumber + 1);
+	for (int i = 0; i < threadNumber; i++)
+		EXPECT_EQ(inits[i], std::make_pair(server::thread_role::io, static_cast<std::size_t>(i)));
+	EXPECT_EQ(inits.back().first, server::thread_role::executor);
+}
+
+/* read count replies from a kept-alive connection, each ends after its
+ * Content-Length. the bytes after them are left in rest.
+ */
+static std::vector<std::string> readReplies(boost::asio::ip::tcp::socket &socket, size_t count, std::string &rest)
+{
+	std::vector<std::string> replies;
+	std::array<char, 4096> buffer;
+	boost::system::error_code ec;
+	while (replies.size() < count)
+	{
+		size_t headerEnd = rest.find("\r\n\r\n");
+		if (headerEnd != std::string::npos)
+		{
+			size_t length = 0;
+			size_t field = rest.find("Content-Length: ");
+			if (field != std::string::npos && field < headerEnd)
+				length = std::stoul(rest.substr(field + 16));
+			if (rest.size() >= headerEnd + 4 + length)
+			{
+				replies.push_back(rest.substr(0, headerEnd + 4 + length));
+				rest.erase(0, headerEnd + 4 + length);
+				continue;
+			}
+		}
+		size_t n = socket.read_some(boost::asio::buffer(buffer), ec);
+		if (ec)
+			break;
+		rest.append(buffer.data(), n);
+	}
+	return replies;
+}
+
+/* pipelined requests in one write come back in order, also when the first
+ * reply is given later from another thread. the connection stays open until
+ * a request closes it.
+ */
+TEST_F(TestHttpServer, KeepAliveTest)
+{
+	using namespace http::server;
+	using boost::asio::ip::tcp;
+	for (auto mode : {server::execution_mode::shared, server::execution_mode::threaded_io})
+	{
+		server s("127.0.0.1", "18090", 2, mode);
+		s.add_async_handler("/slow", [](const request &, request_handler::reply_callback done) {
+			std::thread([done]() {
+				std::this_thread::sleep_for(std::chrono::milliseconds(20));
+				done(reply("slow"));
+			}).detach();
+		});
+		s.add_handler("/echo", [](const request &req) { return reply(req.uri); });
+		std::thread runner([&]() { s.run(); });
+
+		boost::asio::io_service ios;
+		tcp::socket socket(ios);
+		socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 18090));
+		std::string rest;
+		boost::asio::write(socket, boost::asio::buffer(std::string("GET /slow HTTP/1.1\r\n\r\nGET /echo/1 HTTP/1.1\r\nHost: a\r\n\r\nGET /echo/2 HTTP/1.1\r\n\r\n")));
+		auto replies = readReplies(socket, 3, rest);
+		ASSERT_EQ(replies.size(), 3);
+		EXPECT_EQ(replies[0].compare(0, 15, "HTTP/1.1 200 OK"), 0);
+		EXPECT_NE(replies[0].find("Connection: keep-alive"), std::string::npos);
+		EXPECT_EQ(replies[0].substr(replies[0].size() - 4), "slow");
+		EXPECT_EQ(replies[1].substr(replies[1].size() - 7), "/echo/1");
+		EXPECT_EQ(replies[2].substr(replies[2].size() - 7), "/echo/2");
+
+		//HTTP/1.0 asking for keep-alive, then a request in two writes which closes it
+		boost::asio::write(socket, boost::asio::buffer(std::string("GET /echo/3 HTTP/1.0\r\nConnection: Keep-Alive\r\n\r\nGET /echo/4 HT")));
+		replies = readReplies(socket, 1, rest);
+		ASSERT_EQ(replies.size(), 1);
+		EXPECT_EQ(replies[0].compare(0, 15, "HTTP/1.0 200 OK"), 0);
+		EXPECT_NE(replies[0].find("Connection: keep-alive"), std::string::npos);
+		boost::asio::write(socket, boost::asio::buffer(std::string("TP/1.1\r\nConnection: close\r\n\r\nGET /echo/5 HTTP/1.1\r\n\r\n")));
+		replies = readReplies(socket, 2, rest);
+		ASSERT_EQ(replies.size(), 1);
+		EXPECT_NE(replies[0].find("Connection: close"), std::string::npos);
+		EXPECT_EQ(replies[0].substr(replies[0].size() - 7), "/echo/4");
+
+		s.stop();
+		runner.join();
+	}
+}
+
+//an idle connection is closed after the timeout, zero closes after the first reply
+TEST_F(TestHttpServer, IdleTimeoutTest)
+{
+	using namespace http::server;
+	using boost::asio::ip::tcp;
+	server s("127.0.0.1", "18091", 1, server::execution_mode::per_core);
+	s.set_idle_timeout(std::chrono::milliseconds(100));
+	s.add_handler("/echo", [](const request &req) { return reply(req.uri); });
+	std::thread runner([&]() { s.run(); });
+
+	boost::asio::io_service ios;
+	tcp::socket socket(ios);
+	socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 18091));
+	std::string rest;
+	boost::asio::write(socket, boost::asio::buffer(std::string("GET /echo HTTP/1.1\r\n\r\n")));
+	EXPECT_EQ(readReplies(socket, 1, rest).size(), 1);
+	auto start = std::chrono::steady_clock::now();
+	EXPECT_EQ(readReplies(socket, 1, rest).size(), 0);
+	auto idle = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	EXPECT_GE(idle, 50);
+	EXPECT_LT(idle, 5000);
+	s.stop();
+	runner.join();
+}
+
+//a request head which does not fit in the read buffer gets 431, one in pieces is parsed when complete
+TEST_F(TestHttpServer, LargeHeadTest)
+{
+	using namespace http::server;
+	using boost::asio::ip::tcp;
+	server s("127.0.0.1", "18093", 1, server::execution_mode::per_core);
+	s.add_handler("/echo", [](const request &req) {
+		const std::string_view *value = req.find_header("x-long");
+		return reply(value ? std::string(*value) : std::string());
+	});
+	std::thread runner([&]() { s.run(); });
+
+	boost::asio::io_service ios;
+	tcp::socket socket(ios);
+	socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 18093));
+	std::string value(10000, 'v'), rest;
+	std::string request = "GET /echo HTTP/1.1\r\nX-Long: " + value + "\r\n\r\n";
+	boost::asio::write(socket, boost::asio::buffer(std::string("GET /echo HTTP/1.1\r\n\r\n") + request.substr(0, 5000)));
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	boost::asio::write(socket, boost::asio::buffer(request.substr(5000)));
+	auto replies = readReplies(socket, 2, rest);
+	ASSERT_EQ(replies.size(), 2);
+	EXPECT_EQ(replies[1].substr(replies[1].size() - value.size()), value);
+
+	boost::asio::write(socket, boost::asio::buffer("GET /echo HTTP/1.1\r\nX-Long: " + std::string(20000, 'v') + "\r\n\r\n"));
+	replies = readReplies(socket, 2, rest);
+	ASSERT_EQ(replies.size(), 1);
+	EXPECT_EQ(replies[0].compare(0, 12, "HTTP/1.0 431"), 0);
+	s.stop();
+	runner.join();
+}
+
+/* bodies by Content-Length and in chunks, pipelined with other requests and
+ * sent in pieces. a client asking for 100 Continue gets it before sending the
+ * body, a body over the limit gets 413 and the connection is closed.
+ */
+TEST_F(TestHttpServer, BodyTest)
+{
+	using namespace http::server;
+	using boost::asio::ip::tcp;
+	server s("127.0.0.1", "18094", 1, server::execution_mode::per_core);
+	s.set_max_body_size(100000);
+	s.add_handler("/echo", [](const request &req) { return reply(req.method + " " + std::string(req.body)); });
+	std::thread runner([&]() { s.run(); });
+
+	boost::asio::io_service ios;
+	auto connect = [&]() {
+		tcp::socket socket(ios);
+		socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 18094));
+		return socket;
+	};
+	tcp::socket socket = connect();
+	std::string rest;
+	boost::asio::write(socket, boost::asio::buffer(std::string(
+		"POST /echo HTTP/1.1\r\nContent-Length: 5\r\n\r\nhelloGET /echo HTTP/1.1\r\n\r\n"
+		"POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n3;ext=1\r\nabc\r\n")));
+	auto replies = readReplies(socket, 2, rest);
+	ASSERT_EQ(replies.size(), 2);
+	EXPECT_EQ(replies[0].substr(replies[0].size() - 10), "POST hello");
+	EXPECT_EQ(replies[1].substr(replies[1].size() - 4), "GET ");
+	boost::asio::write(socket, boost::asio::buffer(std::string("A\r\n0123456789\r\n0\r\nX-Trailer: 1\r\n\r\nGET /echo HTTP/1.1\r\n\r\n")));
+	replies = readReplies(socket, 2, rest);
+	ASSERT_EQ(replies.size(), 2);
+	EXPECT_EQ(replies[0].substr(replies[0].size() - 18), "POST abc0123456789");
+	EXPECT_EQ(replies[1].substr(replies[1].size() - 4), "GET ");
+
+	//a body larger than the first buffer, in pieces after 100 Continue
+	std::string body(50000, 'b');
+	boost::asio::write(socket, boost::asio::buffer("POST /echo HTTP/1.1\r\nExpect: 100-continue\r\nContent-Length: " + std::to_string(body.size()) + "\r\n\r\n"));
+	replies = readReplies(socket, 1, rest);
+	ASSERT_EQ(replies.size(), 1);
+	EXPECT_EQ(replies[0], "HTTP/1.1 100 Continue\r\n\r\n");
+	boost::asio::write(socket, boost::asio::buffer(body.substr(0, 20000)));
+	std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	boost::asio::write(socket, boost::asio::buffer(body.substr(20000)));
+	replies = readReplies(socket, 1, rest);
+	ASSERT_EQ(replies.size(), 1);
+	EXPECT_EQ(replies[0].substr(replies[0].size() - body.size() - 5), "POST " + body);
+
+	boost::asio::write(socket, boost::asio::buffer(std::string("POST /echo HTTP/1.1\r\nContent-Length: 100001\r\n\r\n")));
+	replies = readReplies(socket, 2, rest);
+	ASSERT_EQ(replies.size(), 1);
+	EXPECT_EQ(replies[0].compare(0, 12, "HTTP/1.1 413"), 0);
+	EXPECT_NE(replies[0].find("Connection: close"), std::string::npos);
+
+	//the chunks add up over the limit
+	socket = connect();
+	rest.clear();
+	std::string chunk = "FFFF\r\n" + std::string(0xFFFF, 'c') + "\r\n";
+	boost::asio::write(socket, boost::asio::buffer("POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\n" + chunk + chunk));
+	replies = readReplies(socket, 2, rest);
+	ASSERT_EQ(replies.size(), 1);
+	EXPECT_EQ(replies[0].compare(0, 12, "HTTP/1.1 413"), 0);
+
+	//a bad chunk size, both framings at once and an unknown coding
+	for (auto request : {"POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\n\r\nzz\r\n",
+			     "POST /echo HTTP/1.1\r\nTransfer-Encoding: chunked\r\nContent-Length: 3\r\n\r\n3\r\nabc\r\n0\r\n\r\n",
+			     "POST /echo HTTP/1.1\r\nContent-Length: 3x\r\n\r\nabc",
+			     "POST /echo HTTP/1.1\r\nTransfer-Encoding: gzip\r\n\r\n"})
+	{
+		socket = connect();
+		rest.clear();
+		boost::asio::write(socket, boost::asio::buffer(std::string(request)));
+		replies = readReplies(socket, 2, rest);
+		ASSERT_EQ(replies.size(), 1);
+		EXPECT_EQ(replies[0].compare(0, 12, std::string(request).find("gzip") == std::string::npos ? "HTTP/1.1 400" : "HTTP/1.1 501"), 0);
+	}
+	s.stop();
+	runner.join();
+}
+
+/* the read buffers of closed connections go back to the pool of the server
+ * thread, the next connections take them from there instead of allocating.
+ */
+TEST_F(TestHttpServer, BufferPoolTest)
+{
+	using namespace http::server;
+	const int requestNumber = 2000;
+	server s("127.0.0.1", "18095", 1, server::execution_mode::per_core);
+	s.add_handler("/ping", [](const request &) { return reply("pong"); });
+	std::thread runner([&]() { s.run(); });
+	auto stats = [&]() {
+		std::promise<buffer_pool::stats> result;
+		s.get_io_service(0).post([&]() { result.set_value(buffer_pool::get_stats()); });
+		return result.get_future().get();
+	};
+	EXPECT_EQ(runClients("18095", "/ping", 10, requestNumber / 10), requestNumber);
+	buffer_pool::stats warm = stats();
+	EXPECT_EQ(runClients("18095", "/ping", 10, requestNumber / 10), requestNumber);
+	buffer_pool::stats after = stats();
+	std::cout << "buffers allocated: " << warm.allocated << " warming up, " << after.allocated - warm.allocated
+		  << " for " << requestNumber << " more connections, " << after.reused - warm.reused << " reused" << std::endl;
+	EXPECT_LE(warm.allocated, 10u);
+	EXPECT_EQ(after.allocated, warm.allocated);
+	EXPECT_EQ(after.reused - warm.reused, static_cast<uint64_t>(requestNumber));
+	s.stop();
+	runner.join();
+
+	//a grown buffer is given back in its own size class, larger ones are not kept
+	size_t size = 5000;
+	char *data = buffer_pool::acquire(size);
+	EXPECT_EQ(size, 8192u);
+	buffer_pool::release(data, size);
+	size = 6000;
+	EXPECT_EQ(buffer_pool::acquire(size), data);
+	buffer_pool::release(data, size);
+	pooled_buffer buffer;
+	buffer.reserve(100, 0);
+	EXPECT_EQ(buffer.capacity(), buffer_pool::min_size);
+	std::fill(buffer.data(), buffer.data() + 100, 'x');
+	buffer.reserve(buffer_pool::max_pooled_size * 2, 100);
+	EXPECT_EQ(buffer.capacity(), buffer_pool::max_pooled_size * 2);
+	EXPECT_EQ(std::string(buffer.data(), 100), std::string(100, 'x'));
+	uint64_t free = buffer_pool::get_stats().free;
+	buffer.release();
+	EXPECT_EQ(buffer_pool::get_stats().free, free);
+}
+
+//the generated headers, extra ones replacing them, small contents copied and large ones referenced
+TEST_F(TestHttpServer, ReplyBuffersTest)
+{
+	using namespace http::server;
+	reply_buffers buffers;
+	reply small("pong");
+	small.content_type = reply::text_plain;
+	auto large = std::make_shared<const std::string>(5000, 'l');
+	reply shared(large), custom(reply::not_found);
+	custom.headers["Content-Type"] = "image/png";
+	custom.headers["X-Id"] = "7";
+	buffers.add(small, true, true);
+	buffers.add(shared, true, true);
+	buffers.add(custom, false, false);
+	auto &result = buffers.buffers();
+	ASSERT_EQ(result.size(), 3);
+	EXPECT_EQ(result[1].data(), large->data());
+	std::string text;
+	for (auto &b : result)
+		text.append(static_cast<const char *>(b.data()), b.size());
+	EXPECT_EQ(buffers.bytes_copied(), text.size() - large->size());
+
+	std::string rest = text;
+	size_t date = rest.find("Date: ");
+	ASSERT_NE(date, std::string::npos);
+	EXPECT_EQ(rest.substr(date + 31, 6), " GMT\r\n");
+	std::string first = rest.substr(0, rest.find("\r\n\r\n") + 8);
+	EXPECT_EQ(first.replace(date, 37, ""), "HTTP/1.1 200 OK\r\nContent-Type: text/plain\r\nContent-Length: 4\r\nConnection: keep-alive\r\n\r\npong");
+	EXPECT_NE(text.find("Content-Length: 5000\r\n"), std::string::npos);
+	size_t last = text.find("HTTP/1.0 404 Not Found\r\n");
+	ASSERT_NE(last, std::string::npos);
+	std::string tail = text.substr(last);
+	EXPECT_NE(tail.find("Content-Type: image/png\r\n"), std::string::npos);
+	EXPECT_EQ(tail.find("text/html"), std::string::npos);
+	EXPECT_NE(tail.find("X-Id: 7\r\n"), std::string::npos);
+	EXPECT_NE(tail.find("Connection: close\r\n\r\n<html>"), std::string::npos);
+
+	buffers.clear();
+	EXPECT_TRUE(buffers.buffers().empty());
+}
+
+//a SyncWriteStream counting the write_some calls, it takes every byte given
+struct CountingStream
+{
+	template <typename ConstBufferSequence>
+	size_t write_some(const ConstBufferSequence &buffers, boost::system::error_code &ec)
+	{
+		ec = {};
+		mCalls++;
+		return boost::asio::buffer_size(buffers);
+	}
+	template <typename ConstBufferSequence>
+	size_t write_some(const ConstBufferSequence &buffers)
+	{
+		boost::system::error_code ec;
+		return write_some(buffers, ec);
+	}
+	size_t mCalls = 0;
+};
+
+/* a batch of 16 pipelined replies, serialized as before into a header map
+ * with four buffers per header, against reply_buffers. the stream counts the
+ * write_some calls async_write makes, each a writev, it takes 16 buffers at
+ * most.
+ */
+TEST_F(TestHttpServer, DISABLED_ReplyWriteBenchmark)
+{
+	using namespace http::server;
+	const int batchNumber = 100000, batchSize = 16;
+	static const std::string http11 = "HTTP/1.1 ", status = "200 OK\r\n";
+	static const char separator[] = {':', ' '}, crlf[] = {'\r', '\n'};
+	std::vector<reply> replies(batchSize, reply("pong"));
+
+	CountingStream before;
+	size_t copied = 0;
+	std::vector<boost::asio::const_buffer> buffers;
+	auto start = std::chrono::steady_clock::now();
+	for (int i = 0; i < batchNumber; i++)
+	{
+		std::vector<std::map<std::string, std::string>> headers(batchSize);
+		buffers.clear();
+		for (int j = 0; j < batchSize; j++)
+		{
+			auto &h = headers[j];
+			h["Content-Length"] = std::to_string(replies[j].content.size());
+			h["Content-Type"] = "text/html";
+			h["Connection"] = "keep-alive";
+			buffers.push_back(boost::asio::buffer(http11));
+			buffers.push_back(boost::asio::buffer(status));
+			for (auto &field : h)
+			{
+				copied += field.first.size() + field.second.size();
+				buffers.push_back(boost::asio::buffer(field.first));
+				buffers.push_back(boost::asio::buffer(separator));
+				buffers.push_back(boost::asio::buffer(field.second));
+				buffers.push_back(boost::asio::buffer(crlf));
+			}
+			buffers.push_back(boost::asio::buffer(crlf));
+			buffers.push_back(boost::asio::buffer(replies[j].content));
+		}
+		boost::asio::write(before, buffers);
+	}
+	auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "header map: " << static_cast<double>(before.mCalls) / batchNumber << " writev per batch, "
+		  << copied / batchNumber / batchSize << " bytes copied per reply, "
+		  << cost * 1000.0 / batchNumber / batchSize << " ns per reply" << std::endl;
+
+	CountingStream after;
+	reply_buffers serialized;
+	copied = 0;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < batchNumber; i++)
+	{
+		serialized.clear();
+		for (auto &rep : replies)
+			serialized.add(rep, true, true);
+		boost::asio::write(after, serialized.buffers());
+		copied += serialized.bytes_copied();
+	}
+	cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cout << "reply_buffers: " << static_cast<double>(after.mCalls) / batchNumber << " writev per batch, "
+		  << copied / batchNumber / batchSize << " bytes copied per reply, "
+		  << cost * 1000.0 / batchNumber / batchSize << " ns per reply" << std::endl;
+	EXPECT_EQ(after.mCalls, static_cast<size_t>(batchNumber));
+	EXPECT_LT(after.mCalls, before.mCalls);
+}
+
+/* read a chunked body from socket after rest, the head is read already.
+ * return its size, the bytes after it are left in rest.
+ */
+static size_t readChunked(boost::asio::ip::tcp::socket &socket, std::string &rest, std::string *body = nullptr)
+{
+	std::array<char, 65536> buffer;
+	size_t size = 0;
+	boost::system::error_code ec;
+	for (;;)
+	{
+		size_t line = rest.find("\r\n");
+		if (line != std::string::npos)
+		{
+			size_t chunk = std::stoul(rest.substr(0, line), nullptr, 16);
+			if (chunk == 0 && rest.size() >= line + 4)
+			{
+				rest.erase(0, line + 4);
+				return size;
+			}
+			if (chunk > 0 && rest.size() >= line + chunk + 4)
+			{
+				if (body)
+					body->append(rest, line + 2, chunk);
+				rest.erase(0, line + chunk + 4);
+				size += chunk;
+				continue;
+			}
+		}
+		size_t n = socket.read_some(boost::asio::buffer(buffer), ec);
+		if (ec)
+			return size;
+		rest.append(buffer.data(), n);
+	}
+}
+
+/* a streamed reply goes out in chunks to HTTP/1.1, the pipelined request
+ * after it is answered when it ends. HTTP/1.0 gets the pieces as they are
+ * and the connection closes after them.
+ */
+TEST_F(TestHttpServer, StreamTest)
+{
+	using namespace http::server;
+	using boost::asio::ip::tcp;
+	server s("127.0.0.1", "18096", 1, server::execution_mode::per_core);
+	//joined before the server stops, they may hold the last reference to a connection
+	std::mutex producersMutex;
+	std::vector<std::thread> producers;
+	s.add_handler("/stream", [&](const request &) {
+		auto left = std::make_shared<int>(3);
+		return reply::stream([&, left](reply::chunk_callback next) {
+			//a piece given later from another thread
+			std::lock_guard<std::mutex> lock(producersMutex);
+			producers.emplace_back([left, next]() {
+				int n = (*left)--;
+				next(n > 0 ? std::string(n, 'a' + n - 1) : std::string());
+			});
+		});
+	});
+	s.add_handler("/echo", [](const request &req) { return reply(req.uri); });
+	std::thread runner([&]() { s.run(); });
+
+	boost::asio::io_service ios;
+	tcp::socket socket(ios);
+	socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 18096));
+	std::string rest, body;
+	boost::asio::write(socket, boost::asio::buffer(std::string("GET /stream HTTP/1.1\r\n\r\nGET /echo HTTP/1.1\r\n\r\n")));
+	auto replies = readReplies(socket, 1, rest);
+	ASSERT_EQ(replies.size(), 1);
+	EXPECT_NE(replies[0].find("Transfer-Encoding: chunked\r\n"), std::string::npos);
+	EXPECT_NE(replies[0].find("Content-Type: text/plain\r\n"), std::string::npos);
+	EXPECT_EQ(replies[0].find("Content-Length"), std::string::npos);
+	EXPECT_EQ(readChunked(socket, rest, &body), 6u);
+	EXPECT_EQ(body, "cccbba");
+	replies = readReplies(socket, 1, rest);
+	ASSERT_EQ(replies.size(), 1);
+	EXPECT_EQ(replies[0].substr(replies[0].size() - 5), "/echo");
+
+	tcp::socket old(ios);
+	old.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 18096));
+	boost::asio::write(old, boost::asio::buffer(std::string("GET /stream HTTP/1.0\r\nConnection: keep-alive\r\n\r\nGET /echo HTTP/1.0\r\n\r\n")));
+	boost::system::error_code ec;
+	std::string all;
+	std::array<char, 4096> buffer;
+	for (size_t n; (n = old.read_some(boost::asio::buffer(buffer), ec)) > 0 || !ec;)
+		all.append(buffer.data(), n);
+	EXPECT_NE(all.find("Connection: close\r\n\r\ncccbba"), std::string::npos);
+	EXPECT_EQ(all.substr(all.size() - 6), "cccbba");
+	{
+		std::lock_guard<std::mutex> lock(producersMutex);
+		for (auto &producer : producers)
+			producer.join();
+	}
+	s.stop();
+	runner.join();
+}
+
+/* 10M elements streamed in chunks of 10000. the producer stops while the
+ * client does not read, only the kernel buffers and one chunk are in flight.
+ */
+TEST_F(TestHttpServer, StreamBackpressureTest)
+{
+	using namespace http::server;
+	using boost::asio::ip::tcp;
+	const size_t elementNumber = 10000000, chunkElements = 10000, elementSize = 8;
+	server s("127.0.0.1", "18097", 1, server::execution_mode::per_core);
+	std::atomic<size_t> produced{0};
+	s.add_handler("/range", [&](const request &) {
+		auto next = std::make_shared<size_t>(0);
+		return reply::stream([&, next](reply::chunk_callback done) {
+			std::string chunk;
+			char element[16];
+			for (size_t i = 0; i < chunkElements && *next < elementNumber; i++, (*next)++)
+			{
+				snprintf(element, sizeof(element), "%07zu\n", *next % 10000000);
+				chunk.append(element, elementSize);
+			}
+			produced += chunk.size();
+			done(std::move(chunk));
+		});
+	});
+	std::thread runner([&]() { s.run(); });
+
+	boost::asio::io_service ios;
+	tcp::socket socket(ios);
+	socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 18097));
+	boost::asio::write(socket, boost::asio::buffer(std::string("GET /range HTTP/1.1\r\n\r\n")));
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	size_t paused = produced;
+	std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	EXPECT_EQ(produced, paused);
+	EXPECT_LT(paused, elementNumber * elementSize / 10);
+	std::cout << "producer paused after " << paused / 1024 << " KiB of " << elementNumber * elementSize / 1024 << " KiB" << std::endl;
+
+	std::string rest;
+	auto start = std::chrono::steady_clock::now();
+	ASSERT_EQ(readReplies(socket, 1, rest).size(), 1);
+	EXPECT_EQ(readChunked(socket, rest), elementNumber * elementSize);
+	auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	std::cout << elementNumber << " elements streamed in " << cost << " ms" << std::endl;
+	EXPECT_EQ(produced, elementNumber * elementSize);
+	s.stop();
+	runner.join();
+}
+
+/* one client sends requestNumber requests one after another, on a new
+ * connection each time and on one kept-alive connection.
+ */
+TEST_F(TestHttpServer, DISABLED_KeepAliveBenchmark)
+{
+	using namespace http::server;
+	using boost::asio::ip::tcp;
+	const int requestNumber = 20000;
+	server s("127.0.0.1", "18092", 1, server::execution_mode::per_core);
+	s.add_handler("/ping", [](const request &) { return reply("pong"); });
+	std::thread runner([&]() { s.run(); });
+
+	auto start = std::chrono::steady_clock::now();
+	int ok = runClients("18092", "/ping", 1, requestNumber);
+	auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	EXPECT_EQ(ok, requestNumber);
+	std::cout << "connection per request: " << cost << " ms, " << (cost ? ok * 1000 / cost : 0) << " requests/s" << std::endl;
+
+	boost::asio::io_service ios;
+	tcp::socket socket(ios);
+	socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 18092));
+	std::string request = "GET /ping HTTP/1.1\r\n\r\n", rest;
+	ok = 0;
+	start = std::chrono::steady_clock::now();
+	for (int i = 0; i < requestNumber; i++)
+	{
+		boost::asio::write(socket, boost::asio::buffer(request));
+		ok += static_cast<int>(readReplies(socket, 1, rest).size());
+	}
+	cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	EXPECT_EQ(ok, requestNumber);
+	std::cout << "keep-alive: " << cost << " ms, " << (cost ? ok * 1000 / cost : 0) << " requests/s" << std::endl;
+	s.stop();
+	runner.join();
+}
+
+/* clientNumber kept-alive connections, each sends requestNumber GET /ping
+ * one after another. return the number of replies.
+ */
+static int runKeepAliveClients(const std::string &port, int clientNumber, int requestNumber)
+{
+	using boost::asio::ip::tcp;
+	struct Client : std::enable_shared_from_this<Client>
+	{
+		Client(boost::asio::io_service &ios, int n, std::atomic<int> &ok) : mSocket(ios), mLeft(n), mOk(ok) {}
+
+		void request()
+		{
+			if (mLeft-- == 0)
+				return;
+			auto self = shared_from_this();
+			boost::asio::async_write(mSocket, boost::asio::buffer(std::string_view("GET /ping HTTP/1.1\r\n\r\n")), [this, self](boost::system::error_code ec, size_t) {
+				if (ec)
+					return;
+				//the reply ends with its content
+				boost::asio::async_read_until(mSocket, boost::asio::dynamic_buffer(mResponse), "pong", [this, self](boost::system::error_code ec, size_t n) {
+					if (ec)
+						return;
+					mResponse.erase(0, n);
+					mOk++;
+					request();
+				});
+			});
+		}
+
+		tcp::socket mSocket;
+		std::string mResponse;
+		int mLeft;
+		std::atomic<int> &mOk;
+	};
+	boost::asio::io_service ios;
+	tcp::endpoint endpoint(boost::asio::ip::make_address("127.0.0.1"), static_cast<unsigned short>(std::stoi(port)));
+	std::atomic<int> ok{0};
+	std::vector<std::shared_ptr<Client>> clients;
+	for (int i = 0; i < clientNumber; i++)
+	{
+		clients.push_back(std::make_shared<Client>(ios, requestNumber, ok));
+		clients.back()->mSocket.connect(endpoint);
+	}
+	for (auto &client : clients)
+		client->request();
+	std::vector<std::thread> threads;
+	for (int i = 0; i < 2; i++)
+		threads.emplace_back([&]() { ios.run(); });
+	for (auto &t : threads)
+		t.join();
+	return ok;
+}
+
+/* clientNumber kept-alive connections, each sends requestNumber requests
+ * one after another. built with and without HTTP_WITH_IO_URING it compares
+ * the io_uring and epoll backends of asio on the same machine.
+ */
+TEST_F(TestHttpServer, DISABLED_IoBackendBenchmark)
+{
+	using namespace http::server;
+	const int clientNumber = 100, requestNumber = 1000;
+	server s("127.0.0.1", "18098", 1, server::execution_mode::per_core);
+	s.add_handler("/ping", [](const request &) { return reply("pong"); });
+	std::thread runner([&]() { s.run(); });
+
+	auto start = std::chrono::steady_clock::now();
+	int ok = runKeepAliveClients("18098", clientNumber, requestNumber);
+	auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	EXPECT_EQ(ok, clientNumber * requestNumber);
+	std::cout << server::io_backend() << ": " << clientNumber << " connections, " << cost << " ms, "
+		  << (cost ? ok * 1000 / cost : 0) << " requests/s" << std::endl;
+	s.stop();
+	runner.join();
+}
+
+/* new connections per second and kept-alive requests per second from 1 to
+ * 32 threads, one io_service and SO_REUSEPORT acceptor per thread against
+ * one io_service shared by all threads with a strand per connection.
+ */
+TEST_F(TestHttpServer, DISABLED_ReusePortScalingBenchmark)
+{
+	using namespace http::server;
+	const int connectClients = 100, connectRequests = 20, keepAliveClients = 64, keepAliveRequests = 200;
+	auto bench = [&](const char *name, server::execution_mode mode, std::size_t threadNumber) {
+		server s("127.0.0.1", "18099", threadNumber, mode);
+		s.add_handler("/ping", [](const request &) { return reply("pong"); });
+		std::thread runner([&]() { s.run(); });
+		auto start = std::chrono::steady_clock::now();
+		int connections = runClients("18099", "/ping", connectClients, connectRequests);
+		auto connectCost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		start = std::chrono::steady_clock::now();
+		int requests = runKeepAliveClients("18099", keepAliveClients, keepAliveRequests);
+		auto requestCost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		s.stop();
+		runner.join();
+		EXPECT_EQ(connections, connectClients * connectRequests);
+		EXPECT_EQ(requests, keepAliveClients * keepAliveRequests);
+		std::cout << name << " " << threadNumber << " threads: "
+			  << (connectCost ? connections * 1000 / connectCost : 0) << " connections/s, "
+			  << (requestCost ? requests * 1000 / requestCost : 0) << " requests/s" << std::endl;
+	};
+	for (std::size_t threadNumber = 1; threadNumber <= 32; threadNumber *= 2)
+	{
+		bench("per_core", server::execution_mode::per_core, threadNumber);
+		bench("shared", server::execution_mode::shared, threadNumber);
+	}
+}
+
+/* 1000 concurrent clients against the strand model, where the handler needs a
+ * lock on the shared HashMap, and threaded_io, where it does not.
+ */
+TEST_F(TestHttpServer, DISABLED_ThreadedIOBenchmark)
+{
+	using namespace http::server;
+	const int clientNumber = 1000, requestNumber = 10, threadNumber = 4;
+	auto bench = [&](const char *name, const std::string &port, server::execution_mode mode, bool locked) {
+		server s("127.0.0.1", port, threadNumber, mode);
+		RedisDataStructure::HashMap<std::string, int> dict;
+		dict.insert("counter", 0);
+		std::mutex mutex;
+		s.add_handler("/incr", [&](const request &) {
+			std::unique_lock<std::mutex> lock(mutex, std::defer_lock);
+			if (locked)
+				lock.lock();
+			return reply(std::to_string(++dict.get("counter")));
+		});
+		std::thread runner([&]() { s.run(); });
+		auto start = std::chrono::steady_clock::now();
+		int ok = runClients(port, "/incr", clientNumber, requestNumber);
+		auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		s.stop();
+		runner.join();
+		EXPECT_EQ(ok, clientNumber * requestNumber);
+		EXPECT_EQ(dict.get("counter"), clientNumber * requestNumber);
+		std::cout << name << ": " << cost << " ms, " << (cost ? ok * 1000 / cost : 0) << " requests/s" << std::endl;
+	};
+	bench("strand per connection", "18087", server::execution_mode::shared, true);
+	bench("threaded io", "18088", server::execution_mode::threaded_io, false);
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,225 @@
+#include <gtest/gtest.h>
+#include <lockManager.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TestLockManager : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+//wait until contended waiters are queued on the stripe of key, false after 5s
+static bool waitContended(const Redis::LockManager &manager, const std::string &key, uint64_t contended)
+{
+	auto deadline = std::chrono::steady_clock::now() + std::chrono::seconds(5);
+	while (manager.getStats(key).mContended < contended)
+	{
+		if (std::chrono::steady_clock::now() > deadline)
+			return false;
+		std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	return true;
+}
+
+TEST_F(TestLockManager, BasicTest)
+{
+	Redis::LockManager manager;
+	std::atomic<bool> entered{false};
+	{
+		auto reader1 = manager.lock("key", Redis::LockMode::SHARED);
+		auto reader2 = manager.lock(std::vector<std::string>{"key", "other"}, Redis::LockMode::SHARED);
+		std::thread writer([&]() {
+			auto guard = manager.lock("key", Redis::LockMode::EXCLUSIVE);
+			entered = true;
+		});
+		//the writer is queued behind both readers
+		ASSERT_TRUE(waitContended(manager, "key", 1));
+		EXPECT_FALSE(entered);
+		reader1.unlock();
+		EXPECT_FALSE(reader1.ownsLock());
+		EXPECT_FALSE(entered);
+		reader2 = Redis::LockManager::Guard();
+		writer.join();
+		EXPECT_TRUE(entered);
+	}
+	Redis::LockStats stats = manager.getStats("key");
+	EXPECT_EQ(stats.mAcquired, 3);
+	EXPECT_EQ(stats.mContended, 1);
+	EXPECT_GT(stats.mWaitNanos, 0);
+	auto hot = manager.getHotStripes(10);
+	ASSERT_EQ(hot.size(), 1);
+	EXPECT_EQ(hot[0].first, manager.stripeOf("key"));
+
+	//the same key twice with different modes is locked once, exclusively
+	auto guard = manager.lock({{"key", Redis::LockMode::SHARED}, {"key", Redis::LockMode::EXCLUSIVE}});
+	std::thread reader([&]() { auto g = manager.lock("key", Redis::LockMode::SHARED); });
+	EXPECT_TRUE(waitContended(manager, "key", 2));
+	EXPECT_EQ(manager.getStats("key").mContended, 2);
+	guard.unlock();
+	reader.join();
+}
+
+//readers keep the key shared all the time, the queued writer still gets it
+TEST_F(TestLockManager, FairnessTest)
+{
+	Redis::LockManager manager;
+	std::atomic<bool> stop{false};
+	std::atomic<int> writes{0};
+	std::vector<std::thread> readers;
+	for (int t = 0; t < 4; t++)
+	{
+		readers.emplace_back([&]() {
+			while (!stop)
+			{
+				auto guard = manager.lock("hot", Redis::LockMode::SHARED);
+				std::this_thread::sleep_for(std::chrono::microseconds(200));
+			}
+		});
+	}
+	std::thread writer([&]() {
+		for (int i = 0; i < 50; i++)
+		{
+			auto guard = manager.lock("hot", Redis::LockMode::EXCLUSIVE);
+			writes++;
+		}
+	});
+	writer.join();
+	stop = true;
+	for (auto &t : readers)
+		t.join();
+	EXPECT_EQ(writes, 50);
+}
+
+/* transfers between random accounts, each locks both accounts exclusively in
+ * the order given by the caller. the lock order is sorted inside, so there is
+ * no deadlock, and the total never changes.
+ */
+TEST_F(TestLockManager, MultiKeyTest)
+{
+	const int accountNumber = 32, threadNumber = 8, opNumber = 20000;
+	Redis::LockManager manager(64);
+	std::vector<long long> balance(accountNumber, 1000);
+	std::vector<std::thread> threads;
+	for (int t = 0; t < threadNumber; t++)
+	{
+		threads.emplace_back([&, t]() {
+			std::mt19937 gen(t);
+			for (int i = 0; i < opNumber; i++)
+			{
+				int from = gen() % accountNumber, to = gen() % accountNumber;
+				if (gen() % 4 == 0)
+				{
+					//a consistent read of the total
+					std::vector<std::string> keys;
+					for (int a = accountNumber - 1; a >= 0; a--)
+						keys.push_back(std::to_string(a));
+					auto guard = manager.lock(keys, Redis::LockMode::SHARED);
+					long long sum = 0;
+					for (auto b : balance)
+						sum += b;
+					EXPECT_EQ(sum, 1000LL * accountNumber);
+					continue;
+				}
+				auto guard = manager.lock(std::vector<std::string>{std::to_string(from), std::to_string(to)}, Redis::LockMode::EXCLUSIVE);
+				balance[from] -= 7;
+				balance[to] += 7;
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	long long sum = 0;
+	for (auto b : balance)
+		sum += b;
+	EXPECT_EQ(sum, 1000LL * accountNumber);
+}
+
+/* MSET of 4 keys, or a transaction reading 3 keys and writing 1, from 4
+ * threads. the key range sets the overlap, from every request touching the
+ * same 16 keys to nearly disjoint requests over 1M keys. one global mutex is
+ * the baseline.
+ */
+TEST_F(TestLockManager, DISABLED_LockManagerBenchmark)
+{
+	const int threadNumber = 4, opNumber = 400000, keysPerOp = 4;
+	for (int keyRange : {16, 1024, 1000000})
+	{
+		std::vector<std::string> keys;
+		for (int k = 0; k < keyRange; k++)
+			keys.push_back("key:" + std::to_string(k));
+		std::vector<long long> values(keyRange, 0);
+		auto run = [&](const char *name, auto lockFn) {
+			std::vector<std::thread> threads;
+			auto start = std::chrono::steady_clock::now();
+			for (int t = 0; t < threadNumber; t++)
+			{
+				threads.emplace_back([&, t]() {
+					std::mt19937 gen(t);
+					std::vector<int> picked(keysPerOp);
+					for (int i = 0; i < opNumber / threadNumber; i++)
+					{
+						for (auto &k : picked)
+							k = gen() % keyRange;
+						bool transaction = gen() % 2 == 0;
+						auto guard = lockFn(picked, transaction);
+						if (transaction)
+							values[picked[0]] = values[picked[1]] + values[picked[2]] + values[picked[3]];
+						else
+							for (int k : picked)
+								values[k]++;
+					}
+				});
+			}
+			for (auto &t : threads)
+				t.join();
+			auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+			std::cout << "  " << name << ": " << static_cast<double>(opNumber) / (cost > 0 ? cost : 1) << " Mops/s" << std::endl;
+		};
+		std::cout << keyRange << " keys" << std::endl;
+		std::mutex global;
+		run("global mutex", [&](const std::vector<int> &, bool) { return std::unique_lock<std::mutex>(global); });
+		Redis::LockManager manager;
+		run("lock manager", [&](const std::vector<int> &picked, bool transaction) {
+			std::vector<std::pair<size_t, Redis::LockMode>> stripes;
+			for (size_t i = 0; i < picked.size(); i++)
+			{
+				bool write = !transaction || i == 0;
+				stripes.emplace_back(manager.stripeOf(keys[picked[i]]), write ? Redis::LockMode::EXCLUSIVE : Redis::LockMode::SHARED);
+			}
+			return manager.lockStripes(std::move(stripes));
+		});
+		auto hot = manager.getHotStripes(1);
+		if (!hot.empty())
+			std::cout << "  hottest stripe " << hot[0].first << ": " << hot[0].second.mContended << " of " << hot[0].second.mAcquired
+					  << " contended, " << hot[0].second.mWaitNanos / 1000 << " us waited" << std::endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,250 @@
+#include <gtest/gtest.h>
+#include <mvcc.h>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <map>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+class TestMvcc : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+TEST_F(TestMvcc, HashMapSnapshotTest)
+{
+	RedisDataStructure::MvccClock clock;
+	RedisDataStructure::MvccHashMap<std::string, int> map(clock);
+	for (int i = 0; i < 1000; i++)
+		map.put(std::to_string(i), i);
+	auto snapshot = map.snapshot();
+	for (int i = 0; i < 1000; i += 2)
+		map.erase(std::to_string(i));
+	for (int i = 1000; i < 3000; i++)
+		map.put(std::to_string(i), i);
+	map.put("1", -1);
+
+	int value;
+	EXPECT_TRUE(map.get(snapshot, "1", value));
+	EXPECT_EQ(value, 1);
+	EXPECT_TRUE(map.get("1", value));
+	EXPECT_EQ(value, -1);
+	EXPECT_TRUE(map.get(snapshot, "0", value));
+	EXPECT_FALSE(map.get("0", value));
+	EXPECT_FALSE(map.get(snapshot, "2000", value));
+
+	std::map<std::string, int> seen;
+	map.forEach(snapshot, [&](const std::string &key, int v) { EXPECT_TRUE(seen.emplace(key, v).second); });
+	ASSERT_EQ(seen.size(), 1000);
+	for (auto &kv : seen)
+		EXPECT_EQ(std::to_string(kv.second), kv.first);
+
+	int latest = 0;
+	map.forEach(map.snapshot(), [&](const std::string &, int) { latest++; });
+	EXPECT_EQ(latest, 2500);
+}
+
+TEST_F(TestMvcc, SkipListRangeTest)
+{
+	RedisDataStructure::MvccClock clock;
+	RedisDataStructure::MvccSkipList<int, std::string> list(clock);
+	for (int i = 0; i < 1000; i++)
+		list.put(i * 2, std::to_string(i));
+	auto snapshot = list.snapshot();
+	for (int i = 0; i < 1000; i++)
+		list.put(i * 2 + 1, "new");
+	list.erase(10);
+	list.put(12, "changed");
+
+	std::vector<int> keys;
+	EXPECT_EQ(list.range(snapshot, 5, 25, [&](int k, const std::string &v) {
+		keys.push_back(k);
+		EXPECT_EQ(v, std::to_string(k / 2));
+	}, 3), 10);
+	EXPECT_EQ(keys, std::vector<int>({6, 8, 10, 12, 14, 16, 18, 20, 22, 24}));
+	keys.clear();
+	list.range(list.snapshot(), -100, 13, [&](int k, const std::string &) { keys.push_back(k); }, 4);
+	EXPECT_EQ(keys.size(), 13);
+	EXPECT_EQ(list.forEach(snapshot, [](int, const std::string &) {}), 1000);
+	std::string value;
+	EXPECT_TRUE(list.get(snapshot, 10, value));
+	EXPECT_FALSE(list.get(10, value));
+	EXPECT_TRUE(list.get(12, value));
+	EXPECT_EQ(value, "changed");
+}
+
+TEST_F(TestMvcc, GarbageCollectionTest)
+{
+	RedisDataStructure::MvccClock clock;
+	RedisDataStructure::MvccHashMap<int, int> map(clock);
+	RedisDataStructure::MvccSkipList<int, int> list(clock);
+	for (int round = 0; round < 5; round++)
+	{
+		for (int i = 0; i < 100; i++)
+		{
+			map.put(i, round);
+			list.put(i, round);
+		}
+	}
+	{
+		auto snapshot = map.snapshot();
+		map.erase(7);
+		list.erase(7);
+		//the versions read by the snapshot and the new ones stay
+		EXPECT_EQ(map.collectGarbage(), 400);
+		EXPECT_EQ(list.collectGarbage(), 400);
+		int value;
+		EXPECT_TRUE(map.get(snapshot, 7, value));
+		EXPECT_TRUE(list.get(snapshot, 7, value));
+		EXPECT_EQ(value, 4);
+	}
+	//the old version of 7 and its tombstone
+	EXPECT_EQ(map.collectGarbage(), 2);
+	EXPECT_EQ(list.collectGarbage(), 2);
+	EXPECT_EQ(map.collectGarbage(), 0);
+	int count = 0;
+	list.forEach(list.snapshot(), [&](int, int) { count++; });
+	EXPECT_EQ(count, 99);
+}
+
+/* transfers between accounts committed by apply, readers scan snapshots
+ * while the writers and the background collector run, every snapshot has the
+ * same total.
+ */
+TEST_F(TestMvcc, ConcurrentSnapshotTest)
+{
+	const int accountNumber = 2000, transferNumber = 20000;
+	RedisDataStructure::MvccClock clock;
+	RedisDataStructure::MvccHashMap<int, long long> map(clock);
+	RedisDataStructure::MvccSkipList<int, long long> list(clock);
+	for (int i = 0; i < accountNumber; i++)
+	{
+		map.put(i, 100);
+		list.put(i, 100);
+	}
+	map.startGarbageCollector(std::chrono::milliseconds(1));
+	list.startGarbageCollector(std::chrono::milliseconds(1));
+	std::atomic<bool> stop{false};
+	std::vector<std::thread> threads;
+	for (int t = 0; t < 2; t++)
+	{
+		threads.emplace_back([&, t]() {
+			std::mt19937 gen(t);
+			for (int i = 0; i < transferNumber; i++)
+			{
+				int from = gen() % accountNumber, to = gen() % accountNumber;
+				if (from == to)
+					continue;
+				long long a = 0, b = 0;
+				//a transfer reads and writes under one commit, so writers take turns on the map
+				static std::mutex writer;
+				std::lock_guard<std::mutex> lock(writer);
+				ASSERT_TRUE(map.get(from, a));
+				ASSERT_TRUE(map.get(to, b));
+				map.apply({{from, a - 1}, {to, b + 1}});
+				ASSERT_TRUE(list.get(from, a));
+				ASSERT_TRUE(list.get(to, b));
+				list.apply({{from, a - 1}, {to, b + 1}});
+			}
+		});
+	}
+	std::atomic<int> scans{0};
+	for (int t = 0; t < 2; t++)
+	{
+		threads.emplace_back([&]() {
+			while (!stop)
+			{
+				long long sum = 0;
+				int count = 0;
+				auto snapshot = map.snapshot();
+				map.forEach(snapshot, [&](int, long long v) { sum += v; count++; });
+				EXPECT_EQ(count, accountNumber);
+				EXPECT_EQ(sum, 100LL * accountNumber);
+				sum = 0;
+				EXPECT_EQ(list.forEach(list.snapshot(), [&](int, long long v) { sum += v; }), accountNumber);
+				EXPECT_EQ(sum, 100LL * accountNumber);
+				scans++;
+			}
+		});
+	}
+	threads[0].join();
+	threads[1].join();
+	stop = true;
+	for (size_t i = 2; i < threads.size(); i++)
+		threads[i].join();
+	EXPECT_GT(scans, 0);
+	map.stopGarbageCollector();
+	list.stopGarbageCollector();
+	//a pass leaves only the latest versions
+	map.collectGarbage();
+	EXPECT_EQ(map.collectGarbage(), 0);
+}
+
+/* writes done while a full scan runs, a scan holding the lock for the whole
+ * read against the snapshot scan which locks per chunk.
+ */
+TEST_F(TestMvcc, DISABLED_ScanWhileWritingBenchmark)
+{
+	const int entryNumber = 500000;
+	RedisDataStructure::MvccClock clock;
+	RedisDataStructure::MvccHashMap<int, int> map(clock);
+	for (int i = 0; i < entryNumber; i++)
+		map.put(i, i);
+	auto run = [&](const char *name, auto scanFn) {
+		std::atomic<bool> scanning{true};
+		std::atomic<long long> writes{0};
+		std::thread writer([&]() {
+			std::mt19937 gen(1);
+			while (scanning)
+			{
+				map.put(gen() % entryNumber, 0);
+				writes++;
+			}
+		});
+		auto start = std::chrono::steady_clock::now();
+		scanFn();
+		auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		scanning = false;
+		writer.join();
+		std::cout << name << ": scan " << cost << " ms, " << writes << " writes during the scan" << std::endl;
+	};
+	//a chunk of entryNumber buckets covers the whole table, the shared lock is held for the whole scan
+	run("scan under one lock", [&]() {
+		long long sum = 0;
+		map.forEach(map.snapshot(), [&](int, int v) { sum += v; }, entryNumber);
+		EXPECT_GE(sum, 0);
+	});
+	run("snapshot scan", [&]() {
+		long long sum = 0;
+		map.forEach(map.snapshot(), [&](int, int v) { sum += v; });
+		EXPECT_GE(sum, 0);
+	});
+	map.collectGarbage();
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
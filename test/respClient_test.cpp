@@ -0,0 +1,289 @@
+#include <gtest/gtest.h>
+#include <respClient.h>
+#include <respServer.h>
+#include <boost/asio.hpp>
+#include <chrono>
+#include <future>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class TestRespClient : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+/* SET, GET, INCR, QUIT and FAIL on one io_service and thread, anything
+ * else is echoed as an array of its arguments.
+ */
+class TestServer
+{
+public:
+	explicit TestServer(const std::string &port)
+		: mGuard(boost::asio::make_work_guard(mIoService)),
+		  mServer({&mIoService}, "127.0.0.1", port, [this](const std::vector<std::string_view> &args, Redis::RespReply reply) {
+			  handle(args, std::move(reply));
+		  }),
+		  mThread([this]() { mIoService.run(); })
+	{
+	}
+
+	~TestServer()
+	{
+		mServer.stop();
+		mGuard.reset();
+		mIoService.stop();
+		mThread.join();
+	}
+
+private:
+	void handle(const std::vector<std::string_view> &args, Redis::RespReply reply)
+	{
+		std::string name(args[0]);
+		if (name == "SET")
+		{
+			mData[std::string(args[1])] = std::string(args[2]);
+			reply.send([](Redis::RespWriter &out) { out.simple("OK"); });
+		}
+		else if (name == "GET")
+		{
+			auto it = mData.find(std::string(args[1]));
+			reply.send([&](Redis::RespWriter &out) {
+				if (it == mData.end())
+					out.null();
+				else
+					out.bulk(it->second);
+			});
+		}
+		else if (name == "INCR")
+		{
+			long long value = std::stoll(mData[std::string(args[1])].empty() ? "0" : mData[std::string(args[1])]) + 1;
+			mData[std::string(args[1])] = std::to_string(value);
+			reply.send([&](Redis::RespWriter &out) { out.integer(value); });
+		}
+		else if (name == "QUIT")
+		{
+			reply.send([](Redis::RespWriter &out) { out.simple("OK"); });
+			reply.getSession().closeAfterReplies();
+		}
+		else if (name == "FAIL")
+		{
+			reply.send([](Redis::RespWriter &out) { out.error("ERR failed"); });
+		}
+		else
+		{
+			reply.send([&](Redis::RespWriter &out) {
+				out.array(args.size());
+				for (auto &arg : args)
+					out.bulk(arg);
+			});
+		}
+	}
+
+	boost::asio::io_service mIoService;
+	boost::asio::executor_work_guard<boost::asio::io_service::executor_type> mGuard;
+	Redis::RespServer mServer;
+	std::map<std::string, std::string> mData;
+	std::thread mThread;
+};
+
+/* commands given on the thread of the connection are all in flight at once
+ * and answered in order, the views of a reply point into the read buffer.
+ */
+TEST_F(TestRespClient, PipelineTest)
+{
+	TestServer server("16380");
+	boost::asio::io_service ios;
+	Redis::RespClient client(ios, "127.0.0.1", "16380");
+	Redis::RespConnection &connection = client.getConnection(0);
+	const int commandNumber = 1000;
+	std::vector<std::string> values;
+	size_t maxPending = 0;
+	boost::asio::post(ios, [&]() {
+		for (int i = 0; i < commandNumber; i++)
+		{
+			client.execute({"SET", "key" + std::to_string(i), "value" + std::to_string(i)}, [&](const boost::system::error_code &ec, const Redis::RespValue &value) {
+				EXPECT_FALSE(ec);
+				EXPECT_EQ(value.getString(), "OK");
+			});
+			client.execute({"GET", "key" + std::to_string(i)}, [&](const boost::system::error_code &ec, const Redis::RespValue &value) {
+				EXPECT_FALSE(ec);
+				values.emplace_back(value.getString());
+			});
+		}
+		maxPending = connection.getPending();
+		client.execute({"GET", "none"}, [&](const boost::system::error_code &, const Redis::RespValue &value) {
+			EXPECT_TRUE(value.isNil());
+		});
+		client.execute({"FAIL"}, [&](const boost::system::error_code &ec, const Redis::RespValue &value) {
+			//an error reply is not an error of the connection
+			EXPECT_FALSE(ec);
+			EXPECT_TRUE(value.isError());
+			EXPECT_EQ(value.getString(), "ERR failed");
+		});
+		client.execute({"ECHO", "a", "b"}, [&](const boost::system::error_code &, const Redis::RespValue &value) {
+			ASSERT_EQ(value.size(), 3u);
+			EXPECT_EQ(value[2].getString(), "b");
+			client.close();
+		});
+	});
+	ios.run();
+	EXPECT_EQ(maxPending, 2u * commandNumber);
+	ASSERT_EQ(values.size(), static_cast<size_t>(commandNumber));
+	for (int i = 0; i < commandNumber; i++)
+		EXPECT_EQ(values[i], "value" + std::to_string(i));
+}
+
+/* commands from another thread, over four connections on two io_services,
+ * and a reply taken as a future.
+ */
+TEST_F(TestRespClient, PoolTest)
+{
+	TestServer server("16381");
+	boost::asio::io_service core0, core1;
+	auto guard0 = boost::asio::make_work_guard(core0);
+	auto guard1 = boost::asio::make_work_guard(core1);
+	std::thread t0([&]() { core0.run(); });
+	std::thread t1([&]() { core1.run(); });
+	{
+		Redis::RespClient client({&core0, &core1}, "127.0.0.1", "16381", 4);
+		EXPECT_EQ(client.getConnectionNumber(), 4u);
+		const int commandNumber = 10000;
+		std::atomic<int> ok{0};
+		std::promise<void> done;
+		for (int i = 0; i < commandNumber; i++)
+		{
+			client.execute({"INCR", "counter"}, [&](const boost::system::error_code &ec, const Redis::RespValue &value) {
+				if (!ec && value.getType() == Redis::RespType::INTEGER && ++ok == commandNumber)
+					done.set_value();
+			});
+		}
+		done.get_future().wait();
+		std::future<Redis::RespResult> result = client.asyncExecute({"GET", "counter"}, boost::asio::use_future);
+		EXPECT_EQ(result.get().getValue().getString(), std::to_string(commandNumber));
+		std::vector<std::string> args = {"ECHO", "x"};
+		EXPECT_EQ(client.asyncExecute(args, boost::asio::use_future).get().getValue()[1].getString(), "x");
+	}
+	guard0.reset();
+	guard1.reset();
+	t0.join();
+	t1.join();
+}
+
+/* the commands after QUIT get the error of the closed connection, the next
+ * command connects again. a server which is not there fails the commands.
+ */
+TEST_F(TestRespClient, ReconnectTest)
+{
+	TestServer server("16382");
+	boost::asio::io_service ios;
+	Redis::RespClient client(ios, "127.0.0.1", "16382");
+	std::vector<std::string> results;
+	auto record = [&](const boost::system::error_code &ec, const Redis::RespValue &value) {
+		results.push_back(ec ? "error" : std::string(value.getString()));
+	};
+	boost::asio::post(ios, [&]() {
+		client.execute({"SET", "a", "1"}, record);
+		client.execute({"QUIT"}, record);
+		client.execute({"GET", "a"}, [&](const boost::system::error_code &ec, const Redis::RespValue &value) {
+			record(ec, value);
+			client.execute({"GET", "a"}, [&](const boost::system::error_code &ec, const Redis::RespValue &value) {
+				record(ec, value);
+				client.close();
+			});
+		});
+	});
+	ios.run();
+	EXPECT_EQ(results, std::vector<std::string>({"OK", "OK", "error", "1"}));
+
+	ios.restart();
+	Redis::RespClient nowhere(ios, "127.0.0.1", "16389");
+	boost::system::error_code error;
+	nowhere.execute({"PING"}, [&](const boost::system::error_code &ec, const Redis::RespValue &) { error = ec; });
+	ios.run();
+	EXPECT_EQ(error, boost::asio::error::connection_refused);
+}
+
+#if defined(BOOST_ASIO_HAS_CO_AWAIT)
+//the coroutine API, built as C++20
+TEST_F(TestRespClient, CoroutineTest)
+{
+	TestServer server("16383");
+	boost::asio::io_service ios;
+	Redis::RespClient client(ios, "127.0.0.1", "16383");
+	std::string value;
+	boost::asio::co_spawn(ios, [&]() -> boost::asio::awaitable<void> {
+		//gcc cannot keep a braced list across co_await
+		std::vector<std::string> set = {"SET", "k", "v"}, get = {"GET", "k"};
+		co_await client.asyncExecute(set, boost::asio::use_awaitable);
+		Redis::RespResult result = co_await client.asyncExecute(get, boost::asio::use_awaitable);
+		value = result.getValue().getString();
+		client.close();
+	}, boost::asio::detached);
+	ios.run();
+	EXPECT_EQ(value, "v");
+}
+#endif
+
+/* GET on one connection with 1 to 256 commands in flight, the commands in
+ * flight go out together so the round trips are shared.
+ */
+TEST_F(TestRespClient, DISABLED_PipelineBenchmark)
+{
+	TestServer server("16384");
+	const int commandNumber = 100000;
+	for (int depth : {1, 16, 256})
+	{
+		boost::asio::io_service ios;
+		Redis::RespClient client(ios, "127.0.0.1", "16384");
+		int sent = 0, ok = 0;
+		std::function<void()> next = [&]() {
+			if (sent == commandNumber)
+				return;
+			sent++;
+			client.execute({"GET", "key"}, [&](const boost::system::error_code &ec, const Redis::RespValue &value) {
+				if (!ec && value.isNil())
+					ok++;
+				if (ok == commandNumber)
+					client.close();
+				next();
+			});
+		};
+		auto start = std::chrono::steady_clock::now();
+		boost::asio::post(ios, [&]() {
+			for (int i = 0; i < depth; i++)
+				next();
+		});
+		ios.run();
+		auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		EXPECT_EQ(ok, commandNumber);
+		std::cout << depth << " in flight: " << cost << " ms, " << (cost ? ok * 1000LL / cost : 0) << " commands/s" << std::endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,376 @@
+#include <gtest/gtest.h>
+#include <resp.h>
+#include <respServer.h>
+#include <boost/asio.hpp>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <thread>
+#include <vector>
+
+class TestResp : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+static std::vector<std::string> toStrings(const std::vector<std::string_view> &args)
+{
+	return std::vector<std::string>(args.begin(), args.end());
+}
+
+TEST_F(TestResp, ParserTest)
+{
+	using Result = Redis::RespParser::Result;
+	Redis::RespParser parser;
+	std::vector<std::string_view> args;
+	size_t consumed = 0;
+
+	std::string input = "*3\r\n$3\r\nSET\r\n$3\r\nkey\r\n$0\r\n\r\nGET  key\r\n\r\n*0\r\n";
+	ASSERT_EQ(parser.parse(input.data(), input.size(), args, consumed), Result::COMMAND);
+	EXPECT_EQ(toStrings(args), std::vector<std::string>({"SET", "key", ""}));
+	//the arguments point into the input
+	EXPECT_EQ(args[1].data(), input.data() + 17);
+	size_t pos = consumed;
+	ASSERT_EQ(parser.parse(input.data() + pos, input.size() - pos, args, consumed), Result::COMMAND);
+	EXPECT_EQ(toStrings(args), std::vector<std::string>({"GET", "key"}));
+	pos += consumed;
+	//an empty line and *0 are commands without arguments
+	ASSERT_EQ(parser.parse(input.data() + pos, input.size() - pos, args, consumed), Result::COMMAND);
+	EXPECT_TRUE(args.empty());
+	pos += consumed;
+	ASSERT_EQ(parser.parse(input.data() + pos, input.size() - pos, args, consumed), Result::COMMAND);
+	EXPECT_TRUE(args.empty());
+	pos += consumed;
+	EXPECT_EQ(pos, input.size());
+	EXPECT_EQ(parser.parse(input.data() + pos, 0, args, consumed), Result::NEED_MORE);
+
+	//one byte more on every call, the bytes are moved to a new buffer each time
+	std::string command = "*2\r\n$4\r\nECHO\r\n$11\r\nhello world\r\n";
+	for (size_t n = 1; n < command.size(); n++)
+	{
+		std::string moved = command.substr(0, n);
+		ASSERT_EQ(parser.parse(moved.data(), moved.size(), args, consumed), Result::NEED_MORE) << n;
+	}
+	ASSERT_EQ(parser.parse(command.data(), command.size(), args, consumed), Result::COMMAND);
+	EXPECT_EQ(consumed, command.size());
+	EXPECT_EQ(toStrings(args), std::vector<std::string>({"ECHO", "hello world"}));
+
+	std::string big = "*2\r\n$3\r\nSET\r\n$100000\r\n";
+	ASSERT_EQ(parser.parse(big.data(), big.size(), args, consumed), Result::NEED_MORE);
+	EXPECT_EQ(parser.getExpectedSize(), big.size() + 100002);
+	big += std::string(100000, 'x') + "\r\n";
+	ASSERT_EQ(parser.parse(big.data(), big.size(), args, consumed), Result::COMMAND);
+	EXPECT_EQ(args[1].size(), 100000);
+
+	for (std::string bad : {"*x\r\n", "*2\r\n+OK\r\n", "*1\r\n$-2\r\n", "*1\r\n$abc\r\n", "*99999999\r\n", "*1\r\n$1x\r\n"})
+	{
+		Redis::RespParser p;
+		bad += std::string(4, '\r');
+		EXPECT_NE(p.parse(bad.data(), bad.size(), args, consumed), Result::COMMAND) << bad;
+	}
+	Redis::RespParser p;
+	std::string noEnd(70000, 'a');
+	EXPECT_EQ(p.parse(noEnd.data(), noEnd.size(), args, consumed), Result::PROTOCOL_ERROR);
+	EXPECT_EQ(p.getError(), "Protocol error: too big inline request");
+	std::string wrongType = "*1\r\n+OK\r\n";
+	EXPECT_EQ(p.parse(wrongType.data(), wrongType.size(), args, consumed), Result::PROTOCOL_ERROR);
+	EXPECT_EQ(p.getError(), "Protocol error: expected '$', got '+'");
+}
+
+TEST_F(TestResp, WriterTest)
+{
+	Redis::RespWriter out;
+	out.simple("OK");
+	out.error("ERR wrong");
+	out.integer(-42);
+	out.bulk("hello");
+	out.bulk("");
+	out.null();
+	out.nullArray();
+	out.array(2);
+	out.map(1);
+	out.boolean(true);
+	out.doubleValue(1.5);
+	EXPECT_EQ(out.getBuffer(), "+OK\r\n-ERR wrong\r\n:-42\r\n$5\r\nhello\r\n$0\r\n\r\n$-1\r\n*-1\r\n*2\r\n*2\r\n:1\r\n$3\r\n1.5\r\n");
+	size_t capacity = out.getBuffer().capacity();
+	out.clear();
+	EXPECT_TRUE(out.empty());
+	EXPECT_EQ(out.getBuffer().capacity(), capacity);
+
+	out.setVersion(Redis::RespVersion::RESP3);
+	out.null();
+	out.map(1);
+	out.set(2);
+	out.boolean(false);
+	out.doubleValue(1.5);
+	EXPECT_EQ(out.getBuffer(), "_\r\n%1\r\n~2\r\n#f\r\n,1.5\r\n");
+}
+
+/* RESP2 and RESP3 replies parsed as views into the input, a nested reply
+ * given one byte more at a time, and a value copied out of its buffer.
+ */
+TEST_F(TestResp, ReplyParserTest)
+{
+	using Result = Redis::RespReplyParser::Result;
+	using Redis::RespType;
+	Redis::RespReplyParser parser;
+	size_t consumed = 0;
+
+	std::string input = "+OK\r\n-ERR wrong\r\n:-42\r\n$5\r\nhello\r\n$-1\r\n*-1\r\n_\r\n#t\r\n,3.5\r\n(12345678901234567890\r\n=8\r\ntxt:text\r\n!4\r\nFAIL\r\n*0\r\n";
+	std::vector<std::pair<RespType, std::string>> expected = {
+		{RespType::SIMPLE_STRING, "OK"}, {RespType::ERROR, "ERR wrong"}, {RespType::INTEGER, ""}, {RespType::BULK_STRING, "hello"},
+		{RespType::NIL, ""}, {RespType::NIL, ""}, {RespType::NIL, ""}, {RespType::BOOLEAN, ""}, {RespType::DOUBLE, "3.5"},
+		{RespType::BIG_NUMBER, "12345678901234567890"}, {RespType::BULK_STRING, "text"}, {RespType::ERROR, "FAIL"}, {RespType::ARRAY, ""}};
+	size_t pos = 0;
+	for (auto &e : expected)
+	{
+		ASSERT_EQ(parser.parse(input.data() + pos, input.size() - pos, consumed), Result::REPLY) << e.second;
+		Redis::RespValue value = parser.getValue(input.data() + pos);
+		EXPECT_EQ(value.getType(), e.first) << e.second;
+		EXPECT_EQ(value.getString(), e.second);
+		pos += consumed;
+	}
+	EXPECT_EQ(pos, input.size());
+	parser.parse(input.data() + 17, input.size() - 17, consumed);
+	EXPECT_EQ(parser.getValue(input.data() + 17).getInteger(), -42);
+	parser.parse(input.data() + 47, input.size() - 47, consumed);
+	EXPECT_EQ(parser.getValue(input.data() + 47).getInteger(), 1);
+	parser.parse(input.data() + 51, input.size() - 51, consumed);
+	EXPECT_EQ(parser.getValue(input.data() + 51).getDouble(), 3.5);
+
+	//one byte more on every call, the bytes are moved to a new buffer each time
+	std::string nested = "*3\r\n$3\r\none\r\n%2\r\n+a\r\n:1\r\n+b\r\n*2\r\n:2\r\n:3\r\n~0\r\n";
+	for (size_t n = 1; n < nested.size(); n++)
+	{
+		std::string moved = nested.substr(0, n);
+		ASSERT_EQ(parser.parse(moved.data(), moved.size(), consumed), Result::NEED_MORE) << n;
+	}
+	ASSERT_EQ(parser.parse(nested.data(), nested.size(), consumed), Result::REPLY);
+	EXPECT_EQ(consumed, nested.size());
+	Redis::RespValue root = parser.getValue(nested.data());
+	ASSERT_EQ(root.size(), 3u);
+	EXPECT_EQ(root[0].getString(), "one");
+	//the strings point into the input
+	EXPECT_EQ(root[0].getString().data(), nested.data() + 8);
+	Redis::RespValue map = root[1];
+	EXPECT_EQ(map.getType(), RespType::MAP);
+	std::vector<std::string> flat;
+	for (Redis::RespValue element : map)
+		flat.push_back(element.getType() == RespType::ARRAY ? "[" + std::to_string(element[0].getInteger()) + std::to_string(element[1].getInteger()) + "]"
+								    : element.getType() == RespType::INTEGER ? std::to_string(element.getInteger()) : std::string(element.getString()));
+	EXPECT_EQ(flat, std::vector<std::string>({"a", "1", "b", "[23]"}));
+	EXPECT_EQ(root[2].getType(), RespType::SET);
+	EXPECT_EQ(root[2].size(), 0u);
+
+	//a copy of the map outlives the input
+	Redis::RespResult copy(map);
+	nested.assign(nested.size(), 'x');
+	Redis::RespValue copied = copy.getValue();
+	EXPECT_EQ(copied.size(), 4u);
+	EXPECT_EQ(copied[2].getString(), "b");
+	EXPECT_EQ(copied[3][1].getInteger(), 3);
+	EXPECT_TRUE(Redis::RespResult().getValue().isNil());
+
+	std::string big = "$100000\r\n";
+	ASSERT_EQ(parser.parse(big.data(), big.size(), consumed), Result::NEED_MORE);
+	EXPECT_EQ(parser.getExpectedSize(), big.size() + 100002);
+	big += std::string(100000, 'x') + "\r\n";
+	ASSERT_EQ(parser.parse(big.data(), big.size(), consumed), Result::REPLY);
+	EXPECT_EQ(parser.getValue(big.data()).getString().size(), 100000u);
+
+	for (std::string bad : {"?x\r\n", ":1x\r\n", "$-2\r\n", "%-1\r\n", "#x\r\n", "$1\r\nab\r\n", "|1\r\n+a\r\n+b\r\n+c\r\n"})
+	{
+		Redis::RespReplyParser p;
+		EXPECT_EQ(p.parse(bad.data(), bad.size(), consumed), Result::PROTOCOL_ERROR) << bad;
+	}
+	Redis::RespReplyParser p;
+	std::string noEnd(70000, 'a');
+	EXPECT_EQ(p.parse(noEnd.data(), noEnd.size(), consumed), Result::PROTOCOL_ERROR);
+	EXPECT_EQ(p.getError(), "Protocol error: too big reply line");
+}
+
+/* a client sends pipelined commands in pieces, SLOW is answered after the
+ * commands behind it and still comes back in order. the io_services run on
+ * two threads like two cores.
+ */
+TEST_F(TestResp, ServerTest)
+{
+	using boost::asio::ip::tcp;
+	boost::asio::io_service core0, core1;
+	auto guard0 = boost::asio::make_work_guard(core0);
+	auto guard1 = boost::asio::make_work_guard(core1);
+	Redis::RespServer server({&core0, &core1}, "127.0.0.1", "16379", [](const std::vector<std::string_view> &args, Redis::RespReply reply) {
+		std::string name(args[0]);
+		if (name == "SLOW")
+		{
+			//answered from a later turn of the loop, after the next commands
+			std::string value(args[1]);
+			auto timer = std::make_shared<boost::asio::steady_timer>(reply.getSession().getSocket().get_executor(), std::chrono::milliseconds(20));
+			timer->async_wait([timer, reply, value](const boost::system::error_code &) mutable {
+				reply.send([&](Redis::RespWriter &out) { out.bulk(value); });
+			});
+			return;
+		}
+		if (name == "HELLO")
+			reply.getSession().setVersion(Redis::RespVersion::RESP3);
+		if (name == "NIL")
+		{
+			reply.send([](Redis::RespWriter &out) { out.null(); });
+			return;
+		}
+		if (name == "QUIT")
+			reply.getSession().closeAfterReplies();
+		reply.send([&](Redis::RespWriter &out) {
+			if (args.size() > 1)
+				out.bulk(args[1]);
+			else
+				out.simple("OK");
+		});
+	});
+	std::thread t0([&]() { core0.run(); });
+	std::thread t1([&]() { core1.run(); });
+
+	boost::asio::io_service ios;
+	tcp::socket socket(ios);
+	socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 16379));
+	std::string big(200000, 'b');
+	std::string request = "ECHO 1\r\n*2\r\n$4\r\nSLOW\r\n$1\r\n2\r\nECHO 3\r\nNIL\r\nHELLO\r\nNIL\r\n*2\r\n$4\r\nECHO\r\n$200000\r\n" + big + "\r\nQUIT\r\nECHO dropped\r\n";
+	//in pieces which split the commands
+	for (size_t pos = 0; pos < request.size(); pos += 7)
+	{
+		boost::asio::write(socket, boost::asio::buffer(request.data() + pos, std::min<size_t>(7, request.size() - pos)));
+		if (pos < 100)
+			std::this_thread::sleep_for(std::chrono::milliseconds(1));
+	}
+	std::string response;
+	boost::system::error_code ec;
+	char buffer[65536];
+	while (!ec)
+	{
+		size_t n = socket.read_some(boost::asio::buffer(buffer), ec);
+		response.append(buffer, n);
+	}
+	EXPECT_EQ(response, "$1\r\n1\r\n$1\r\n2\r\n$1\r\n3\r\n$-1\r\n+OK\r\n_\r\n$200000\r\n" + big + "\r\n+OK\r\n");
+
+	//the reply to a protocol error ends the connection
+	tcp::socket bad(ios);
+	bad.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 16379));
+	boost::asio::write(bad, boost::asio::buffer(std::string("ECHO ok\r\n*1\r\n$x\r\nECHO no\r\n")));
+	response.clear();
+	ec.clear();
+	while (!ec)
+	{
+		size_t n = bad.read_some(boost::asio::buffer(buffer), ec);
+		response.append(buffer, n);
+	}
+	EXPECT_EQ(response, "$2\r\nok\r\n-ERR Protocol error: invalid bulk length\r\n");
+
+	server.stop();
+	guard0.reset();
+	guard1.reset();
+	core0.stop();
+	core1.stop();
+	t0.join();
+	t1.join();
+}
+
+/* a bulk length beyond the query buffer limit is answered with an error
+ * and the connection is closed, the command never reaches the handler.
+ */
+TEST_F(TestResp, QueryBufferLimitTest)
+{
+	using boost::asio::ip::tcp;
+	boost::asio::io_service core;
+	auto guard = boost::asio::make_work_guard(core);
+	std::atomic<int> handled{0};
+	Redis::RespServer server({&core}, "127.0.0.1", "16378", [&](const std::vector<std::string_view> &, Redis::RespReply reply) {
+		handled++;
+		reply.send([](Redis::RespWriter &out) { out.simple("OK"); });
+	}, 1024 * 1024);
+	std::thread t([&]() { core.run(); });
+
+	boost::asio::io_service ios;
+	tcp::socket socket(ios);
+	socket.connect(tcp::endpoint(boost::asio::ip::make_address("127.0.0.1"), 16378));
+	boost::asio::write(socket, boost::asio::buffer(std::string("PING\r\n*2\r\n$3\r\nSET\r\n$2000000\r\n")));
+	std::string response;
+	boost::system::error_code ec;
+	char buffer[4096];
+	while (!ec)
+	{
+		size_t n = socket.read_some(boost::asio::buffer(buffer), ec);
+		response.append(buffer, n);
+	}
+	EXPECT_EQ(response, "+OK\r\n-ERR Protocol error: query buffer limit reached\r\n");
+	EXPECT_EQ(handled, 1);
+
+	server.stop();
+	guard.reset();
+	core.stop();
+	t.join();
+}
+
+/* pipelined SET commands parsed from one buffer, the views against copying
+ * every argument into a string as the HTTP request parser does, and the
+ * replies serialized into a reused buffer.
+ */
+TEST_F(TestResp, DISABLED_ParserBenchmark)
+{
+	const int commandNumber = 1000000;
+	std::string input;
+	for (int i = 0; i < commandNumber; i++)
+	{
+		std::string key = "key:" + std::to_string(i % 100000);
+		input += "*3\r\n$3\r\nSET\r\n$" + std::to_string(key.size()) + "\r\n" + key + "\r\n$5\r\nvalue\r\n";
+	}
+	auto run = [&](const char *name, bool copy) {
+		Redis::RespParser parser;
+		Redis::RespWriter out;
+		std::vector<std::string_view> args;
+		std::vector<std::string> copied;
+		size_t pos = 0, consumed = 0, bytes = 0;
+		auto start = std::chrono::steady_clock::now();
+		while (parser.parse(input.data() + pos, input.size() - pos, args, consumed) == Redis::RespParser::Result::COMMAND)
+		{
+			pos += consumed;
+			if (copy)
+				copied.assign(args.begin(), args.end());
+			bytes += args[1].size();
+			out.simple("OK");
+			//a write every 64 commands, as a pipelining client reads them
+			if (out.size() > 64 * 5)
+				out.clear();
+		}
+		auto cost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		EXPECT_EQ(pos, input.size());
+		EXPECT_GT(bytes, 0);
+		std::cout << name << ": " << static_cast<double>(commandNumber) / (cost > 0 ? cost : 1) << " M commands/s" << std::endl;
+	};
+	run("argument views", false);
+	run("argument copies", true);
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
@@ -0,0 +1,243 @@
+#include <gtest/gtest.h>
+#include <shard.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <iostream>
+#include <mutex>
+#include <random>
+#include <string>
+#include <thread>
+#include <vector>
+
+//poll until done, the thread gives up its time slice when the mailboxes are empty
+template <typename Pred>
+static void pollUntil(Redis::ShardRuntime &runtime, size_t shard, Pred done)
+{
+	while (!done())
+	{
+		if (runtime.poll(shard) == 0)
+			std::this_thread::yield();
+	}
+}
+
+class TestShard : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+//the type and the content of a result in one string
+static std::string describe(const Redis::KeyspaceResult &result)
+{
+	switch (result.mType)
+	{
+	case Redis::KeyspaceResult::Type::STATUS:
+		return "status " + result.mValue;
+	case Redis::KeyspaceResult::Type::VALUE:
+		return "value " + result.mValue;
+	case Redis::KeyspaceResult::Type::NIL:
+		return "nil";
+	case Redis::KeyspaceResult::Type::INTEGER:
+		return "integer " + std::to_string(result.mInteger);
+	default:
+		return "error " + result.mValue;
+	}
+}
+
+TEST_F(TestShard, KeyspaceTest)
+{
+	Redis::Keyspace keyspace;
+	EXPECT_EQ(describe(keyspace.execute({"PING"})), "status PONG");
+	EXPECT_EQ(describe(keyspace.execute({"GET", "hello"})), "nil");
+	EXPECT_EQ(describe(keyspace.execute({"SET", "hello", "world"})), "status OK");
+	EXPECT_EQ(describe(keyspace.execute({"SET", "hello", "redis"})), "status OK");
+	EXPECT_EQ(describe(keyspace.execute({"GET", "hello"})), "value redis");
+	EXPECT_EQ(describe(keyspace.execute({"EXISTS", "hello"})), "integer 1");
+	EXPECT_EQ(describe(keyspace.execute({"DEL", "hello"})), "integer 1");
+	EXPECT_EQ(describe(keyspace.execute({"DEL", "hello"})), "integer 0");
+	EXPECT_EQ(keyspace.execute({"SET", "hello"}).mType, Redis::KeyspaceResult::Type::ERROR);
+	EXPECT_EQ(keyspace.execute({}).mType, Redis::KeyspaceResult::Type::ERROR);
+	//values which look like an error or a nil are still values
+	keyspace.execute({"SET", "a", "ERR not an error"});
+	keyspace.execute({"SET", "b", "(nil)"});
+	EXPECT_EQ(describe(keyspace.execute({"GET", "a"})), "value ERR not an error");
+	EXPECT_EQ(describe(keyspace.execute({"GET", "b"})), "value (nil)");
+}
+
+/* every thread runs one shard and sets its own keys, the GET of a key is sent
+ * from the callback of its SET. the threads keep polling until all of them are
+ * done, since the others still forward commands to them.
+ */
+TEST_F(TestShard, ShardRuntimeTest)
+{
+	const int shardNumber = 4, keyNumber = 20000;
+	Redis::ShardRuntime runtime(shardNumber, 16);
+	std::atomic<int> finished{0};
+	std::vector<std::thread> threads;
+	for (int t = 0; t < shardNumber; t++)
+	{
+		threads.emplace_back([&, t]() {
+			int replies = 0;
+			for (int i = 0; i < keyNumber; i++)
+			{
+				std::string key = std::to_string(t) + ":" + std::to_string(i);
+				runtime.execute(t, {"SET", key, std::to_string(i)}, [&, t, i, key](Redis::KeyspaceResult result) {
+					EXPECT_EQ(describe(result), "status OK");
+					runtime.execute(t, {"GET", key}, [&, i](Redis::KeyspaceResult value) {
+						EXPECT_EQ(describe(value), "value " + std::to_string(i));
+						replies++;
+					});
+				});
+				runtime.poll(t);
+			}
+			pollUntil(runtime, t, [&]() { return replies == keyNumber; });
+			finished++;
+			pollUntil(runtime, t, [&]() { return finished == shardNumber; });
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	std::vector<int> owned(shardNumber);
+	for (int t = 0; t < shardNumber; t++)
+	{
+		for (int i = 0; i < keyNumber; i++)
+		{
+			std::string key = std::to_string(t) + ":" + std::to_string(i);
+			size_t owner = runtime.shardOf(key);
+			owned[owner]++;
+			EXPECT_EQ(describe(runtime.getKeyspace(owner).execute({"GET", key})), "value " + std::to_string(i));
+			EXPECT_EQ(describe(runtime.getKeyspace((owner + 1) % shardNumber).execute({"EXISTS", key})), "integer 0");
+		}
+	}
+	//the keys are spread over all shards
+	for (int n : owned)
+		EXPECT_GT(n, keyNumber / 2);
+}
+
+/* every key is scanned once in chunks of about count keys, also by a task
+ * sent to the shard owning them.
+ */
+TEST_F(TestShard, ScanTest)
+{
+	const int keyNumber = 10000;
+	Redis::ShardRuntime runtime(2);
+	for (int i = 0; i < keyNumber; i++)
+		runtime.getKeyspace(1).execute({"SET", "key" + std::to_string(i), "v"});
+	std::vector<std::string> keys;
+	size_t cursor = 0, chunks = 0;
+	do
+	{
+		size_t before = keys.size();
+		cursor = runtime.getKeyspace(1).scan(cursor, keys, 100);
+		EXPECT_LT(keys.size() - before, 200u);
+		chunks++;
+	} while (cursor != 0);
+	std::sort(keys.begin(), keys.end());
+	EXPECT_EQ(std::unique(keys.begin(), keys.end()) - keys.begin(), keyNumber);
+	EXPECT_GE(chunks, static_cast<size_t>(keyNumber / 200));
+
+	std::string counted;
+	runtime.run(0, 1, [](Redis::Keyspace &keyspace) {
+		std::vector<std::string> all;
+		size_t next = 0;
+		do
+			next = keyspace.scan(next, all);
+		while (next != 0);
+		return std::to_string(all.size());
+	}, [&](std::string result) { counted = result; });
+	EXPECT_EQ(runtime.poll(1), 1u);
+	pollUntil(runtime, 0, [&]() { return !counted.empty(); });
+	EXPECT_EQ(counted, std::to_string(keyNumber));
+}
+
+/* 90% GET, 10% SET on 100k keys from 1 to 8 threads, a HashMap behind one
+ * mutex against one shard per thread. every shard thread keeps at most 64
+ * commands in flight.
+ */
+TEST_F(TestShard, DISABLED_ShardBenchmark)
+{
+	const int keyRange = 100000, opNumber = 1000000, window = 64;
+	auto keyOf = [](int k) { return "key:" + std::to_string(k); };
+	for (int threadNumber = 1; threadNumber <= 8; threadNumber *= 2)
+	{
+		RedisDataStructure::HashMap<std::string, std::string> dict;
+		std::mutex mutex;
+		for (int k = 0; k < keyRange; k++)
+			dict.insert(keyOf(k), "value");
+		std::vector<std::thread> threads;
+		auto start = std::chrono::steady_clock::now();
+		for (int t = 0; t < threadNumber; t++)
+		{
+			threads.emplace_back([&, t]() {
+				std::mt19937 gen(t);
+				for (int i = 0; i < opNumber / threadNumber; i++)
+				{
+					std::string key = keyOf(gen() % keyRange);
+					std::lock_guard<std::mutex> lock(mutex);
+					if (gen() % 10 == 0)
+						dict.get(key) = "value";
+					else
+						dict.peek(key);
+				}
+			});
+		}
+		for (auto &t : threads)
+			t.join();
+		auto lockCost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+
+		Redis::ShardRuntime runtime(threadNumber);
+		for (int k = 0; k < keyRange; k++)
+			runtime.getKeyspace(runtime.shardOf(keyOf(k))).execute({"SET", keyOf(k), "value"});
+		std::atomic<int> finished{0};
+		threads.clear();
+		start = std::chrono::steady_clock::now();
+		for (int t = 0; t < threadNumber; t++)
+		{
+			threads.emplace_back([&, t]() {
+				std::mt19937 gen(t);
+				int inflight = 0;
+				for (int i = 0; i < opNumber / threadNumber; i++)
+				{
+					pollUntil(runtime, t, [&]() { return inflight < window; });
+					inflight++;
+					std::string key = keyOf(gen() % keyRange);
+					if (gen() % 10 == 0)
+						runtime.execute(t, {"SET", key, "value"}, [&](Redis::KeyspaceResult) { inflight--; });
+					else
+						runtime.execute(t, {"GET", key}, [&](Redis::KeyspaceResult) { inflight--; });
+				}
+				pollUntil(runtime, t, [&]() { return inflight == 0; });
+				finished++;
+				pollUntil(runtime, t, [&]() { return finished == threadNumber; });
+			});
+		}
+		for (auto &t : threads)
+			t.join();
+		auto shardCost = std::chrono::duration_cast<std::chrono::microseconds>(std::chrono::steady_clock::now() - start).count();
+		std::cout << threadNumber << " threads: locked HashMap " << static_cast<double>(opNumber) / (lockCost > 0 ? lockCost : 1)
+				  << " Mops/s, shards " << static_cast<double>(opNumber) / (shardCost > 0 ? shardCost : 1) << " Mops/s" << std::endl;
+	}
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}
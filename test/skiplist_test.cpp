@@ -2,6 +2,8 @@
 #include <SkipList.h>
 #include <string>
 #include <iostream>
+#include <chrono>
+#include <utility>
 class TestMap : public testing::Test
 {
 public:
@@ -100,6 +102,145 @@ TEST_F(TestMap, SkipListBoundTest)
 	EXPECT_EQ(high->mKey, 8);
 }
 
+TEST_F(TestMap, SkipListEraseValueTest)
+{
+	RedisDataStructure::SkipList<int, std::string> sortedlist;
+	std::vector<std::string> values{"he", "fun", "world"};
+	sortedlist.insert(1, "he");
+	sortedlist.insert(3, "llo");
+	sortedlist.insert(3, "fun");
+	sortedlist.insert(8, "world");
+	EXPECT_FALSE(sortedlist.erase(3, "world"));
+	EXPECT_TRUE(sortedlist.erase(3, "llo"));
+	EXPECT_EQ(sortedlist.getLength(), 3);
+	EXPECT_EQ(sortedlist.getRank(8), 3);
+	int valueIndex = 0;
+	for (auto it = sortedlist.begin(); it != sortedlist.end(); it++)
+	{
+		EXPECT_EQ(it->mValue, values[valueIndex++]);
+	}
+}
+
+TEST_F(TestMap, SkipListAssignSortedTest)
+{
+	RedisDataStructure::SkipList<int, std::string> sortedlist;
+	std::vector<std::pair<int, std::string>> input;
+	for (int i = 0; i < 100; i++)
+	{
+		input.emplace_back(i * 2, std::to_string(i));
+	}
+	sortedlist.insert(7, "replaced");
+	sortedlist.assignSorted(input.begin(), input.end());
+	EXPECT_EQ(sortedlist.getLength(), 100);
+	int keyIndex = 0;
+	for (auto it = sortedlist.begin(); it != sortedlist.end(); it++)
+	{
+		EXPECT_EQ(it->mKey, input[keyIndex++].first);
+	}
+	for (int i = 0; i < 100; i++)
+	{
+		EXPECT_EQ(sortedlist.getRank(i * 2), i + 1);
+	}
+	//the built list keeps working with insert and erase
+	sortedlist.insert(3, "three");
+	EXPECT_EQ(sortedlist.getRank(3), 3);
+	EXPECT_EQ(sortedlist.getRank(198), 101);
+	EXPECT_TRUE(sortedlist.erase(0));
+	EXPECT_EQ(sortedlist.getRank(198), 100);
+	EXPECT_EQ(sortedlist.rbegin()->mKey, 198);
+
+	std::vector<std::pair<int, std::string>> unsorted{{2, "a"}, {1, "b"}};
+	EXPECT_THROW(sortedlist.assignSorted(unsorted.begin(), unsorted.end()), std::invalid_argument);
+	EXPECT_EQ(sortedlist.getLength(), 100);
+}
+
+TEST_F(TestMap, DISABLED_SkipListAssignSortedBenchmark)
+{
+	const int n = 1000000;
+	std::vector<std::pair<int, int>> input;
+	for (int i = 0; i < n; i++)
+	{
+		input.emplace_back(i, i);
+	}
+	auto start = std::chrono::steady_clock::now();
+	{
+		RedisDataStructure::SkipList<int, int> sortedlist;
+		for (auto &p : input)
+			sortedlist.insert(p.first, p.second);
+	}
+	auto middle = std::chrono::steady_clock::now();
+	{
+		RedisDataStructure::SkipList<int, int> sortedlist;
+		sortedlist.assignSorted(input.begin(), input.end());
+		EXPECT_EQ(sortedlist.getLength(), n);
+	}
+	auto end = std::chrono::steady_clock::now();
+	std::cout << "build " << n << " nodes, insert: "
+			  << std::chrono::duration_cast<std::chrono::milliseconds>(middle - start).count() << " ms, assignSorted: "
+			  << std::chrono::duration_cast<std::chrono::milliseconds>(end - middle).count() << " ms" << std::endl;
+}
+
+TEST_F(TestMap, SkipListFingerTest)
+{
+	RedisDataStructure::SkipList<int, int> sortedlist;
+	std::vector<int> keys;
+	//mostly ascending keys with some jumps back, the finger falls back to mHead for those
+	for (int i = 0; i < 2000; i++)
+	{
+		int k = (i % 100 == 99) ? i / 2 : i;
+		keys.push_back(k);
+		sortedlist.insertWithFinger(k, i);
+		if (i % 500 == 0)
+			sortedlist.erase(k);
+		if (i % 500 == 0)
+			keys.pop_back();
+	}
+	std::sort(keys.begin(), keys.end());
+	EXPECT_EQ(sortedlist.getLength(), (int)keys.size());
+	int keyIndex = 0;
+	for (auto it = sortedlist.begin(); it != sortedlist.end(); it++)
+	{
+		EXPECT_EQ(it->mKey, keys[keyIndex++]);
+	}
+	//ranks are kept by the finger insert
+	for (int k = 1; k < 2000; k += 37)
+	{
+		bool exist = std::binary_search(keys.begin(), keys.end(), k);
+		EXPECT_EQ(sortedlist.getRank(k), exist ? (int)(std::upper_bound(keys.begin(), keys.end(), k) - keys.begin()) : 0);
+	}
+	for (int k : {-1, 1, 1500, 1999, 5000})
+	{
+		auto nd = sortedlist.lowerBoundWithFinger(k);
+		auto expect = std::lower_bound(keys.begin(), keys.end(), k);
+		if (expect == keys.end())
+			EXPECT_EQ(nd, nullptr);
+		else
+			EXPECT_EQ(nd->mKey, *expect);
+	}
+}
+
+TEST_F(TestMap, DISABLED_SkipListFingerBenchmark)
+{
+	const int n = 1000000;
+	long long cost[2];
+	for (int useFinger = 0; useFinger < 2; useFinger++)
+	{
+		RedisDataStructure::SkipList<long long, int> timeline;
+		auto start = std::chrono::steady_clock::now();
+		//monotonic timestamps, with equal timestamps from time to time
+		for (int i = 0; i < n; i++)
+		{
+			if (useFinger)
+				timeline.insertWithFinger(1600000000000LL + i - i % 3, i);
+			else
+				timeline.insert(1600000000000LL + i - i % 3, i);
+		}
+		cost[useFinger] = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		EXPECT_EQ(timeline.getLength(), n);
+	}
+	std::cout << "monotonic insert " << n << " nodes, insert: " << cost[0] << " ms, insertWithFinger: " << cost[1] << " ms" << std::endl;
+}
+
 int main(int argc, char **argv)
 {
 	::testing::InitGoogleTest(&argc, argv);
@@ -1,8 +1,17 @@
 #include <gtest/gtest.h>
 #include <threadPool.h>
+#include <atomic>
+#include <chrono>
+#include <ctime>
+#include <functional>
 #include <iostream>
+#include <iterator>
+#include <memory>
+#include <set>
+#include <stdexcept>
 #include <string>
 #include <thread>
+#include <vector>
 
 class TestThreadPool : public testing::Test
 {
@@ -47,6 +56,473 @@ TEST_F(TestThreadPool, ConcurrentQueueTest)
 	consumer.join();
 }
 
+TEST_F(TestThreadPool, LockFreeQueueTest)
+{
+	Redis::ConcurrentQueueLockFree<std::unique_ptr<int>> q(3);
+	EXPECT_EQ(q.getMaxSize(), 4);
+	for (int i = 0; i < 4; i++)
+		EXPECT_TRUE(q.tryPush(std::unique_ptr<int>(new int(i))));
+	EXPECT_FALSE(q.tryPush(std::unique_ptr<int>(new int(4))));
+	EXPECT_EQ(q.getSize(), 4);
+	std::unique_ptr<int> value;
+	for (int i = 0; i < 4; i++)
+	{
+		EXPECT_TRUE(q.tryPop(value));
+		EXPECT_EQ(*value, i);
+	}
+	EXPECT_FALSE(q.tryPop(value));
+	EXPECT_TRUE(q.empty());
+
+	//the items left over are destroyed with the queue, also after the positions wrap around
+	auto shared = std::make_shared<int>(0);
+	{
+		Redis::ConcurrentQueueLockFree<std::shared_ptr<int>> left(4);
+		std::shared_ptr<int> item;
+		for (int i = 0; i < 3; i++)
+			EXPECT_TRUE(left.tryPush(shared));
+		EXPECT_TRUE(left.tryPop(item));
+		EXPECT_TRUE(left.tryPop(item));
+		item.reset();
+		for (int i = 0; i < 3; i++)
+			EXPECT_TRUE(left.tryPush(shared));
+		EXPECT_EQ(shared.use_count(), 5);
+	}
+	EXPECT_EQ(shared.use_count(), 1);
+
+	//producers block on the full queue and consumers on the empty one, every item arrives once
+	const int producerNumber = 4, itemNumber = 100000;
+	Redis::ConcurrentQueueLockFree<int> small(16);
+	std::vector<std::thread> threads;
+	std::atomic<long long> sum{0};
+	for (int t = 0; t < producerNumber; t++)
+	{
+		threads.emplace_back([&, t]() {
+			for (int i = t; i < itemNumber; i += producerNumber)
+				small.waitPush(i);
+		});
+		threads.emplace_back([&]() {
+			int item;
+			for (int i = 0; i < itemNumber / producerNumber; i++)
+			{
+				small.waitPop(item);
+				sum += item;
+			}
+		});
+	}
+	for (auto &t : threads)
+		t.join();
+	EXPECT_EQ(sum, (long long)itemNumber * (itemNumber - 1) / 2);
+	EXPECT_TRUE(small.empty());
+}
+
+//one producer and one consumer, the items arrive in order
+TEST_F(TestThreadPool, SPSCQueueTest)
+{
+	Redis::ConcurrentQueueSPSC<std::unique_ptr<int>> q(3);
+	EXPECT_EQ(q.getMaxSize(), 4);
+	for (int i = 0; i < 4; i++)
+		EXPECT_TRUE(q.tryPush(std::unique_ptr<int>(new int(i))));
+	EXPECT_FALSE(q.tryPush(std::unique_ptr<int>(new int(4))));
+	std::unique_ptr<int> value;
+	for (int i = 0; i < 4; i++)
+	{
+		EXPECT_TRUE(q.tryPop(value));
+		EXPECT_EQ(*value, i);
+	}
+	EXPECT_FALSE(q.tryPop(value));
+	EXPECT_TRUE(q.empty());
+
+	const int itemNumber = 1000000;
+	Redis::ConcurrentQueueSPSC<int> small(64);
+	std::thread producer([&]() {
+		for (int i = 0; i < itemNumber; i++)
+		{
+			while (!small.tryPush(i))
+				std::this_thread::yield();
+		}
+	});
+	int item, expect = 0;
+	while (expect < itemNumber)
+	{
+		if (small.tryPop(item))
+			EXPECT_EQ(item, expect++);
+		else
+			std::this_thread::yield();
+	}
+	producer.join();
+	EXPECT_TRUE(small.empty());
+}
+
+//n producers and n consumers pass 1M ints through a queue of 1024 slots
+TEST_F(TestThreadPool, DISABLED_ConcurrentQueueBenchmark)
+{
+	const int itemNumber = 1 << 20;
+	auto run = [&](auto &queue, int pairs, auto push, auto pop) {
+		std::vector<std::thread> threads;
+		auto start = std::chrono::steady_clock::now();
+		for (int t = 0; t < pairs; t++)
+		{
+			threads.emplace_back([&]() {
+				for (int i = 0; i < itemNumber / pairs; i++)
+					push(queue, i);
+			});
+			threads.emplace_back([&]() {
+				for (int i = 0; i < itemNumber / pairs; i++)
+					pop(queue);
+			});
+		}
+		for (auto &t : threads)
+			t.join();
+		return std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+	};
+	for (int pairs : {1, 2, 4})
+	{
+		Redis::ConcurrentQueueWithLock<int> locked(1024);
+		Redis::ConcurrentQueueLockFree<int> lockFree(1024);
+		auto lockedCost = run(locked, pairs, [](Redis::ConcurrentQueueWithLock<int> &q, int i) { q.waitPush(i); },
+							  [](Redis::ConcurrentQueueWithLock<int> &q) { q.waitPop(); });
+		auto lockFreeCost = run(lockFree, pairs, [](Redis::ConcurrentQueueLockFree<int> &q, int i) { q.waitPush(i); },
+								[](Redis::ConcurrentQueueLockFree<int> &q) {
+									int item;
+									q.waitPop(item);
+								});
+		std::cout << pairs << " producers and " << pairs << " consumers, locked queue: " << lockedCost
+				  << " ms, lock free queue: " << lockFreeCost << " ms" << std::endl;
+	}
+}
+
+struct ThrowOnCopy
+{
+	ThrowOnCopy() = default;
+	ThrowOnCopy(ThrowOnCopy &&) noexcept = default;
+	ThrowOnCopy &operator=(ThrowOnCopy &&) noexcept = default;
+	ThrowOnCopy(const ThrowOnCopy &other) : mThrow(other.mThrow)
+	{
+		if (mThrow)
+			throw std::runtime_error("copy failed");
+	}
+	bool mThrow = false;
+};
+
+TEST_F(TestThreadPool, BulkQueueTest)
+{
+	Redis::ConcurrentQueueLockFree<int> q(8);
+	std::vector<int> input(12), output(16, -1);
+	for (int i = 0; i < 12; i++)
+		input[i] = i;
+	EXPECT_EQ(q.tryPushBulk(input.begin(), input.end()), 8);
+	EXPECT_EQ(q.tryPopBulk(output.begin(), 5), 5);
+	EXPECT_EQ(q.tryPushBulk(input.begin() + 8, input.end()), 4);
+	EXPECT_EQ(q.tryPopBulk(output.begin() + 5, 16), 7);
+	EXPECT_EQ(q.tryPopBulk(output.begin(), 16), 0);
+	EXPECT_EQ(std::vector<int>(output.begin(), output.begin() + 12), input);
+
+	//move only items through move iterators
+	Redis::ConcurrentQueueLockFree<std::unique_ptr<int>> moveOnly(4);
+	std::vector<std::unique_ptr<int>> pointers;
+	for (int i = 0; i < 3; i++)
+		pointers.emplace_back(new int(i));
+	EXPECT_EQ(moveOnly.tryPushBulk(std::make_move_iterator(pointers.begin()), std::make_move_iterator(pointers.end())), 3);
+	std::vector<std::unique_ptr<int>> popped(3);
+	EXPECT_EQ(moveOnly.tryPopBulk(popped.begin(), 3), 3);
+	EXPECT_EQ(*popped[2], 2);
+
+	//a copy which throws leaves the items before it in the queue, and no slot is left unfilled
+	Redis::ConcurrentQueueLockFree<ThrowOnCopy> throwing(8);
+	std::vector<ThrowOnCopy> items(4);
+	items[2].mThrow = true;
+	EXPECT_THROW(throwing.tryPushBulk(items.begin(), items.end()), std::runtime_error);
+	EXPECT_EQ(throwing.getSize(), 2);
+	std::vector<ThrowOnCopy> out(8);
+	EXPECT_EQ(throwing.tryPopBulk(out.begin(), 8), 2);
+	items[2].mThrow = false;
+	EXPECT_EQ(throwing.tryPushBulk(items.begin(), items.end()), 4);
+
+	//one producer and one consumer, the order is kept through batches of different sizes
+	const int itemNumber = 100000;
+	Redis::ConcurrentQueueLockFree<int> lockFree(64);
+	Redis::ConcurrentQueueWithLock<int> locked(64);
+	auto produce = [&](auto &queue) {
+		std::vector<int> batch;
+		for (int i = 0; i < itemNumber;)
+		{
+			batch.clear();
+			for (int n = i % 100 + 1; n > 0 && i < itemNumber; n--)
+				batch.push_back(i++);
+			queue.pushBulk(batch.begin(), batch.end());
+		}
+	};
+	std::thread lockFreeProducer([&]() { produce(lockFree); });
+	std::thread lockedProducer([&]() { produce(locked); });
+	std::vector<int> fromLockFree, fromLocked;
+	std::vector<int> buffer(37);
+	while ((int)fromLockFree.size() < itemNumber)
+	{
+		size_t n = lockFree.popBulk(buffer.begin(), buffer.size());
+		fromLockFree.insert(fromLockFree.end(), buffer.begin(), buffer.begin() + n);
+	}
+	while ((int)fromLocked.size() < itemNumber)
+	{
+		size_t n = locked.popBulk(buffer.begin(), buffer.size());
+		fromLocked.insert(fromLocked.end(), buffer.begin(), buffer.begin() + n);
+	}
+	lockFreeProducer.join();
+	lockedProducer.join();
+	for (int i = 0; i < itemNumber; i++)
+	{
+		EXPECT_EQ(fromLockFree[i], i);
+		EXPECT_EQ(fromLocked[i], i);
+	}
+}
+
+//10M small messages from one thread to another, one by one and in batches of 64
+TEST_F(TestThreadPool, DISABLED_BulkQueueBenchmark)
+{
+	const int itemNumber = 10 * 1000 * 1000, batchSize = 64;
+	auto run = [&](const char *name, auto &queue, bool bulk, auto popOne) {
+		auto start = std::chrono::steady_clock::now();
+		std::thread producer([&]() {
+			std::vector<int> batch(batchSize);
+			for (int i = 0; i < itemNumber; i += batchSize)
+			{
+				if (bulk)
+				{
+					queue.pushBulk(batch.begin(), batch.end());
+					continue;
+				}
+				for (int j = 0; j < batchSize; j++)
+					queue.waitPush(j);
+			}
+		});
+		std::vector<int> batch(batchSize);
+		for (int received = 0; received < itemNumber;)
+		{
+			if (bulk)
+			{
+				received += queue.popBulk(batch.begin(), batchSize);
+				continue;
+			}
+			popOne();
+			received++;
+		}
+		producer.join();
+		auto cost = std::chrono::duration_cast<std::chrono::milliseconds>(std::chrono::steady_clock::now() - start).count();
+		std::cout << name << (bulk ? " bulk: " : " one by one: ") << cost << " ms, "
+				  << (cost ? itemNumber / cost / 1000.0 : 0) << " M messages/s" << std::endl;
+	};
+	for (bool bulk : {false, true})
+	{
+		Redis::ConcurrentQueueWithLock<int> locked(1024);
+		Redis::ConcurrentQueueLockFree<int> lockFree(1024);
+		run("locked queue", locked, bulk, [&]() { locked.waitPop(); });
+		run("lock free queue", lockFree, bulk, [&]() {
+			int item;
+			lockFree.waitPop(item);
+		});
+	}
+}
+
+TEST_F(TestThreadPool, WorkStealingDequeTest)
+{
+	const int itemNumber = 200000, thiefNumber = 3;
+	Redis::WorkStealingDeque<int> deque(4);
+	std::atomic<bool> done{false};
+	std::vector<int> taken[thiefNumber + 1];
+	std::vector<std::thread> thieves;
+	for (int t = 1; t <= thiefNumber; t++)
+	{
+		thieves.emplace_back([&, t]() {
+			int item;
+			while (!done || !deque.empty())
+			{
+				if (deque.steal(item))
+					taken[t].push_back(item);
+			}
+		});
+	}
+	int item;
+	for (int i = 0; i < itemNumber; i++)
+	{
+		deque.push(i);
+		if (i % 3 == 0 && deque.pop(item))
+			taken[0].push_back(item);
+	}
+	while (deque.pop(item))
+		taken[0].push_back(item);
+	done = true;
+	for (auto &t : thieves)
+		t.join();
+	//every item is taken exactly once
+	std::vector<bool> seen(itemNumber, false);
+	size_t total = 0;
+	for (auto &items : taken)
+	{
+		for (auto i : items)
+		{
+			EXPECT_FALSE(seen[i]);
+			seen[i] = true;
+		}
+		total += items.size();
+	}
+	EXPECT_EQ(total, itemNumber);
+}
+
+TEST_F(TestThreadPool, ThreadPoolSubmitTest)
+{
+	Redis::ThreadPool pool(4);
+	auto sum = pool.submit([](int a, int b) { return a + b; }, 1, 2);
+	auto text = pool.submit(Redis::ThreadPool::Priority::BACKGROUND, [](std::string s) { return s + " world"; }, std::string("hello"));
+	auto error = pool.submit([]() -> int { throw std::runtime_error("task failed"); });
+	EXPECT_EQ(sum.get(), 3);
+	EXPECT_EQ(text.get(), "hello world");
+	EXPECT_THROW(error.get(), std::runtime_error);
+	//move only task
+	std::unique_ptr<int> value(new int(42));
+	auto moved = pool.submit([v = std::move(value)]() { return *v; });
+	EXPECT_EQ(moved.get(), 42);
+}
+
+//tasks spawn tasks from the workers, which go to the local deques and are stolen by the others
+TEST_F(TestThreadPool, ThreadPoolRecursiveTest)
+{
+	Redis::ThreadPool pool(4);
+	const int depth = 14;
+	std::atomic<int> leaves{0};
+	std::promise<void> finished;
+	std::function<void(int)> spawn = [&](int level) {
+		if (level == depth)
+		{
+			if (++leaves == (1 << depth))
+				finished.set_value();
+			return;
+		}
+		pool.post(Redis::ThreadPool::Priority::HIGH, [&, level]() { spawn(level + 1); });
+		pool.post(Redis::ThreadPool::Priority::HIGH, [&, level]() { spawn(level + 1); });
+	};
+	spawn(0);
+	finished.get_future().wait();
+	EXPECT_EQ(leaves, 1 << depth);
+}
+
+TEST_F(TestThreadPool, ThreadPoolShutdownTest)
+{
+	std::atomic<int> counter{0};
+	Redis::ThreadPool pool(2);
+	for (int i = 0; i < 1000; i++)
+	{
+		pool.post(i % 2 ? Redis::ThreadPool::Priority::HIGH : Redis::ThreadPool::Priority::BACKGROUND, [&]() {
+			std::this_thread::sleep_for(std::chrono::microseconds(10));
+			counter++;
+		});
+	}
+	//all the queued tasks run before shutdown returns
+	pool.shutdown();
+	EXPECT_EQ(counter, 1000);
+	EXPECT_THROW(pool.submit([]() {}), std::runtime_error);
+	pool.shutdown();
+}
+
+//a task cannot shut down its own pool, and idle workers sleep while a long task finishes
+TEST_F(TestThreadPool, ThreadPoolShutdownFromWorkerTest)
+{
+	Redis::ThreadPool pool(4);
+	auto error = pool.submit([&]() { pool.shutdown(); });
+	EXPECT_THROW(error.get(), std::runtime_error);
+	std::atomic<bool> started{false};
+	pool.post(Redis::ThreadPool::Priority::HIGH, [&]() {
+		started = true;
+		std::this_thread::sleep_for(std::chrono::milliseconds(200));
+	});
+	while (!started)
+		std::this_thread::yield();
+	auto start = std::clock();
+	pool.shutdown();
+	//three idle workers spinning for 200ms would burn about 600ms of cpu
+	EXPECT_LT(double(std::clock() - start) / CLOCKS_PER_SEC, 0.1);
+}
+
+/* the pool with a single locked queue, all the workers and submitters fight
+ * for one mutex.
+ */
+class LockedQueuePool
+{
+public:
+	explicit LockedQueuePool(size_t threadNumber) : mQueue(SIZE_MAX)
+	{
+		for (size_t i = 0; i < threadNumber; i++)
+		{
+			mThreads.emplace_back([this]() {
+				while (true)
+				{
+					auto task = mQueue.waitPop();
+					if (!*task)
+						break;
+					(*task)();
+				}
+			});
+		}
+	}
+	~LockedQueuePool()
+	{
+		for (size_t i = 0; i < mThreads.size(); i++)
+			mQueue.waitPush(std::function<void()>());
+		for (auto &t : mThreads)
+			t.join();
+	}
+	void post(const std::function<void()> &task) { mQueue.waitPush(task); }
+
+private:
+	Redis::ConcurrentQueueWithLock<std::function<void()>> mQueue;
+	std::vector<std::thread> mThreads;
+};
+
+//1M fine grained tasks, submitted from outside and spawned by the tasks themselves
+TEST_F(TestThreadPool, DISABLED_ThreadPoolBenchmark)
+{
+	const size_t threadNumber = std::max(4u, std::thread::hardware_concurrency());
+	const int taskNumber = 1 << 20;
+	auto run = [&](const char *name, auto &pool, auto post) {
+		std::atomic<int> counter{0};
+		std::promise<void> finished;
+		auto task = [&]() {
+			if (++counter == taskNumber)
+				finished.set_value();
+		};
+		auto start = std::chrono::steady_clock::now();
+		for (int i = 0; i < taskNumber; i++)
+			post(pool, task);
+		finished.get_future().wait();
+		auto middle = std::chrono::steady_clock::now();
+
+		counter = 0;
+		std::promise<void> spawned;
+		std::function<void(int)> spawn = [&](int level) {
+			if (level == 20)
+			{
+				if (++counter == taskNumber)
+					spawned.set_value();
+				return;
+			}
+			post(pool, [&, level]() { spawn(level + 1); });
+			post(pool, [&, level]() { spawn(level + 1); });
+		};
+		spawn(0);
+		spawned.get_future().wait();
+		auto end = std::chrono::steady_clock::now();
+		std::cout << name << " with " << threadNumber << " threads, external submit: "
+				  << std::chrono::duration_cast<std::chrono::milliseconds>(middle - start).count() << " ms, recursive spawn: "
+				  << std::chrono::duration_cast<std::chrono::milliseconds>(end - middle).count() << " ms" << std::endl;
+	};
+	{
+		LockedQueuePool pool(threadNumber);
+		run("locked queue", pool, [](LockedQueuePool &p, std::function<void()> task) { p.post(task); });
+	}
+	{
+		Redis::ThreadPool pool(threadNumber);
+		run("work stealing", pool, [](Redis::ThreadPool &p, std::function<void()> task) { p.post(Redis::ThreadPool::Priority::HIGH, std::move(task)); });
+	}
+}
+
 // TEST_F(TestThreadPool, LockTest) {
 // 	std::mutex m;
 // 	std::unique_lock<std::mutex> l1(m);
@@ -0,0 +1,373 @@
+#include <gtest/gtest.h>
+#include <zset.h>
+#include <zsetAlgebra.h>
+#include <algorithm>
+#include <chrono>
+#include <atomic>
+#include <cstdlib>
+#include <iostream>
+#include <map>
+#include <memory>
+#include <new>
+#include <stdexcept>
+#include <string>
+#include <vector>
+
+//count the live heap bytes, so that the memory of two encodings can be compared.
+static std::atomic<size_t> gLiveBytes{0};
+
+void *operator new(std::size_t size)
+{
+	void *p = std::malloc(size + sizeof(std::max_align_t));
+	if (!p)
+		throw std::bad_alloc();
+	*static_cast<size_t *>(p) = size;
+	gLiveBytes += size;
+	return static_cast<char *>(p) + sizeof(std::max_align_t);
+}
+
+//the temporary buffer of stable_sort is taken with the nothrow form and given back to the delete below
+void *operator new(std::size_t size, const std::nothrow_t &) noexcept
+{
+	try
+	{
+		return operator new(size);
+	}
+	catch (const std::bad_alloc &)
+	{
+		return nullptr;
+	}
+}
+
+void operator delete(void *p) noexcept
+{
+	if (!p)
+		return;
+	void *raw = static_cast<char *>(p) - sizeof(std::max_align_t);
+	gLiveBytes -= *static_cast<size_t *>(raw);
+	std::free(raw);
+}
+
+void operator delete(void *p, std::size_t) noexcept
+{
+	operator delete(p);
+}
+
+class TestZSet : public testing::Test
+{
+public:
+	static void SetUpTestCase()
+	{
+		std::cout << "SetUpTestCase" << std::endl;
+	}
+	static void TearDownTestCase()
+	{
+		std::cout << "TearDownTestCase" << std::endl;
+	}
+	virtual void SetUp()
+	{
+		std::cout << "SetUp" << std::endl;
+	}
+	virtual void TearDown()
+	{
+		std::cout << "TearDown" << std::endl;
+	}
+};
+
+TEST_F(TestZSet, ListPackInsertTest)
+{
+	RedisDataStructure::ListPack pack;
+	pack.insert(3, "c");
+	pack.insert(1, "a");
+	pack.insert(2, "b");
+	pack.insert(2, "bb");
+	std::vector<std::string> members{"a", "b", "bb", "c"};
+	EXPECT_EQ(pack.getLength(), 4);
+	for (size_t i = 0; i < pack.getLength(); i++)
+	{
+		EXPECT_EQ(pack.memberAt(i), members[i]);
+	}
+	EXPECT_EQ(pack.lowerBound(2), 1);
+	EXPECT_EQ(pack.upperBound(2), 3);
+	EXPECT_EQ(pack.find("bb"), 2);
+	EXPECT_EQ(pack.find("d"), RedisDataStructure::ListPack::npos);
+	pack.erase(1);
+	EXPECT_EQ(pack.memberAt(1), "bb");
+	EXPECT_EQ(pack.memberAt(2), "c");
+}
+
+TEST_F(TestZSet, SortedSetAddTest)
+{
+	RedisDataStructure::SortedSet zset;
+	EXPECT_TRUE(zset.add("world", 8));
+	EXPECT_TRUE(zset.add("he", 1));
+	EXPECT_TRUE(zset.add("llo", 3));
+	EXPECT_FALSE(zset.add("he", 9));
+	EXPECT_EQ(zset.getEncoding(), RedisDataStructure::SortedSet::Encoding::LISTPACK);
+	std::vector<std::string> members{"llo", "world", "he"};
+	int index = 0;
+	zset.forEach([&](std::string_view member, double) { EXPECT_EQ(member, members[index++]); });
+	double score = 0;
+	EXPECT_TRUE(zset.getScore("he", score));
+	EXPECT_EQ(score, 9);
+	EXPECT_TRUE(zset.remove("llo"));
+	EXPECT_FALSE(zset.remove("llo"));
+	EXPECT_EQ(zset.getLength(), 2);
+}
+
+TEST_F(TestZSet, SortedSetConvertTest)
+{
+	RedisDataStructure::SortedSetConfig config;
+	config.mMaxListPackEntries = 4;
+	RedisDataStructure::SortedSet zset(config);
+	for (int i = 0; i < 4; i++)
+	{
+		zset.add("m" + std::to_string(i), 4 - i);
+	}
+	EXPECT_EQ(zset.getEncoding(), RedisDataStructure::SortedSet::Encoding::LISTPACK);
+	zset.add("m4", 0);
+	EXPECT_EQ(zset.getEncoding(), RedisDataStructure::SortedSet::Encoding::SKIPLIST);
+	std::vector<std::string> members{"m4", "m3", "m2", "m1", "m0"};
+	int index = 0;
+	zset.forEach([&](std::string_view member, double) { EXPECT_EQ(member, members[index++]); });
+	EXPECT_FALSE(zset.add("m4", 10));
+	EXPECT_TRUE(zset.remove("m3"));
+	std::vector<std::string> inRange;
+	zset.forEachInRange(2, 10, [&](std::string_view member, double) { inRange.emplace_back(member); });
+	EXPECT_EQ(inRange, std::vector<std::string>({"m2", "m1", "m0", "m4"}));
+
+	RedisDataStructure::SortedSet bigValue;
+	bigValue.add("small", 1);
+	bigValue.add(std::string(100, 'x'), 2);
+	EXPECT_EQ(bigValue.getEncoding(), RedisDataStructure::SortedSet::Encoding::SKIPLIST);
+	EXPECT_EQ(bigValue.getLength(), 2);
+}
+
+TEST_F(TestZSet, SortedSetLoadSortedTest)
+{
+	std::vector<std::pair<double, std::string>> input;
+	for (int i = 0; i < 200; i++)
+	{
+		input.emplace_back(i, "m" + std::to_string(i));
+	}
+	RedisDataStructure::SortedSet small, large;
+	small.loadSorted(input.begin(), input.begin() + 10);
+	large.loadSorted(input.begin(), input.end());
+	EXPECT_EQ(small.getEncoding(), RedisDataStructure::SortedSet::Encoding::LISTPACK);
+	EXPECT_EQ(large.getEncoding(), RedisDataStructure::SortedSet::Encoding::SKIPLIST);
+	EXPECT_EQ(small.getLength(), 10);
+	EXPECT_EQ(large.getLength(), 200);
+	double score = 0;
+	EXPECT_TRUE(large.getScore("m150", score));
+	EXPECT_EQ(score, 150);
+	int index = 0;
+	large.forEach([&](std::string_view member, double) { EXPECT_EQ(member, input[index++].second); });
+	EXPECT_TRUE(small.add("m100", 100));
+	EXPECT_TRUE(large.remove("m150"));
+	EXPECT_EQ(large.getLength(), 199);
+}
+
+TEST_F(TestZSet, SortedSetLoadSortedInvalidTest)
+{
+	//both encodings reject the same input and keep their content
+	for (int length : {10, 200})
+	{
+		std::vector<std::pair<double, std::string>> unsorted, duplicate;
+		for (int i = 0; i < length; i++)
+		{
+			unsorted.emplace_back(i, "m" + std::to_string(i));
+			duplicate.emplace_back(i, "m" + std::to_string(i));
+		}
+		std::swap(unsorted[3].first, unsorted[length - 2].first);
+		duplicate[length - 1].second = "m0";
+		RedisDataStructure::SortedSet zset;
+		zset.add("old", 1);
+		EXPECT_THROW(zset.loadSorted(unsorted.begin(), unsorted.end()), std::invalid_argument);
+		EXPECT_THROW(zset.loadSorted(duplicate.begin(), duplicate.end()), std::invalid_argument);
+		EXPECT_EQ(zset.getEncoding(), RedisDataStructure::SortedSet::Encoding::LISTPACK);
+		EXPECT_EQ(zset.getLength(), 1);
+		double score = 0;
+		EXPECT_TRUE(zset.getScore("old", score));
+	}
+}
+
+TEST_F(TestZSet, BPlusTreeSortedSetTest)
+{
+	RedisDataStructure::SortedSetConfig config;
+	config.mMaxListPackEntries = 4;
+	RedisDataStructure::BPlusTreeSortedSet zset(config);
+	for (int i = 0; i < 1000; i++)
+	{
+		zset.add("m" + std::to_string(i), 1000 - i);
+	}
+	EXPECT_EQ(zset.getEncoding(), RedisDataStructure::BPlusTreeSortedSet::Encoding::BPLUSTREE);
+	EXPECT_TRUE(zset.remove("m500"));
+	EXPECT_FALSE(zset.add("m0", -1));
+	std::vector<std::string> inRange;
+	zset.forEachInRange(498, 502, [&](std::string_view member, double) { inRange.emplace_back(member); });
+	EXPECT_EQ(inRange, std::vector<std::string>({"m502", "m501", "m499", "m498"}));
+	double previous = -2;
+	zset.forEach([&](std::string_view, double score) {
+		EXPECT_LT(previous, score);
+		previous = score;
+	});
+	EXPECT_EQ(zset.getLength(), 999);
+}
+
+TEST_F(TestZSet, ZUnionStoreTest)
+{
+	RedisDataStructure::SortedSetConfig config;
+	config.mMaxListPackEntries = 2;
+	RedisDataStructure::SortedSet a, b(config), dst;
+	a.add("x", 1);
+	a.add("y", 2);
+	b.add("y", 3);
+	b.add("z", 4);
+	b.add("w", 0);
+	std::vector<RedisDataStructure::SortedSet *> sets{&a, &b};
+	auto collect = [](RedisDataStructure::SortedSet &zset) {
+		std::vector<std::pair<std::string, double>> result;
+		zset.forEach([&](std::string_view member, double score) { result.emplace_back(member, score); });
+		return result;
+	};
+	EXPECT_EQ(RedisDataStructure::zunionstore(dst, sets), 4);
+	EXPECT_EQ(collect(dst), (std::vector<std::pair<std::string, double>>{{"w", 0}, {"x", 1}, {"z", 4}, {"y", 5}}));
+	RedisDataStructure::zunionstore(dst, sets, {2, 1}, RedisDataStructure::Aggregate::MIN);
+	EXPECT_EQ(collect(dst), (std::vector<std::pair<std::string, double>>{{"w", 0}, {"x", 2}, {"y", 3}, {"z", 4}}));
+	//dst is one of the inputs
+	RedisDataStructure::zunionstore(a, sets, {1, -1}, RedisDataStructure::Aggregate::MAX);
+	EXPECT_EQ(collect(a), (std::vector<std::pair<std::string, double>>{{"z", -4}, {"w", 0}, {"x", 1}, {"y", 2}}));
+
+	//overlapping sets with equal scores, against an aggregate by map and a sort
+	std::vector<std::unique_ptr<RedisDataStructure::SortedSet>> owners;
+	std::vector<RedisDataStructure::SortedSet *> random;
+	std::srand(7);
+	for (int i = 0; i < 4; i++)
+	{
+		owners.emplace_back(new RedisDataStructure::SortedSet());
+		for (int j = 0; j < 300; j++)
+			owners.back()->add("m" + std::to_string(std::rand() % 500), std::rand() % 20);
+		random.push_back(owners.back().get());
+	}
+	for (auto aggregate : {RedisDataStructure::Aggregate::SUM, RedisDataStructure::Aggregate::MIN, RedisDataStructure::Aggregate::MAX})
+	{
+		for (auto weights : {std::vector<double>(), std::vector<double>{1, -2, 0, 0.5}})
+		{
+			std::map<std::string, double> expect;
+			for (size_t i = 0; i < random.size(); i++)
+			{
+				double weight = i < weights.size() ? weights[i] : 1;
+				random[i]->forEach([&](std::string_view member, double score) {
+					auto it = expect.find(std::string(member));
+					if (it == expect.end())
+						expect.emplace(member, score * weight);
+					else
+						it->second = RedisDataStructure::ZSetAlgebra::combine(it->second, score * weight, aggregate);
+				});
+			}
+			std::vector<std::pair<double, std::string>> sorted;
+			for (auto &e : expect)
+				sorted.emplace_back(e.second, e.first);
+			std::sort(sorted.begin(), sorted.end());
+			std::vector<std::pair<std::string, double>> expectOrder;
+			for (auto &e : sorted)
+				expectOrder.emplace_back(e.second, e.first);
+			EXPECT_EQ(RedisDataStructure::zunionstore(dst, random, weights, aggregate), expect.size());
+			EXPECT_EQ(collect(dst), expectOrder);
+		}
+	}
+}
+
+TEST_F(TestZSet, ZInterStoreTest)
+{
+	RedisDataStructure::SortedSet a, b, c, dst;
+	for (int i = 0; i < 300; i++)
+	{
+		a.add("m" + std::to_string(i), i);
+		if (i % 2 == 0)
+			b.add("m" + std::to_string(i), 1);
+		if (i % 3 == 0)
+			c.add("m" + std::to_string(i), 2);
+	}
+	EXPECT_EQ(RedisDataStructure::zinterstore(dst, {&a, &b, &c}, {1, 10, 100}), 50);
+	EXPECT_EQ(dst.getEncoding(), RedisDataStructure::SortedSet::Encoding::LISTPACK);
+	double score = 0;
+	EXPECT_TRUE(dst.getScore("m6", score));
+	EXPECT_EQ(score, 216);
+	EXPECT_FALSE(dst.getScore("m2", score));
+	RedisDataStructure::SortedSet empty;
+	EXPECT_EQ(RedisDataStructure::zinterstore(dst, {&a, &empty}), 0);
+	EXPECT_EQ(dst.getLength(), 0);
+}
+
+/* the feed ranking case: union of 30 zsets, then intersection of 3 of them,
+ * computed by one thread and by 4 threads. the results must be the same.
+ */
+TEST_F(TestZSet, DISABLED_ZSetAlgebraBenchmark)
+{
+	const int setNumber = 30, memberNumber = 50000;
+	std::vector<std::unique_ptr<RedisDataStructure::SortedSet>> corpus;
+	std::vector<RedisDataStructure::SortedSet *> sets;
+	for (int i = 0; i < setNumber; i++)
+	{
+		corpus.emplace_back(new RedisDataStructure::SortedSet());
+		for (int j = 0; j < memberNumber; j++)
+			corpus.back()->add("item:" + std::to_string(std::rand() % (memberNumber * 4)), std::rand() % 10000);
+		sets.push_back(corpus.back().get());
+	}
+	std::vector<std::pair<std::string, double>> results[2];
+	for (size_t parallelism : {1, 4})
+	{
+		RedisDataStructure::SortedSet unionSet, interSet;
+		auto start = std::chrono::steady_clock::now();
+		RedisDataStructure::zunionstore(unionSet, sets, {}, RedisDataStructure::Aggregate::SUM, parallelism);
+		auto middle = std::chrono::steady_clock::now();
+		RedisDataStructure::zinterstore(interSet, {sets[0], sets[1], sets[2]}, {}, RedisDataStructure::Aggregate::MAX, parallelism);
+		auto end = std::chrono::steady_clock::now();
+		std::cout << parallelism << " threads" << ", union of " << setNumber << " zsets: "
+				  << std::chrono::duration_cast<std::chrono::milliseconds>(middle - start).count() << " ms, "
+				  << unionSet.getLength() << " members; intersection of 3: "
+				  << std::chrono::duration_cast<std::chrono::milliseconds>(end - middle).count() << " ms, "
+				  << interSet.getLength() << " members" << std::endl;
+		auto &result = results[parallelism == 1 ? 0 : 1];
+		unionSet.forEach([&](std::string_view member, double score) { result.emplace_back(member, score); });
+		interSet.forEach([&](std::string_view member, double score) { result.emplace_back(member, score); });
+	}
+	EXPECT_EQ(results[0], results[1]);
+}
+
+//build a corpus of small zsets in both encodings, report the heap bytes per 1M zsets.
+TEST_F(TestZSet, SortedSetMemoryTest)
+{
+	const int setNumber = 10000, memberNumber = 32;
+	RedisDataStructure::SortedSetConfig skiplistConfig;
+	skiplistConfig.mMaxListPackEntries = 0;
+	size_t used[2];
+	for (int encoding = 0; encoding < 2; encoding++)
+	{
+		size_t before = gLiveBytes;
+		std::vector<std::unique_ptr<RedisDataStructure::SortedSet>> corpus;
+		corpus.reserve(setNumber);
+		for (int i = 0; i < setNumber; i++)
+		{
+			corpus.emplace_back(encoding == 0 ? new RedisDataStructure::SortedSet()
+											  : new RedisDataStructure::SortedSet(skiplistConfig));
+			for (int j = 0; j < memberNumber; j++)
+			{
+				corpus.back()->add("member:" + std::to_string(j), std::rand() % 1000);
+			}
+		}
+		used[encoding] = gLiveBytes - before;
+	}
+	std::cout << "memory of 1M zsets with " << memberNumber << " members, listpack: "
+			  << used[0] * (1000000 / setNumber) / (1 << 20) << " MB, skiplist: "
+			  << used[1] * (1000000 / setNumber) / (1 << 20) << " MB" << std::endl;
+	EXPECT_LT(used[0] * 4, used[1]);
+}
+
+int main(int argc, char **argv)
+{
+	::testing::InitGoogleTest(&argc, argv);
+
+	return RUN_ALL_TESTS();
+}